@@ -0,0 +1,599 @@
+/*  Copyright 2011-2024 The Ready Bunch
+
+    This file is part of Ready.
+
+    Ready is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ready is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ready. If not, see <http://www.gnu.org/licenses/>.         */
+
+// cxxopts:
+#include <cxxopts.hpp>
+
+// STL:
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// readybase:
+#include <AbstractRD.hpp>
+#include <OpenCL_utils.hpp>
+#include <PerformanceCounters.hpp>
+#include <Properties.hpp>
+#include <scene_items.hpp>
+#include <SystemFactory.hpp>
+#include <utils.hpp>
+
+// OS:
+#ifdef _WIN32
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif
+    #include <windows.h>
+    #include <psapi.h>
+#else
+    #include <sys/resource.h>
+#endif
+
+using namespace std;
+
+// -------------------------------------------------------------------------------------------------------------
+/*
+        Ready benchmark utility.
+
+        Loads a fixed set of the bundled patterns, optionally resizes them, and runs each one for a fixed number
+        of steps on each of the chosen backends (the CPU, or an OpenCL device), reporting the speed in the same
+        terms as rdy --stats. The results can be saved as JSON and later compared against, so that a change to the
+        kernels or the host code can be checked for speed regressions on the same machine.
+
+        The default set covers each kind of system: inbuilt, formula and kernel rules, in 1D, 2D and 3D images,
+        and a mesh.
+*/
+// -------------------------------------------------------------------------------------------------------------
+
+/// Where a case is run: on the CPU, or on an OpenCL device.
+struct Backend
+{
+    bool use_opencl;
+    int platform;
+    int device;
+
+    string GetName() const
+    {
+        if (!this->use_opencl)
+            return "cpu";
+        ostringstream oss;
+        oss << "opencl:" << this->platform << ":" << this->device;
+        return oss.str();
+    }
+};
+
+/// The measurements of one pattern at one size on one backend.
+struct BenchResult
+{
+    string id;
+    string pattern;
+    string backend;
+    string device;
+    string size;
+    string status = "ok";  // "ok", "skipped" or "failed"
+    string reason;
+    string rule_type;
+    string rule_name;
+    int dimensions[3] = { 0, 0, 0 };
+    int n_cells = 0;
+    int n_steps = 0;
+    double mcells_per_second = 0.0;       // median over the repeats, by the wall clock
+    double best_mcells_per_second = 0.0;
+    double kernel_mcells_per_second = 0.0;
+    double effective_gb_per_second = 0.0;
+    double kernel_seconds = 0.0;          // the remaining times are totals over the repeats
+    double stepping_seconds = 0.0;
+    double transfer_to_device_seconds = 0.0;
+    double transfer_from_device_seconds = 0.0;
+    double build_seconds = 0.0;
+    int n_builds = 0;
+    size_t system_memory_bytes = 0;
+    size_t peak_process_memory_bytes = 0;
+};
+
+// -------------------------------------------------------------------------------------------------------------
+
+/// Returns the high-water mark of this process's resident memory so far, in bytes, or zero if not known.
+size_t GetPeakProcessMemory()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return counters.PeakWorkingSetSize;
+    return 0;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+    #ifdef __APPLE__
+        return static_cast<size_t>(usage.ru_maxrss); // in bytes on macOS
+    #else
+        return static_cast<size_t>(usage.ru_maxrss) * 1024; // in kilobytes on Linux
+    #endif
+#endif
+}
+
+// -------------------------------------------------------------------------------------------------------------
+
+vector<Backend> ParseBackends(const vector<string>& names)
+{
+    const bool is_opencl_available = OpenCL_utils::IsOpenCLAvailable();
+    vector<Backend> backends;
+    for (const string& name : names)
+    {
+        if (name == "cpu")
+        {
+            backends.push_back({ false, 0, 0 });
+        }
+        else if (name == "all")
+        {
+            backends.push_back({ false, 0, 0 });
+            if (!is_opencl_available)
+                continue;
+            for (int iPlatform = 0; iPlatform < OpenCL_utils::GetNumberOfPlatforms(); iPlatform++)
+                for (int iDevice = 0; iDevice < OpenCL_utils::GetNumberOfDevices(iPlatform); iDevice++)
+                    backends.push_back({ true, iPlatform, iDevice });
+        }
+        else
+        {
+            Backend backend{ true, 0, 0 };
+            char colon;
+            istringstream iss(name);
+            if (!(iss >> backend.platform >> colon >> backend.device) || colon != ':' || !iss.eof())
+                throw runtime_error("Unrecognized backend: " + name + " (expected cpu, all or platform:device)");
+            backends.push_back(backend);
+        }
+    }
+    return backends;
+}
+
+// -------------------------------------------------------------------------------------------------------------
+
+/// Returns the dimensions of a system of the given dimensionality with n cells along each of its axes.
+void GetDimensionsForSize(int arena_dimensionality, int n, int dimensions[3])
+{
+    dimensions[0] = n;
+    dimensions[1] = arena_dimensionality > 1 ? n : 1;
+    dimensions[2] = arena_dimensionality > 2 ? n : 1;
+}
+
+// -------------------------------------------------------------------------------------------------------------
+
+/// Returns an empty string if the system can be resized to these dimensions, else the reason why not.
+string CheckDimensions(const AbstractRD& system, const int dimensions[3])
+{
+    if (!system.HasEditableDimensions())
+        return "this system's size can't be changed";
+    if (dimensions[0] % system.GetBlockSizeX() || dimensions[1] % system.GetBlockSizeY()
+        || dimensions[2] % system.GetBlockSizeZ())
+        return "the size is not a multiple of the block size";
+    if (system.NeedsPowerOfTwoDimensions())
+        for (int i = 0; i < 3; i++)
+            if (dimensions[i] & (dimensions[i] - 1))
+                return "this system needs each dimension to be a power of two";
+    return "";
+}
+
+// -------------------------------------------------------------------------------------------------------------
+
+double GetMedian(vector<double> values)
+{
+    if (values.empty())
+        return 0.0;
+    sort(values.begin(), values.end());
+    const size_t mid = values.size() / 2;
+    return values.size() % 2 ? values[mid] : (values[mid - 1] + values[mid]) / 2.0;
+}
+
+// -------------------------------------------------------------------------------------------------------------
+
+/// Loads the pattern on the backend, resizes it to size (if not zero) and times the steps. Throws on failure.
+void RunCase(const string& path, const Backend& backend, int size, int n_steps, int n_warmup_steps, int n_repeats,
+             BenchResult& result)
+{
+    if (backend.use_opencl && !OpenCL_utils::IsOpenCLAvailable())
+    {
+        result.status = "skipped";
+        result.reason = "OpenCL not found";
+        return;
+    }
+
+    Properties render_settings("render_settings");
+    SetDefaultRenderSettings(render_settings);
+
+    unique_ptr<AbstractRD> system;
+    try
+    {
+        bool warn_to_update;
+        system = SystemFactory::CreateFromFile(path.c_str(), backend.use_opencl, backend.platform, backend.device,
+                                               render_settings, warn_to_update);
+    }
+    catch (const exception& e)
+    {
+        // e.g. a formula pattern on the CPU backend, which needs OpenCL
+        result.status = "skipped";
+        result.reason = e.what();
+        return;
+    }
+    result.rule_type = system->GetRuleType();
+    result.rule_name = system->GetRuleName();
+    if (backend.use_opencl && result.rule_type == "inbuilt")
+    {
+        result.status = "skipped";
+        result.reason = "inbuilt rules only run on the CPU";
+        return;
+    }
+
+    if (size > 0)
+    {
+        int dimensions[3];
+        GetDimensionsForSize(system->GetArenaDimensionality(), size, dimensions);
+        result.reason = CheckDimensions(*system, dimensions);
+        if (!result.reason.empty())
+        {
+            result.status = "skipped";
+            return;
+        }
+        system->SetDimensions(dimensions[0], dimensions[1], dimensions[2]);
+        system->GenerateInitialPattern();
+    }
+
+    // the first update builds the kernels, so time it separately from the steps
+    system->Update(0);
+    result.build_seconds = system->GetPerformanceCounters().GetBuildTime();
+    result.n_builds = system->GetPerformanceCounters().GetNumberOfBuilds();
+    if (n_warmup_steps > 0)
+        system->Update(n_warmup_steps);
+
+    PerformanceCounters totals;
+    vector<double> rates;
+    for (int iRepeat = 0; iRepeat < n_repeats; iRepeat++)
+    {
+        system->ResetPerformanceCounters();
+        system->Update(n_steps);
+        rates.push_back(system->GetPerformanceCounters().GetMcellsPerSecond());
+        totals.Add(system->GetPerformanceCounters());
+    }
+
+    result.dimensions[0] = system->GetX();
+    result.dimensions[1] = system->GetY();
+    result.dimensions[2] = system->GetZ();
+    result.n_cells = system->GetNumberOfCells();
+    result.n_steps = n_steps;
+    result.mcells_per_second = GetMedian(rates);
+    result.best_mcells_per_second = rates.empty() ? 0.0 : *max_element(rates.begin(), rates.end());
+    result.kernel_mcells_per_second = totals.GetKernelMcellsPerSecond();
+    result.effective_gb_per_second = totals.GetEffectiveGBPerSecond();
+    result.kernel_seconds = totals.GetKernelTime();
+    result.stepping_seconds = totals.GetSteppingTime();
+    result.transfer_to_device_seconds = totals.GetTransferToDeviceTime();
+    result.transfer_from_device_seconds = totals.GetTransferFromDeviceTime();
+    result.system_memory_bytes = system->GetMemorySize();
+    result.peak_process_memory_bytes = GetPeakProcessMemory();
+}
+
+// -------------------------------------------------------------------------------------------------------------
+
+string QuoteJSON(const string& s)
+{
+    ostringstream oss;
+    oss << '"';
+    for (const char c : s)
+    {
+        switch (c)
+        {
+            case '"':  oss << "\\\""; break;
+            case '\\': oss << "\\\\"; break;
+            case '\n': oss << "\\n"; break;
+            case '\r': oss << "\\r"; break;
+            case '\t': oss << "\\t"; break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20)
+                    oss << "\\u" << hex << setw(4) << setfill('0') << static_cast<int>(c) << dec << setfill(' ');
+                else
+                    oss << c;
+        }
+    }
+    oss << '"';
+    return oss.str();
+}
+
+// -------------------------------------------------------------------------------------------------------------
+
+/// Writes the results as JSON, one case per line so that the files can be diffed.
+void WriteJSON(ostream& out, const vector<BenchResult>& results, int n_steps, int n_warmup_steps, int n_repeats)
+{
+    out << "{\n";
+    out << "  \"ready_version\": " << QuoteJSON(STR(READY_VERSION)) << ",\n";
+    out << "  \"steps\": " << n_steps << ",\n";
+    out << "  \"warmup_steps\": " << n_warmup_steps << ",\n";
+    out << "  \"repeats\": " << n_repeats << ",\n";
+    out << "  \"cases\": [\n";
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const BenchResult& r = results[i];
+        out << "    { \"id\": " << QuoteJSON(r.id)
+            << ", \"pattern\": " << QuoteJSON(r.pattern)
+            << ", \"backend\": " << QuoteJSON(r.backend)
+            << ", \"device\": " << QuoteJSON(r.device)
+            << ", \"size\": " << QuoteJSON(r.size)
+            << ", \"status\": " << QuoteJSON(r.status);
+        if (!r.reason.empty())
+            out << ", \"reason\": " << QuoteJSON(r.reason);
+        if (r.status == "ok")
+        {
+            out << ", \"rule_type\": " << QuoteJSON(r.rule_type)
+                << ", \"rule_name\": " << QuoteJSON(r.rule_name)
+                << ", \"dimensions\": [" << r.dimensions[0] << ", " << r.dimensions[1] << ", " << r.dimensions[2] << "]"
+                << ", \"cells\": " << r.n_cells
+                << ", \"steps\": " << r.n_steps
+                << ", \"mcells_per_second\": " << r.mcells_per_second
+                << ", \"best_mcells_per_second\": " << r.best_mcells_per_second
+                << ", \"kernel_mcells_per_second\": " << r.kernel_mcells_per_second
+                << ", \"effective_gb_per_second\": " << r.effective_gb_per_second
+                << ", \"stepping_seconds\": " << r.stepping_seconds
+                << ", \"kernel_seconds\": " << r.kernel_seconds
+                << ", \"transfer_to_device_seconds\": " << r.transfer_to_device_seconds
+                << ", \"transfer_from_device_seconds\": " << r.transfer_from_device_seconds
+                << ", \"build_seconds\": " << r.build_seconds
+                << ", \"builds\": " << r.n_builds
+                << ", \"system_memory_bytes\": " << r.system_memory_bytes
+                << ", \"peak_process_memory_bytes\": " << r.peak_process_memory_bytes;
+        }
+        out << " }" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n";
+    out << "}\n";
+}
+
+// -------------------------------------------------------------------------------------------------------------
+
+/// Reads the id and mcells_per_second of each successful case from a file written by WriteJSON.
+/** This isn't a general JSON parser: it relies on each case having its id before its other values. */
+map<string, double> ReadBaselineJSON(const string& filename)
+{
+    ifstream in(filename);
+    if (!in)
+        throw runtime_error("Failed to open baseline file: " + filename);
+    const string text((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+
+    map<string, double> baseline;
+    const string id_key = "\"id\":";
+    const string rate_key = "\"mcells_per_second\":";
+    size_t pos = text.find(id_key);
+    while (pos != string::npos)
+    {
+        // read the quoted id
+        size_t i = text.find('"', pos + id_key.size());
+        if (i == string::npos)
+            break;
+        string id;
+        for (i++; i < text.size() && text[i] != '"'; i++)
+        {
+            if (text[i] == '\\' && i + 1 < text.size())
+            {
+                i++;
+                switch (text[i])
+                {
+                    case 'n': id += '\n'; break;
+                    case 'r': id += '\r'; break;
+                    case 't': id += '\t'; break;
+                    default: id += text[i];
+                }
+            }
+            else
+                id += text[i];
+        }
+        const size_t next = text.find(id_key, i);
+        const size_t rate_pos = text.find(rate_key, i);
+        if (rate_pos != string::npos && rate_pos < next)
+            baseline[id] = strtod(text.c_str() + rate_pos + rate_key.size(), nullptr);
+        pos = next;
+    }
+    return baseline;
+}
+
+// -------------------------------------------------------------------------------------------------------------
+
+/// Prints each case's speed against the baseline and returns the number of cases that got slower by more than
+/// the tolerance.
+int CompareWithBaseline(const vector<BenchResult>& results, const map<string, double>& baseline, double tolerance)
+{
+    int n_regressions = 0;
+    cout << "\nComparison with baseline (Mcells/s, tolerance " << tolerance << "%):\n";
+    cout << "================================\n";
+    for (const BenchResult& r : results)
+    {
+        if (r.status != "ok")
+            continue;
+        cout << r.id << ": ";
+        const auto it = baseline.find(r.id);
+        if (it == baseline.end() || it->second <= 0.0)
+        {
+            cout << "not in baseline, " << r.mcells_per_second << "\n";
+            continue;
+        }
+        const double change = 100.0 * (r.mcells_per_second - it->second) / it->second;
+        cout << it->second << " -> " << r.mcells_per_second << " (" << showpos << fixed << setprecision(1) << change
+             << "%" << noshowpos << defaultfloat << setprecision(6) << ")";
+        if (change < -tolerance)
+        {
+            cout << " REGRESSION";
+            n_regressions++;
+        }
+        cout << "\n";
+    }
+    cout << "================================\n";
+    cout << n_regressions << " regression(s)\n";
+    return n_regressions;
+}
+
+// -------------------------------------------------------------------------------------------------------------
+
+int main(int argc, char *argv[])
+{
+    vtkObject::GlobalWarningDisplayOff();
+
+    const string blurb = "Ready benchmark utility.\n"
+                         "\n"
+                         "Loads a fixed set of the bundled patterns, optionally resizes them, and runs each one for a fixed number\n"
+                         "of steps on each of the chosen backends (the CPU, or an OpenCL device), reporting the speed in the same\n"
+                         "terms as rdy --stats. The results can be saved as JSON and later compared against, so that a change to the\n"
+                         "kernels or the host code can be checked for speed regressions on the same machine.\n";
+
+    vector<string> patterns;
+    string patterns_dir;
+    vector<int> sizes;
+    vector<string> backend_names;
+    int n_steps = 1000;
+    int n_warmup_steps = 100;
+    int n_repeats = 3;
+    string json_out;
+    string baseline_file;
+    double tolerance = 10.0;
+
+    cxxopts::Options options("ready_bench", "Benchmark Ready on a set of patterns");
+    try
+    {
+        options.add_options()
+            ("h,help", "Print the help message")
+            ("patterns", "Patterns to run, relative to --patterns-dir",
+                cxxopts::value<vector<string>>(patterns)->default_value(
+                    "CPU-only/grayscott_1D.vti,CPU-only/grayscott_2D.vti,CPU-only/grayscott_3D.vti,"
+                    "RosenzweigMacArthur1963/predator-prey_1D.vti,GrayScott1984/Pearson1993.vti,"
+                    "GrayScott1984/parameter-map_3D.vti,kernel_test.vti,GrayScott1984/bunny.vtu"))
+            ("patterns-dir", "Folder that the patterns are in", cxxopts::value<string>(patterns_dir)->default_value("Patterns"))
+            ("sizes", "Number of cells along each axis to resize the images to (0 to keep the size in the file)",
+                cxxopts::value<vector<int>>(sizes)->default_value("0"))
+            ("backends", "Where to run: cpu, platform:device for an OpenCL device, or all",
+                cxxopts::value<vector<string>>(backend_names)->default_value("all"))
+            ("n,steps", "Number of steps to time in each repeat", cxxopts::value<int>(n_steps)->default_value("1000"))
+            ("warmup", "Number of untimed steps to take before the repeats", cxxopts::value<int>(n_warmup_steps)->default_value("100"))
+            ("repeats", "Number of times to time the steps (the median speed is reported)", cxxopts::value<int>(n_repeats)->default_value("3"))
+            ("json", "File to save the results in, as JSON", cxxopts::value<string>(json_out))
+            ("compare", "JSON file from an earlier run to compare the speeds against", cxxopts::value<string>(baseline_file))
+            ("tolerance", "Percentage slowdown against the baseline to allow before reporting a regression",
+                cxxopts::value<double>(tolerance)->default_value("10"))
+            ;
+    }
+    catch (const cxxopts::OptionSpecException& e)
+    {
+        cout << "Caught spec exception: " << e.what() << endl;
+        return EXIT_FAILURE;
+    }
+
+    vector<Backend> backends;
+    map<string, double> baseline;
+    try
+    {
+        const cxxopts::ParseResult args = options.parse(argc, argv);
+        if (args.count("help"))
+        {
+            cout << blurb << endl;
+            cout << options.help() << endl;
+            return EXIT_SUCCESS;
+        }
+        if (n_steps < 1 || n_repeats < 1 || n_warmup_steps < 0)
+        {
+            cout << "steps and repeats must be at least 1, warmup at least 0" << endl;
+            return EXIT_FAILURE;
+        }
+        backends = ParseBackends(backend_names);
+        if (!baseline_file.empty())
+            baseline = ReadBaselineJSON(baseline_file);
+    }
+    catch (const cxxopts::OptionParseException& e)
+    {
+        cout << "Argument error: " << e.what() << endl;
+        cout << options.help() << endl;
+        return EXIT_FAILURE;
+    }
+    catch (const exception& e)
+    {
+        cout << "Error: " << e.what() << endl;
+        return EXIT_FAILURE;
+    }
+
+    vector<BenchResult> results;
+    bool any_failed = false;
+    for (const string& pattern : patterns)
+    {
+        const string path = patterns_dir.empty() ? pattern : patterns_dir + "/" + pattern;
+        if (!ifstream(path))
+        {
+            cout << "File does not exist: " << path << endl;
+            return EXIT_FAILURE;
+        }
+        for (const Backend& backend : backends)
+        {
+            for (const int size : sizes)
+            {
+                BenchResult result;
+                result.pattern = pattern;
+                result.backend = backend.GetName();
+                result.size = size > 0 ? to_string(size) : "file";
+                result.id = result.pattern + " " + result.backend + " " + result.size;
+                if (backend.use_opencl && OpenCL_utils::IsOpenCLAvailable())
+                    result.device = OpenCL_utils::GetDeviceDescription(backend.platform, backend.device);
+
+                cout << result.id << ": " << flush;
+                try
+                {
+                    RunCase(path, backend, size, n_steps, n_warmup_steps, n_repeats, result);
+                }
+                catch (const exception& e)
+                {
+                    result.status = "failed";
+                    result.reason = e.what();
+                    any_failed = true;
+                }
+                if (result.status == "ok")
+                    cout << result.dimensions[0] << "x" << result.dimensions[1] << "x" << result.dimensions[2] << ", "
+                         << result.mcells_per_second << " Mcells/s" << endl;
+                else
+                    cout << result.status << ": " << result.reason << endl;
+                results.push_back(result);
+            }
+        }
+    }
+
+    if (!json_out.empty())
+    {
+        ofstream out(json_out);
+        WriteJSON(out, results, n_steps, n_warmup_steps, n_repeats);
+        if (!out)
+        {
+            cout << "Failed to write " << json_out << endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (!baseline_file.empty() && CompareWithBaseline(results, baseline, tolerance) > 0)
+        return EXIT_FAILURE;
+
+    return any_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+// -------------------------------------------------------------------------------------------------------------
@@ -19,16 +19,22 @@
 #include <cxxopts.hpp>
 
 // STL:
+#include <algorithm>
 #include <cstdlib>
+#include <iomanip>
 #include <iostream>
+#include <sstream>
 
 // readybase:
 #include <AbstractRD.hpp>
+#include <FrameRecorder.hpp>
 #include <OpenCL_utils.hpp>
 #include <OpenCLImageRD.hpp>
 #include <Properties.hpp>
 #include <scene_items.hpp>
 #include <SystemFactory.hpp>
+#include <TuningCache.hpp>
+#include <utils.hpp>
 
 using namespace std;
 
@@ -43,6 +49,9 @@ using namespace std;
         and can also still be used (like it used to work) to iterate the system to a specified number
         of steps, and save it to a new vti file.
 
+        With --record-every it also saves frames as it goes (images, raw chemical values or 3D meshes), in the
+        same way as recording in the GUI but without needing a display.
+
         The various print options can facilitate the import of ready simulations into other applications, (such
         as Houdini), without the need to actually link the ready libraries. This includes reagent initial-states,
         (via -m), be ready for some large lumps of text on stdout when using that argument.
@@ -56,6 +65,43 @@ void printSeparator()
     cout << "================================\n";
 }
 
+// -------------------------------------------------------------------------------------------------------------
+
+// Takes a snapshot of the system and queues it to be written by the recorder's threads. Uses the same
+// file naming as the recording in the GUI.
+void recordFrame(FrameRecorder& recorder, const AbstractRD& system, const Properties& render_settings,
+                 const std::string& prefix, const std::string& format, bool all_chemicals, int iFrame)
+{
+    ostringstream frame_number;
+    frame_number << setfill('0') << setw(6) << iFrame;
+    const std::string suffix = frame_number.str() + "." + format;
+
+    if (format == "raw")
+    {
+        vector<vector<float>> chemicals;
+        for (int iChem = 0; iChem < system.GetNumberOfChemicals(); iChem++)
+            chemicals.push_back(system.GetData(iChem));
+        recorder.SubmitRawData(move(chemicals), prefix + suffix);
+    }
+    else if (format == "vtp" || format == "ply")
+    {
+        recorder.SubmitMesh(system.GetAsMeshLater(render_settings), prefix + suffix, render_settings);
+    }
+    else if (all_chemicals)
+    {
+        for (int iChem = 0; iChem < system.GetNumberOfChemicals(); iChem++)
+        {
+            Properties chemical_settings = render_settings;
+            chemical_settings.GetProperty("active_chemical").SetChemical(GetChemicalName(iChem));
+            recorder.SubmitImage(system.GetAs2DImageLater(chemical_settings), prefix + GetChemicalName(iChem) + "_" + suffix);
+        }
+    }
+    else
+    {
+        recorder.SubmitImage(system.GetAs2DImageLater(render_settings), prefix + suffix);
+    }
+}
+
 int main(int argc,char *argv[])
 {
     vtkObject::GlobalWarningDisplayOff();
@@ -66,6 +112,9 @@ int main(int argc,char *argv[])
                         "and can also still be used (like it used to work) to iterate the system to a specified number\n"
                         "of steps, and save it to a new vti file.\n"
                         "\n"
+                        "With --record-every it also saves frames as it goes (images, raw chemical values or 3D meshes), in the\n"
+                        "same way as recording in the GUI but without needing a display.\n"
+                        "\n"
                         "The various print options can facilitate the import of ready simulations into other applications, (such\n"
                         "as Houdini), without the need to actually link the ready libraries. This includes reagent initial-states,\n"
                         "(via -m), be ready for some large lumps of text on stdout when using that argument.\n"
@@ -87,6 +136,14 @@ int main(int argc,char *argv[])
     int opencl_platform = 0;
     int opencl_device = 0;
     bool verbose = false;
+    int record_every = 0;
+    std::string record_prefix;
+    std::string record_format;
+    bool record_all_chemicals = false;
+    int record_threads = 0;
+    bool print_stats = false;
+    bool auto_tune = false;
+    std::string tuning_cache;
 
     cxxopts::Options options("rdy", "Command-line version of Ready");
     try
@@ -109,6 +166,17 @@ int main(int argc,char *argv[])
             ("l,opencl-platform", "OpenCL platform number (Currently will crash if incorrect!)", cxxopts::value<int>(opencl_platform))
             ("g,opencl-device", "OpenCL device number (Currently will crash if incorrect!)", cxxopts::value<int>(opencl_device))
             ("v,verbose", "Verbose output.", cxxopts::value<bool>(verbose)->default_value("false"))
+            ("e,record-every", "Record a frame every N iterations while running (0 for no recording)", cxxopts::value<int>(record_every)->default_value("0"))
+            ("record-prefix", "Path and filename prefix for the recorded frames", cxxopts::value<string>(record_prefix)->default_value("frame_"))
+            ("record-format", "Recorded frame format: png or jpg (2D data image), raw (all chemicals as 32-bit floats), vtp or ply (3D surface)",
+                cxxopts::value<string>(record_format)->default_value("png"))
+            ("record-all-chemicals", "Record an image of each chemical, not just the active one", cxxopts::value<bool>(record_all_chemicals)->default_value("false"))
+            ("record-threads", "Number of threads writing the recorded frames (0 to choose automatically)", cxxopts::value<int>(record_threads)->default_value("0"))
+            ("stats", "Print performance statistics after running: cell updates per second, kernel and transfer times", cxxopts::value<bool>(print_stats)->default_value("false"))
+            ("auto-tune", "Time the kernel with different block and work-group sizes before running, and use the fastest (formula systems only)",
+                cxxopts::value<bool>(auto_tune)->default_value("false"))
+            ("tuning-cache", "File to keep the results of --auto-tune in, so that each kernel, device and grid size is only tuned once",
+                cxxopts::value<string>(tuning_cache))
             ;
     }
     catch (const cxxopts::OptionSpecException& e)
@@ -136,6 +204,13 @@ int main(int argc,char *argv[])
             cout << options.help() << endl;
             return EXIT_FAILURE;
         }
+        const vector<string> record_formats = { "png", "jpg", "raw", "vtp", "ply" };
+        if (find(record_formats.begin(), record_formats.end(), record_format) == record_formats.end())
+        {
+            cout << "Unsupported record-format: " << record_format << endl;
+            cout << options.help() << endl;
+            return EXIT_FAILURE;
+        }
     }
     catch (const cxxopts::OptionParseException& e)
     {
@@ -171,6 +246,9 @@ int main(int argc,char *argv[])
     Properties render_settings("render_settings");
     SetDefaultRenderSettings(render_settings);
 
+    if (!tuning_cache.empty())
+        TuningCache::SetFilename(tuning_cache);
+
     unique_ptr<AbstractRD> system;
     try
     {
@@ -188,12 +266,32 @@ int main(int argc,char *argv[])
                 cout << "Loaded VTI: " << vti_in.c_str() << "\n";
             }
 
+            if ( auto_tune )
+            {
+                if ( system->HasAutoTuneOption() )
+                    system->SetAutoTune( true );
+                else
+                    cout << "Warning: this system can't be auto-tuned.\n";
+            }
+
             system->Update( 0 );
             if (verbose)
             {
                 cout << "System updated to zeroth step..\n";
             }
 
+            if ( system->GetAutoTune() )
+            {
+                // (the tuning was done in the update above, and shouldn't count towards the statistics)
+                system->ResetPerformanceCounters();
+                if (verbose)
+                {
+                    cout << "Auto-tuned block size: " << system->GetBlockSizeX() << " x " << system->GetBlockSizeY()
+                         << " x " << system->GetBlockSizeZ() << ", use local memory: "
+                         << ( system->GetUseLocalMemory() ? "true" : "false" ) << "\n";
+                }
+            }
+
             if ( print_reagent_info )
             {
                 int num_chemicals = system->GetNumberOfChemicals();
@@ -294,6 +392,9 @@ int main(int argc,char *argv[])
                     } else if (property_type == "axis") {
                         std::string property_value = this_property.GetAxis();
                         cout << " " << property_value << "\n";
+                    } else if (property_type == "pooling") {
+                        std::string property_value = this_property.GetPooling();
+                        cout << " " << property_value << "\n";
                     }
                 }
                 cout << "================================\n";
@@ -360,7 +461,42 @@ int main(int argc,char *argv[])
         if ( numiter > 0 )
         {
             cout << "Run the simulation for " << numiter << " steps...\n";
-            system->Update( numiter );
+            if ( record_every > 0 )
+            {
+                if ( ( record_format == "png" || record_format == "jpg" ) && !system->Is2DImageAvailable() )
+                {
+                    cout << "This system has no 2D image to record, try a mesh format instead.\n";
+                    return EXIT_FAILURE;
+                }
+                // the frames are written on other threads while the next steps are taken
+                FrameRecorder recorder( record_threads );
+                int iFrame = 0;
+                for ( int steps_taken = 0; steps_taken < numiter; )
+                {
+                    const int n_steps = min( record_every, numiter - steps_taken );
+                    system->Update( n_steps );
+                    steps_taken += n_steps;
+                    recordFrame( recorder, *system, render_settings, record_prefix, record_format, record_all_chemicals, iFrame++ );
+                }
+                recorder.Finish();
+                if (verbose)
+                {
+                    cout << "Recorded " << iFrame << " frames to " << record_prefix << "*." << record_format << "\n";
+                }
+            }
+            else
+            {
+                system->Update( numiter );
+            }
+
+            if ( print_stats )
+            {
+                cout << "\n";
+                cout << "Performance statistics:\n";
+                cout << "================================\n";
+                cout << system->GetPerformanceCounters().GetSummary();
+                cout << "================================\n";
+            }
 
             if ( !vti_out.empty() )
             {
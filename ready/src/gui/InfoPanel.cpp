@@ -33,12 +33,15 @@
 // wxWidgets:
 #include <wx/filename.h>        // for wxFileName
 #include <wx/colordlg.h>
+#include <wx/tokenzr.h>         // for wxStringTokenizer
 
 // VTK:
 #include <vtkMath.h>
 
 // STL:
 #include <algorithm>
+#include <map>
+#include <stdexcept>
 #include <string>
 
 using namespace std;
@@ -54,6 +57,8 @@ const wxString InfoPanel::kernel_label = _("Kernel");
 const wxString InfoPanel::dimensions_label = _("Dimensions");
 const wxString InfoPanel::block_size_label = _("Block size");
 const wxString InfoPanel::use_local_memory_label = _("Use local memory");
+const wxString InfoPanel::auto_tune_label = _("Auto-tune kernel");
+const wxString InfoPanel::parameter_maps_label = _("Parameter maps");
 const wxString InfoPanel::number_of_cells_label = _("Number of cells");
 const wxString InfoPanel::wrap_label = _("Toroidal wrap-around");
 const wxString InfoPanel::data_type_label = _("Data type");
@@ -153,6 +158,12 @@ void InfoPanel::UpdatePanel(const AbstractRD& system)
             FormatFloat(system.GetParameterValue(iParam)), true);
     }
 
+    if (system.HasParameterMapOption())
+    {
+        const wxString maps = GetParameterMapsString(system);
+        contents += AppendRow(parameter_maps_label, parameter_maps_label, maps.empty() ? _("none") : maps, true);
+    }
+
     wxString formula = system.GetFormula();
     if (system.HasEditableFormula() || formula.size() > 0)
     {
@@ -202,6 +213,9 @@ void InfoPanel::UpdatePanel(const AbstractRD& system)
 
     contents += AppendRow(use_local_memory_label, use_local_memory_label, system.GetUseLocalMemory() ? _("true") : _("false"), true);
 
+    if (system.HasAutoTuneOption())
+        contents += AppendRow(auto_tune_label, auto_tune_label, system.GetAutoTune() ? _("true") : _("false"), true);
+
     if (system.HasEditableWrapOption())
         contents += AppendRow(wrap_label, wrap_label, system.GetWrap() ? _("on") : _("off"), true);
 
@@ -258,10 +272,31 @@ void InfoPanel::UpdatePanel(const AbstractRD& system)
             contents += AppendRow(print_label, name, prop.GetAxis(), true);
         else if(type=="colormap")
             contents += AppendRow(print_label, name, prop.GetColorMap(), true);
+        else if(type=="pooling")
+            contents += AppendRow(print_label, name, prop.GetPooling(), true);
         else throw runtime_error("InfoPanel::Update : unrecognised type: "+type);
     }
 
-    contents += _T("</table></body></html>");
+    contents += _T("</table>");
+
+    // the speed of the system so far (read only, and not saved with the pattern)
+    const vector<pair<string,string>> performance_report = system.GetPerformanceCounters().GetReport();
+    if (!performance_report.empty())
+    {
+        contents += wxT("<h5><center>");
+        contents += _("Performance:");
+        contents += wxT("</h5></center>");
+        contents += wxT("<table border=0 cellspacing=0 cellpadding=4 width=\"100%\">");
+
+        rownum = 1;
+
+        for (const pair<string,string>& item : performance_report)
+            contents += AppendRow(wxString(item.first), wxString(item.first), wxString(item.second), false);
+
+        contents += _T("</table>");
+    }
+
+    contents += _T("</body></html>");
 
     html->SaveScrollPos();
     html->Freeze();             // prevent flicker
@@ -443,6 +478,20 @@ void InfoPanel::ChangeRenderSetting(const wxString& setting)
         prop.SetColorMap(string(choices[dlg.GetSelection()].mb_str()));
         frame->RenderSettingsChanged();
     }
+    else if (type == "pooling")
+    {
+        wxArrayString choices;
+        for (const string& s : SupportedPoolingModes)
+        {
+            choices.Add(s);
+        }
+        wxSingleChoiceDialog dlg(this, _("Pooling:"), _("Select how preview cells are pooled"), choices);
+        int iPooling = distance(begin(SupportedPoolingModes), find(begin(SupportedPoolingModes), end(SupportedPoolingModes), prop.GetPooling()));
+        dlg.SetSelection(iPooling);
+        if (dlg.ShowModal() != wxID_OK) return;
+        prop.SetPooling(string(choices[dlg.GetSelection()].mb_str()));
+        frame->RenderSettingsChanged();
+    }
     else {
         wxMessageBox("Editing "+setting+" of type "+wxString(type.c_str(),wxConvUTF8)+" is not currently supported");
     }
@@ -486,6 +535,83 @@ void InfoPanel::ChangeParameter(const wxString& parameter)
 
 // -----------------------------------------------------------------------------
 
+wxString InfoPanel::GetParameterMapsString(const AbstractRD& system)
+{
+    // e.g. "c = feed, d = kill"
+    wxString s;
+    for (const pair<const int, string>& parameter_map : system.GetParameterMaps())
+    {
+        if (parameter_map.first >= system.GetNumberOfChemicals()) continue;
+        if (!s.empty()) s += wxT(", ");
+        s += wxString(GetChemicalName(parameter_map.first).c_str(), wxConvUTF8) + wxT(" = ")
+            + wxString(parameter_map.second.c_str(), wxConvUTF8);
+    }
+    return s;
+}
+
+// -----------------------------------------------------------------------------
+
+void InfoPanel::ChangeParameterMaps()
+{
+    AbstractRD& sys = frame->GetCurrentRDSystem();
+    wxString oldmaps = GetParameterMapsString(sys);
+    wxString newmaps;
+
+    // position dialog box to left of linkrect
+    wxPoint pos = ClientToScreen( wxPoint(html->linkrect.x, html->linkrect.y) );
+    int dlgwd = 300;
+    pos.x -= dlgwd + 20;
+
+    if ( !GetString(_("Change parameter maps"), _("Enter the chemicals to use as parameter maps, e.g. c = feed, d = kill:"),
+                    oldmaps, newmaps, pos, wxSize(dlgwd,wxDefaultCoord)) || newmaps == oldmaps )
+        return;
+
+    // check them all before changing any
+    map<int, string> parameter_maps;
+    wxStringTokenizer tokenizer(newmaps, wxT(","));
+    while (tokenizer.HasMoreTokens())
+    {
+        const wxString item = tokenizer.GetNextToken().Trim(true).Trim(false);
+        if (item.empty()) continue;
+        const wxString chemical = item.BeforeFirst('=').Trim(true).Trim(false);
+        const wxString name = item.AfterFirst('=').Trim(true).Trim(false);
+        int iChemical = -1;
+        for (int i = 0; i < sys.GetNumberOfChemicals(); i++)
+            if (chemical == wxString(GetChemicalName(i).c_str(), wxConvUTF8)) iChemical = i;
+        if (iChemical < 0 || name.empty())
+        {
+            Warning(_("Expected a chemical, an equals sign and a name, but got: ") + item);
+            return;
+        }
+        for (const pair<const int, string>& parameter_map : parameter_maps)
+        {
+            if (parameter_map.first != iChemical && wxString(parameter_map.second.c_str(), wxConvUTF8) == name)
+            {
+                Warning(_("Two parameter maps can't have the same name: ") + name);
+                return;
+            }
+        }
+        try
+        {
+            sys.CheckParameterMapName(iChemical, string(name.mb_str()));
+        }
+        catch (const exception& e)
+        {
+            Warning(wxString(e.what(), wxConvUTF8));
+            return;
+        }
+        parameter_maps[iChemical] = string(name.mb_str());
+    }
+    // (clear them all first, so that names can be swapped between chemicals)
+    for (int i = 0; i < sys.GetNumberOfChemicals(); i++)
+        sys.SetParameterMapName(i, "");
+    for (const pair<const int, string>& parameter_map : parameter_maps)
+        sys.SetParameterMapName(parameter_map.first, parameter_map.second);
+    UpdatePanel(sys);
+}
+
+// -----------------------------------------------------------------------------
+
 void InfoPanel::ChangeRuleName()
 {
     wxString oldname(frame->GetCurrentRDSystem().GetRuleName().c_str(),wxConvUTF8);
@@ -597,7 +723,7 @@ void InfoPanel::ChangeDimensions()
         newz = dialog.GetZ();
         if (newx == oldx && newy == oldy && newz == oldz) break;
         const bool not_all_powers_of_two = newx&(newx - 1) || newy&(newy - 1) || newz&(newz - 1);
-        if (sys.GetRuleType() == "formula" && not_all_powers_of_two)
+        if (sys.NeedsPowerOfTwoDimensions() && not_all_powers_of_two)
         {
             wxMessageBox(_("For efficient wrap-around in OpenCL we require all the dimensions to be powers of 2"));
             continue;
@@ -666,9 +792,9 @@ void InfoPanel::ChangeBlockSize()
     }
     else
     {
-        newx = (oldx == 4) ? 1 : 4;
-        newy = newz = 1;
-        frame->SetBlockSize(newx, newy, newz);
+        // step through the vector widths along x: 1, 4, 8, 16
+        newx = (oldx == 1) ? 4 : (oldx == 4) ? 8 : (oldx == 8) ? 16 : 1;
+        frame->SetBlockSize(newx, oldy, oldz);
     }
 }
 
@@ -683,6 +809,15 @@ void InfoPanel::ChangeUseLocalMemory()
 
 // -----------------------------------------------------------------------------
 
+void InfoPanel::ChangeAutoTune()
+{
+    AbstractRD& sys = frame->GetCurrentRDSystem();
+    sys.SetAutoTune(!sys.GetAutoTune());
+    this->UpdatePanel(sys);
+}
+
+// -----------------------------------------------------------------------------
+
 void InfoPanel::ChangeWrapOption()
 {
     AbstractRD& sys = frame->GetCurrentRDSystem();
@@ -736,6 +871,12 @@ void InfoPanel::ChangeInfo(const wxString& label)
     } else if ( label == use_local_memory_label ) {
         ChangeUseLocalMemory();
 
+    } else if ( label == auto_tune_label ) {
+        ChangeAutoTune();
+
+    } else if ( label == parameter_maps_label ) {
+        ChangeParameterMaps();
+
     } else if ( label == wrap_label ) {
         ChangeWrapOption();
 
@@ -84,6 +84,8 @@ class InfoPanel : public wxPanel
         static const wxString dimensions_label;
         static const wxString block_size_label;
         static const wxString use_local_memory_label;
+        static const wxString auto_tune_label;
+        static const wxString parameter_maps_label;
         static const wxString number_of_cells_label;
         static const wxString wrap_label;
         static const wxString data_type_label;
@@ -100,8 +102,12 @@ private:
                            bool is_editable, bool is_multiline = false,
                            const wxString& color = wxEmptyString);
 
+        /// Returns e.g. "c = feed, d = kill".
+        static wxString GetParameterMapsString(const AbstractRD& system);
+
         // for making changes
         void ChangeParameter(const wxString& parameter);
+        void ChangeParameterMaps();
         void ChangeRenderSetting(const wxString& setting);
         void ChangeRuleName();
         void ChangeDescription();
@@ -111,6 +117,7 @@ private:
         void ChangeBlockSize();
         void ChangeAccuracy();
         void ChangeUseLocalMemory();
+        void ChangeAutoTune();
         void ChangeWrapOption();
         void ChangeDataType();
         
@@ -29,6 +29,7 @@ along with Ready. If not, see <http://www.gnu.org/licenses/>.         */
 // wxWidgets:
 #include <wx/choicdlg.h>
 #include <wx/msgdlg.h>
+#include <wx/progdlg.h>
 #include <wx/utils.h>
 
 // VTK:
@@ -39,6 +40,30 @@ along with Ready. If not, see <http://www.gnu.org/licenses/>.         */
 
 using namespace std;
 
+// ---------------------------------------------------------------------
+
+/// Shows the progress of the slower mesh generators.
+class MeshProgressDialog
+{
+    public:
+
+        MeshProgressDialog()
+            : dlg(_("Making mesh"), _("Generating the mesh..."), PROGRESS_RANGE, NULL, wxPD_APP_MODAL | wxPD_AUTO_HIDE | wxPD_ELAPSED_TIME)
+        {}
+
+        MeshGenerators::ProgressCallback GetCallback()
+        {
+            return [this](double fraction_done) { this->dlg.Update(static_cast<int>(fraction_done * PROGRESS_RANGE)); };
+        }
+
+    private:
+
+        static const int PROGRESS_RANGE = 1000;
+        wxProgressDialog dlg;
+};
+
+// ---------------------------------------------------------------------
+
 unique_ptr<AbstractRD> MakeNewImage1D(const bool is_opencl_available,const int opencl_platform,const int opencl_device,Properties& render_settings)
 {
     // perhaps at some point we will want this to be determined by the user
@@ -310,7 +335,10 @@ unique_ptr<AbstractRD> MakeNewPenroseP3Tiling(const bool is_opencl_available, co
     }
     wxBusyCursor busy;
     vtkSmartPointer<vtkUnstructuredGrid> mesh = vtkSmartPointer<vtkUnstructuredGrid>::New();
-    MeshGenerators::GetPenroseTiling(divs, 0, mesh, 2, data_type);
+    {
+        MeshProgressDialog progress;
+        MeshGenerators::GetPenroseTiling(divs, 0, mesh, 2, data_type, progress.GetCallback());
+    }
     unique_ptr<MeshRD> mesh_sys;
     if (is_opencl_available)
         mesh_sys = make_unique<FormulaOpenCLMeshRD>(opencl_platform, opencl_device, data_type);
@@ -349,7 +377,10 @@ unique_ptr<AbstractRD> MakeNewPenroseP2Tiling(const bool is_opencl_available, co
     }
     wxBusyCursor busy;
     vtkSmartPointer<vtkUnstructuredGrid> mesh = vtkSmartPointer<vtkUnstructuredGrid>::New();
-    MeshGenerators::GetPenroseTiling(divs, 1, mesh, 2, data_type);
+    {
+        MeshProgressDialog progress;
+        MeshGenerators::GetPenroseTiling(divs, 1, mesh, 2, data_type, progress.GetCallback());
+    }
     unique_ptr<MeshRD> mesh_sys;
     if (is_opencl_available)
         mesh_sys = make_unique<FormulaOpenCLMeshRD>(opencl_platform, opencl_device, data_type);
@@ -426,7 +457,10 @@ unique_ptr<AbstractRD> MakeNewVoronoi2D(const bool is_opencl_available, const in
     }
     wxBusyCursor busy;
     vtkSmartPointer<vtkUnstructuredGrid> mesh = vtkSmartPointer<vtkUnstructuredGrid>::New();
-    MeshGenerators::GetRandomVoronoi2D(npts, mesh, 2, data_type);
+    {
+        MeshProgressDialog progress;
+        MeshGenerators::GetRandomVoronoi2D(npts, mesh, 2, data_type, progress.GetCallback());
+    }
     unique_ptr<MeshRD> mesh_sys;
     if (is_opencl_available)
         mesh_sys = make_unique<FormulaOpenCLMeshRD>(opencl_platform, opencl_device, data_type);
@@ -464,7 +498,10 @@ unique_ptr<AbstractRD> MakeNewDelaunay3D(const bool is_opencl_available, const i
     }
     wxBusyCursor busy;
     vtkSmartPointer<vtkUnstructuredGrid> mesh = vtkSmartPointer<vtkUnstructuredGrid>::New();
-    MeshGenerators::GetRandomDelaunay3D(npts, mesh, 2, data_type);
+    {
+        MeshProgressDialog progress;
+        MeshGenerators::GetRandomDelaunay3D(npts, mesh, 2, data_type, progress.GetCallback());
+    }
     unique_ptr<MeshRD> mesh_sys;
     if (is_opencl_available)
         mesh_sys = make_unique<FormulaOpenCLMeshRD>(opencl_platform, opencl_device, data_type);
@@ -630,7 +667,10 @@ unique_ptr<AbstractRD> MakeNewHyperbolicPlane(const bool is_opencl_available, co
     int levels = 30 / schlafli1; // make this a user option?
     wxBusyCursor busy;
     vtkSmartPointer<vtkUnstructuredGrid> mesh = vtkSmartPointer<vtkUnstructuredGrid>::New();
-    MeshGenerators::GetHyperbolicPlaneTiling(schlafli1, schlafli2, levels, mesh, 2, data_type);
+    {
+        MeshProgressDialog progress;
+        MeshGenerators::GetHyperbolicPlaneTiling(schlafli1, schlafli2, levels, mesh, 2, data_type, progress.GetCallback());
+    }
     unique_ptr<MeshRD> mesh_sys;
     if (is_opencl_available)
         mesh_sys = make_unique<FormulaOpenCLMeshRD>(opencl_platform, opencl_device, data_type);
@@ -700,7 +740,10 @@ unique_ptr<AbstractRD> MakeNewHyperbolicSpace(const bool is_opencl_available, co
     }
     wxBusyCursor busy;
     vtkSmartPointer<vtkUnstructuredGrid> mesh = vtkSmartPointer<vtkUnstructuredGrid>::New();
-    MeshGenerators::GetHyperbolicSpaceTessellation(schlafli1, schlafli2, schlafli3, levels, mesh, 2, data_type);
+    {
+        MeshProgressDialog progress;
+        MeshGenerators::GetHyperbolicSpaceTessellation(schlafli1, schlafli2, schlafli3, levels, mesh, 2, data_type, progress.GetCallback());
+    }
     unique_ptr<MeshRD> mesh_sys;
     if (is_opencl_available)
         mesh_sys = make_unique<FormulaOpenCLMeshRD>(opencl_platform, opencl_device, data_type);
@@ -132,6 +132,26 @@ bool MyApp::OnInit()
     return true;
 }
 
+static bool EventCantChangeTheSystem(wxEventType type)
+{
+    // (the mouse wheel only zooms, and painting by dragging the mouse goes through MyFrame::ChangeSystem)
+    return type == wxEVT_IDLE || type == wxEVT_UPDATE_UI || type == wxEVT_TIMER || type == wxEVT_THREAD ||
+        type == wxEVT_PAINT || type == wxEVT_ERASE_BACKGROUND || type == wxEVT_SIZE || type == wxEVT_MOVE ||
+        type == wxEVT_SHOW || type == wxEVT_ACTIVATE || type == wxEVT_ACTIVATE_APP ||
+        type == wxEVT_SET_FOCUS || type == wxEVT_KILL_FOCUS || type == wxEVT_CHILD_FOCUS ||
+        type == wxEVT_MOTION || type == wxEVT_ENTER_WINDOW || type == wxEVT_LEAVE_WINDOW ||
+        type == wxEVT_MOUSEWHEEL || type == wxEVT_SET_CURSOR || type == wxEVT_MENU_HIGHLIGHT;
+}
+
+int MyApp::FilterEvent(wxEvent& event)
+{
+    // a menu command, a key press or a click might change the system, which the worker thread mustn't be stepping
+    // at the time; the steps carry on at the next idle event
+    if (currframe && currframe->IsSteppingInBackground() && !EventCantChangeTheSystem(event.GetEventType()))
+        currframe->PauseBackgroundSteps();
+    return -1; // process the event as usual
+}
+
 // homepage for doxygen docs:
 
 /*! \mainpage
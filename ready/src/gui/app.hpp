@@ -30,8 +30,13 @@ class MyFrame;
 class MyApp : public wxApp
 {
 public:
+    MyApp() : currframe(NULL) {}
+
     virtual bool OnInit();
 
+    // pauses the background steps before any event that might change the system
+    virtual int FilterEvent(wxEvent& event);
+
     #ifdef __WXMAC__
         // called in response to an open-document event which is sent
         // if a .vti file is double-clicked or dropped onto the app icon
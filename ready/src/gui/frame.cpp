@@ -63,6 +63,8 @@
 // STL:
 #include <string>
 #include <algorithm>
+#include <functional>
+#include <stdexcept>
 
 // VTK:
 #include <vtkBMPReader.h>
@@ -76,10 +78,8 @@
 #include <vtkImageResize.h>
 #include <vtkImageShiftScale.h>
 #include <vtkJPEGReader.h>
-#include <vtkJPEGWriter.h>
 #include <vtkOBJReader.h>
 #include <vtkPNGReader.h>
-#include <vtkPNGWriter.h>
 #include <vtkPLYWriter.h>
 #include <vtkPointData.h>
 #include <vtkPolyDataNormals.h>
@@ -262,7 +262,6 @@ MyFrame::MyFrame(const wxString& title)
     render_settings("render_settings"),
     is_running(false),
     time_at_last_render(0),
-    i_timesteps_per_second_buffer(0),
     speed_data_available(false),
     is_recording(false),
     fullscreen(false),
@@ -339,6 +338,9 @@ MyFrame::MyFrame(const wxString& title)
 
 MyFrame::~MyFrame()
 {
+    this->StopBackgroundSteps();
+    wxGetApp().currframe = NULL;
+    this->StopRecording();
     this->SaveSettings(); // save the current settings so it starts up the same next time
     this->aui_mgr.UnInit();
 }
@@ -992,13 +994,14 @@ void MyFrame::OnAddMyPatterns(wxCommandEvent& event)
 
 void MyFrame::SetCurrentRDSystem(unique_ptr<AbstractRD> sys)
 {
+    this->StopBackgroundSteps();
     this->system = std::move(sys);
     int iChem = IndexFromChemicalName(this->render_settings.GetProperty("active_chemical").GetChemical());
     iChem = min(iChem,this->system->GetNumberOfChemicals()-1); // ensure is in valid range
     this->render_settings.GetProperty("active_chemical").SetChemical(GetChemicalName(iChem));
     InitializeVTKPipeline(this->pVTKWindow, *this->system, this->render_settings, true);
     this->is_running = false;
-    this->i_timesteps_per_second_buffer = 0;
+    this->step_scheduler.Reset();
     this->speed_data_available = false;
     this->info_panel->ResetPosition();
     this->UpdateWindows();
@@ -1051,15 +1054,8 @@ void MyFrame::OnStep(wxCommandEvent& event)
         return;
 
     if (this->system->GetTimestepsTaken() == 0)
-    {
         this->system->SaveStartingPattern();
 
-        // reset the initial number of steps used by system->Update in OnIdle
-        num_steps = 50;
-        // 50 is half the initial timesteps_per_render value used in most
-        // pattern files, but really we could choose any small number > 0
-    }
-
     try
     {
         if (event.GetId() == ID::Step1)
@@ -1075,6 +1071,7 @@ void MyFrame::OnStep(wxCommandEvent& event)
             this->is_running = true;
             steps_since_last_render = 0;
             this->computation_time_since_last_render = 0.0;
+            this->time_at_last_render = get_time_in_seconds();
             do_one_render = true;
         }
     }
@@ -1105,7 +1102,9 @@ void MyFrame::OnRunStop(wxCommandEvent& event)
 {
     if (this->is_running) {
         this->is_running = false;
+        this->StopBackgroundSteps();
         this->SetStatusBarText();
+        this->UpdateInfoPane(); // (for the performance counters)
     } else {
         this->is_running = true;
     }
@@ -1114,16 +1113,10 @@ void MyFrame::OnRunStop(wxCommandEvent& event)
 
     if (this->is_running) {
         if (this->system->GetTimestepsTaken() == 0)
-        {
             this->system->SaveStartingPattern();
-
-            // reset the initial number of steps used by system->Update in OnIdle
-            num_steps = 50;
-            // 50 is half the initial timesteps_per_render value used in most
-            // pattern files, but really we could choose any small number > 0
-        }
         steps_since_last_render = 0;
         this->computation_time_since_last_render = 0.0;
+        this->time_at_last_render = get_time_in_seconds();
         do_one_render = false;
     }
 }
@@ -1217,19 +1210,32 @@ void MyFrame::OnIdle(wxIdleEvent& event)
         if (this->IsActive()) this->CheckFocus();
     #endif
 
-    // we drive our simulation loop via idle events
-    if (this->is_running)
+    if (this->is_running && !do_one_render && this->system->CanStepInBackground())
     {
-        // ensure num_steps <= timesteps_per_render
-        int timesteps_per_render = this->render_settings.GetProperty("timesteps_per_render").GetInt();
-        if (num_steps > timesteps_per_render) num_steps = timesteps_per_render;
-
-        // use temp_steps for the actual system->Update call because it might be < num_steps
-        int temp_steps = num_steps;
-        if (steps_since_last_render + temp_steps > timesteps_per_render) {
-            // do final steps of this rendering phase
-            temp_steps = timesteps_per_render - steps_since_last_render;
+        // the steps are taken on a worker thread, which wakes us up when it needs us
+        try
+        {
+            this->UpdateBackgroundSteps();
         }
+        catch(const exception& e)
+        {
+            this->simulation_thread.reset();
+            this->is_running = false;
+            this->SetStatusBarText();
+            this->UpdateToolbars();
+            MonospaceMessageBox(_("An error occurred when running the simulation:\n\n")+wxString(e.what(),wxConvUTF8),_("Error"),wxART_ERROR);
+        }
+    }
+    else
+        this->StopBackgroundSteps();
+
+    // otherwise we drive our simulation loop via idle events
+    if (this->is_running && !this->simulation_thread)
+    {
+        const int timesteps_per_render = this->GetTimestepsPerRender();
+
+        // take as many steps as fit in a short time, so that the app remains responsive
+        int temp_steps = this->step_scheduler.GetStepsForNextUpdate(timesteps_per_render - steps_since_last_render);
 
         double time_before = get_time_in_seconds();
 
@@ -1253,46 +1259,21 @@ void MyFrame::OnIdle(wxIdleEvent& event)
             wxMessageBox(_("An unknown error occurred when running the simulation"));
         }
 
-        double time_diff = get_time_in_seconds() - time_before;
-
-        // note that we don't change num_steps if temp_steps < num_steps
-        if (num_steps == temp_steps) {
-            // if the above system->Update was quick then we'll use more steps in the next call,
-            // otherwise we'll use less steps so that the app remains responsive
-            if (time_diff < 0.1) {
-                num_steps *= 2;
-                if (num_steps > timesteps_per_render) num_steps = timesteps_per_render;
-            } else {
-                num_steps /= 2;
-                if (num_steps < 1) num_steps = 1;
-            }
-        }
+        double time_after = get_time_in_seconds();
+        double time_diff = time_after - time_before;
+        this->step_scheduler.AddUpdateTiming(temp_steps, time_diff);
 
         this->computation_time_since_last_render += time_diff;
         steps_since_last_render += temp_steps;
 
         if (steps_since_last_render >= timesteps_per_render) {
             // it's time to render what we've computed so far
-            if (this->computation_time_since_last_render == 0.0)
-                this->computation_time_since_last_render = 0.000001;  // unlikely, but play safe
-            double time_since_last_render = time_before - this->time_at_last_render;
-            this->time_at_last_render = time_before;
-            this->timesteps_per_second_buffer[this->i_timesteps_per_second_buffer] = steps_since_last_render / time_since_last_render;
-            this->computed_frames_per_second_buffer[this->i_timesteps_per_second_buffer] = steps_since_last_render / this->computation_time_since_last_render;
-            this->i_timesteps_per_second_buffer++;
-            if(this->i_timesteps_per_second_buffer==10)
-            {
-                this->smoothed_timesteps_per_second = 0.0;
-                double smoothed_cfps = 0.0;
-                for(int i=0;i<10;i++) {
-                    this->smoothed_timesteps_per_second += this->timesteps_per_second_buffer[i]/10.0;
-                    smoothed_cfps += this->computed_frames_per_second_buffer[i]/10.0;
-                }
-                if(smoothed_cfps > this->smoothed_timesteps_per_second)
-                    this->percentage_spent_rendering = 100.0 - 100.0 * this->smoothed_timesteps_per_second / smoothed_cfps;
-                this->i_timesteps_per_second_buffer = 0;
+            // (the time since the last render includes that render, so the scheduler can tell how long rendering takes)
+            this->step_scheduler.AddFrameTiming(steps_since_last_render, time_after - this->time_at_last_render,
+                                                this->computation_time_since_last_render);
+            this->time_at_last_render = time_after;
+            if (this->step_scheduler.HasSpeedEstimates())
                 this->speed_data_available = true;
-            }
 
             if(this->is_recording)
                 this->RecordFrame();
@@ -1321,6 +1302,138 @@ void MyFrame::OnIdle(wxIdleEvent& event)
 
 // ---------------------------------------------------------------------
 
+int MyFrame::GetTimestepsPerRender()
+{
+    // timesteps_per_render is the most steps we take between renders, but the scheduler renders sooner if
+    // that is what it takes to keep to the target frame rate. Step by N and recording frames need exactly
+    // timesteps_per_render steps between renders.
+    this->step_scheduler.SetTargetFrameTime(1.0 / target_frame_rate);
+    int timesteps_per_render = this->render_settings.GetProperty("timesteps_per_render").GetInt();
+    if (!do_one_render && !this->is_recording)
+        timesteps_per_render = this->step_scheduler.GetStepsPerRender(timesteps_per_render);
+    return timesteps_per_render;
+}
+
+// ---------------------------------------------------------------------
+
+void MyFrame::UpdateBackgroundSteps()
+{
+    if (!this->simulation_thread)
+        this->simulation_thread = make_unique<SimulationThread>(*this->system, [] { wxWakeUpIdle(); });
+
+    if (!this->simulation_thread->IsPaused())
+    {
+        if (!this->simulation_thread->AreStepsDone())
+            return; // still busy with this frame
+        // the worker starts on the next frame while this one is read back and rendered
+        this->CountBackgroundSteps(this->simulation_thread->StartNextFrame(this->GetTimestepsPerRender()));
+        this->RenderBackgroundFrame();
+    }
+    else if (steps_since_last_render >= this->GetTimestepsPerRender())
+    {
+        // a user action paused the worker at the end of a frame
+        this->RenderBackgroundFrame();
+        this->simulation_thread->Resume(this->GetTimestepsPerRender());
+    }
+    else
+    {
+        // a user action paused the worker part-way through a frame (or we are just starting), so finish it
+        this->simulation_thread->Resume(this->GetTimestepsPerRender() - steps_since_last_render);
+    }
+}
+
+// ---------------------------------------------------------------------
+
+void MyFrame::CountBackgroundSteps(int n_steps)
+{
+    const double time_taken = this->simulation_thread->GetSteppingTime();
+    this->step_scheduler.AddUpdateTiming(n_steps, time_taken);
+    this->computation_time_since_last_render += time_taken;
+    steps_since_last_render += n_steps;
+}
+
+// ---------------------------------------------------------------------
+
+void MyFrame::RenderBackgroundFrame()
+{
+    const double time_now = get_time_in_seconds();
+    this->step_scheduler.AddFrameTiming(steps_since_last_render, time_now - this->time_at_last_render,
+                                        this->computation_time_since_last_render);
+    this->time_at_last_render = time_now;
+    if (this->step_scheduler.HasSpeedEstimates())
+        this->speed_data_available = true;
+
+    if (this->is_recording)
+        this->RecordFrame();
+
+    steps_since_last_render = 0;
+    this->computation_time_since_last_render = 0.0;
+
+    this->pVTKWindow->GetRenderWindow()->GetRenderers()->GetFirstRenderer()->ResetCameraClippingRange();
+    this->pVTKWindow->Refresh(false);
+    this->SetStatusBarText();
+}
+
+// ---------------------------------------------------------------------
+
+bool MyFrame::IsSteppingInBackground() const
+{
+    return this->simulation_thread && !this->simulation_thread->IsPaused();
+}
+
+// ---------------------------------------------------------------------
+
+void MyFrame::PauseBackgroundSteps()
+{
+    if (!this->IsSteppingInBackground())
+        return;
+
+    try
+    {
+        this->CountBackgroundSteps(this->simulation_thread->Pause());
+    }
+    catch(const exception& e)
+    {
+        this->simulation_thread.reset();
+        this->is_running = false;
+        this->SetStatusBarText();
+        this->UpdateToolbars();
+        MonospaceMessageBox(_("An error occurred when running the simulation:\n\n")+wxString(e.what(),wxConvUTF8),_("Error"),wxART_ERROR);
+    }
+    catch(...)
+    {
+        this->simulation_thread.reset();
+        this->is_running = false;
+        this->SetStatusBarText();
+        this->UpdateToolbars();
+        wxMessageBox(_("An unknown error occurred when running the simulation"));
+    }
+}
+
+// ---------------------------------------------------------------------
+
+void MyFrame::StopBackgroundSteps()
+{
+    if (!this->simulation_thread)
+        return;
+    this->PauseBackgroundSteps();
+    this->simulation_thread.reset();
+    this->pVTKWindow->Refresh(false);
+}
+
+// ---------------------------------------------------------------------
+
+void MyFrame::ChangeSystem(const function<void(AbstractRD&)>& change)
+{
+    // while the worker is stepping, changes wait until it next pauses
+    if (this->simulation_thread)
+        this->simulation_thread->Post(change);
+    else
+        change(*this->system);
+}
+
+// ---------------------------------------------------------------------
+
 void MyFrame::SetStatusBarText()
 {
     wxString txt;
@@ -1329,10 +1442,12 @@ void MyFrame::SetStatusBarText()
     txt << _(" Timesteps: ") << this->system->GetTimestepsTaken();
     if(this->speed_data_available)
     {
-        txt << wxString::Format(_T("  -   %.0f"),this->smoothed_timesteps_per_second)
+        txt << wxString::Format(_T("  -   %.0f"),this->step_scheduler.GetTimestepsPerSecond())
             << _(" timesteps per second");
+        txt << wxString::Format(_T(" = %.1f Mcells/s"),
+            this->step_scheduler.GetTimestepsPerSecond() * this->system->GetNumberOfCells() / 1e6);
         txt << _T("   ( ")
-            << wxString::Format(_T("%.1f"),this->percentage_spent_rendering)
+            << wxString::Format(_T("%.1f"),this->step_scheduler.GetPercentageSpentRendering())
             << _("% of time spent rendering )");
     }
     //txt << " GPU mem: " << this->system->GetMemorySize()/(1024*1024) << " MB";
@@ -2384,7 +2499,7 @@ bool MyFrame::SetDimensions(int x,int y,int z)
                 "x" << this->system->GetBlockSizeY() << "x" << this->system->GetBlockSizeZ() << ")";
             throw runtime_error(oss.str().c_str());
         }
-        if( this->system->GetRuleType()=="formula" && ( x&(x - 1) || y&(y - 1) || z&(z - 1) ) )
+        if( this->system->NeedsPowerOfTwoDimensions() && ( x&(x - 1) || y&(y - 1) || z&(z - 1) ) )
         {
             return false; // for wrap-around in OpenCL we require all the dimensions to be powers of 2
         }
@@ -2759,11 +2874,11 @@ void MyFrame::OnExportMesh(wxCommandEvent& event)
 
 // ---------------------------------------------------------------------
 
-void MyFrame::SaveCurrentMesh(const wxFileName& mesh_filename, bool should_decimate, double targetReduction)
+/// Writes the mesh to an obj, vtp or ply file. Returns false if the file type is not supported.
+/** Doesn't touch the GUI so can be called from the recording threads. The mesh is modified. */
+static bool WriteMeshToFile(vtkPolyData* mesh, const wxFileName& mesh_filename, bool should_decimate, double targetReduction,
+                            const Properties& render_settings)
 {
-    vtkSmartPointer<vtkPolyData> mesh = vtkSmartPointer<vtkPolyData>::New();
-    this->system->GetAsMesh(mesh,this->render_settings);
-
     if (should_decimate)
     {
         vtkSmartPointer<vtkQuadricDecimation> dec = vtkSmartPointer<vtkQuadricDecimation>::New();
@@ -2781,7 +2896,6 @@ void MyFrame::SaveCurrentMesh(const wxFileName& mesh_filename, bool should_decim
 
     if(mesh_filename.GetExt().Lower() == _T("obj"))
     {
-        wxBusyCursor busy;
         wxFileOutputStream to_file(mesh_filename.GetFullPath());
         wxTextOutputStream out(to_file);
         out << "# Output from Ready - https://github.com/GollyGang/ready\n";
@@ -2815,7 +2929,6 @@ void MyFrame::SaveCurrentMesh(const wxFileName& mesh_filename, bool should_decim
     }
     else if(mesh_filename.GetExt().Lower() == _T("vtp"))
     {
-        wxBusyCursor busy;
         vtkSmartPointer<vtkXMLPolyDataWriter> writer = vtkSmartPointer<vtkXMLPolyDataWriter>::New();
         writer->SetInputData(pd);
         wxFileOutputStream to_file(mesh_filename.GetFullPath());
@@ -2826,22 +2939,32 @@ void MyFrame::SaveCurrentMesh(const wxFileName& mesh_filename, bool should_decim
     }
     else if(mesh_filename.GetExt().Lower() == _T("ply"))
     {
-        wxBusyCursor busy;
         vtkSmartPointer<vtkCellDataToPointData> to_point_data = vtkSmartPointer<vtkCellDataToPointData>::New();
         to_point_data->SetInputData(pd);
         vtkSmartPointer<vtkPLYWriter> writer = vtkSmartPointer<vtkPLYWriter>::New();
         writer->SetInputConnection(to_point_data->GetOutputPort());
         writer->SetFileName(mesh_filename.GetFullPath());
-        vtkSmartPointer<vtkScalarsToColors> lut = GetColorMap(this->render_settings);
+        vtkSmartPointer<vtkScalarsToColors> lut = GetColorMap(render_settings);
         writer->SetLookupTable(lut);
-        writer->SetArrayName(this->render_settings.GetProperty("active_chemical").GetChemical().c_str());
+        writer->SetArrayName(render_settings.GetProperty("active_chemical").GetChemical().c_str());
         writer->Write();
     }
     else
     {
-        wxMessageBox(_("Unsupported file type"));
-        return;
+        return false;
     }
+    return true;
+}
+
+// ---------------------------------------------------------------------
+
+void MyFrame::SaveCurrentMesh(const wxFileName& mesh_filename, bool should_decimate, double targetReduction)
+{
+    wxBusyCursor busy;
+    vtkSmartPointer<vtkPolyData> mesh = vtkSmartPointer<vtkPolyData>::New();
+    this->system->GetAsMesh(mesh,this->render_settings);
+    if (!WriteMeshToFile(mesh, mesh_filename, should_decimate, targetReduction, this->render_settings))
+        wxMessageBox(_("Unsupported file type"));
 }
 
 // ---------------------------------------------------------------------
@@ -2954,87 +3077,105 @@ void MyFrame::OnUpdateExportImage(wxUpdateUIEvent& event)
 
 void MyFrame::RecordFrame()
 {
-    ostringstream oss;
+    // We only take a snapshot here, on the main thread. Making the images or meshes from the snapshots and writing
+    // them to disk happens on the recorder's threads, so the simulation can carry on meanwhile. If the recorder
+    // falls behind, Submit() waits for it to catch up.
+    if (!this->frame_recorder)
+        this->frame_recorder.reset(new FrameRecorder());
 
-    if (this->record_3D_surface)
-    {
-        // save the 3D mesh
-        oss << this->recording_prefix << setfill('0') << setw(6) << this->iRecordingFrame << this->recording_extension;
-        SaveCurrentMesh(wxString(oss.str().c_str()), this->recording_should_decimate, this->recording_target_reduction);
-    }
-    else
+    try
     {
-        vtkSmartPointer<vtkImageWriter> writer;
-        if (this->recording_extension == _T(".png")) writer = vtkSmartPointer<vtkPNGWriter>::New();
-        else if (this->recording_extension == _T(".jpg")) writer = vtkSmartPointer<vtkJPEGWriter>::New();
-
-        // store the currently active chemical, in the case of multi-reagent output it needs to be restored later.
-        std::string remember_chemical = this->render_settings.GetProperty("active_chemical").GetChemical();
-
-        if (this->record_data_image) // take the 2D data (2D system or 2D slice)
+        ostringstream oss;
+        if (this->record_3D_surface)
+        {
+            // save the 3D mesh
+            oss << this->recording_prefix << setfill('0') << setw(6) << this->iRecordingFrame << this->recording_extension;
+            const string filename = oss.str();
+            function<void(vtkPolyData*)> make_mesh = this->system->GetAsMeshLater(this->render_settings);
+            const bool should_decimate = this->recording_should_decimate;
+            const double target_reduction = this->recording_target_reduction;
+            const Properties render_settings = this->render_settings;
+            this->frame_recorder->Submit([make_mesh, filename, should_decimate, target_reduction, render_settings]()
+            {
+                vtkSmartPointer<vtkPolyData> mesh = vtkSmartPointer<vtkPolyData>::New();
+                make_mesh(mesh);
+                if (!WriteMeshToFile(mesh, wxString(filename.c_str()), should_decimate, target_reduction, render_settings))
+                    throw runtime_error("Unsupported mesh file type: " + filename);
+            });
+        }
+        else if (this->record_data_image) // take the 2D data (2D system or 2D slice)
         {
             if (this->record_all_chemicals)
             {
-                int num_chems = this->system->GetNumberOfChemicals();
-                for (int chemical_number = 0; chemical_number < num_chems; chemical_number++)
+                // each chemical gets its own copy of the render settings, so what the user sees in the viewport is left alone
+                for (int chemical_number = 0; chemical_number < this->system->GetNumberOfChemicals(); chemical_number++)
                 {
-                    // make modified name for chemicals.
                     oss.str("");
                     oss.clear();
                     std::string chemical_name = GetChemicalName(chemical_number);
                     oss << this->recording_prefix << chemical_name << "_" << setfill('0') << setw(6) << this->iRecordingFrame << this->recording_extension;
-
-                    this->render_settings.GetProperty("active_chemical").SetChemical(GetChemicalName(chemical_number));
-
-                    vtkSmartPointer<vtkImageData> image = vtkSmartPointer<vtkImageData>::New();
-                    this->system->GetAs2DImage(image, this->render_settings);
-                    writer->SetInputData(image);
-                    if (chemical_number < num_chems - 1) //write all but the last one as it will get written by the code below.
-                    {
-                        writer->SetFileName(oss.str().c_str());
-                        writer->Write();
-                        if (this->recording_extension == _T(".png")) writer = vtkSmartPointer<vtkPNGWriter>::New();
-                        else if (this->recording_extension == _T(".jpg")) writer = vtkSmartPointer<vtkJPEGWriter>::New();
-                    }
+                    Properties chemical_settings = this->render_settings;
+                    chemical_settings.GetProperty("active_chemical").SetChemical(chemical_name);
+                    this->frame_recorder->SubmitImage(this->system->GetAs2DImageLater(chemical_settings), oss.str());
                 }
             }
             else
             {
                 oss << this->recording_prefix << setfill('0') << setw(6) << this->iRecordingFrame << this->recording_extension;
-                vtkSmartPointer<vtkImageData> image = vtkSmartPointer<vtkImageData>::New();
-                this->system->GetAs2DImage(image, this->render_settings);
-                writer->SetInputData(image);
+                this->frame_recorder->SubmitImage(this->system->GetAs2DImageLater(this->render_settings), oss.str());
             }
         }
         else // take a screenshot of the current view
         {
+            // grabbing the pixels has to happen here, but the encoding can wait
             oss << this->recording_prefix << setfill('0') << setw(6) << this->iRecordingFrame << this->recording_extension;
             vtkSmartPointer<vtkWindowToImageFilter> screenshot = vtkSmartPointer<vtkWindowToImageFilter>::New();
             screenshot->SetInput(this->pVTKWindow->GetRenderWindow());
-            writer->SetInputConnection(screenshot->GetOutputPort());
-        }
-
-        writer->SetFileName(oss.str().c_str());
-        writer->Write();
-
-        if (this->record_all_chemicals)
-        {
-            // restore the stored active chemical so that the user still sees what they usually see in the viewport.
-            // only do this in the case of record_all_chemicals (ie when it has potentially changed), ere it may cause wasted cycles?.
-            this->render_settings.GetProperty("active_chemical").SetChemical(remember_chemical);
+            screenshot->Update();
+            vtkSmartPointer<vtkImageData> pixels = vtkSmartPointer<vtkImageData>::New();
+            pixels->DeepCopy(screenshot->GetOutput());
+            this->frame_recorder->SubmitImage([pixels](vtkImageData* out) { out->ShallowCopy(pixels); }, oss.str());
         }
     }
+    catch (const exception& e)
+    {
+        this->is_recording = false;
+        this->frame_recorder.reset(); // (drops any frames still waiting)
+        MonospaceMessageBox(_("Recording stopped because a frame could not be saved:\n\n") + wxString(e.what(), wxConvUTF8),
+            _("Error recording frames"), wxART_ERROR);
+        return;
+    }
 
     this->iRecordingFrame++;
 }
 
 // ---------------------------------------------------------------------
 
+void MyFrame::StopRecording()
+{
+    this->is_recording = false;
+    if (!this->frame_recorder)
+        return;
+    try
+    {
+        wxBusyCursor busy;
+        this->frame_recorder->Finish(); // wait for the last frames to be written
+    }
+    catch (const exception& e)
+    {
+        MonospaceMessageBox(_("Some frames could not be saved:\n\n") + wxString(e.what(), wxConvUTF8),
+            _("Error recording frames"), wxART_ERROR);
+    }
+    this->frame_recorder.reset();
+}
+
+// ---------------------------------------------------------------------
+
 void MyFrame::OnRecordFrames(wxCommandEvent &event)
 {
     if (this->is_recording)
     {
-        this->is_recording = false;
+        this->StopRecording();
         return;
     }
 
@@ -3288,18 +3429,17 @@ void MyFrame::MouseMove(int x, int y)
                 break; // (VTK will handle the control of the viewpoint)
             case TCursorType::PENCIL:
             {
-                if (erasing) {
-                    this->system->SetValue(p[0],p[1],p[2],this->render_settings.GetProperty("low").GetFloat(),this->render_settings);
-                } else {
-                    this->system->SetValue(p[0],p[1],p[2],this->current_paint_value,this->render_settings);
-                }
+                const float value = erasing ? this->render_settings.GetProperty("low").GetFloat() : this->current_paint_value;
+                const double px = p[0], py = p[1], pz = p[2];
+                this->ChangeSystem([=](AbstractRD& rd) { rd.SetValue(px,py,pz,value,this->render_settings); });
                 this->pVTKWindow->Refresh();
             }
             break;
             case TCursorType::BRUSH:
             {
-                this->system->SetValuesInRadius(p[0],p[1],p[2],this->brush_sizes[current_brush_size],
-                    this->current_paint_value,this->render_settings);
+                const float r = this->brush_sizes[current_brush_size], value = this->current_paint_value;
+                const double px = p[0], py = p[1], pz = p[2];
+                this->ChangeSystem([=](AbstractRD& rd) { rd.SetValuesInRadius(px,py,pz,r,value,this->render_settings); });
                 this->pVTKWindow->Refresh();
             }
             break;
@@ -3526,7 +3666,8 @@ void MyFrame::OnConvertToFullKernel(wxCommandEvent& event)
 
 void MyFrame::OnUpdateConvertToFullKernel(wxUpdateUIEvent& event)
 {
-    event.Enable(this->system->GetRuleType()=="formula");
+    // (formula rules that run on the CPU have no kernel to convert)
+    event.Enable(this->system->GetRuleType()=="formula" && this->is_opencl_available);
 }
 
 // ---------------------------------------------------------------------
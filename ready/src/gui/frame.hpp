@@ -35,11 +35,18 @@ class wxVTKRenderWindowInteractor;
 
 // readybase
 #include "AbstractRD.hpp"
+#include "FrameRecorder.hpp"
 #include "Properties.hpp"
+#include "SimulationThread.hpp"
+#include "StepScheduler.hpp"
 
 // VTK:
 class vtkUnstructuredGrid;
 
+// STL:
+#include <functional>
+#include <memory>
+
 /// The wxFrame-derived top-level window for the Ready GUI.
 class MyFrame : public wxFrame, public IPaintHandler
 {
@@ -213,6 +220,12 @@ class MyFrame : public wxFrame, public IPaintHandler
         void UpdateToolbars();
         void SetStatusBarText();
         void RecordFrame();
+        void StopRecording();
+
+        // the steps of some systems are taken on a worker thread
+        bool IsSteppingInBackground() const;
+        void PauseBackgroundSteps();    // the worker carries on at the next idle event
+        void StopBackgroundSteps();
 
         bool LoadMesh(const wxFileName& filename, vtkUnstructuredGrid* ug);
         void MakeDefaultImageSystemFromMesh(vtkUnstructuredGrid* ug);
@@ -246,15 +259,20 @@ class MyFrame : public wxFrame, public IPaintHandler
 
         // following are used when running a simulation:
         bool is_running;
-        int num_steps;
         bool do_one_render;
+        StepScheduler step_scheduler; ///< decides how many steps to take per Update() and per render
+        std::unique_ptr<SimulationThread> simulation_thread; ///< takes the steps, for systems that can step in the background
+
+        int GetTimestepsPerRender();
+        void UpdateBackgroundSteps();
+        void CountBackgroundSteps(int n_steps);
+        void RenderBackgroundFrame();
+        void ChangeSystem(const std::function<void(AbstractRD&)>& change); ///< deferred while stepping in the background
 
         // used for reporting speed:
         int steps_since_last_render;
-        double computation_time_since_last_render, computed_frames_per_second_buffer[10];
-        double time_at_last_render, percentage_spent_rendering;
-        double smoothed_timesteps_per_second,timesteps_per_second_buffer[10];
-        int i_timesteps_per_second_buffer;
+        double computation_time_since_last_render;
+        double time_at_last_render;
         bool speed_data_available;
 
         // used when recording frames to disk
@@ -262,6 +280,7 @@ class MyFrame : public wxFrame, public IPaintHandler
         std::string recording_prefix,recording_extension;
         int iRecordingFrame;
         float recording_target_reduction;
+        std::unique_ptr<FrameRecorder> frame_recorder; ///< writes the recorded frames on worker threads
 
         static const int MAX_TIMESTEPS_PER_RENDER = 1e8;
 
@@ -38,6 +38,9 @@
 #include "wxutils.hpp"           // for Warning, Fatal, Beep
 #include "prefs.hpp"
 
+// readybase:
+#include <TuningCache.hpp>
+
 // STL:
 #include <algorithm>
 
@@ -50,6 +53,9 @@
 
 const wxString PREFS_NAME = wxT("ReadyPrefs");
 
+// the kernel configurations found by the auto-tuner are kept in datadir, so they survive updates of the app
+const wxString TUNING_NAME = wxT("ReadyTuning.txt");
+
 wxString prefspath;              // full path to prefs file
 wxString choosedir;              // directory used by Choose File button
 
@@ -103,6 +109,7 @@ wxMenu* patternSubMenu = NULL;   // submenu of recent pattern files
 int numpatterns = 0;             // current number of recent pattern files
 int maxpatterns = 20;            // maximum number of recent pattern files (1..MAX_RECENT)
 int current_brush_size = 1;      // small, medium or large brush
+int target_frame_rate = 30;      // renders per second to aim for while running
 
 // local (ie. non-exported) globals:
 
@@ -930,6 +937,7 @@ void SavePrefs()
     fprintf(f, "show_tips=%d\n", showtips ? 1 : 0);
     fprintf(f, "repaint_to_erase=%d\n", repaint_to_erase ? 1 : 0);
     fprintf(f, "current_brush_size=%d\n", current_brush_size);
+    fprintf(f, "target_frame_rate=%d (%d..%d)\n", target_frame_rate, minframerate, maxframerate);
     fprintf(f, "allow_beep=%d\n", allowbeep ? 1 : 0);
     fprintf(f, "ask_on_new=%d\n", askonnew ? 1 : 0);
     fprintf(f, "ask_on_load=%d\n", askonload ? 1 : 0);
@@ -1136,6 +1144,8 @@ void InitPaths()
     patterndir = readydir + PATT_DIR;
 
     recordingdir = _T(".");
+
+    TuningCache::SetFilename((const char*)(datadir + TUNING_NAME).mb_str(wxConvLocal));
 }
 
 // -----------------------------------------------------------------------------
@@ -1245,6 +1255,10 @@ void GetPrefs()
         } else if (strcmp(keyword, "current_brush_size") == 0) {
             sscanf(value, "%d", &current_brush_size);
             current_brush_size = std::min(2,std::max(0,current_brush_size));
+        } else if (strcmp(keyword, "target_frame_rate") == 0) {
+            sscanf(value, "%d", &target_frame_rate);
+            if (target_frame_rate < minframerate) target_frame_rate = minframerate;
+            if (target_frame_rate > maxframerate) target_frame_rate = maxframerate;
         } else if (strcmp(keyword, "allow_beep") == 0)  { allowbeep = value[0] == '1';
         } else if (strcmp(keyword, "ask_on_new") == 0)  { askonnew = value[0] == '1';
         } else if (strcmp(keyword, "ask_on_load") == 0) { askonload = value[0] == '1';
@@ -1335,7 +1349,7 @@ enum
     // View prefs
     PREF_SHOW_TIPS,
     // Action prefs
-    // none as yet
+    PREF_FRAME_RATE,
     // Keyboard prefs
     PREF_KEYCOMBO,
     PREF_ACTION,
@@ -1900,13 +1914,26 @@ wxPanel* PrefsDialog::CreateActionPrefs(wxWindow* parent)
     wxBoxSizer* topSizer = new wxBoxSizer(wxVERTICAL);
     wxBoxSizer* vbox = new wxBoxSizer(wxVERTICAL);
 
-    wxString note = _("No settings here as yet.");
-    wxBoxSizer* notebox = new wxBoxSizer(wxHORIZONTAL);
-    notebox->Add(new wxStaticText(panel, wxID_STATIC, note));
+    // target_frame_rate
+
+    wxBoxSizer* ratebox = new wxBoxSizer(wxHORIZONTAL);
+    ratebox->Add(new wxStaticText(panel, wxID_STATIC, _("Target renders per second while running:")),
+        0, wxALL, 0);
+
+    wxSpinCtrl* spin1 = new MySpinCtrl(panel, PREF_FRAME_RATE, wxEmptyString,
+        wxDefaultPosition, wxSize(70, wxDefaultCoord));
+
+    wxBoxSizer* hrbox = new wxBoxSizer(wxHORIZONTAL);
+    hrbox->Add(ratebox, 0, wxALIGN_CENTER_VERTICAL, 0);
+    hrbox->Add(spin1, 0, wxLEFT | wxRIGHT | wxALIGN_CENTER_VERTICAL, SPINGAP);
 
     // position things
     vbox->AddSpacer(5);
-    vbox->Add(notebox, 0, wxALIGN_CENTER, LRGAP);
+    vbox->Add(hrbox, 0, wxLEFT | wxRIGHT, LRGAP);
+    vbox->AddSpacer(5);
+
+    // init control values
+    spin1->SetRange(minframerate, maxframerate); spin1->SetValue(target_frame_rate);
 
     topSizer->Add(vbox, 1, wxGROW | wxALL, 5);
     panel->SetSizer(topSizer);
@@ -2232,7 +2259,8 @@ bool PrefsDialog::ValidatePage()
         // no spin ctrls on this page
 
     } else if (currpage == ACTION_PAGE) {
-        // no spin ctrls on this page
+        if ( BadSpinVal(PREF_FRAME_RATE, minframerate, maxframerate, _("Target renders per second")) )
+            return false;
 
     } else if (currpage == KEYBOARD_PAGE) {
         // no spin ctrls on this page
@@ -2296,7 +2324,7 @@ bool PrefsDialog::TransferDataFromWindow()
     #endif
 
     // ACTION_PAGE
-    // nothing yet
+    target_frame_rate = GetSpinVal(PREF_FRAME_RATE);
 
     // KEYBOARD_PAGE
     // go thru keyaction table and make sure the file field is empty
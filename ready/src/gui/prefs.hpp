@@ -38,6 +38,8 @@ void ChooseTextEditor(wxWindow* parent, wxString& result);
 
 const int minfontsize = 8;       // minimum value of infofontsize/helpfontsize
 const int maxfontsize = 30;      // maximum value of infofontsize/helpfontsize
+const int minframerate = 1;      // minimum value of target_frame_rate
+const int maxframerate = 240;    // maximum value of target_frame_rate
 
 // Global directory paths:
 
@@ -77,6 +79,7 @@ extern int numpatterns;          // current number of recent pattern files
 extern int maxpatterns;          // maximum number of recent pattern files
 extern bool repaint_to_erase;    // whether painting over the current color reverts to low
 extern int current_brush_size;
+extern int target_frame_rate;    // renders per second to aim for while running
 
 // Keyboard shortcuts:
 
@@ -0,0 +1,725 @@
+/*  Copyright 2011-2024 The Ready Bunch
+
+    This file is part of Ready.
+
+    Ready is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ready is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ready. If not, see <http://www.gnu.org/licenses/>.         */
+
+// local:
+#include "AMROpenCLImageRD.hpp"
+#include "OpenCL_utils.hpp"
+#include "parallel.hpp"
+#include "utils.hpp"
+using namespace OpenCL_utils;
+
+// VTK:
+#include <vtkImageData.h>
+#include <vtkMath.h>
+#include <vtkXMLDataElement.h>
+
+// STL:
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+#include <stdexcept>
+
+using namespace std;
+
+// ----------------------------------------------------------------------------------------------------------------
+
+namespace
+{
+    const int GHOST_CELLS = 4;              // fine cells on each side of a patch, enough for any stencil we support
+    const size_t MIN_TILES_PER_THREAD = 16;
+
+    // ghost filling, restriction and the integral inputs for the patches (prefixed with the #defines from ReloadKernelIfNeeded)
+    const char* helper_kernels_source = "\n\
+int fit(int v, int n)\n\
+{\n\
+    // wrap or clamp a coordinate into [0,n)\n\
+    return WRAP ? ((v % n) + n) % n : min(n - 1, max(0, v));\n\
+}\n\
+\n\
+real coarse_at(global const real* coarse_old, global const real* coarse_new, const real w, int x, int y, int z)\n\
+{\n\
+    const int i = X * (Y * fit(z, Z) + fit(y, Y)) + fit(x, X);\n\
+    return (1 - w) * coarse_old[i] + w * coarse_new[i];\n\
+}\n\
+\n\
+real interpolate_coarse(global const real* coarse_old, global const real* coarse_new, const real w, int fx, int fy, int fz)\n\
+{\n\
+    // multilinear interpolation between the centers of the coarse cells\n\
+    const real ux = (fx + (real)0.5) / RX - (real)0.5;\n\
+    const real uy = (fy + (real)0.5) / RY - (real)0.5;\n\
+    const real uz = (fz + (real)0.5) / RZ - (real)0.5;\n\
+    const int x0 = (int)floor(ux);\n\
+    const int y0 = (int)floor(uy);\n\
+    const int z0 = (int)floor(uz);\n\
+    const real tx = ux - x0;\n\
+    const real ty = uy - y0;\n\
+    const real tz = uz - z0;\n\
+    real val = 0;\n\
+    for (int dz = 0; dz < 2; dz++)\n\
+        for (int dy = 0; dy < 2; dy++)\n\
+            for (int dx = 0; dx < 2; dx++)\n\
+            {\n\
+                const real weight = (dx ? tx : 1 - tx) * (dy ? ty : 1 - ty) * (dz ? tz : 1 - tz);\n\
+                if (weight > 0)\n\
+                    val += weight * coarse_at(coarse_old, coarse_new, w, x0 + dx, y0 + dy, z0 + dz);\n\
+            }\n\
+    return val;\n\
+}\n\
+\n\
+kernel void amr_fill_ghosts(global const real* coarse_old, global const real* coarse_new, const real w, global real* atlas,\n\
+                            global const int* patch_tiles, global const int* tile_patches, const int first_patch, const int prolong_all)\n\
+{\n\
+    const int p = first_patch + get_global_id(0) / PATCH_CELLS;\n\
+    const int i = get_global_id(0) % PATCH_CELLS;\n\
+    const int px = i % PX;\n\
+    const int py = (i / PX) % PY;\n\
+    const int pz = i / (PX * PY);\n\
+    const bool interior = px >= GX && px < PX - GX && py >= GY && py < PY - GY && pz >= GZ && pz < PZ - GZ;\n\
+    if (interior && !prolong_all)\n\
+        return;\n\
+    const int tile = patch_tiles[p];\n\
+    const int fx = fit((tile % NTX) * TX * RX + px - GX, X * RX);\n\
+    const int fy = fit(((tile / NTX) % NTY) * TY * RY + py - GY, Y * RY);\n\
+    const int fz = fit((tile / (NTX * NTY)) * TZ * RZ + pz - GZ, Z * RZ);\n\
+    if (!prolong_all)\n\
+    {\n\
+        // copy from the patch that covers this cell, if there is one\n\
+        const int ntx = fx / (TX * RX);\n\
+        const int nty = fy / (TY * RY);\n\
+        const int ntz = fz / (TZ * RZ);\n\
+        const int q = tile_patches[NTX * (NTY * ntz + nty) + ntx];\n\
+        if (q >= 0)\n\
+        {\n\
+            const int qx = fx - ntx * TX * RX + GX;\n\
+            const int qy = fy - nty * TY * RY + GY;\n\
+            const int qz = fz - ntz * TZ * RZ + GZ;\n\
+            atlas[p * PATCH_CELLS + i] = atlas[q * PATCH_CELLS + PX * (PY * qz + qy) + qx];\n\
+            return;\n\
+        }\n\
+    }\n\
+    atlas[p * PATCH_CELLS + i] = interpolate_coarse(coarse_old, coarse_new, w, fx, fy, fz);\n\
+}\n\
+\n\
+kernel void amr_restrict(global const real* atlas, global real* coarse, global const int* patch_tiles)\n\
+{\n\
+    // average the fine cells of a patch into each coarse cell of its tile\n\
+    const int p = get_global_id(0) / (TX * TY * TZ);\n\
+    const int c = get_global_id(0) % (TX * TY * TZ);\n\
+    const int cx = c % TX;\n\
+    const int cy = (c / TX) % TY;\n\
+    const int cz = c / (TX * TY);\n\
+    const int tile = patch_tiles[p];\n\
+    real sum = 0;\n\
+    for (int iz = 0; iz < RZ; iz++)\n\
+        for (int iy = 0; iy < RY; iy++)\n\
+            for (int ix = 0; ix < RX; ix++)\n\
+                sum += atlas[p * PATCH_CELLS + PX * (PY * (GZ + cz * RZ + iz) + GY + cy * RY + iy) + GX + cx * RX + ix];\n\
+    const int x = (tile % NTX) * TX + cx;\n\
+    const int y = ((tile / NTX) % NTY) * TY + cy;\n\
+    const int z = (tile / (NTX * NTY)) * TZ + cz;\n\
+    coarse[X * (Y * z + y) + x] = sum / (RX * RY * RZ);\n\
+}\n\
+\n\
+kernel void amr_fill_value(global real* out, global const real* value)\n\
+{\n\
+    out[get_global_id(0)] = value[0];\n\
+}\n";
+
+    // ------------------------------------------------------------------------------------------------------------
+
+    template <typename T>
+    double GetMaxCentralDifference(const T* data, const int dims[3], bool wrap, const int from[3], const int to[3])
+    {
+        double max_diff = 0.0;
+        for (int z = from[2]; z < to[2]; z++)
+        {
+            for (int y = from[1]; y < to[1]; y++)
+            {
+                for (int x = from[0]; x < to[0]; x++)
+                {
+                    const int here[3] = { x, y, z };
+                    for (int axis = 0; axis < 3; axis++)
+                    {
+                        if (dims[axis] == 1)
+                            continue;
+                        int before[3] = { x, y, z };
+                        int after[3] = { x, y, z };
+                        if (wrap)
+                        {
+                            before[axis] = (here[axis] - 1 + dims[axis]) % dims[axis];
+                            after[axis] = (here[axis] + 1) % dims[axis];
+                        }
+                        else
+                        {
+                            before[axis] = max(0, here[axis] - 1);
+                            after[axis] = min(dims[axis] - 1, here[axis] + 1);
+                        }
+                        const T a = data[dims[0] * (dims[1] * before[2] + before[1]) + before[0]];
+                        const T b = data[dims[0] * (dims[1] * after[2] + after[1]) + after[0]];
+                        max_diff = max(max_diff, fabs(static_cast<double>(b) - static_cast<double>(a)) / 2.0);
+                    }
+                }
+            }
+        }
+        return max_diff;
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+AMROpenCLImageRD::AMROpenCLImageRD(int opencl_platform,int opencl_device,int data_type)
+    : FormulaOpenCLImageRD(opencl_platform,opencl_device,data_type)
+    , refinement_ratio(2)
+    , refinement_threshold(0.05f)
+    , refinement_tile_size(16)
+    , refinement_interval(16)
+    , tile_size{ 1, 1, 1 }
+    , ghost_size{ 0, 0, 0 }
+    , ratio{ 1, 1, 1 }
+    , patch_size{ 1, 1, 1 }
+    , num_tiles{ 1, 1, 1 }
+    , stack_axis(0)
+    , patch_cells(1)
+    , patch_program(NULL)
+    , helper_program(NULL)
+    , patch_kernel(NULL)
+    , fill_ghosts_kernel(NULL)
+    , restrict_kernel(NULL)
+    , fill_value_kernel(NULL)
+    , patch_context(NULL)
+    , patch_capacity(0)
+    , iCurrentAtlas(0)
+    , patch_tiles_buffer(NULL)
+    , tile_patches_buffer(NULL)
+    , need_regrid(true)
+    , steps_since_regrid(0)
+{
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+AMROpenCLImageRD::~AMROpenCLImageRD()
+{
+    clFinish(this->command_queue);
+    this->ReleasePatches();
+    this->ReleasePatchKernels();
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void AMROpenCLImageRD::ReleasePatches()
+{
+    for (int i = 0; i < 2; i++)
+    {
+        for (cl_mem atlas : this->atlases[i])
+            clReleaseMemObject(atlas);
+        this->atlases[i].clear();
+    }
+    for (cl_mem integral : this->atlas_integrals)
+        clReleaseMemObject(integral);
+    this->atlas_integrals.clear();
+    if (this->patch_tiles_buffer)
+        clReleaseMemObject(this->patch_tiles_buffer);
+    if (this->tile_patches_buffer)
+        clReleaseMemObject(this->tile_patches_buffer);
+    this->patch_tiles_buffer = NULL;
+    this->tile_patches_buffer = NULL;
+    this->patch_capacity = 0;
+    this->iCurrentAtlas = 0;
+    this->patch_tiles.clear();
+    this->tile_patches.clear();
+    this->need_regrid = true;
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void AMROpenCLImageRD::ReleasePatchKernels()
+{
+    for (cl_kernel k : { this->patch_kernel, this->fill_ghosts_kernel, this->restrict_kernel, this->fill_value_kernel })
+        if (k)
+            clReleaseKernel(k);
+    if (this->patch_program)
+        clReleaseProgram(this->patch_program);
+    if (this->helper_program)
+        clReleaseProgram(this->helper_program);
+    this->patch_kernel = this->fill_ghosts_kernel = this->restrict_kernel = this->fill_value_kernel = NULL;
+    this->patch_program = this->helper_program = NULL;
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void AMROpenCLImageRD::ReleaseOpenCLBuffers()
+{
+    FormulaOpenCLImageRD::ReleaseOpenCLBuffers();
+    this->ReleasePatches();
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void AMROpenCLImageRD::WriteToOpenCLBuffersIfNeeded()
+{
+    if (!this->need_write_to_opencl_buffers) return;
+
+    FormulaOpenCLImageRD::WriteToOpenCLBuffersIfNeeded();
+
+    // the patches no longer match the image, so start them again from the new coarse values
+    this->patch_tiles.clear();
+    this->tile_patches.assign(this->tile_patches.size(), -1);
+    this->need_regrid = true;
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void AMROpenCLImageRD::ReloadKernelIfNeeded()
+{
+    const bool context_changed = this->patch_context != this->context;
+    const bool rebuild = this->need_reload_formula || context_changed;
+
+    FormulaOpenCLImageRD::ReloadKernelIfNeeded();
+
+    if (!rebuild) return;
+
+    if (context_changed)
+        this->ReleasePatches();
+    this->ReleasePatchKernels();
+
+    // check that the formula and the image suit the patches
+    if (this->refinement_ratio < 2)
+        throw runtime_error("AMROpenCLImageRD::ReloadKernelIfNeeded : refinement_ratio must be at least 2");
+    if (this->refinement_tile_size < 1)
+        throw runtime_error("AMROpenCLImageRD::ReloadKernelIfNeeded : refinement_tile_size must be at least 1");
+    if (!this->IsParameter("timestep"))
+        throw runtime_error("AMROpenCLImageRD::ReloadKernelIfNeeded : refinement needs a parameter called timestep");
+    const vector<string> formula_tokens = tokenize_for_keywords(this->formula);
+    if (UsingKeyword(formula_tokens, "x_pos") || UsingKeyword(formula_tokens, "y_pos") || UsingKeyword(formula_tokens, "z_pos"))
+        throw runtime_error("AMROpenCLImageRD::ReloadKernelIfNeeded : refinement does not support x_pos, y_pos or z_pos");
+    if (this->GetStencilRadius(this->formula) > GHOST_CELLS)
+        throw runtime_error("AMROpenCLImageRD::ReloadKernelIfNeeded : the formula's stencils are too large for refinement");
+    const int dims[3] = { vtkMath::Round(this->GetX()), vtkMath::Round(this->GetY()), vtkMath::Round(this->GetZ()) };
+    for (int axis = 0; axis < 3; axis++)
+    {
+        const bool refined = dims[axis] > 1;
+        this->tile_size[axis] = refined ? this->refinement_tile_size : 1;
+        this->ghost_size[axis] = refined ? GHOST_CELLS : 0;
+        this->ratio[axis] = refined ? this->refinement_ratio : 1;
+        this->patch_size[axis] = this->tile_size[axis] * this->ratio[axis] + 2 * this->ghost_size[axis];
+        if (dims[axis] % this->tile_size[axis] != 0)
+            throw runtime_error("AMROpenCLImageRD::ReloadKernelIfNeeded : image dimensions must be a multiple of refinement_tile_size");
+        this->num_tiles[axis] = dims[axis] / this->tile_size[axis];
+        if (refined)
+            this->stack_axis = axis;
+    }
+    if (this->patch_size[0] % this->GetBlockSizeX() != 0)
+        throw runtime_error("AMROpenCLImageRD::ReloadKernelIfNeeded : refinement_tile_size * refinement_ratio must be a multiple of block_size_x");
+    if (this->GetBlockSizeY() != 1 || this->GetBlockSizeZ() != 1)
+        throw runtime_error("AMROpenCLImageRD::ReloadKernelIfNeeded : block_size_y and block_size_z must be 1");
+    this->patch_cells = static_cast<size_t>(this->patch_size[0]) * this->patch_size[1] * this->patch_size[2];
+
+    // the patch kernel is the formula kernel with the finer grid spacing and timestep, with no wrap-around: the
+    // ghost cells supply the neighbors
+    const int R = this->refinement_ratio;
+    vector<Parameter> fine_parameters = this->parameters;
+    bool has_dx = false;
+    for (Parameter& parameter : fine_parameters)
+    {
+        if (parameter.name == "timestep")
+            parameter.value /= R * R;
+        else if (parameter.name == "dx")
+        {
+            parameter.value /= R;
+            has_dx = true;
+        }
+    }
+    if (!has_dx)
+        fine_parameters.push_back({ "dx", 1.0f / R });
+    this->patch_program = this->CreateProgramFromSource(this->AssembleKernelSourceWithOptions(this->formula, false, fine_parameters, false, false, false));
+    cl_int ret;
+    this->patch_kernel = clCreateKernel(this->patch_program, this->kernel_function_name.c_str(), &ret);
+    throwOnError(ret, "AMROpenCLImageRD::ReloadKernelIfNeeded : patch kernel creation failed: ");
+
+    ostringstream helper_source;
+    if (this->data_type == VTK_DOUBLE)
+        helper_source << "#pragma OPENCL EXTENSION cl_khr_fp64 : enable\n";
+    helper_source << "typedef " << this->data_type_string << " real;\n";
+    helper_source << "#define WRAP " << (this->wrap ? 1 : 0) << "\n";
+    const char* axis_names[3] = { "X", "Y", "Z" };
+    for (int axis = 0; axis < 3; axis++)
+    {
+        const string a = axis_names[axis];
+        helper_source << "#define " << a << " " << dims[axis] << "\n";
+        helper_source << "#define R" << a << " " << this->ratio[axis] << "\n";
+        helper_source << "#define G" << a << " " << this->ghost_size[axis] << "\n";
+        helper_source << "#define T" << a << " " << this->tile_size[axis] << "\n";
+        helper_source << "#define P" << a << " " << this->patch_size[axis] << "\n";
+        helper_source << "#define NT" << a << " " << this->num_tiles[axis] << "\n";
+    }
+    helper_source << "#define PATCH_CELLS " << this->patch_cells << "\n";
+    helper_source << helper_kernels_source;
+    this->helper_program = this->CreateProgramFromSource(helper_source.str());
+    this->fill_ghosts_kernel = clCreateKernel(this->helper_program, "amr_fill_ghosts", &ret);
+    throwOnError(ret, "AMROpenCLImageRD::ReloadKernelIfNeeded : kernel creation failed: ");
+    this->restrict_kernel = clCreateKernel(this->helper_program, "amr_restrict", &ret);
+    throwOnError(ret, "AMROpenCLImageRD::ReloadKernelIfNeeded : kernel creation failed: ");
+    this->fill_value_kernel = clCreateKernel(this->helper_program, "amr_fill_value", &ret);
+    throwOnError(ret, "AMROpenCLImageRD::ReloadKernelIfNeeded : kernel creation failed: ");
+
+    this->patch_context = this->context;
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void AMROpenCLImageRD::InternalUpdate(int n_steps)
+{
+    this->ReloadContextIfNeeded();
+    this->ReloadKernelIfNeeded();
+    this->WriteToOpenCLBuffersIfNeeded();
+
+    for (int it = 0; it < n_steps; it++)
+    {
+        if (this->need_regrid || this->steps_since_regrid >= this->refinement_interval)
+        {
+            if (it > 0)
+                this->ReadFromOpenCLBuffers(); // Regrid() looks at the images
+            this->Regrid();
+        }
+        const int iOldBuffer = this->iCurrentBuffer;
+        this->RunKernel();
+        this->AdvancePatches(iOldBuffer, this->iCurrentBuffer);
+        this->steps_since_regrid++;
+    }
+    // (the time includes the formula kernel on the patches but not the helper kernels that fill their ghost cells and
+    //  restrict them, nor any regridding; the cells counted are only those of the coarse grid)
+    this->performance_counters.AddKernelTime(n_steps, this->GetNumberOfCells(), this->GetBytesPerCellUpdate(),
+        this->CollectKernelTime());
+
+    this->ReadFromOpenCLBuffers();
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+vector<double> AMROpenCLImageRD::GetTileActivity() const
+{
+    const int n_tiles = this->num_tiles[0] * this->num_tiles[1] * this->num_tiles[2];
+    const int dims[3] = { this->num_tiles[0] * this->tile_size[0], this->num_tiles[1] * this->tile_size[1],
+                          this->num_tiles[2] * this->tile_size[2] };
+    vector<double> activity(n_tiles, 0.0);
+    ParallelFor(GetNumberOfWorkerThreads(n_tiles, MIN_TILES_PER_THREAD), n_tiles, [&](int, size_t begin, size_t end)
+    {
+        for (size_t iTile = begin; iTile < end; iTile++)
+        {
+            const int t[3] = { static_cast<int>(iTile) % this->num_tiles[0],
+                               (static_cast<int>(iTile) / this->num_tiles[0]) % this->num_tiles[1],
+                               static_cast<int>(iTile) / (this->num_tiles[0] * this->num_tiles[1]) };
+            const int from[3] = { t[0] * this->tile_size[0], t[1] * this->tile_size[1], t[2] * this->tile_size[2] };
+            const int to[3] = { from[0] + this->tile_size[0], from[1] + this->tile_size[1], from[2] + this->tile_size[2] };
+            for (const vtkSmartPointer<vtkImageData>& image : this->images)
+            {
+                const double diff = (this->data_type == VTK_DOUBLE)
+                    ? GetMaxCentralDifference(static_cast<const double*>(image->GetScalarPointer()), dims, this->wrap, from, to)
+                    : GetMaxCentralDifference(static_cast<const float*>(image->GetScalarPointer()), dims, this->wrap, from, to);
+                activity[iTile] = max(activity[iTile], diff);
+            }
+        }
+    });
+    return activity;
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+vector<cl_mem> AMROpenCLImageRD::CreateAtlas(int n_patches) const
+{
+    vector<cl_mem> atlas(this->GetNumberOfChemicals());
+    for (cl_mem& buffer : atlas)
+    {
+        cl_int ret;
+        buffer = clCreateBuffer(this->context, CL_MEM_READ_WRITE, this->data_type_size * this->patch_cells * n_patches, NULL, &ret);
+        throwOnError(ret, "AMROpenCLImageRD::CreateAtlas : buffer creation failed: ");
+    }
+    return atlas;
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void AMROpenCLImageRD::Regrid()
+{
+    const int NC = this->GetNumberOfChemicals();
+    const int n_tiles = this->num_tiles[0] * this->num_tiles[1] * this->num_tiles[2];
+    if (static_cast<int>(this->tile_patches.size()) != n_tiles)
+    {
+        this->patch_tiles.clear();
+        this->tile_patches.assign(n_tiles, -1);
+    }
+
+    // flag the tiles that are active, with some hysteresis so that tiles near the threshold don't flicker
+    const vector<double> activity = this->GetTileActivity();
+    vector<char> refine(n_tiles, 0);
+    for (int iTile = 0; iTile < n_tiles; iTile++)
+    {
+        const bool is_refined = this->tile_patches[iTile] >= 0;
+        if (activity[iTile] <= (is_refined ? this->refinement_threshold / 2 : this->refinement_threshold))
+            continue;
+        // refine the neighbors too, so that a moving front stays inside the patches until the next regrid
+        const int t[3] = { iTile % this->num_tiles[0], (iTile / this->num_tiles[0]) % this->num_tiles[1],
+                           iTile / (this->num_tiles[0] * this->num_tiles[1]) };
+        for (int dz = -1; dz <= 1; dz++)
+        {
+            for (int dy = -1; dy <= 1; dy++)
+            {
+                for (int dx = -1; dx <= 1; dx++)
+                {
+                    int n[3] = { t[0] + dx, t[1] + dy, t[2] + dz };
+                    bool inside = true;
+                    for (int axis = 0; axis < 3; axis++)
+                    {
+                        if (this->wrap)
+                            n[axis] = (n[axis] + this->num_tiles[axis]) % this->num_tiles[axis];
+                        else if (n[axis] < 0 || n[axis] >= this->num_tiles[axis])
+                            inside = false;
+                    }
+                    if (inside)
+                        refine[this->num_tiles[0] * (this->num_tiles[1] * n[2] + n[1]) + n[0]] = 1;
+                }
+            }
+        }
+    }
+
+    // the patches we keep go first, in their old order, so they can be moved with few copies; new ones go after
+    vector<int> kept_patches, new_patch_tiles;
+    for (int iPatch = 0; iPatch < static_cast<int>(this->patch_tiles.size()); iPatch++)
+    {
+        if (refine[this->patch_tiles[iPatch]])
+        {
+            kept_patches.push_back(iPatch);
+            new_patch_tiles.push_back(this->patch_tiles[iPatch]);
+        }
+    }
+    const int n_kept = static_cast<int>(kept_patches.size());
+    for (int iTile = 0; iTile < n_tiles; iTile++)
+        if (refine[iTile] && this->tile_patches[iTile] < 0)
+            new_patch_tiles.push_back(iTile);
+    const int n_patches = static_cast<int>(new_patch_tiles.size());
+
+    this->need_regrid = false;
+    this->steps_since_regrid = 0;
+    if (n_kept == static_cast<int>(this->patch_tiles.size()) && n_patches == n_kept)
+        return; // nothing changed
+
+    cl_int ret;
+    const size_t PATCH_SIZE = this->data_type_size * this->patch_cells;
+    const bool grow = n_patches > this->patch_capacity;
+    const int new_capacity = grow ? max(n_patches, this->patch_capacity * 3 / 2) : this->patch_capacity;
+    const vector<cl_mem> target = grow ? this->CreateAtlas(new_capacity) : this->atlases[1 - this->iCurrentAtlas];
+    if (!this->tile_patches_buffer)
+    {
+        this->tile_patches_buffer = clCreateBuffer(this->context, CL_MEM_READ_ONLY, sizeof(int) * n_tiles, NULL, &ret);
+        throwOnError(ret, "AMROpenCLImageRD::Regrid : buffer creation failed: ");
+    }
+
+    // copy the kept patches, a run of consecutive ones at a time
+    for (int iRunStart = 0; iRunStart < n_kept; )
+    {
+        int iRunEnd = iRunStart + 1;
+        while (iRunEnd < n_kept && kept_patches[iRunEnd] == kept_patches[iRunEnd - 1] + 1)
+            iRunEnd++;
+        for (int ic = 0; ic < NC; ic++)
+        {
+            ret = clEnqueueCopyBuffer(this->command_queue, this->atlases[this->iCurrentAtlas][ic], target[ic],
+                kept_patches[iRunStart] * PATCH_SIZE, iRunStart * PATCH_SIZE, (iRunEnd - iRunStart) * PATCH_SIZE, 0, NULL, NULL);
+            throwOnError(ret, "AMROpenCLImageRD::Regrid : clEnqueueCopyBuffer failed: ");
+        }
+        iRunStart = iRunEnd;
+    }
+
+    if (grow)
+    {
+        // (OpenCL keeps the old buffers alive until the copies above have finished)
+        for (int i = 0; i < 2; i++)
+            for (cl_mem atlas : this->atlases[i])
+                clReleaseMemObject(atlas);
+        for (cl_mem integral : this->atlas_integrals)
+            clReleaseMemObject(integral);
+        if (this->patch_tiles_buffer)
+            clReleaseMemObject(this->patch_tiles_buffer);
+        this->atlases[0] = target;
+        this->atlases[1] = this->CreateAtlas(new_capacity);
+        this->atlas_integrals = this->CreateAtlas(new_capacity);
+        this->patch_tiles_buffer = clCreateBuffer(this->context, CL_MEM_READ_ONLY, sizeof(int) * new_capacity, NULL, &ret);
+        throwOnError(ret, "AMROpenCLImageRD::Regrid : buffer creation failed: ");
+        this->patch_capacity = new_capacity;
+        this->iCurrentAtlas = 0;
+    }
+    else
+    {
+        this->iCurrentAtlas = 1 - this->iCurrentAtlas;
+    }
+
+    // update the lookup tables
+    this->patch_tiles = new_patch_tiles;
+    this->tile_patches.assign(n_tiles, -1);
+    for (int iPatch = 0; iPatch < n_patches; iPatch++)
+        this->tile_patches[this->patch_tiles[iPatch]] = iPatch;
+    if (n_patches == 0)
+        return;
+    ret = clEnqueueWriteBuffer(this->command_queue, this->patch_tiles_buffer, CL_FALSE, 0, sizeof(int) * n_patches,
+        this->patch_tiles.data(), 0, NULL, NULL);
+    throwOnError(ret, "AMROpenCLImageRD::Regrid : buffer writing failed: ");
+    ret = clEnqueueWriteBuffer(this->command_queue, this->tile_patches_buffer, CL_TRUE, 0, sizeof(int) * n_tiles,
+        this->tile_patches.data(), 0, NULL, NULL);
+    throwOnError(ret, "AMROpenCLImageRD::Regrid : buffer writing failed: ");
+
+    // fill the new patches by interpolating the coarse image
+    const double w_double = 0.0;
+    const float w_float = 0.0f;
+    const void* w = (this->data_type == VTK_DOUBLE) ? static_cast<const void*>(&w_double) : static_cast<const void*>(&w_float);
+    const int prolong_all = 1;
+    for (int ic = 0; ic < NC && n_kept < n_patches; ic++)
+    {
+        cl_mem coarse = this->buffers[this->iCurrentBuffer][ic];
+        this->SetKernelArg(this->fill_ghosts_kernel, 0, sizeof(cl_mem), &coarse);
+        this->SetKernelArg(this->fill_ghosts_kernel, 1, sizeof(cl_mem), &coarse);
+        this->SetKernelArg(this->fill_ghosts_kernel, 2, this->data_type_size, w);
+        this->SetKernelArg(this->fill_ghosts_kernel, 3, sizeof(cl_mem), &this->atlases[this->iCurrentAtlas][ic]);
+        this->SetKernelArg(this->fill_ghosts_kernel, 4, sizeof(cl_mem), &this->patch_tiles_buffer);
+        this->SetKernelArg(this->fill_ghosts_kernel, 5, sizeof(cl_mem), &this->tile_patches_buffer);
+        this->SetKernelArg(this->fill_ghosts_kernel, 6, sizeof(int), &n_kept);
+        this->SetKernelArg(this->fill_ghosts_kernel, 7, sizeof(int), &prolong_all);
+        this->RunHelperKernel(this->fill_ghosts_kernel, (n_patches - n_kept) * this->patch_cells);
+    }
+
+    // the formula kernel takes the integral of each chemical at every cell
+    for (int ic = 0; ic < NC; ic++)
+    {
+        this->SetKernelArg(this->fill_value_kernel, 0, sizeof(cl_mem), &this->atlas_integrals[ic]);
+        this->SetKernelArg(this->fill_value_kernel, 1, sizeof(cl_mem), &this->intergral_buffers[0][ic]);
+        this->RunHelperKernel(this->fill_value_kernel, this->patch_capacity * this->patch_cells);
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void AMROpenCLImageRD::AdvancePatches(int iOldBuffer, int iNewBuffer)
+{
+    if (this->patch_tiles.empty()) return;
+
+    const int NC = this->GetNumberOfChemicals();
+    const int n_patches = static_cast<int>(this->patch_tiles.size());
+    size_t patch_range[3] = { static_cast<size_t>(this->patch_size[0] / this->GetBlockSizeX()),
+                              static_cast<size_t>(this->patch_size[1]), static_cast<size_t>(this->patch_size[2]) };
+    patch_range[this->stack_axis] *= n_patches;
+
+    // the finer grid needs a smaller timestep for the diffusion to stay stable
+    const int n_substeps = this->refinement_ratio * this->refinement_ratio;
+    const int first_patch = 0;
+    const int prolong_all = 0;
+    for (int iSubstep = 0; iSubstep < n_substeps; iSubstep++)
+    {
+        // fill the ghost cells, interpolating the coarse image to the time of this substep
+        const double w_double = iSubstep / static_cast<double>(n_substeps);
+        const float w_float = static_cast<float>(w_double);
+        const void* w = (this->data_type == VTK_DOUBLE) ? static_cast<const void*>(&w_double) : static_cast<const void*>(&w_float);
+        for (int ic = 0; ic < NC; ic++)
+        {
+            this->SetKernelArg(this->fill_ghosts_kernel, 0, sizeof(cl_mem), &this->buffers[iOldBuffer][ic]);
+            this->SetKernelArg(this->fill_ghosts_kernel, 1, sizeof(cl_mem), &this->buffers[iNewBuffer][ic]);
+            this->SetKernelArg(this->fill_ghosts_kernel, 2, this->data_type_size, w);
+            this->SetKernelArg(this->fill_ghosts_kernel, 3, sizeof(cl_mem), &this->atlases[this->iCurrentAtlas][ic]);
+            this->SetKernelArg(this->fill_ghosts_kernel, 4, sizeof(cl_mem), &this->patch_tiles_buffer);
+            this->SetKernelArg(this->fill_ghosts_kernel, 5, sizeof(cl_mem), &this->tile_patches_buffer);
+            this->SetKernelArg(this->fill_ghosts_kernel, 6, sizeof(int), &first_patch);
+            this->SetKernelArg(this->fill_ghosts_kernel, 7, sizeof(int), &prolong_all);
+            this->RunHelperKernel(this->fill_ghosts_kernel, n_patches * this->patch_cells);
+        }
+
+        // update every patch with a single launch of the formula kernel
+        for (int ic = 0; ic < NC; ic++)
+        {
+            this->SetKernelArg(this->patch_kernel, ic, sizeof(cl_mem), &this->atlas_integrals[ic]);
+            this->SetKernelArg(this->patch_kernel, NC + ic, sizeof(cl_mem), &this->atlases[this->iCurrentAtlas][ic]);
+            this->SetKernelArg(this->patch_kernel, 2 * NC + ic, sizeof(cl_mem), &this->atlases[1 - this->iCurrentAtlas][ic]);
+        }
+        cl_int ret = clEnqueueNDRangeKernel(this->command_queue, this->patch_kernel, 3, NULL, patch_range, NULL, 0, NULL,
+            this->GetKernelTimingEvent());
+        throwOnError(ret, "AMROpenCLImageRD::AdvancePatches : clEnqueueNDRangeKernel failed: ");
+        this->iCurrentAtlas = 1 - this->iCurrentAtlas;
+    }
+
+    // replace the coarse values under the patches with the average of the fine ones
+    for (int ic = 0; ic < NC; ic++)
+    {
+        this->SetKernelArg(this->restrict_kernel, 0, sizeof(cl_mem), &this->atlases[this->iCurrentAtlas][ic]);
+        this->SetKernelArg(this->restrict_kernel, 1, sizeof(cl_mem), &this->buffers[iNewBuffer][ic]);
+        this->SetKernelArg(this->restrict_kernel, 2, sizeof(cl_mem), &this->patch_tiles_buffer);
+        this->RunHelperKernel(this->restrict_kernel, n_patches * this->tile_size[0] * this->tile_size[1] * this->tile_size[2]);
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void AMROpenCLImageRD::SetKernelArg(cl_kernel k, int i, size_t size, const void* value) const
+{
+    cl_int ret = clSetKernelArg(k, i, size, value);
+    throwOnError(ret, "AMROpenCLImageRD::SetKernelArg : clSetKernelArg failed: ");
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void AMROpenCLImageRD::RunHelperKernel(cl_kernel k, size_t n_work_items) const
+{
+    cl_int ret = clEnqueueNDRangeKernel(this->command_queue, k, 1, NULL, &n_work_items, NULL, 0, NULL, NULL);
+    throwOnError(ret, "AMROpenCLImageRD::RunHelperKernel : clEnqueueNDRangeKernel failed: ");
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void AMROpenCLImageRD::InitializeFromXML(vtkXMLDataElement *rd, bool &warn_to_update)
+{
+    FormulaOpenCLImageRD::InitializeFromXML(rd, warn_to_update);
+
+    vtkSmartPointer<vtkXMLDataElement> rule = rd->FindNestedElementWithName("rule");
+    if(!rule) throw runtime_error("rule node not found in file");
+    vtkSmartPointer<vtkXMLDataElement> xml_formula = rule->FindNestedElementWithName("formula");
+    if(!xml_formula) throw runtime_error("formula node not found in file");
+
+    read_optional_attribute(xml_formula, "refinement_ratio", this->refinement_ratio);
+    read_optional_attribute(xml_formula, "refinement_threshold", this->refinement_threshold);
+    read_optional_attribute(xml_formula, "refinement_tile_size", this->refinement_tile_size);
+    read_optional_attribute(xml_formula, "refinement_interval", this->refinement_interval);
+    // (skipping quiescent tiles isn't supported: the patches change the coarse image without the kernel seeing it)
+    this->quiescent_steps = 0;
+    this->need_reload_formula = true;
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+vtkSmartPointer<vtkXMLDataElement> AMROpenCLImageRD::GetAsXML(bool generate_initial_pattern_when_loading) const
+{
+    vtkSmartPointer<vtkXMLDataElement> rd = FormulaOpenCLImageRD::GetAsXML(generate_initial_pattern_when_loading);
+
+    vtkSmartPointer<vtkXMLDataElement> rule = rd->FindNestedElementWithName("rule");
+    if(!rule) throw runtime_error("rule node not found");
+    vtkSmartPointer<vtkXMLDataElement> formula = rule->FindNestedElementWithName("formula");
+    if(!formula) throw runtime_error("formula node not found");
+
+    formula->SetIntAttribute("refinement_ratio", this->refinement_ratio);
+    formula->SetFloatAttribute("refinement_threshold", this->refinement_threshold);
+    formula->SetIntAttribute("refinement_tile_size", this->refinement_tile_size);
+    formula->SetIntAttribute("refinement_interval", this->refinement_interval);
+
+    return rd;
+}
+
+// ----------------------------------------------------------------------------------------------------------------
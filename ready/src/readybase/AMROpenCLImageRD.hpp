@@ -0,0 +1,118 @@
+/*  Copyright 2011-2024 The Ready Bunch
+
+    This file is part of Ready.
+
+    Ready is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ready is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ready. If not, see <http://www.gnu.org/licenses/>.         */
+
+#ifndef __AMROPENCLIMAGERD__
+#define __AMROPENCLIMAGERD__
+
+// local:
+#include "FormulaOpenCLImageRD.hpp"
+
+/// A formula RD system that adds finer patches over the tiles of the image where the pattern is changing quickly.
+/** Block-structured adaptive mesh refinement with two levels. The image is split into square tiles and every tile
+ *  whose chemicals have a steep gradient gets a patch with refinement_ratio times as many cells along each axis.
+ *  Each step we advance the coarse image as usual, then advance every patch by refinement_ratio^2 substeps (to keep
+ *  the diffusion stable), filling their ghost cells from neighboring patches or by interpolating the coarse image
+ *  in space and time, and finally average the patches back down into the coarse image. Tiles are refined and
+ *  coarsened every refinement_interval steps.
+ *
+ *  All the patches are packed into one long image (the atlas) so that the unchanged formula kernel can update them
+ *  all with a single launch. The image that is displayed and saved is the coarse one. */
+class AMROpenCLImageRD : public FormulaOpenCLImageRD
+{
+    public:
+
+        AMROpenCLImageRD(int opencl_platform,int opencl_device,int data_type);
+        ~AMROpenCLImageRD() override;
+
+        void InitializeFromXML(vtkXMLDataElement* rd,bool& warn_to_update) override;
+        vtkSmartPointer<vtkXMLDataElement> GetAsXML(bool generate_initial_pattern_when_loading) const override;
+
+        int GetNumberOfRefinedTiles() const { return static_cast<int>(this->patch_tiles.size()); }
+
+        /// Regridding reads the images partway through the steps, so they can't be taken in the background.
+        bool CanStepInBackground() const override { return false; }
+        /// The patches sample the coarse buffers directly, so those keep the plain layout.
+        bool IsUsingGhostCells() const override { return false; }
+        Storage GetStorage() const override { return Storage::Same; }
+        /// The patches step their own pairs of buffers with the same kernel, so it writes every chemical.
+        bool IsSharingConstantBuffers() const override { return false; }
+        /// The patches are stepped from buffers that are sliced out of the coarse ones, so they have no images to read.
+        bool IsUsingImageObjects() const override { return false; }
+        /// The patches are stepped by the main kernel alone.
+        bool IsStagingStencils() const override { return false; }
+        /// The patches are launched with the same block size, so we don't try others.
+        bool HasAutoTuneOption() const override { return false; }
+
+    protected:
+
+        void InternalUpdate(int n_steps) override;
+
+        void ReloadKernelIfNeeded() override;
+
+        void WriteToOpenCLBuffersIfNeeded() override;
+        void ReleaseOpenCLBuffers() override;
+
+    private:
+
+        /// Finds the tiles that need refining from the current images and rebuilds the patches to match.
+        void Regrid();
+
+        /// Advances the patches by one coarse step, given the coarse buffers before and after that step.
+        void AdvancePatches(int iOldBuffer, int iNewBuffer);
+
+        /// Returns the largest central difference (in value per cell) of any chemical in each tile.
+        std::vector<double> GetTileActivity() const;
+
+        /// Creates one atlas buffer per chemical with room for n_patches.
+        std::vector<cl_mem> CreateAtlas(int n_patches) const;
+
+        void ReleasePatches();
+        void ReleasePatchKernels();
+
+        void SetKernelArg(cl_kernel k, int i, size_t size, const void* value) const;
+        void RunHelperKernel(cl_kernel k, size_t n_work_items) const;
+
+    private:
+
+        // settings:
+        int refinement_ratio;           ///< number of fine cells along each axis of a coarse cell
+        float refinement_threshold;     ///< tiles with a central difference larger than this get refined
+        int refinement_tile_size;       ///< tile size in coarse cells, along each axis
+        int refinement_interval;        ///< number of steps between regrids
+
+        // derived from the settings and the image dimensions when the kernels are built:
+        int tile_size[3], ghost_size[3], ratio[3], patch_size[3], num_tiles[3];
+        int stack_axis;                 ///< the patches are stacked along this axis in the atlas
+        size_t patch_cells;             ///< number of cells in each patch, including the ghost cells
+
+        cl_program patch_program, helper_program;
+        cl_kernel patch_kernel, fill_ghosts_kernel, restrict_kernel, fill_value_kernel;
+        cl_context patch_context;       ///< the context the patch objects were made in
+
+        std::vector<int> patch_tiles;   ///< the tile that each patch covers
+        std::vector<int> tile_patches;  ///< the patch covering each tile, or -1
+        int patch_capacity;             ///< number of patches that the atlas buffers have room for
+        std::vector<cl_mem> atlases[2]; ///< ping-pong buffers, one per chemical in each
+        std::vector<cl_mem> atlas_integrals; ///< the integral_ kernel inputs, sized to match the atlas
+        int iCurrentAtlas;
+        cl_mem patch_tiles_buffer, tile_patches_buffer;
+
+        bool need_regrid;
+        int steps_since_regrid;
+};
+
+#endif
@@ -18,9 +18,17 @@
 // local:
 #include "AbstractRD.hpp"
 #include "overlays.hpp"
+#include "stencils.hpp"
+#include "utils.hpp"
+
+// VTK:
+#include <vtkImageData.h>
+#include <vtkPolyData.h>
 
 // STL:
 #include <algorithm>
+#include <cctype>
+#include <stdexcept>
 
 // SSE:
 #undef USE_SSE
@@ -171,6 +179,68 @@ void AbstractRD::SetParameterValue(int iParam,float val)
 
 // ---------------------------------------------------------------------
 
+string AbstractRD::GetParameterMapName(int iChemical) const
+{
+    const auto it = this->parameter_maps.find(iChemical);
+    return it == this->parameter_maps.end() ? "" : it->second;
+}
+
+// ---------------------------------------------------------------------
+
+void AbstractRD::SetParameterMapName(int iChemical,const string& name)
+{
+    if (name.empty())
+        this->parameter_maps.erase(iChemical);
+    else
+    {
+        this->CheckParameterMapName(iChemical,name);
+        for (const pair<const int,string>& parameter_map : this->parameter_maps)
+            if (parameter_map.first != iChemical && parameter_map.second == name)
+                throw runtime_error("AbstractRD::SetParameterMapName : chemical "+GetChemicalName(parameter_map.first)
+                    +" is already a parameter map called "+name);
+        this->parameter_maps[iChemical] = name;
+    }
+    this->is_modified = true;
+}
+
+// ---------------------------------------------------------------------
+
+void AbstractRD::CheckParameterMapName(int iChemical,const string& name) const
+{
+    // the formula kernels declare the parameter map as a variable of this name, alongside these others
+    const auto fail = [&](const string& reason) {
+        throw runtime_error("AbstractRD::CheckParameterMapName : \""+name+"\" can't be the name of a parameter map: "+reason);
+    };
+    const auto is_word_char = [](char c) { return isalnum(static_cast<unsigned char>(c)) || c == '_'; };
+    if (name.empty() || isdigit(static_cast<unsigned char>(name[0])) || !all_of(name.begin(), name.end(), is_word_char))
+        fail("it must be made of letters, digits and underscores, and not start with a digit");
+    if (this->IsParameter(name))
+        fail("there is a parameter of that name");
+    vector<string> prefixes = { "delta", "gradient_mag_squared", "lap1", "lap2" }; // (lapN_a are staged stencils)
+    for (int dimensionality = 1; dimensionality <= 3; dimensionality++)
+        for (const Accuracy accuracy : { Accuracy::Low, Accuracy::Medium, Accuracy::High })
+            for (const Stencil& stencil : GetKnownStencils(dimensionality, accuracy))
+                prefixes.push_back(stencil.label);
+    vector<string> keywords = { "x_pos", "y_pos", "z_pos", "X", "Y", "Z",
+        "const", "float", "double", "half", "int", "bool", "void", "if", "else", "for", "while", "do", "return",
+        "global", "local", "kernel" }; // (and some of OpenCL C's own)
+    const int n_chemicals = max(this->GetNumberOfChemicals(), iChemical + 1);
+    for (int i = 0; i < n_chemicals; i++)
+    {
+        const string chem = GetChemicalName(i);
+        if (name == chem)
+            fail("it is the name of a chemical");
+        keywords.push_back(chem+"_in");
+        keywords.push_back(chem+"_out");
+        for (const string& prefix : prefixes)
+            keywords.push_back(prefix+"_"+chem);
+    }
+    if (find(keywords.begin(), keywords.end(), name) != keywords.end() || name.compare(0, 6, "index_") == 0)
+        fail("it is a formula keyword");
+}
+
+// ---------------------------------------------------------------------
+
 bool AbstractRD::IsParameter(const string& name) const
 {
     return find_if(this->parameters.begin(), this->parameters.end(),
@@ -240,6 +310,19 @@ void AbstractRD::InitializeFromXML(vtkXMLDataElement* rd, bool& warn_to_update)
         this->AddParameter(name,f);
     }
 
+    // parameter maps:
+    this->parameter_maps.clear();
+    for(int i=0;i<rule->GetNumberOfNestedElements();i++)
+    {
+        vtkSmartPointer<vtkXMLDataElement> node = rule->GetNestedElement(i);
+        if(string(node->GetName())!="parameter_map") continue;
+        if(!this->HasParameterMapOption()) throw runtime_error("parameter maps are not supported by this rule type");
+        string chemical, name;
+        read_required_attribute(node,"chemical",chemical);
+        read_required_attribute(node,"name",name);
+        this->SetParameterMapName(IndexFromChemicalName(chemical),name);
+    }
+
     // description:
     vtkSmartPointer<vtkXMLDataElement> xml_description = rd->FindNestedElementWithName("description");
     if(!xml_description) this->SetDescription(""); // optional, default is empty string
@@ -284,6 +367,15 @@ vtkSmartPointer<vtkXMLDataElement> AbstractRD::GetAsXML(bool generate_initial_pa
         param->SetCharacterData(s.c_str(),(int)s.length());
         rule->AddNestedElement(param);
     }
+    for(const pair<const int,string>& parameter_map : this->parameter_maps)
+    {
+        if(parameter_map.first >= this->GetNumberOfChemicals()) continue;
+        vtkSmartPointer<vtkXMLDataElement> node = vtkSmartPointer<vtkXMLDataElement>::New();
+        node->SetName("parameter_map");
+        node->SetAttribute("chemical",GetChemicalName(parameter_map.first).c_str());
+        node->SetAttribute("name",parameter_map.second.c_str());
+        rule->AddNestedElement(node);
+    }
     rd->AddNestedElement(rule);
 
     rd->AddNestedElement(initial_pattern_generator.GetAsXML(generate_initial_pattern_when_loading));
@@ -376,6 +468,43 @@ void AbstractRD::StorePaintAction(int iChemical,int iCell,float old_val)
 
 // ---------------------------------------------------------------------
 
+function<void(vtkPolyData*)> AbstractRD::GetAsMeshLater(const Properties& render_settings) const
+{
+    vtkSmartPointer<vtkPolyData> mesh = vtkSmartPointer<vtkPolyData>::New();
+    this->GetAsMesh(mesh, render_settings);
+    return [mesh](vtkPolyData* out) { out->DeepCopy(mesh); };
+}
+
+// ---------------------------------------------------------------------
+
+function<void(vtkImageData*)> AbstractRD::GetAs2DImageLater(const Properties& render_settings) const
+{
+    vtkSmartPointer<vtkImageData> image = vtkSmartPointer<vtkImageData>::New();
+    this->GetAs2DImage(image, render_settings);
+    return [image](vtkImageData* out) { out->DeepCopy(image); };
+}
+
+// ---------------------------------------------------------------------
+
+void AbstractRD::StepInBackground(int /*n_steps*/)
+{
+    throw runtime_error("AbstractRD::StepInBackground : this system cannot step in the background");
+}
+
+// ---------------------------------------------------------------------
+
+void AbstractRD::TimedInternalUpdate(int n_steps)
+{
+    const double start = get_time_in_seconds();
+    const double build_time_before = this->performance_counters.GetBuildTime();
+    this->InternalUpdate(n_steps);
+    // (a kernel build is a one-off, so we leave it out of the speed of the steps)
+    const double build_time = this->performance_counters.GetBuildTime() - build_time_before;
+    this->performance_counters.AddSteps(n_steps, this->GetNumberOfCells(), get_time_in_seconds() - start - build_time);
+}
+
+// ---------------------------------------------------------------------
+
 std::string AbstractRD::GetNeighborhoodType() const
 {
     return this->canonical_neighborhood_type_identifiers.find(this->neighborhood_type)->second;
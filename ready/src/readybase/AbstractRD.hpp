@@ -20,6 +20,7 @@
 
 // local:
 #include "InitialPatternGenerator.hpp"
+#include "PerformanceCounters.hpp"
 class Overlay;
 class Properties;
 
@@ -31,6 +32,7 @@ class vtkPolyData;
 class vtkImageData;
 
 // STL:
+#include <functional>
 #include <string>
 #include <vector>
 #include <map>
@@ -51,6 +53,21 @@ class AbstractRD
         /// Called to progress the simulation by N steps.
         virtual void Update(int n_steps) =0;
 
+        /// Indicates whether StepInBackground() can be called, as an alternative to Update() (see SimulationThread).
+        virtual bool CanStepInBackground() const { return false; }
+        /// Makes any changes since the last background steps take effect. Call while no background steps are running.
+        virtual void PrepareForBackgroundSteps() {}
+        /// Progresses the simulation by N steps without changing anything that the other methods read.
+        /** This is safe to call on another thread, as long as the system is only read (not changed) in the meantime.
+            The results are not visible until FinishBackgroundSteps() is called. */
+        virtual void StepInBackground(int n_steps);
+        /// Makes the results of StepInBackground() visible, as if Update() had been called for the same number of steps.
+        /** Some implementations only start the read back here, so that it overlaps the next background steps. Call
+            CompleteBackgroundSteps() before reading or changing the system. */
+        virtual void FinishBackgroundSteps(int /*n_steps_taken*/) {}
+        /// Waits for anything that FinishBackgroundSteps() left running.
+        virtual void CompleteBackgroundSteps() {}
+
         /// Some implementations (e.g. inbuilt ones) cannot have their number_of_chemicals edited.
         virtual bool HasEditableNumberOfChemicals() const { return true; }
         int GetNumberOfChemicals() const { return this->n_chemicals; }
@@ -95,6 +112,22 @@ class AbstractRD
         virtual void SetParameterName(int iParam,const std::string& s);
         virtual void SetParameterValue(int iParam,float val);
 
+        /// Some implementations (e.g. FormulaOpenCLImageRD) can make chemicals into parameter maps: read-only fields
+        /// that the formula uses by name, e.g. to vary a parameter across the image.
+        /** They are painted, imported and saved like the other chemicals, but the implementation can store them once
+            and skip reading them back after each update. */
+        virtual bool HasParameterMapOption() const { return false; }
+        /// Returns the name of the parameter map that chemical iChemical holds, or "" if it is an ordinary chemical.
+        std::string GetParameterMapName(int iChemical) const;
+        /// Makes chemical iChemical a parameter map called name, or (if name is empty) an ordinary chemical again.
+        /** Throws std::runtime_error if CheckParameterMapName() rejects the name, or another chemical has it. */
+        virtual void SetParameterMapName(int iChemical,const std::string& name);
+        /// Throws std::runtime_error, saying why, if chemical iChemical can't be a parameter map called name: it must be
+        /// an identifier, and not the name of a parameter, a chemical or a formula keyword.
+        void CheckParameterMapName(int iChemical,const std::string& name) const;
+        /// Returns the name of each chemical that is a parameter map.
+        const std::map<int,std::string>& GetParameterMaps() const { return this->parameter_maps; }
+
         /// Should the user be asked if they want to save this pattern?
         bool IsModified() const { return this->is_modified; }
         void SetModified(bool m);
@@ -119,6 +152,8 @@ class AbstractRD
         virtual float GetY() const =0;
         virtual float GetZ() const =0;
         virtual void SetDimensions(int /*x*/,int /*y*/,int /*z*/) {}
+        /// Some implementations (e.g. FormulaOpenCLImageRD) can only wrap around efficiently if the dimensions are powers of 2.
+        virtual bool NeedsPowerOfTwoDimensions() const { return false; }
 
         /// Only some implementations (e.g. FullKernelOpenCLImageRD) can have their block size edited.
         virtual bool HasEditableBlockSize() const { return false; }
@@ -132,6 +167,12 @@ class AbstractRD
         bool GetUseLocalMemory() const { return this->use_local_memory; }
         void SetUseLocalMemory(bool val) { this->use_local_memory = val; this->need_reload_formula = true; }
 
+        /// Some implementations (e.g. FormulaOpenCLImageRD) can time their kernel with different block sizes and
+        /// work-group sizes, and use the fastest.
+        virtual bool HasAutoTuneOption() const { return false; }
+        virtual bool GetAutoTune() const { return false; }
+        virtual void SetAutoTune(bool /*val*/) {}
+
         virtual bool HasEditableWrapOption() const { return false; }
         bool GetWrap() const { return this->wrap; }
         virtual void SetWrap(bool w) { this->wrap = w; }
@@ -148,6 +189,13 @@ class AbstractRD
         virtual void GetAs2DImage(vtkImageData *out,const Properties& render_settings) const =0;
         /// Sets the values for a certain chemical from an image
         virtual void SetFrom2DImage(int iChemical, vtkImageData *im) = 0;
+        /// Takes a snapshot of what GetAsMesh() needs, returning a function that makes the 3D object from it later.
+        /** The returned function doesn't refer to the system so it can be called from another thread, after the system has moved on.
+            The default implementation makes the mesh immediately. */
+        virtual std::function<void(vtkPolyData*)> GetAsMeshLater(const Properties& render_settings) const;
+        /// Takes a snapshot of what GetAs2DImage() needs, returning a function that makes the 2D image from it later.
+        /** As with GetAsMeshLater(), the returned function can be called from another thread. */
+        virtual std::function<void(vtkImageData*)> GetAs2DImageLater(const Properties& render_settings) const;
         /// Indicates whether GetAs2DImage() and SetFrom2DImage() can be called.
         virtual bool Is2DImageAvailable() const =0;
 
@@ -181,6 +229,10 @@ class AbstractRD
         /// Returns the total memory size that will need to be transferred to the GPU
         virtual size_t GetMemorySize() const =0;
 
+        /// Returns the work done since the system was created (or the counters were reset), and how long it took.
+        const PerformanceCounters& GetPerformanceCounters() const { return this->performance_counters; }
+        void ResetPerformanceCounters() { this->performance_counters.Reset(); }
+
         virtual std::vector<float> GetData(int i_chemical) const =0;
 
         struct Parameter {
@@ -208,6 +260,7 @@ class AbstractRD
         InitialPatternGenerator initial_pattern_generator;
 
         std::vector<Parameter> parameters;
+        std::map<int,std::string> parameter_maps; ///< the name of each chemical that is a parameter map
 
         std::vector<float> integrals;
 
@@ -239,10 +292,17 @@ class AbstractRD
 
         Accuracy accuracy;
 
+        PerformanceCounters performance_counters;
+
     protected: // functions
 
         /// Advance the RD system by n timesteps.
         virtual void InternalUpdate(int n_steps)=0;
+        /// Calls InternalUpdate(), adding the steps and the time they took to the performance counters.
+        void TimedInternalUpdate(int n_steps);
+
+        /// The memory traffic of updating one cell, if each chemical is read and written once.
+        virtual size_t GetBytesPerCellUpdate() const { return 2 * this->n_chemicals * this->data_type_size; }
 
         virtual void AddPhasePlot(vtkRenderer* pRenderer, float scaling, float low, float high, float posX, float posY, float posZ,
             int iChemX, int iChemY, int iChemZ) =0;
@@ -0,0 +1,301 @@
+/*  Copyright 2011-2024 The Ready Bunch
+
+    This file is part of Ready.
+
+    Ready is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ready is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ready. If not, see <http://www.gnu.org/licenses/>.         */
+
+// local:
+#include "FormulaCPUMeshRD.hpp"
+#include "parallel.hpp"
+#include "utils.hpp"
+
+// VTK:
+#include <vtkCellData.h>
+#include <vtkDataArray.h>
+#include <vtkUnstructuredGrid.h>
+#include <vtkXMLDataElement.h>
+
+// STL:
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+using namespace std;
+
+// -------------------------------------------------------------------------
+
+FormulaCPUMeshRD::FormulaCPUMeshRD(int data_type)
+    : MeshRD(data_type)
+{
+    // these settings are used in File > New Pattern
+    this->SetRuleName("Gray-Scott");
+    this->AddParameter("timestep",1.0f);
+    this->AddParameter("D_a",0.082f);
+    this->AddParameter("D_b",0.041f);
+    this->AddParameter("K",0.06f);
+    this->AddParameter("F",0.035f);
+    this->SetFormula("\
+delta_a = D_a * laplacian_a - a*b*b + F*(1.0" + this->data_type_suffix + "-a);\n\
+delta_b = D_b * laplacian_b + a*b*b - (F+K)*b;");
+}
+
+// -------------------------------------------------------------------------
+
+void FormulaCPUMeshRD::CompileFormula(const string& f, FormulaInterpreter& target, vector<bool>& laplacians) const
+{
+    if(!this->IsParameter("timestep"))
+        throw runtime_error("FormulaCPUMeshRD::CompileFormula : formula rules need a parameter called timestep");
+
+    // the variable slots: chemicals, laplacians, deltas, parameters (must match UpdateCells)
+    const int NC = this->GetNumberOfChemicals();
+    vector<string> variable_names;
+    for(int i=0;i<NC;i++)
+        variable_names.push_back(GetChemicalName(i));
+    for(int i=0;i<NC;i++)
+        variable_names.push_back("laplacian_"+GetChemicalName(i));
+    for(int i=0;i<NC;i++)
+        variable_names.push_back("delta_"+GetChemicalName(i));
+    for(const Parameter& parameter : this->parameters)
+        variable_names.push_back(parameter.name);
+    target.Compile(f,variable_names);
+
+    // we only compute the laplacians that the formula uses
+    const vector<string> formula_tokens = tokenize_for_keywords(f);
+    laplacians.resize(NC);
+    for(int i=0;i<NC;i++)
+        laplacians[i] = UsingKeyword(formula_tokens,"laplacian_"+GetChemicalName(i));
+}
+
+// -------------------------------------------------------------------------
+
+void FormulaCPUMeshRD::TestFormula(std::string f)
+{
+    FormulaInterpreter test_interpreter;
+    vector<bool> test_laplacians;
+    this->CompileFormula(f,test_interpreter,test_laplacians);
+}
+
+// -------------------------------------------------------------------------
+
+void FormulaCPUMeshRD::InternalUpdate(int n_steps)
+{
+    if(this->need_reload_formula)
+    {
+        this->CompileFormula(this->formula,this->interpreter,this->laplacians_needed);
+        this->need_reload_formula = false;
+    }
+
+    const int NC = this->GetNumberOfChemicals();
+    const vtkIdType n_cells = this->mesh->GetNumberOfCells();
+
+    // find the storage for each chemical, and make buffers to match
+    this->buffers.resize(NC);
+    vector<vtkDataArray*> mesh_arrays(NC);
+    for(int iChem=0;iChem<NC;iChem++)
+    {
+        mesh_arrays[iChem] = this->mesh->GetCellData()->GetArray(GetChemicalName(iChem).c_str());
+        if(!mesh_arrays[iChem] || mesh_arrays[iChem]->GetDataType() != this->data_type)
+            throw runtime_error("FormulaCPUMeshRD::InternalUpdate : failed to find "+this->data_type_string+" array for chemical "+GetChemicalName(iChem));
+        if(!this->buffers[iChem] || this->buffers[iChem]->GetDataType() != this->data_type)
+        {
+            this->buffers[iChem] = vtkSmartPointer<vtkDataArray>::Take(vtkDataArray::CreateDataArray(this->data_type));
+            this->buffers[iChem]->SetName(GetChemicalName(iChem).c_str());
+        }
+        if(this->buffers[iChem]->GetNumberOfTuples() != n_cells)
+            this->buffers[iChem]->SetNumberOfTuples(n_cells);
+    }
+
+    if(this->data_type == VTK_DOUBLE)
+    {
+        vector<double*> data[2];
+        for(int iChem=0;iChem<NC;iChem++)
+        {
+            data[0].push_back(static_cast<double*>(mesh_arrays[iChem]->GetVoidPointer(0)));
+            data[1].push_back(static_cast<double*>(this->buffers[iChem]->GetVoidPointer(0)));
+        }
+        this->UpdateCells<double>(n_steps,data);
+    }
+    else
+    {
+        vector<float*> data[2];
+        for(int iChem=0;iChem<NC;iChem++)
+        {
+            data[0].push_back(static_cast<float*>(mesh_arrays[iChem]->GetVoidPointer(0)));
+            data[1].push_back(static_cast<float*>(this->buffers[iChem]->GetVoidPointer(0)));
+        }
+        this->UpdateCells<float>(n_steps,data);
+    }
+
+    if(n_steps%2)
+    {
+        // the latest values are in the buffers, so swap them into the mesh (AddArray replaces the array with the same name)
+        for(int iChem=0;iChem<NC;iChem++)
+        {
+            vtkSmartPointer<vtkDataArray> previous = mesh_arrays[iChem];
+            this->mesh->GetCellData()->AddArray(this->buffers[iChem]);
+            this->buffers[iChem] = previous;
+        }
+    }
+}
+
+// -------------------------------------------------------------------------
+
+template <typename T>
+void FormulaCPUMeshRD::UpdateCells(int n_steps, const vector<T*> data[2])
+{
+    const int NC = this->GetNumberOfChemicals();
+    const int n_parameters = this->GetNumberOfParameters();
+    const int n_cells = this->mesh->GetNumberOfCells();
+
+    // slot layout, as set up in CompileFormula
+    const int LAPLACIANS = NC;
+    const int DELTAS = 2*NC;
+    const int PARAMETERS = 3*NC;
+    int iTimestep = 0;
+    vector<double> parameter_values(n_parameters);
+    for(int iParam=0;iParam<n_parameters;iParam++)
+    {
+        parameter_values[iParam] = this->parameters[iParam].value;
+        if(this->parameters[iParam].name == "timestep")
+            iTimestep = PARAMETERS + iParam;
+    }
+    vector<int> chemicals_with_laplacian;
+    for(int iChem=0;iChem<NC;iChem++)
+        if(this->laplacians_needed[iChem])
+            chemicals_with_laplacian.push_back(iChem);
+    vector<vector<T>> laplacians(NC);
+    for(int iChem : chemicals_with_laplacian)
+        laplacians[iChem].resize(n_cells);
+
+    // each thread needs its own variable slots
+    const int n_threads = GetNumberOfWorkerThreads(n_cells, MIN_CELLS_PER_THREAD);
+    vector<vector<double>> thread_slots(n_threads, vector<double>(this->interpreter.GetNumberOfSlots(), 0.0));
+
+    // each thread works on whole blocks of rows of the Laplacian operator, so it can apply it to its own cells independently
+    const SparseMatrix& L = this->laplacian_operator;
+    const int block_size = L.GetRowBlockSize();
+    ParallelForSteps(n_threads, L.GetNumberOfRowBlocks(), n_steps, [&](int iThread, int iStep, size_t begin_block, size_t end_block)
+    {
+        const vector<T*>& source = data[iStep%2];
+        const vector<T*>& target = data[(iStep+1)%2];
+        const int begin = static_cast<int>(begin_block) * block_size;
+        const int end = min(n_cells, static_cast<int>(end_block) * block_size);
+        // diffusion:
+        for(int iChem : chemicals_with_laplacian)
+            L.Multiply(source[iChem], laplacians[iChem].data(), begin, end);
+        // reaction, cell by cell:
+        double *v = thread_slots[iThread].data();
+        for(int iCell=begin;iCell<end;iCell++)
+        {
+            for(int iChem=0;iChem<NC;iChem++)
+            {
+                v[iChem] = source[iChem][iCell];
+                v[DELTAS+iChem] = 0.0;
+            }
+            for(int iChem : chemicals_with_laplacian)
+                v[LAPLACIANS+iChem] = laplacians[iChem][iCell];
+            // (the formula is free to overwrite the parameters, so we reset them for each cell)
+            for(int iParam=0;iParam<n_parameters;iParam++)
+                v[PARAMETERS+iParam] = parameter_values[iParam];
+            this->interpreter.Run(v);
+            // the forward-Euler step
+            for(int iChem=0;iChem<NC;iChem++)
+                target[iChem][iCell] = static_cast<T>(v[iChem] + v[iTimestep] * v[DELTAS+iChem]);
+        }
+    });
+}
+
+// -------------------------------------------------------------------------
+
+void FormulaCPUMeshRD::InitializeFromXML(vtkXMLDataElement *rd, bool &warn_to_update)
+{
+    MeshRD::InitializeFromXML(rd,warn_to_update);
+
+    vtkSmartPointer<vtkXMLDataElement> rule = rd->FindNestedElementWithName("rule");
+    if(!rule) throw runtime_error("rule node not found in file");
+
+    // formula:
+    vtkSmartPointer<vtkXMLDataElement> xml_formula = rule->FindNestedElementWithName("formula");
+    if(!xml_formula) throw runtime_error("formula node not found in file");
+
+    // number_of_chemicals:
+    read_required_attribute(xml_formula,"number_of_chemicals",this->n_chemicals);
+
+    string formula = trim_multiline_string(xml_formula->GetCharacterData());
+    this->TestFormula(formula); // will throw on error
+    this->SetFormula(formula); // (won't throw yet)
+}
+
+// -------------------------------------------------------------------------
+
+vtkSmartPointer<vtkXMLDataElement> FormulaCPUMeshRD::GetAsXML(bool generate_initial_pattern_when_loading) const
+{
+    vtkSmartPointer<vtkXMLDataElement> rd = MeshRD::GetAsXML(generate_initial_pattern_when_loading);
+
+    vtkSmartPointer<vtkXMLDataElement> rule = rd->FindNestedElementWithName("rule");
+    if(!rule) throw runtime_error("rule node not found");
+
+    // formula
+    vtkSmartPointer<vtkXMLDataElement> formula = vtkSmartPointer<vtkXMLDataElement>::New();
+    formula->SetName("formula");
+    formula->SetIntAttribute("number_of_chemicals",this->GetNumberOfChemicals());
+    string f = this->GetFormula();
+    f = ReplaceAllSubstrings(f, "\n", "\n        "); // indent the lines
+    formula->SetCharacterData(f.c_str(), (int)f.length());
+    rule->AddNestedElement(formula);
+
+    return rd;
+}
+
+// -------------------------------------------------------------------------
+
+void FormulaCPUMeshRD::SetNumberOfChemicals(int n, bool reallocate_storage)
+{
+    MeshRD::SetNumberOfChemicals(n, reallocate_storage);
+    this->need_reload_formula = true;
+}
+
+// -------------------------------------------------------------------------
+
+void FormulaCPUMeshRD::SetParameterName(int iParam,const string& s)
+{
+    AbstractRD::SetParameterName(iParam,s);
+    this->need_reload_formula = true;
+}
+
+// -------------------------------------------------------------------------
+
+void FormulaCPUMeshRD::AddParameter(const std::string& name,float val)
+{
+    AbstractRD::AddParameter(name,val);
+    this->need_reload_formula = true;
+}
+
+// -------------------------------------------------------------------------
+
+void FormulaCPUMeshRD::DeleteParameter(int iParam)
+{
+    AbstractRD::DeleteParameter(iParam);
+    this->need_reload_formula = true;
+}
+
+// -------------------------------------------------------------------------
+
+void FormulaCPUMeshRD::DeleteAllParameters()
+{
+    AbstractRD::DeleteAllParameters();
+    this->need_reload_formula = true;
+}
+
+// -------------------------------------------------------------------------
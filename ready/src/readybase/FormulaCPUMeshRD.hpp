@@ -0,0 +1,70 @@
+/*  Copyright 2011-2024 The Ready Bunch
+
+    This file is part of Ready.
+
+    Ready is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ready is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ready. If not, see <http://www.gnu.org/licenses/>.         */
+
+#ifndef __FORMULACPUMESHRD__
+#define __FORMULACPUMESHRD__
+
+// local:
+#include "MeshRD.hpp"
+#include "FormulaInterpreter.hpp"
+
+// VTK:
+class vtkDataArray;
+
+/// A mesh RD system that runs a formula rule on the CPU, for when OpenCL is not available.
+/** Accepts the same formulas as FormulaOpenCLMeshRD, as far as FormulaInterpreter supports them. */
+class FormulaCPUMeshRD : public MeshRD
+{
+    public:
+
+        FormulaCPUMeshRD(int data_type);
+
+        void InitializeFromXML(vtkXMLDataElement* rd,bool& warn_to_update) override;
+        vtkSmartPointer<vtkXMLDataElement> GetAsXML(bool generate_initial_pattern_when_loading) const override;
+
+        std::string GetRuleType() const override { return "formula"; }
+
+        void TestFormula(std::string formula) override;
+
+        void SetNumberOfChemicals(int n, bool reallocate_storage = false) override;
+
+        // changing the parameter names or the number of them changes the variable layout, so we need to recompile
+        void AddParameter(const std::string& name,float val) override;
+        void DeleteParameter(int iParam) override;
+        void DeleteAllParameters() override;
+        void SetParameterName(int iParam,const std::string& s) override;
+
+        bool HasEditableDataType() const override { return true; }
+
+    protected:
+
+        void InternalUpdate(int n_steps) override;
+
+        /// Compiles the formula into the given interpreter, throws std::runtime_error on error.
+        void CompileFormula(const std::string& formula, FormulaInterpreter& target, std::vector<bool>& laplacians_needed) const;
+
+        /// Advances the cells by n_steps, ping-ponging between data[0] (the mesh) and data[1] (the buffers). T matches the data type.
+        template <typename T> void UpdateCells(int n_steps, const std::vector<T*> data[2]);
+
+    protected:
+
+        FormulaInterpreter interpreter;
+        std::vector<bool> laplacians_needed;                    ///< laplacians_needed[iChem] is true if the formula uses laplacian_X
+        std::vector<vtkSmartPointer<vtkDataArray>> buffers;     ///< temporary storage used during computation, swapped with the mesh arrays
+};
+
+#endif
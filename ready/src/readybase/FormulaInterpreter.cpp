@@ -0,0 +1,726 @@
+/*  Copyright 2011-2024 The Ready Bunch
+
+    This file is part of Ready.
+
+    Ready is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ready is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ready. If not, see <http://www.gnu.org/licenses/>.         */
+
+// local:
+#include "FormulaInterpreter.hpp"
+
+// STL:
+#include <cctype>
+#include <cmath>
+#include <locale>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+
+using namespace std;
+
+// ---------------------------------------------------------------------
+
+namespace
+{
+    typedef double (*Function1)(double);
+    typedef double (*Function2)(double,double);
+    typedef double (*Function3)(double,double,double);
+
+    struct NamedFunction1 { const char* name; Function1 f; };
+    struct NamedFunction2 { const char* name; Function2 f; };
+    struct NamedFunction3 { const char* name; Function3 f; };
+
+    // the OpenCL built-in math functions that make sense for scalars
+    const NamedFunction1 functions1[] = {
+        { "sin", [](double x) { return sin(x); } },
+        { "cos", [](double x) { return cos(x); } },
+        { "tan", [](double x) { return tan(x); } },
+        { "asin", [](double x) { return asin(x); } },
+        { "acos", [](double x) { return acos(x); } },
+        { "atan", [](double x) { return atan(x); } },
+        { "sinh", [](double x) { return sinh(x); } },
+        { "cosh", [](double x) { return cosh(x); } },
+        { "tanh", [](double x) { return tanh(x); } },
+        { "asinh", [](double x) { return asinh(x); } },
+        { "acosh", [](double x) { return acosh(x); } },
+        { "atanh", [](double x) { return atanh(x); } },
+        { "exp", [](double x) { return exp(x); } },
+        { "exp2", [](double x) { return exp2(x); } },
+        { "exp10", [](double x) { return pow(10.0, x); } },
+        { "expm1", [](double x) { return expm1(x); } },
+        { "log", [](double x) { return log(x); } },
+        { "log2", [](double x) { return log2(x); } },
+        { "log10", [](double x) { return log10(x); } },
+        { "log1p", [](double x) { return log1p(x); } },
+        { "sqrt", [](double x) { return sqrt(x); } },
+        { "rsqrt", [](double x) { return 1.0 / sqrt(x); } },
+        { "cbrt", [](double x) { return cbrt(x); } },
+        { "fabs", [](double x) { return fabs(x); } },
+        { "abs", [](double x) { return fabs(x); } },
+        { "floor", [](double x) { return floor(x); } },
+        { "ceil", [](double x) { return ceil(x); } },
+        { "round", [](double x) { return round(x); } },
+        { "trunc", [](double x) { return trunc(x); } },
+        { "sign", [](double x) { return x > 0.0 ? 1.0 : (x < 0.0 ? -1.0 : 0.0); } },
+    };
+    const NamedFunction2 functions2[] = {
+        { "pow", [](double x, double y) { return pow(x, y); } },
+        { "pown", [](double x, double y) { return pow(x, y); } },
+        { "powr", [](double x, double y) { return pow(x, y); } },
+        { "atan2", [](double y, double x) { return atan2(y, x); } },
+        { "fmin", [](double x, double y) { return fmin(x, y); } },
+        { "fmax", [](double x, double y) { return fmax(x, y); } },
+        { "min", [](double x, double y) { return fmin(x, y); } },
+        { "max", [](double x, double y) { return fmax(x, y); } },
+        { "fmod", [](double x, double y) { return fmod(x, y); } },
+        { "hypot", [](double x, double y) { return hypot(x, y); } },
+        { "copysign", [](double x, double y) { return copysign(x, y); } },
+        { "fdim", [](double x, double y) { return fdim(x, y); } },
+        { "step", [](double edge, double x) { return x < edge ? 0.0 : 1.0; } },
+    };
+    const NamedFunction3 functions3[] = {
+        { "clamp", [](double x, double lo, double hi) { return fmin(fmax(x, lo), hi); } },
+        { "mix", [](double a, double b, double t) { return a + (b - a) * t; } },
+        { "smoothstep", [](double e0, double e1, double x) {
+            const double t = fmin(fmax((x - e0) / (e1 - e0), 0.0), 1.0);
+            return t * t * (3.0 - 2.0 * t); } },
+        { "fma", [](double a, double b, double c) { return a * b + c; } },
+        { "mad", [](double a, double b, double c) { return a * b + c; } },
+    };
+
+    template <typename T, size_t N>
+    int FindFunction(const T (&functions)[N], const string& name)
+    {
+        for (size_t i = 0; i < N; i++)
+            if (name == functions[i].name)
+                return static_cast<int>(i);
+        return -1;
+    }
+
+    bool IsScalarTypeName(const string& s)
+    {
+        return s == "float" || s == "double" || s == "int" || s == "half" || s == "bool" || s == "uint";
+    }
+
+    // what we keep track of for each value, so that we can convert like C does (we hold them all as doubles)
+    enum class ValueType { Float, Int, Bool };
+
+    ValueType GetValueType(const string& type_name)
+    {
+        if (type_name == "int") return ValueType::Int;
+        if (type_name == "bool") return ValueType::Bool;
+        if (type_name == "uint")
+            throw runtime_error("unsigned types are not supported");
+        return ValueType::Float;
+    }
+
+    ValueType GetArithmeticType(ValueType a, ValueType b)
+    {
+        // (bool is promoted to int)
+        return (a == ValueType::Float || b == ValueType::Float) ? ValueType::Float : ValueType::Int;
+    }
+
+    bool IsVectorTypeName(const string& s)
+    {
+        for (const char* base : { "float", "double", "int", "half", "uint" })
+        {
+            const string b(base);
+            if (s.size() > b.size() && s.compare(0, b.size(), b) == 0 && isdigit(static_cast<unsigned char>(s[b.size()])))
+                return true;
+        }
+        return false;
+    }
+
+    // -----------------------------------------------------------------
+
+    struct Token
+    {
+        enum class Type { Number, Identifier, Symbol, End };
+        Type type;
+        string text;
+        double value;
+        int line;
+        bool is_integer; ///< for numbers: no '.', exponent or suffix
+    };
+
+    vector<Token> Tokenize(const string& s)
+    {
+        vector<Token> tokens;
+        int line = 1;
+        size_t i = 0;
+        while (i < s.size())
+        {
+            const char c = s[i];
+            if (c == '\n') { line++; i++; continue; }
+            if (isspace(static_cast<unsigned char>(c))) { i++; continue; }
+            if (s.compare(i, 2, "//") == 0)
+            {
+                while (i < s.size() && s[i] != '\n') i++;
+                continue;
+            }
+            if (s.compare(i, 2, "/*") == 0)
+            {
+                const size_t end = s.find("*/", i + 2);
+                if (end == string::npos)
+                    throw runtime_error("Line " + to_string(line) + ": unterminated comment");
+                for (size_t j = i; j < end; j++)
+                    if (s[j] == '\n') line++;
+                i = end + 2;
+                continue;
+            }
+            if (c == '#')
+                throw runtime_error("Line " + to_string(line) + ": preprocessor directives are not supported");
+            if (isdigit(static_cast<unsigned char>(c)) || (c == '.' && i + 1 < s.size() && isdigit(static_cast<unsigned char>(s[i + 1]))))
+            {
+                // find the extent of the literal ourselves and then convert it in the classic locale, since strtod
+                // follows the user's locale and would stop at the '.' if that uses a comma as the decimal separator
+                const size_t start = i;
+                while (i < s.size() && (isdigit(static_cast<unsigned char>(s[i])) || s[i] == '.')) i++;
+                if (i < s.size() && (s[i] == 'e' || s[i] == 'E'))
+                {
+                    size_t j = i + 1;
+                    if (j < s.size() && (s[j] == '+' || s[j] == '-')) j++;
+                    if (j < s.size() && isdigit(static_cast<unsigned char>(s[j])))
+                    {
+                        i = j;
+                        while (i < s.size() && isdigit(static_cast<unsigned char>(s[i]))) i++;
+                    }
+                }
+                const string number = s.substr(start, i - start);
+                istringstream iss(number);
+                iss.imbue(locale::classic());
+                double value;
+                if (!(iss >> value) || iss.peek() != char_traits<char>::eof())
+                    throw runtime_error("Line " + to_string(line) + ": invalid number '" + number + "'");
+                const bool is_integer = number.find_first_of(".eE") == string::npos;
+                if (i < s.size() && (s[i] == 'f' || s[i] == 'F')) i++; // single-precision suffix
+                tokens.push_back({ Token::Type::Number, s.substr(start, i - start), value, line, is_integer && i - start == number.size() });
+                continue;
+            }
+            if (isalpha(static_cast<unsigned char>(c)) || c == '_')
+            {
+                const size_t start = i;
+                while (i < s.size() && (isalnum(static_cast<unsigned char>(s[i])) || s[i] == '_')) i++;
+                tokens.push_back({ Token::Type::Identifier, s.substr(start, i - start), 0.0, line, false });
+                continue;
+            }
+            static const char* two_char_symbols[] = { "<=", ">=", "==", "!=", "&&", "||", "+=", "-=", "*=", "/=", "++", "--" };
+            string symbol(1, c);
+            for (const char* sym : two_char_symbols)
+                if (s.compare(i, 2, sym) == 0)
+                    symbol = sym;
+            i += symbol.size();
+            tokens.push_back({ Token::Type::Symbol, symbol, 0.0, line, false });
+        }
+        tokens.push_back({ Token::Type::End, "", 0.0, line, false });
+        return tokens;
+    }
+
+    // -----------------------------------------------------------------
+
+    /// Recursive-descent parser that emits stack-machine instructions as it goes.
+    class Compiler
+    {
+        public:
+
+            typedef FormulaInterpreter::OpCode OpCode;
+
+            Compiler(const string& formula, const vector<string>& variable_names)
+                : n_slots(0), tokens(Tokenize(formula)), pos(0), depth(0), max_depth(0)
+            {
+                this->scopes.emplace_back();
+                for (const string& name : variable_names)
+                {
+                    this->scopes.back()[name] = static_cast<int>(this->n_slots++);
+                    this->slot_types.push_back(ValueType::Float);
+                }
+            }
+
+            void CompileAll()
+            {
+                while (this->Peek().type != Token::Type::End)
+                    this->ParseStatement();
+            }
+
+            vector<FormulaInterpreter::Instruction> program;
+            size_t n_slots;
+
+        private:
+
+            const Token& Peek(int ahead = 0) const { return this->tokens[min(this->pos + ahead, this->tokens.size() - 1)]; }
+            const Token& Next() { const Token& t = this->Peek(); if (this->pos < this->tokens.size() - 1) this->pos++; return t; }
+            bool IsSymbol(const string& s, int ahead = 0) const { const Token& t = this->Peek(ahead); return t.type == Token::Type::Symbol && t.text == s; }
+            bool IsWord(const string& s, int ahead = 0) const { const Token& t = this->Peek(ahead); return t.type == Token::Type::Identifier && t.text == s; }
+
+            [[noreturn]] void Fail(const string& message) const
+            {
+                throw runtime_error("Line " + to_string(this->Peek().line) + ": " + message);
+            }
+
+            void Expect(const string& s)
+            {
+                if (!this->IsSymbol(s))
+                    this->Fail("expected '" + s + "' but found '" + this->Peek().text + "'");
+                this->Next();
+            }
+
+            int Emit(OpCode op, int arg = 0, double value = 0.0)
+            {
+                switch (op)
+                {
+                    case OpCode::Constant: case OpCode::Load: this->depth++; break;
+                    case OpCode::Negate: case OpCode::Not: case OpCode::Truncate: case OpCode::Call1: case OpCode::Jump: break;
+                    case OpCode::Call3: this->depth -= 2; break;
+                    default: this->depth--; break; // binary operators, Call2, Store, JumpIfFalse
+                }
+                if (this->depth > this->max_depth)
+                {
+                    this->max_depth = this->depth;
+                    if (this->max_depth > FormulaInterpreter::MAX_STACK_DEPTH)
+                        this->Fail("expression is too deeply nested");
+                }
+                this->program.push_back({ op, arg, value });
+                return static_cast<int>(this->program.size()) - 1;
+            }
+
+            void PatchJumpToHere(int iInstruction) { this->program[iInstruction].arg = static_cast<int>(this->program.size()); }
+
+            /// Emits the conversion of the value on top of the stack, as C would do it.
+            void EmitConversion(ValueType from, ValueType to)
+            {
+                if (to == ValueType::Int && from == ValueType::Float)
+                    this->Emit(OpCode::Truncate);
+                else if (to == ValueType::Bool && from != ValueType::Bool)
+                {
+                    this->Emit(OpCode::Not);
+                    this->Emit(OpCode::Not);
+                }
+            }
+
+            void EmitStore(ValueType from, int slot)
+            {
+                this->EmitConversion(from, this->slot_types[slot]);
+                this->Emit(OpCode::Store, slot);
+            }
+
+            int LookupVariable(const string& name) const
+            {
+                for (auto scope = this->scopes.rbegin(); scope != this->scopes.rend(); scope++)
+                {
+                    auto found = scope->find(name);
+                    if (found != scope->end())
+                        return found->second;
+                }
+                this->Fail("unknown identifier '" + name + "'");
+            }
+
+            // ---------------------------------------------------------
+
+            void ParseStatement()
+            {
+                if (this->IsSymbol(";")) { this->Next(); return; }
+                if (this->IsSymbol("{"))
+                {
+                    this->Next();
+                    this->scopes.emplace_back();
+                    while (!this->IsSymbol("}"))
+                    {
+                        if (this->Peek().type == Token::Type::End)
+                            this->Fail("missing '}'");
+                        this->ParseStatement();
+                    }
+                    this->Next();
+                    this->scopes.pop_back();
+                    return;
+                }
+                if (this->Peek().type != Token::Type::Identifier)
+                    this->Fail("unexpected '" + this->Peek().text + "'");
+                const string word = this->Peek().text;
+                if (word == "if")
+                {
+                    this->Next();
+                    this->Expect("(");
+                    this->ParseExpression();
+                    this->Expect(")");
+                    const int jump_to_else = this->Emit(OpCode::JumpIfFalse);
+                    this->ParseStatement();
+                    if (this->IsWord("else"))
+                    {
+                        this->Next();
+                        const int jump_to_end = this->Emit(OpCode::Jump);
+                        this->PatchJumpToHere(jump_to_else);
+                        this->ParseStatement();
+                        this->PatchJumpToHere(jump_to_end);
+                    }
+                    else
+                        this->PatchJumpToHere(jump_to_else);
+                    return;
+                }
+                if (word == "for" || word == "while" || word == "do" || word == "switch" || word == "return" || word == "break" || word == "goto")
+                    this->Fail("'" + word + "' is not supported");
+                if (word == "const" || IsScalarTypeName(word))
+                {
+                    this->ParseDeclaration();
+                    return;
+                }
+                if (IsVectorTypeName(word))
+                    this->Fail("vector types are not supported");
+                this->ParseAssignment();
+            }
+
+            void ParseDeclaration()
+            {
+                if (this->IsWord("const"))
+                    this->Next();
+                if (this->Peek().type != Token::Type::Identifier || !IsScalarTypeName(this->Peek().text))
+                    this->Fail("expected a type name");
+                const ValueType type = this->ParseTypeName();
+                while (true)
+                {
+                    const Token& name = this->Next();
+                    if (name.type != Token::Type::Identifier || IsScalarTypeName(name.text))
+                        this->Fail("expected a variable name");
+                    if (this->scopes.back().count(name.text))
+                        this->Fail("redefinition of '" + name.text + "'");
+                    ValueType value_type = type;
+                    if (this->IsSymbol("="))
+                    {
+                        this->Next();
+                        value_type = this->ParseExpression();
+                    }
+                    else
+                        this->Emit(OpCode::Constant, 0, 0.0);
+                    const int slot = static_cast<int>(this->n_slots++);
+                    this->slot_types.push_back(type);
+                    this->scopes.back()[name.text] = slot;
+                    this->EmitStore(value_type, slot);
+                    if (this->IsSymbol(","))
+                    {
+                        this->Next();
+                        continue;
+                    }
+                    this->Expect(";");
+                    return;
+                }
+            }
+
+            void ParseAssignment()
+            {
+                const int slot = this->LookupVariable(this->Next().text);
+                const string op = this->Next().text;
+                ValueType type = this->slot_types[slot];
+                if (op == "++" || op == "--")
+                {
+                    this->Emit(OpCode::Load, slot);
+                    this->Emit(OpCode::Constant, 0, 1.0);
+                    this->Emit(op == "++" ? OpCode::Add : OpCode::Subtract);
+                    type = GetArithmeticType(type, ValueType::Int);
+                }
+                else
+                {
+                    static const map<string, OpCode> compound = { { "+=", OpCode::Add }, { "-=", OpCode::Subtract },
+                                                                  { "*=", OpCode::Multiply }, { "/=", OpCode::Divide } };
+                    const bool is_compound = compound.count(op) > 0;
+                    if (op != "=" && !is_compound)
+                        this->Fail("expected an assignment");
+                    if (is_compound)
+                        this->Emit(OpCode::Load, slot);
+                    const ValueType rhs = this->ParseExpression();
+                    type = is_compound ? this->EmitArithmetic(compound.at(op), type, rhs) : rhs;
+                }
+                this->EmitStore(type, slot);
+                this->Expect(";");
+            }
+
+            // ---------------------------------------------------------
+
+            ValueType ParseTypeName()
+            {
+                const Token& t = this->Next();
+                try
+                {
+                    return GetValueType(t.text);
+                }
+                catch (const runtime_error& e)
+                {
+                    this->Fail(e.what());
+                }
+            }
+
+            /// Emits a binary arithmetic operator, returning the type of the result.
+            ValueType EmitArithmetic(OpCode op, ValueType a, ValueType b)
+            {
+                const ValueType type = GetArithmeticType(a, b);
+                this->Emit(op);
+                if (op == OpCode::Divide && type == ValueType::Int)
+                    this->Emit(OpCode::Truncate); // integer division rounds towards zero
+                return type;
+            }
+
+            ValueType ParseExpression()
+            {
+                const ValueType type = this->ParseLogicalOr();
+                if (!this->IsSymbol("?"))
+                    return type;
+                this->Next();
+                const int jump_to_false = this->Emit(OpCode::JumpIfFalse);
+                const ValueType if_true = this->ParseExpression();
+                this->Expect(":");
+                const int jump_to_end = this->Emit(OpCode::Jump);
+                this->depth--; // only one of the two branches will leave its value on the stack
+                this->PatchJumpToHere(jump_to_false);
+                const ValueType if_false = this->ParseExpression();
+                this->PatchJumpToHere(jump_to_end);
+                // (an int in one branch needs no conversion to become a float, since all our values are doubles)
+                return (if_true == ValueType::Bool && if_false == ValueType::Bool) ? ValueType::Bool : GetArithmeticType(if_true, if_false);
+            }
+
+            // (comparisons and logical operators give an int in C)
+
+            ValueType ParseLogicalOr()
+            {
+                ValueType type = this->ParseLogicalAnd();
+                while (this->IsSymbol("||")) { this->Next(); this->ParseLogicalAnd(); this->Emit(OpCode::Or); type = ValueType::Int; }
+                return type;
+            }
+
+            ValueType ParseLogicalAnd()
+            {
+                ValueType type = this->ParseEquality();
+                while (this->IsSymbol("&&")) { this->Next(); this->ParseEquality(); this->Emit(OpCode::And); type = ValueType::Int; }
+                return type;
+            }
+
+            ValueType ParseEquality()
+            {
+                ValueType type = this->ParseRelational();
+                while (this->IsSymbol("==") || this->IsSymbol("!="))
+                {
+                    const bool equal = this->Next().text == "==";
+                    this->ParseRelational();
+                    this->Emit(equal ? OpCode::Equal : OpCode::NotEqual);
+                    type = ValueType::Int;
+                }
+                return type;
+            }
+
+            ValueType ParseRelational()
+            {
+                ValueType type = this->ParseAdditive();
+                while (this->IsSymbol("<") || this->IsSymbol(">") || this->IsSymbol("<=") || this->IsSymbol(">="))
+                {
+                    const string op = this->Next().text;
+                    this->ParseAdditive();
+                    if (op == "<") this->Emit(OpCode::Less);
+                    else if (op == ">") this->Emit(OpCode::Greater);
+                    else if (op == "<=") this->Emit(OpCode::LessOrEqual);
+                    else this->Emit(OpCode::GreaterOrEqual);
+                    type = ValueType::Int;
+                }
+                return type;
+            }
+
+            ValueType ParseAdditive()
+            {
+                ValueType type = this->ParseMultiplicative();
+                while (this->IsSymbol("+") || this->IsSymbol("-"))
+                {
+                    const bool add = this->Next().text == "+";
+                    const ValueType rhs = this->ParseMultiplicative();
+                    type = this->EmitArithmetic(add ? OpCode::Add : OpCode::Subtract, type, rhs);
+                }
+                return type;
+            }
+
+            ValueType ParseMultiplicative()
+            {
+                ValueType type = this->ParseUnary();
+                while (this->IsSymbol("*") || this->IsSymbol("/") || this->IsSymbol("%"))
+                {
+                    const string op = this->Next().text;
+                    const ValueType rhs = this->ParseUnary();
+                    type = this->EmitArithmetic(op == "*" ? OpCode::Multiply : (op == "/" ? OpCode::Divide : OpCode::Modulo), type, rhs);
+                }
+                return type;
+            }
+
+            ValueType ParseUnary()
+            {
+                if (this->IsSymbol("-"))
+                {
+                    this->Next();
+                    const ValueType type = GetArithmeticType(this->ParseUnary(), ValueType::Int);
+                    this->Emit(OpCode::Negate);
+                    return type;
+                }
+                if (this->IsSymbol("+")) { this->Next(); return GetArithmeticType(this->ParseUnary(), ValueType::Int); }
+                if (this->IsSymbol("!")) { this->Next(); this->ParseUnary(); this->Emit(OpCode::Not); return ValueType::Int; }
+                if (this->IsSymbol("(") && this->Peek(1).type == Token::Type::Identifier && IsScalarTypeName(this->Peek(1).text) && this->IsSymbol(")", 2))
+                {
+                    // a cast
+                    this->Next();
+                    const ValueType type = this->ParseTypeName();
+                    this->Next();
+                    this->EmitConversion(this->ParseUnary(), type);
+                    return type;
+                }
+                return this->ParsePrimary();
+            }
+
+            ValueType ParsePrimary()
+            {
+                const Token& t = this->Next();
+                if (t.type == Token::Type::Number)
+                {
+                    this->Emit(OpCode::Constant, 0, t.value);
+                    return t.is_integer ? ValueType::Int : ValueType::Float;
+                }
+                if (t.type == Token::Type::Symbol && t.text == "(")
+                {
+                    const ValueType type = this->ParseExpression();
+                    this->Expect(")");
+                    return type;
+                }
+                if (t.type != Token::Type::Identifier)
+                    this->Fail("unexpected '" + t.text + "'");
+                if (this->IsSymbol("("))
+                    return this->ParseFunctionCall(t.text);
+                static const map<string, double> constants = { { "M_PI", acos(-1.0) }, { "M_PI_F", acos(-1.0) }, { "M_E", exp(1.0) }, { "M_E_F", exp(1.0) } };
+                auto constant = constants.find(t.text);
+                if (constant != constants.end())
+                {
+                    this->Emit(OpCode::Constant, 0, constant->second);
+                    return ValueType::Float;
+                }
+                if (t.text == "true" || t.text == "false")
+                {
+                    this->Emit(OpCode::Constant, 0, t.text == "true" ? 1.0 : 0.0);
+                    return ValueType::Bool;
+                }
+                const int slot = this->LookupVariable(t.text);
+                this->Emit(OpCode::Load, slot);
+                return this->slot_types[slot];
+            }
+
+            ValueType ParseFunctionCall(string name)
+            {
+                this->Expect("(");
+                int n_args = 0;
+                bool all_int = true;
+                if (!this->IsSymbol(")"))
+                {
+                    while (true)
+                    {
+                        if (this->ParseExpression() == ValueType::Float)
+                            all_int = false;
+                        n_args++;
+                        if (!this->IsSymbol(","))
+                            break;
+                        this->Next();
+                    }
+                }
+                this->Expect(")");
+                // the fast and reduced-precision variants are the same thing here
+                for (const string prefix : { "native_", "half_" })
+                    if (name.compare(0, prefix.size(), prefix) == 0)
+                        name = name.substr(prefix.size());
+                int iFunction = -1;
+                if (n_args == 1 && (iFunction = FindFunction(functions1, name)) >= 0)
+                    this->Emit(OpCode::Call1, iFunction);
+                else if (n_args == 2 && (iFunction = FindFunction(functions2, name)) >= 0)
+                    this->Emit(OpCode::Call2, iFunction);
+                else if (n_args == 3 && (iFunction = FindFunction(functions3, name)) >= 0)
+                    this->Emit(OpCode::Call3, iFunction);
+                else
+                    this->Fail("unsupported function: " + name + " with " + to_string(n_args) + " argument(s)");
+                // (the integer functions give an int back; on integral values ours do the same thing as them)
+                const bool is_integer_function = name == "abs" || name == "min" || name == "max" || name == "clamp";
+                return (is_integer_function && all_int) ? ValueType::Int : ValueType::Float;
+            }
+
+        private:
+
+            vector<Token> tokens;
+            size_t pos;
+            vector<map<string, int>> scopes;
+            vector<ValueType> slot_types;
+            int depth, max_depth;
+    };
+}
+
+// ---------------------------------------------------------------------
+
+FormulaInterpreter::FormulaInterpreter()
+    : n_slots(0)
+{
+}
+
+// ---------------------------------------------------------------------
+
+void FormulaInterpreter::Compile(const string& formula, const vector<string>& variable_names)
+{
+    try
+    {
+        Compiler compiler(formula, variable_names); // (tokenizes, so can throw too)
+        compiler.CompileAll();
+        this->program.swap(compiler.program);
+        this->n_slots = compiler.n_slots;
+    }
+    catch (const runtime_error& e)
+    {
+        throw runtime_error(string("FormulaInterpreter::Compile : ") + e.what());
+    }
+}
+
+// ---------------------------------------------------------------------
+
+void FormulaInterpreter::Run(double* slots) const
+{
+    double stack[MAX_STACK_DEPTH];
+    int sp = 0;
+    const Instruction* code = this->program.data();
+    const size_t n_instructions = this->program.size();
+    for (size_t pc = 0; pc < n_instructions; )
+    {
+        const Instruction& in = code[pc++];
+        switch (in.op)
+        {
+            case OpCode::Constant:       stack[sp++] = in.value; break;
+            case OpCode::Load:           stack[sp++] = slots[in.arg]; break;
+            case OpCode::Store:          slots[in.arg] = stack[--sp]; break;
+            case OpCode::Add:            sp--; stack[sp - 1] += stack[sp]; break;
+            case OpCode::Subtract:       sp--; stack[sp - 1] -= stack[sp]; break;
+            case OpCode::Multiply:       sp--; stack[sp - 1] *= stack[sp]; break;
+            case OpCode::Divide:         sp--; stack[sp - 1] /= stack[sp]; break;
+            case OpCode::Modulo:         sp--; stack[sp - 1] = fmod(stack[sp - 1], stack[sp]); break;
+            case OpCode::Negate:         stack[sp - 1] = -stack[sp - 1]; break;
+            case OpCode::Truncate:       stack[sp - 1] = trunc(stack[sp - 1]); break;
+            case OpCode::Not:            stack[sp - 1] = stack[sp - 1] == 0.0 ? 1.0 : 0.0; break;
+            case OpCode::Less:           sp--; stack[sp - 1] = stack[sp - 1] < stack[sp] ? 1.0 : 0.0; break;
+            case OpCode::Greater:        sp--; stack[sp - 1] = stack[sp - 1] > stack[sp] ? 1.0 : 0.0; break;
+            case OpCode::LessOrEqual:    sp--; stack[sp - 1] = stack[sp - 1] <= stack[sp] ? 1.0 : 0.0; break;
+            case OpCode::GreaterOrEqual: sp--; stack[sp - 1] = stack[sp - 1] >= stack[sp] ? 1.0 : 0.0; break;
+            case OpCode::Equal:          sp--; stack[sp - 1] = stack[sp - 1] == stack[sp] ? 1.0 : 0.0; break;
+            case OpCode::NotEqual:       sp--; stack[sp - 1] = stack[sp - 1] != stack[sp] ? 1.0 : 0.0; break;
+            case OpCode::And:            sp--; stack[sp - 1] = (stack[sp - 1] != 0.0 && stack[sp] != 0.0) ? 1.0 : 0.0; break;
+            case OpCode::Or:             sp--; stack[sp - 1] = (stack[sp - 1] != 0.0 || stack[sp] != 0.0) ? 1.0 : 0.0; break;
+            case OpCode::Call1:          stack[sp - 1] = functions1[in.arg].f(stack[sp - 1]); break;
+            case OpCode::Call2:          sp--; stack[sp - 1] = functions2[in.arg].f(stack[sp - 1], stack[sp]); break;
+            case OpCode::Call3:          sp -= 2; stack[sp - 1] = functions3[in.arg].f(stack[sp - 1], stack[sp], stack[sp + 1]); break;
+            case OpCode::Jump:           pc = in.arg; break;
+            case OpCode::JumpIfFalse:    if (stack[--sp] == 0.0) pc = in.arg; break;
+        }
+    }
+}
+
+// ---------------------------------------------------------------------
@@ -0,0 +1,72 @@
+/*  Copyright 2011-2024 The Ready Bunch
+
+    This file is part of Ready.
+
+    Ready is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ready is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ready. If not, see <http://www.gnu.org/licenses/>.         */
+
+#ifndef __FORMULAINTERPRETER__
+#define __FORMULAINTERPRETER__
+
+// STL:
+#include <string>
+#include <vector>
+
+/// Runs formula snippets (the scalar subset of OpenCL C that our formula rules use) on the CPU.
+/** The formula is compiled once into a small stack-machine program that works on an array of variable slots.
+    The first slots are the named variables passed to Compile() (e.g. chemicals, laplacians, deltas, parameters),
+    the rest hold any local variables that the formula declares.
+
+    Supported: assignments (=, +=, -=, *=, /=), local declarations (float, double, int, bool, with optional const),
+    if/else, blocks, the usual arithmetic, comparison and logical operators, the ternary operator, casts
+    to scalar types, numeric literals (with optional f suffix) and the common OpenCL math functions.
+    All values are held as doubles, but we keep track of which are ints so that they convert as in C: storing
+    to an int or casting to one truncates, and / between ints is integer division. Unsigned types are not
+    supported. */
+class FormulaInterpreter
+{
+    public:
+
+        FormulaInterpreter();
+
+        /// Compiles the formula. Throws std::runtime_error with a description if the formula is not supported.
+        void Compile(const std::string& formula, const std::vector<std::string>& variable_names);
+
+        /// How many slots Run() needs: the named variables first, then the locals.
+        size_t GetNumberOfSlots() const { return this->n_slots; }
+
+        /// Executes the compiled program, reading and writing the values in slots.
+        void Run(double* slots) const;
+
+    public:
+
+        enum class OpCode { Constant, Load, Store, Add, Subtract, Multiply, Divide, Modulo, Negate, Not, Truncate,
+                            Less, Greater, LessOrEqual, GreaterOrEqual, Equal, NotEqual, And, Or,
+                            Call1, Call2, Call3, Jump, JumpIfFalse };
+
+        struct Instruction
+        {
+            OpCode op;
+            int arg;        ///< slot index, function index or jump target
+            double value;   ///< for constants
+        };
+
+        static const int MAX_STACK_DEPTH = 64;
+
+    private:
+
+        std::vector<Instruction> program;
+        size_t n_slots;
+};
+
+#endif
@@ -17,17 +17,23 @@
 
 // local:
 #include "FormulaOpenCLImageRD.hpp"
+#include "OpenCL_utils.hpp"
 #include "stencils.hpp"
 #include "utils.hpp"
+using namespace OpenCL_utils;
 
 // STL:
 #include <algorithm>
 #include <cmath>
+#include <limits>
 #include <set>
 #include <sstream>
 #include <string>
+#include <utility>
+#include <vector>
 
 // VTK:
+#include <vtkMath.h>
 #include <vtkXMLUtilities.h>
 
 using namespace std;
@@ -36,7 +42,21 @@ using namespace std;
 
 FormulaOpenCLImageRD::FormulaOpenCLImageRD(int opencl_platform,int opencl_device,int data_type)
     : OpenCLImageRD(opencl_platform,opencl_device,data_type)
+    , quiescent_steps(0)
+    , activity_threshold(1e-6f)
+    , use_ghost_cells(false)
+    , use_image_objects(false)
+    , stage_stencils(false)
+    , storage(Storage::Same)
     , block_size{4, 1, 1}
+    , auto_tune(false)
+    , is_tuned(false)
+    , activity_program(NULL)
+    , activity_kernel(NULL)
+    , tile_active_buffer(NULL)
+    , tile_quiet_buffer(NULL)
+    , tile_changed_buffers{ NULL, NULL }
+    , iChangedBuffer(0)
 {
     // these settings are used in File > New Pattern
     this->SetRuleName("Gray-Scott");
@@ -52,9 +72,20 @@ delta_b = D_b * laplacian_b + a*b*b - (F+K)*b;");
 
 // -------------------------------------------------------------------------
 
+FormulaOpenCLImageRD::~FormulaOpenCLImageRD()
+{
+    clFinish(this->command_queue);
+    this->ReleaseActivityMask();
+    this->ReleaseStages();
+}
+
+// -------------------------------------------------------------------------
+
 struct InputsNeeded {
-    vector<string> chemicals_needed;
+    vector<string> chemicals_needed;  ///< every chemical, since the kernel takes the buffers of each
+    vector<string> chemicals_written; ///< those that the formula changes, the others being constant
     vector<AppliedStencil> stencils_needed;
+    vector<SharedSum> shared_sums; ///< sums of neighbors that several of the stencils need
     set<InputPoint> cells_needed;
     map<string, int> gradient_mag_squared;
     bool using_x_pos;
@@ -62,44 +93,24 @@ struct InputsNeeded {
     bool using_z_pos;
     vector<string> deltas_needed;
     vector<string> local_memory_needed;
+    vector<pair<string, string>> parameter_maps_needed; ///< the name of each parameter map used, and its chemical
+    vector<string> staged_inputs;   ///< read-only buffers that earlier passes fill, taken after the chemicals
     int stencil_radii[3];
 };
 
 // -------------------------------------------------------------------------
 
 InputsNeeded DetectInputsNeeded(const string& formula, int num_chemicals, int dimensionality, const int block_size[3],
-                                const AbstractRD::Accuracy& accuracy)
+                                const AbstractRD::Accuracy& accuracy, const map<int, string>& parameter_maps,
+                                const vector<string>& staged_inputs)
 {
     InputsNeeded inputs_needed;
 
     const vector<string> formula_tokens = tokenize_for_keywords(formula);
     const vector<Stencil> known_stencils = GetKnownStencils(dimensionality, accuracy);
-    for (int i = 0; i < num_chemicals; i++)
+    // finds the stencils and neighbors of an input that the formula uses
+    const auto detect_reads = [&](const string& chem, const set<string>& dependent_stencils)
     {
-        const string chem = GetChemicalName(i);
-        inputs_needed.chemicals_needed.push_back(chem);
-        // assume we will need the central cell
-        inputs_needed.cells_needed.insert({ { { 0, 0, 0 } }, chem });
-        // assume we need delta_<chem> for the forward Euler step
-        inputs_needed.deltas_needed.push_back(chem);
-        // assume we need local memory for every chemical
-        inputs_needed.local_memory_needed.push_back(chem);
-        // search for keywords that make use of stencils
-        set<string> dependent_stencils;
-        if (UsingKeyword(formula_tokens, "gradient_mag_squared_" + chem))
-        {
-            inputs_needed.gradient_mag_squared[chem] = dimensionality;
-            switch (dimensionality)
-            {
-            default:
-            case 3:
-                dependent_stencils.insert("z_gradient_" + chem);
-            case 2:
-                dependent_stencils.insert("y_gradient_" + chem);
-            case 1:
-                dependent_stencils.insert("x_gradient_" + chem); // (N.B. no breaks)
-            }
-        }
         // search for keywords that are stencils
         for (const Stencil& stencil : known_stencils)
         {
@@ -129,35 +140,116 @@ InputsNeeded DetectInputsNeeded(const string& formula, int num_chemicals, int di
                 }
             }
         }
+    };
+    for (int i = 0; i < num_chemicals; i++)
+    {
+        const string chem = GetChemicalName(i);
+        inputs_needed.chemicals_needed.push_back(chem);
+        // the chemical changes if the formula sets delta_<chem> for the forward Euler step, or assigns to it directly
+        const bool using_delta = UsingKeyword(formula_tokens, "delta_" + chem);
+        if (using_delta)
+        {
+            inputs_needed.deltas_needed.push_back(chem);
+        }
+        const bool is_written = using_delta || AssigningToKeyword(formula, chem);
+        if (is_written)
+        {
+            inputs_needed.chemicals_written.push_back(chem);
+        }
+        // we need the central cell if the formula uses it, or to update it (stencils add it themselves if needed)
+        if (using_delta || UsingKeyword(formula_tokens, chem))
+        {
+            inputs_needed.cells_needed.insert({ { { 0, 0, 0 } }, chem });
+        }
+        // parameter maps are read-only, and are also used by name
+        const auto parameter_map = parameter_maps.find(i);
+        if (parameter_map != parameter_maps.end())
+        {
+            if (is_written)
+            {
+                throw runtime_error("the formula changes chemical " + chem + ", but it is the parameter map "
+                    + parameter_map->second + ", which is read-only");
+            }
+            if (UsingKeyword(formula_tokens, parameter_map->second))
+            {
+                inputs_needed.cells_needed.insert({ { { 0, 0, 0 } }, chem });
+                inputs_needed.parameter_maps_needed.push_back({ parameter_map->second, chem });
+            }
+        }
+        // search for keywords that make use of stencils
+        set<string> dependent_stencils;
+        if (UsingKeyword(formula_tokens, "gradient_mag_squared_" + chem))
+        {
+            inputs_needed.gradient_mag_squared[chem] = dimensionality;
+            switch (dimensionality)
+            {
+            default:
+            case 3:
+                dependent_stencils.insert("z_gradient_" + chem);
+            case 2:
+                dependent_stencils.insert("y_gradient_" + chem);
+            case 1:
+                dependent_stencils.insert("x_gradient_" + chem); // (N.B. no breaks)
+            }
+        }
+        detect_reads(chem, dependent_stencils);
     }
-    if (block_size[0] == 4)
+    // the staged inputs are read like chemicals that the formula never changes
+    for (const string& staged_input : staged_inputs)
+    {
+        inputs_needed.staged_inputs.push_back(staged_input);
+        if (UsingKeyword(formula_tokens, staged_input))
+        {
+            inputs_needed.cells_needed.insert({ { { 0, 0, 0 } }, staged_input });
+        }
+        detect_reads(staged_input, {});
+    }
+    if (block_size[0] > 1)
     {
         // non-block-aligned inputs need other inputs: the two blocks that supply them
         vector<InputPoint> blocks_needed;
         for (const InputPoint& input_point : inputs_needed.cells_needed)
         {
-            if (input_point.point.x % 4 != 0)
+            if (input_point.point.x % block_size[0] != 0)
             {
-                const pair<InputPoint, InputPoint> blocks = input_point.GetAlignedBlocks_Block411();
+                const pair<InputPoint, InputPoint> blocks = input_point.GetAlignedBlocks(block_size[0]);
                 blocks_needed.push_back(blocks.first);
                 blocks_needed.push_back(blocks.second);
             }
         }
         inputs_needed.cells_needed.insert(blocks_needed.begin(), blocks_needed.end());
     }
+    // only the inputs whose neighbors we read need to be copied into local memory (the central cells are read directly)
+    vector<string> all_inputs = inputs_needed.chemicals_needed;
+    all_inputs.insert(all_inputs.end(), inputs_needed.staged_inputs.begin(), inputs_needed.staged_inputs.end());
+    for (const string& chem : all_inputs)
+    {
+        const bool reading_neighbors = any_of(inputs_needed.cells_needed.begin(), inputs_needed.cells_needed.end(),
+            [&](const InputPoint& input_point) {
+                return input_point.chem == chem && input_point.point.x % block_size[0] == 0
+                    && !(input_point.point.x == 0 && input_point.point.y == 0 && input_point.point.z == 0);
+            });
+        if (reading_neighbors)
+        {
+            inputs_needed.local_memory_needed.push_back(chem);
+        }
+    }
+    // find the sums that the stencils have in common, e.g. the 4 diagonal neighbors used by laplacian_a and bilaplacian_a
+    inputs_needed.shared_sums = FindSharedSums(inputs_needed.stencils_needed);
     // detect if using x_pos, y_pos or z_pos
     inputs_needed.using_x_pos = UsingKeyword(formula_tokens, "x_pos");
     inputs_needed.using_y_pos = UsingKeyword(formula_tokens, "y_pos");
     inputs_needed.using_z_pos = UsingKeyword(formula_tokens, "z_pos");
-    // compute the overall stencil radius in each direction
+    // compute the overall stencil radius in each direction (in blocks along x, and in cells along y and z, since
+    // blocking along those only changes how many cells each work-item updates)
     inputs_needed.stencil_radii[0] = 0;
     inputs_needed.stencil_radii[1] = 0;
     inputs_needed.stencil_radii[2] = 0;
     for (const InputPoint& input_point : inputs_needed.cells_needed)
     {
         inputs_needed.stencil_radii[0] = max(inputs_needed.stencil_radii[0], abs(input_point.point.x) / block_size[0]);
-        inputs_needed.stencil_radii[1] = max(inputs_needed.stencil_radii[1], abs(input_point.point.y) / block_size[1]);
-        inputs_needed.stencil_radii[2] = max(inputs_needed.stencil_radii[2], abs(input_point.point.z) / block_size[2]);
+        inputs_needed.stencil_radii[1] = max(inputs_needed.stencil_radii[1], abs(input_point.point.y));
+        inputs_needed.stencil_radii[2] = max(inputs_needed.stencil_radii[2], abs(input_point.point.z));
     }
 
     return inputs_needed;
@@ -165,11 +257,95 @@ InputsNeeded DetectInputsNeeded(const string& formula, int num_chemicals, int di
 
 // -------------------------------------------------------------------------
 
+/// How the high-order stencils of a formula are split into passes that each apply the laplacian, filling a buffer
+/// for each chemical that the next pass (or the main kernel) reads.
+struct StencilStages {
+    string formula;                         ///< with e.g. bilaplacian_a replaced by laplacian_lap1_a
+    vector<string> staged_inputs;           ///< the buffers that the passes fill, e.g. lap1_a, in pass order
+    vector<pair<int, int>> staged_buffers;  ///< the pass (from 1) and the chemical of each staged input
+    int num_passes;
+};
+
+// -------------------------------------------------------------------------
+
+/// Returns the name of the staged input that holds the laplacian of chem, applied num_laplacians times.
+string GetStagedInputName(int num_laplacians, const string& chem)
+{
+    return "lap" + to_string(num_laplacians) + "_" + chem;
+}
+
+// -------------------------------------------------------------------------
+
+StencilStages PlanStencilStages(const string& formula, int num_chemicals)
+{
+    // bilaplacian_a is the laplacian of laplacian_a, and trilaplacian_a the laplacian of that, so the passes compute
+    // the inner laplacians and the main kernel applies the last one, along with the reaction terms
+    const pair<string, int> high_order_stencils[2] = { { "bilaplacian", 1 }, { "trilaplacian", 2 } };
+    const vector<string> formula_tokens = tokenize_for_keywords(formula);
+    StencilStages stages{ formula, {}, {}, 0 };
+    vector<int> passes_needed(num_chemicals, 0);
+    for (int ic = 0; ic < num_chemicals; ic++)
+    {
+        const string chem = GetChemicalName(ic);
+        for (const pair<string, int>& stencil : high_order_stencils)
+        {
+            if (UsingKeyword(formula_tokens, stencil.first + "_" + chem))
+            {
+                stages.formula = ReplaceKeyword(stages.formula, stencil.first + "_" + chem,
+                    "laplacian_" + GetStagedInputName(stencil.second, chem));
+                passes_needed[ic] = max(passes_needed[ic], stencil.second);
+            }
+        }
+        if (passes_needed[ic] > 0)
+        {
+            // (the first pass has already computed the laplacian, so we read it rather than compute it again)
+            stages.formula = ReplaceKeyword(stages.formula, "laplacian_" + chem, GetStagedInputName(1, chem));
+        }
+    }
+    for (int ic = 0; ic < num_chemicals; ic++)
+    {
+        stages.num_passes = max(stages.num_passes, passes_needed[ic]);
+    }
+    for (int pass = 1; pass <= stages.num_passes; pass++)
+    {
+        for (int ic = 0; ic < num_chemicals; ic++)
+        {
+            if (passes_needed[ic] >= pass)
+            {
+                stages.staged_inputs.push_back(GetStagedInputName(pass, GetChemicalName(ic)));
+                stages.staged_buffers.push_back({ pass, ic });
+            }
+        }
+    }
+    return stages;
+}
+
+// -------------------------------------------------------------------------
+
+/// Returns the formula for one of the passes: the laplacian of each of its chemicals, whose buffers hold the values
+/// from the pass before.
+string GetStageFormula(const StencilStages& stages, int pass)
+{
+    ostringstream formula;
+    for (const pair<int, int>& staged_buffer : stages.staged_buffers)
+    {
+        if (staged_buffer.first == pass)
+        {
+            const string chem = GetChemicalName(staged_buffer.second);
+            formula << chem << " = laplacian_" << chem << ";\n";
+        }
+    }
+    return formula.str();
+}
+
+// -------------------------------------------------------------------------
+
 struct KernelOptions {
-    KernelOptions(bool wrap, const string& indent, int data_type, const string& data_type_string,
+    KernelOptions(bool wrap, bool use_ghost_cells, const string& indent, int data_type, const string& data_type_string,
                   const string& data_type_suffix, const int block_size[3],
                   bool use_local_memory, const size_t local_work_size[3])
         : wrap(wrap)
+        , use_ghost_cells(use_ghost_cells)
         , indent(indent)
         , data_type(data_type)
         , data_type_string(data_type_string)
@@ -177,8 +353,124 @@ struct KernelOptions {
         , block_size{ block_size[0], block_size[1], block_size[2] }
         , use_local_memory(use_local_memory)
         , local_work_size{ local_work_size[0], local_work_size[1], local_work_size[2] }
+        , activity_threshold(0.0)
+        , storage(OpenCLImageRD::Storage::Same)
+        , write_constant_chemicals(true)
+        , image_dimensionality(0)
     {}
+    /// Returns the index of the cell being updated in the chemical buffers, which differs when they have ghost cells.
+    string GetCellIndex() const { return this->use_ghost_cells ? "index_cell" : "index_here"; }
+    /// Returns the type that the chemical buffers are declared as, which differs when they store another type.
+    string GetStoredTypeString() const
+    {
+        switch (this->storage)
+        {
+            case OpenCLImageRD::Storage::Half: return "half"; // (only read and written with vload_half and vstore_half)
+            case OpenCLImageRD::Storage::Float: return "float" + this->GetVectorSize();
+            default:
+            case OpenCLImageRD::Storage::Same: return this->data_type_string;
+        }
+    }
+    /// Returns the code that reads the block at index from a chemical buffer, as the data type.
+    string GetLoadCode(const string& buffer, const string& index) const
+    {
+        switch (this->storage)
+        {
+            case OpenCLImageRD::Storage::Half:
+            {
+                const string load = "vload_half" + this->GetVectorSize() + "(" + index + ", " + buffer + ")";
+                return this->data_type == VTK_DOUBLE ? "convert_" + this->data_type_string + "(" + load + ")" : load;
+            }
+            case OpenCLImageRD::Storage::Float: return "convert_" + this->data_type_string + "(" + buffer + "[" + index + "])";
+            default:
+            case OpenCLImageRD::Storage::Same: return buffer + "[" + index + "]";
+        }
+    }
+    /// Returns the statement that writes value to the block at index in a chemical buffer, as the stored type.
+    string GetStoreCode(const string& buffer, const string& index, const string& value) const
+    {
+        switch (this->storage)
+        {
+            case OpenCLImageRD::Storage::Half: return "vstore_half" + this->GetVectorSize() + "(" + value + ", " + index + ", " + buffer + ");";
+            case OpenCLImageRD::Storage::Float: return buffer + "[" + index + "] = convert_" + this->GetStoredTypeString() + "(" + value + ");";
+            default:
+            case OpenCLImageRD::Storage::Same: return buffer + "[" + index + "] = " + value + ";";
+        }
+    }
+    /// Returns the code that reads the block at the given offset (in blocks along x, and in cells along y and z) from a
+    /// chemical's input image, whose sampler deals with the edges.
+    string GetImageReadCode(const string& image, int dx, int dy, int dz) const
+    {
+        const auto offset = [](const string& index, int d) {
+            return d == 0 ? index : index + (d > 0 ? " + " : " - ") + to_string(abs(d));
+        };
+        const bool is_3d = this->image_dimensionality == 3;
+        ostringstream coord;
+        if (this->wrap)
+        {
+            // (wrapping around needs normalized coordinates, so we sample at the centers of the texels)
+            coord << "(float" << (is_3d ? "4" : "2") << ")(" << offset("index_x", dx) << " + 0.5f, " << offset("index_y", dy) << " + 0.5f";
+            if (is_3d)
+            {
+                coord << ", " << offset("index_z", dz) << " + 0.5f, 0.0f";
+            }
+            coord << ") * image_scale";
+        }
+        else
+        {
+            coord << "(int" << (is_3d ? "4" : "2") << ")(" << offset("index_x", dx) << ", " << offset("index_y", dy);
+            if (is_3d)
+            {
+                coord << ", " << offset("index_z", dz) << ", 0";
+            }
+            coord << ")";
+        }
+        // (each texel holds a block, in as many channels as the block has cells)
+        const string channels = this->block_size[0] == 1 ? ".x" : this->block_size[0] == 2 ? ".xy" : "";
+        return "read_imagef(" + image + ", sampler, " + coord.str() + ")" + channels;
+    }
+    /// Returns the statement that writes value to the block being updated in a chemical's output buffer or image.
+    string GetOutputStoreCode(const string& chem, const string& value) const
+    {
+        if (this->image_dimensionality > 0)
+        {
+            const string coord = this->image_dimensionality == 3 ? "(int4)(index_x, index_y, index_z, 0)" : "(int2)(index_x, index_y)";
+            // (a texel is always written as four channels, of which the image keeps as many as the block has cells)
+            const string texel = this->block_size[0] == 1 ? "(float4)(" + value + ", 0.0f, 0.0f, 0.0f)"
+                : this->block_size[0] == 2 ? "(float4)(" + value + ", 0.0f, 0.0f)" : value;
+            return "write_imagef(" + chem + "_out, " + coord + ", " + texel + ");";
+        }
+        return this->GetStoreCode(chem + "_out", this->GetCellIndex(), value);
+    }
+    /// Returns the code that reads the block being updated from a chemical's input buffer or image.
+    string GetCentralLoadCode(const string& chem) const
+    {
+        if (this->image_dimensionality > 0)
+        {
+            return this->GetImageReadCode(chem + "_in", 0, 0, 0);
+        }
+        return this->GetLoadCode(chem + "_in", this->GetCellIndex());
+    }
+    /// Returns the code that reads a block-aligned input point, from local memory or from its chemical's buffer or image.
+    string GetAccessCode(const InputPoint& input_point) const
+    {
+        if (this->image_dimensionality > 0)
+        {
+            return this->GetImageReadCode(input_point.chem + "_in", input_point.point.x / this->block_size[0],
+                input_point.point.y, input_point.point.z);
+        }
+        if (this->use_local_memory)
+        {
+            return input_point.GetAccessCode(this->wrap, this->use_ghost_cells, this->block_size, true);
+        }
+        return this->GetLoadCode(input_point.chem + "_in", input_point.GetIndexCode(this->wrap, this->use_ghost_cells, this->block_size));
+    }
+    /// Returns the suffix of the vector types, e.g. "4" for float4, or "" if the blocks are single cells.
+    string GetVectorSize() const { return this->block_size[0] > 1 ? to_string(this->block_size[0]) : ""; }
+    /// Returns whether each work-item updates several blocks along y and z, sharing the neighbors they have in common.
+    bool IsRegisterBlocked() const { return this->block_size[1] * this->block_size[2] > 1; }
     bool wrap;
+    bool use_ghost_cells; ///< if true, the buffers are padded with the values the stencils need beyond each edge
     string indent;
     int data_type;
     string data_type_string;
@@ -186,6 +478,11 @@ struct KernelOptions {
     const int block_size[3];
     bool use_local_memory;
     const size_t local_work_size[3];
+    string activity_tile_index; ///< if not empty, the kernel skips inactive tiles and reports which tiles changed
+    double activity_threshold;
+    OpenCLImageRD::Storage storage; ///< how the chemical buffers hold each value
+    bool write_constant_chemicals;  ///< if false, the input and output buffers of the constant chemicals are the same
+    int image_dimensionality;       ///< if 2 or 3, the chemicals are stepped in image2d_t or image3d_t objects, not buffers
 };
 
 // -------------------------------------------------------------------------
@@ -203,12 +500,19 @@ void WriteHeader(ostringstream& kernel_source, const InputsNeeded& inputs_needed
     #error \"Double precision floating point not supported on this OpenCL device. Choose another or contact the Ready team.\"\n\
 #endif\n\n";
     }
+    if (options.image_dimensionality == 3)
+    {
+        kernel_source << "#pragma OPENCL EXTENSION cl_khr_3d_image_writes : enable\n\n";
+    }
     if (options.use_local_memory)
     {
         kernel_source << "// work group size, in blocks:\n";
         kernel_source << "#define LX " << options.local_work_size[0] << "\n";
         kernel_source << "#define LY " << options.local_work_size[1] << "\n";
         kernel_source << "#define LZ " << options.local_work_size[2] << "\n\n";
+    }
+    if (options.use_local_memory || options.use_ghost_cells)
+    {
         kernel_source << "// neighborhood size in each direction, in blocks:\n";
         kernel_source << "#define XR " << inputs_needed.stencil_radii[0] << "\n";
         kernel_source << "#define YR " << inputs_needed.stencil_radii[1] << "\n";
@@ -233,17 +537,43 @@ void WriteHeader(ostringstream& kernel_source, const InputsNeeded& inputs_needed
 
     for (const string& chem : inputs_needed.chemicals_needed)
     {
-        kernel_source << "global " << options.data_type_string << " *" << chem << "_in";
+        if (options.image_dimensionality > 0)
+        {
+            kernel_source << "read_only image" << options.image_dimensionality << "d_t " << chem << "_in";
+        }
+        else
+        {
+            kernel_source << "global " << options.GetStoredTypeString() << " *" << chem << "_in";
+        }
         kernel_source << ",";
     }
     for (size_t i = 0; i < inputs_needed.chemicals_needed.size(); i++)
     {
-        kernel_source << "global " << options.data_type_string << " *" << inputs_needed.chemicals_needed[i] << "_out";
+        const string& chem = inputs_needed.chemicals_needed[i];
+        // (a constant chemical that isn't written keeps its buffer here, since its image is also its input)
+        const bool is_written = options.write_constant_chemicals
+            || find(inputs_needed.chemicals_written.begin(), inputs_needed.chemicals_written.end(), chem) != inputs_needed.chemicals_written.end();
+        if (options.image_dimensionality > 0 && is_written)
+        {
+            kernel_source << "write_only image" << options.image_dimensionality << "d_t " << chem << "_out";
+        }
+        else
+        {
+            kernel_source << "global " << options.GetStoredTypeString() << " *" << chem << "_out";
+        }
         if (i < inputs_needed.chemicals_needed.size() - 1)
         {
             kernel_source << ",";
         }
     }
+    if (!options.activity_tile_index.empty())
+    {
+        kernel_source << ",global const int *tile_active,global int *tile_changed";
+    }
+    for (const string& staged_input : inputs_needed.staged_inputs)
+    {
+        kernel_source << ",global const " << options.GetStoredTypeString() << " *" << staged_input << "_in";
+    }
     kernel_source << ")\n{\n";
 }
 
@@ -275,8 +605,17 @@ void WriteIndices(ostringstream& kernel_source, const InputsNeeded& inputs_neede
 {
     kernel_source << options.indent << "// indices:\n";
     kernel_source << options.indent << "const int index_x = get_global_id(0);\n";
-    kernel_source << options.indent << "const int index_y = get_global_id(1);\n";
-    kernel_source << options.indent << "const int index_z = get_global_id(2);\n";
+    if (options.IsRegisterBlocked())
+    {
+        // each work-item updates block_size[1] x block_size[2] blocks, from here
+        kernel_source << options.indent << "const int index_y = get_global_id(1) * " << options.block_size[1] << ";\n";
+        kernel_source << options.indent << "const int index_z = get_global_id(2) * " << options.block_size[2] << ";\n";
+    }
+    else
+    {
+        kernel_source << options.indent << "const int index_y = get_global_id(1);\n";
+        kernel_source << options.indent << "const int index_z = get_global_id(2);\n";
+    }
     if (options.use_local_memory)
     {
         kernel_source << options.indent << "const int local_x = get_local_id(0);\n";
@@ -284,13 +623,57 @@ void WriteIndices(ostringstream& kernel_source, const InputsNeeded& inputs_neede
         kernel_source << options.indent << "const int local_z = get_local_id(2);\n";
     }
     kernel_source << options.indent << "const int X = get_global_size(0);\n";
-    kernel_source << options.indent << "const int Y = get_global_size(1);\n";
-    kernel_source << options.indent << "const int Z = get_global_size(2);\n";
+    if (options.IsRegisterBlocked())
+    {
+        kernel_source << options.indent << "const int Y = get_global_size(1) * " << options.block_size[1] << ";\n";
+        kernel_source << options.indent << "const int Z = get_global_size(2) * " << options.block_size[2] << ";\n";
+    }
+    else
+    {
+        kernel_source << options.indent << "const int Y = get_global_size(1);\n";
+        kernel_source << options.indent << "const int Z = get_global_size(2);\n";
+    }
     kernel_source << options.indent << "const int index_here = X*(Y*index_z + index_y) + index_x;\n";
-    for (const string& chem : inputs_needed.chemicals_needed)
+    if (options.use_ghost_cells)
+    {
+        // (the ghost cells are filled before each step, so every neighbor is at a fixed offset, with no wrapping or clamping)
+        kernel_source << options.indent << "const int PX = X + XR * 2;\n";
+        kernel_source << options.indent << "const int PY = Y + YR * 2;\n";
+        kernel_source << options.indent << "const int index_cell = PX*(PY*(index_z + ZR) + index_y + YR) + index_x + XR;\n";
+    }
+    if (options.image_dimensionality > 0)
+    {
+        // (the sampler wraps around or clamps to the edge for us, so the neighbor reads need no index arithmetic)
+        if (options.wrap)
+        {
+            kernel_source << options.indent << "const sampler_t sampler = CLK_NORMALIZED_COORDS_TRUE | CLK_ADDRESS_REPEAT | CLK_FILTER_NEAREST;\n";
+            if (options.image_dimensionality == 3)
+            {
+                kernel_source << options.indent << "const float4 image_scale = (float4)(1.0f / X, 1.0f / Y, 1.0f / Z, 0.0f);\n";
+            }
+            else
+            {
+                kernel_source << options.indent << "const float2 image_scale = (float2)(1.0f / X, 1.0f / Y);\n";
+            }
+        }
+        else
+        {
+            kernel_source << options.indent << "const sampler_t sampler = CLK_NORMALIZED_COORDS_FALSE | CLK_ADDRESS_CLAMP_TO_EDGE | CLK_FILTER_NEAREST;\n";
+        }
+    }
+    if (!options.IsRegisterBlocked()) // (else each block reads its own, in WriteCellsNeeded)
     {
-        kernel_source << options.indent << options.data_type_string << " " << chem << " = " << chem << "_in[index_here];\n";
-        // (non-const to allow the user to assign directly to it if needed)
+        vector<string> all_inputs = inputs_needed.chemicals_needed;
+        all_inputs.insert(all_inputs.end(), inputs_needed.staged_inputs.begin(), inputs_needed.staged_inputs.end());
+        for (const string& chem : all_inputs)
+        {
+            if (inputs_needed.cells_needed.find({ { { 0, 0, 0 } }, chem }) == inputs_needed.cells_needed.end())
+            {
+                continue; // (the formula doesn't use this chemical here)
+            }
+            kernel_source << options.indent << options.data_type_string << " " << chem << " = " << options.GetCentralLoadCode(chem) << ";\n";
+            // (non-const to allow the user to assign directly to it if needed)
+        }
     }
     kernel_source << "\n";
 }
@@ -377,7 +760,8 @@ void WriteLocalMemoryCopyBlocksUnrolled(ostringstream& kernel_source, const Inpu
                         kernel_source << cx << " * LX + ";
                     }
                     kernel_source << "local_x]";
-                    kernel_source << "= " << chem << "_in[" << GetIndexString(ix.str(), iy.str(), iz.str(), options.wrap) << "]; \n";
+                    kernel_source << "= " << options.GetLoadCode(chem + "_in", options.use_ghost_cells ? GetPaddedIndexString(ix.str(), iy.str(), iz.str())
+                        : GetIndexString(ix.str(), iy.str(), iz.str(), options.wrap)) << "; \n";
                 }
                 if (!first_block)
                 {
@@ -405,8 +789,8 @@ void WriteLocalMemoryCopyBlocksWithLoops(ostringstream& kernel_source, const Inp
     for (const string& chem : inputs_needed.local_memory_needed)
     {
         kernel_source << options.indent << options.indent << options.indent << options.indent << "local_" << chem
-            << "[z - z_start][y - y_start][x - x_start] = " << chem << "_in["
-            << GetIndexString("x", "y", "z", options.wrap) << "];\n";
+            << "[z - z_start][y - y_start][x - x_start] = "
+            << options.GetLoadCode(chem + "_in", options.use_ghost_cells ? GetPaddedIndexString("x", "y", "z") : GetIndexString("x", "y", "z", options.wrap)) << ";\n";
     }
     kernel_source << options.indent << options.indent << options.indent << "}\n";
     kernel_source << options.indent << options.indent << "}\n";
@@ -435,33 +819,82 @@ void WriteLocalMemorySection(ostringstream& kernel_source, const InputsNeeded& i
 
 // -------------------------------------------------------------------------
 
-void WriteCellsNeeded(ostringstream& kernel_source, const set<InputPoint>& cells_needed, const KernelOptions& options)
+void WriteCellsNeeded(ostringstream& kernel_source, const set<InputPoint>& cells_needed, const KernelOptions& options,
+                      const int* sub_block = nullptr)
 {
     kernel_source << options.indent << "// cells needed:\n";
-    // write code to retrieve the block-aligned inputs from global memory
-    for (const InputPoint& input_point : cells_needed)
+    if (sub_block)
+    {
+        // take this block's cells from those read by WriteRegisterBlockCells(), offset by where the block is
+        for (const InputPoint& input_point : cells_needed)
+        {
+            if (input_point.point.x % options.block_size[0] == 0)
+            {
+                const InputPoint register_point{ { { input_point.point.x, input_point.point.y + sub_block[1], input_point.point.z + sub_block[2] } },
+                                                 input_point.chem };
+                const bool is_central_cell = input_point.point.x == 0 && input_point.point.y == 0 && input_point.point.z == 0;
+                kernel_source << options.indent << (is_central_cell ? "" : "const ") << options.data_type_string << " "
+                              << input_point.GetName() << " = block_" << register_point.GetName() << ";\n";
+                // (the central cell is non-const to allow the user to assign directly to it if needed)
+            }
+        }
+    }
+    else
     {
-        // block-aligned points (but not the central cell)
-        if (!(input_point.point.x == 0 && input_point.point.y == 0 && input_point.point.z == 0)
-            && input_point.point.x % options.block_size[0] == 0)
+        // write code to retrieve the block-aligned inputs from global memory
+        for (const InputPoint& input_point : cells_needed)
         {
-            kernel_source << options.indent << "const " << options.data_type_string << " "
-                          << input_point.GetDirectAccessCode(options.wrap, options.block_size, options.use_local_memory) << ";\n";
+            // block-aligned points (but not the central cell)
+            if (!(input_point.point.x == 0 && input_point.point.y == 0 && input_point.point.z == 0)
+                && input_point.point.x % options.block_size[0] == 0)
+            {
+                kernel_source << options.indent << "const " << options.data_type_string << " "
+                              << input_point.GetName() << " = " << options.GetAccessCode(input_point) << ";\n";
+            }
         }
     }
-    if (options.block_size[0] == 4)
+    if (options.block_size[0] > 1)
     {
-        // write code to compute the non-block-aligned float4's from the block-aligned ones we have retrieved
+        // write code to compute the non-block-aligned vectors from the block-aligned ones we have retrieved
         for (const InputPoint& input_point : cells_needed)
         {
             if (input_point.point.x % options.block_size[0] != 0)
             {
                 // swizzle from the retrieved blocks
                 kernel_source << options.indent << "const " << options.data_type_string << " " << input_point.GetName()
-                    << " = (" << options.data_type_string << ")(" << input_point.GetSwizzled_Block411() << ");\n";
+                    << " = (" << options.data_type_string << ")(" << input_point.GetSwizzled(options.block_size[0]) << ");\n";
+            }
+        }
+    }
+    kernel_source << "\n";
+}
+
+// -------------------------------------------------------------------------
+
+void WriteRegisterBlockCells(ostringstream& kernel_source, const set<InputPoint>& cells_needed, const KernelOptions& options)
+{
+    // read each block-aligned cell that any of the blocks needs just once, into registers that they share
+    set<InputPoint> register_points;
+    for (const InputPoint& input_point : cells_needed)
+    {
+        if (input_point.point.x % options.block_size[0] == 0)
+        {
+            for (int sub_z = 0; sub_z < options.block_size[2]; sub_z++)
+            {
+                for (int sub_y = 0; sub_y < options.block_size[1]; sub_y++)
+                {
+                    register_points.insert({ { { input_point.point.x, input_point.point.y + sub_y, input_point.point.z + sub_z } },
+                                             input_point.chem });
+                }
             }
         }
     }
+    kernel_source << options.indent << "// cells needed by the " << options.block_size[1] * options.block_size[2] << " blocks:\n";
+    for (const InputPoint& register_point : register_points)
+    {
+        kernel_source << options.indent << "const " << options.data_type_string << " block_" << register_point.GetName() << " = "
+                      << options.GetAccessCode(register_point) << ";\n";
+    }
     kernel_source << "\n";
 }
 
@@ -470,19 +903,26 @@ void WriteCellsNeeded(ostringstream& kernel_source, const set<InputPoint>& cells
 void WriteKeywords(ostringstream& kernel_source, const InputsNeeded& inputs_needed, const KernelOptions& options)
 {
     kernel_source << options.indent << "// keywords needed:\n";
-    // write code for the stencils we need
+    // write code for the sums that the stencils share, then the stencils we need
+    for (const SharedSum& shared_sum : inputs_needed.shared_sums)
+    {
+        kernel_source << options.indent << "const " << options.data_type_string << " " << shared_sum.GetCode() << ";\n";
+    }
     for (const AppliedStencil& applied_stencil : inputs_needed.stencils_needed)
     {
-        kernel_source << options.indent << "const " << options.data_type_string << " " << applied_stencil.GetCode() << ";\n";
+        kernel_source << options.indent << "const " << options.data_type_string << " " << applied_stencil.GetCode(inputs_needed.shared_sums) << ";\n";
     }
     // write code for x_pos, y_pos, z_pos if needed
     if (inputs_needed.using_x_pos)
     {
-        if (options.block_size[0] == 4)
+        if (options.block_size[0] > 1)
         {
-            kernel_source << options.indent << "const " << options.data_type_string << " x_pos = (index_x + (" << options.data_type_string
-                << ")(0.0" << options.data_type_suffix << ", 0.25" << options.data_type_suffix << ", 0.5" << options.data_type_suffix
-                << ", 0.75" << options.data_type_suffix << ")) / X;\n";
+            kernel_source << options.indent << "const " << options.data_type_string << " x_pos = (index_x + (" << options.data_type_string << ")(";
+            for (int i = 0; i < options.block_size[0]; i++)
+            {
+                kernel_source << (i > 0 ? ", " : "") << i / static_cast<double>(options.block_size[0]) << options.data_type_suffix;
+            }
+            kernel_source << ")) / X;\n";
         }
         else
         {
@@ -514,6 +954,11 @@ void WriteKeywords(ostringstream& kernel_source, const InputsNeeded& inputs_need
         }
         kernel_source << ";\n";
     }
+    // write code for the parameter maps, which are the central cells of their chemicals
+    for (const pair<string, string>& parameter_map : inputs_needed.parameter_maps_needed)
+    {
+        kernel_source << options.indent << "const " << options.data_type_string << " " << parameter_map.first << " = " << parameter_map.second << ";\n";
+    }
     // declare delta_a, etc. and initialize to zero
     for (const string& chem : inputs_needed.deltas_needed)
     {
@@ -524,26 +969,8 @@ void WriteKeywords(ostringstream& kernel_source, const InputsNeeded& inputs_need
 
 // -------------------------------------------------------------------------
 
-string AssembleKernelSource(const InputsNeeded& inputs_needed,
-    const vector<AbstractRD::Parameter>& parameters,
-    const string& formula,
-    const KernelOptions& options)
+void WriteUpdate(ostringstream& kernel_source, const InputsNeeded& inputs_needed, const string& formula, const KernelOptions& options)
 {
-    ostringstream kernel_source;
-    kernel_source << fixed << setprecision(6);
-    // add the #defines and the kernel definition header
-    WriteHeader(kernel_source, inputs_needed, options);
-    // add the parameters
-    WriteParameters(kernel_source, parameters, inputs_needed, options);
-    // add the bit that retrieves the global indices etc.
-    WriteIndices(kernel_source, inputs_needed, options);
-    // add the bit that declares local memory and copies into it
-    if (options.use_local_memory)
-    {
-        WriteLocalMemorySection(kernel_source, inputs_needed, options);
-    }
-    // add the cells we need
-    WriteCellsNeeded(kernel_source, inputs_needed.cells_needed, options);
     // add the keywords we need
     WriteKeywords(kernel_source, inputs_needed, options);
     // add the formula
@@ -556,45 +983,198 @@ string AssembleKernelSource(const InputsNeeded& inputs_needed,
         kernel_source << options.indent << s << "\n";
     }
     kernel_source << "\n";
-    // add the forward-Euler step
-    // TODO: only add this when delta_<chem> appears in the formula
+    // add the forward-Euler step, for the chemicals that change
     kernel_source << options.indent << "// forward-Euler update step:\n";
-    for (const string& chem : inputs_needed.chemicals_needed)
+    const auto get_new_value = [&](const string& chem) {
+        const bool using_delta = find(inputs_needed.deltas_needed.begin(), inputs_needed.deltas_needed.end(), chem) != inputs_needed.deltas_needed.end();
+        return using_delta ? chem + " + timestep * delta_" + chem : chem;
+    };
+    for (const string& chem : inputs_needed.chemicals_written)
     {
-        kernel_source << options.indent << chem << "_out[index_here] = " << chem << " + timestep * delta_" << chem << ";\n";
+        kernel_source << options.indent << options.GetOutputStoreCode(chem, get_new_value(chem)) << "\n";
     }
-    // TODO: timestep only needed if it appears in the formula or if we are doing forward-Euler for at least one chemical
-    // finish up
-    kernel_source << "}\n";
-
-    return kernel_source.str();
-}
-
-// -------------------------------------------------------------------------
-
-string FormulaOpenCLImageRD::AssembleKernelSourceFromFormula(const string& formula) const
-{
-    string full_data_type_string = this->data_type_string;
-    if (this->block_size[0] == 4 && this->block_size[1] == 1 && this->block_size[2] == 1)
+    // copy the constant chemicals across, unless their output buffer is their input buffer
+    if (options.write_constant_chemicals)
+    {
+        for (const string& chem : inputs_needed.chemicals_needed)
+        {
+            if (find(inputs_needed.chemicals_written.begin(), inputs_needed.chemicals_written.end(), chem) == inputs_needed.chemicals_written.end())
+            {
+                kernel_source << options.indent << options.GetOutputStoreCode(chem, options.GetCentralLoadCode(chem)) << "\n";
+            }
+        }
+    }
+    // report whether this tile is still changing (the constant chemicals never do)
+    if (!options.activity_tile_index.empty() && !inputs_needed.chemicals_written.empty())
+    {
+        const bool is_vector = options.block_size[0] > 1;
+        kernel_source << options.indent << "if (";
+        for (size_t i = 0; i < inputs_needed.chemicals_written.size(); i++)
+        {
+            const string& chem = inputs_needed.chemicals_written[i];
+            if (i > 0)
+            {
+                kernel_source << " || ";
+            }
+            // (the output images can't be read, so then we look at the value written rather than what was stored)
+            const string written = options.image_dimensionality > 0 ? "(" + get_new_value(chem) + ")"
+                : options.GetLoadCode(chem + "_out", options.GetCellIndex());
+            kernel_source << (is_vector ? "any(" : "(") << "fabs(" << written << " - "
+                << options.GetCentralLoadCode(chem) << ") > "
+                << scientific << options.activity_threshold << fixed << options.data_type_suffix << ")";
+        }
+        kernel_source << ")\n";
+        kernel_source << options.indent << options.indent << "tile_changed[tile_here] = 1;\n";
+    }
+    // TODO: timestep only needed if it appears in the formula or if we are doing forward-Euler for at least one chemical
+}
+
+// -------------------------------------------------------------------------
+
+string AssembleKernelSource(const InputsNeeded& inputs_needed,
+    const vector<AbstractRD::Parameter>& parameters,
+    const string& formula,
+    const KernelOptions& options)
+{
+    ostringstream kernel_source;
+    kernel_source << fixed << setprecision(6);
+    // add the #defines and the kernel definition header
+    WriteHeader(kernel_source, inputs_needed, options);
+    // add the parameters
+    WriteParameters(kernel_source, parameters, inputs_needed, options);
+    // add the bit that retrieves the global indices etc.
+    WriteIndices(kernel_source, inputs_needed, options);
+    // add the bit that declares local memory and copies into it
+    if (options.use_local_memory)
+    {
+        WriteLocalMemorySection(kernel_source, inputs_needed, options);
+    }
+    // skip the tiles that have stopped changing (after the barrier, if any, so the whole work group reaches it)
+    // (the blocks of a work-item are all in the same tile, since the block sizes divide the tile size)
+    if (!options.activity_tile_index.empty())
     {
-        full_data_type_string += "4";
+        kernel_source << options.indent << "// activity tracking:\n";
+        kernel_source << options.indent << "const int tile_here = " << options.activity_tile_index << ";\n";
+        kernel_source << options.indent << "if (!tile_active[tile_here]) return;\n\n";
     }
-    else if(this->block_size[0] == 1 && this->block_size[1] == 1 && this->block_size[2] == 1)
+    if (options.IsRegisterBlocked())
     {
+        // read the cells that the blocks need, then update each block in turn, in its own scope
+        WriteRegisterBlockCells(kernel_source, inputs_needed.cells_needed, options);
+        KernelOptions block_options = options;
+        block_options.indent += options.indent;
+        for (int sub_z = 0; sub_z < options.block_size[2]; sub_z++)
+        {
+            for (int sub_y = 0; sub_y < options.block_size[1]; sub_y++)
+            {
+                const int sub_block[3] = { 0, sub_y, sub_z };
+                kernel_source << options.indent << "{\n";
+                kernel_source << block_options.indent << "// block at y + " << sub_y << ", z + " << sub_z << ":\n";
+                kernel_source << block_options.indent << "const int index_y = get_global_id(1) * " << options.block_size[1] << " + " << sub_y << ";\n";
+                kernel_source << block_options.indent << "const int index_z = get_global_id(2) * " << options.block_size[2] << " + " << sub_z << ";\n";
+                kernel_source << block_options.indent << "const int index_here = X*(Y*index_z + index_y) + index_x;\n";
+                if (options.use_ghost_cells)
+                {
+                    kernel_source << block_options.indent << "const int index_cell = PX*(PY*(index_z + ZR) + index_y + YR) + index_x + XR;\n";
+                }
+                WriteCellsNeeded(kernel_source, inputs_needed.cells_needed, block_options, sub_block);
+                WriteUpdate(kernel_source, inputs_needed, formula, block_options);
+                kernel_source << options.indent << "}\n";
+            }
+        }
     }
     else
+    {
+        // add the cells we need
+        WriteCellsNeeded(kernel_source, inputs_needed.cells_needed, options);
+        WriteUpdate(kernel_source, inputs_needed, formula, options);
+    }
+    // finish up
+    kernel_source << "}\n";
+
+    return kernel_source.str();
+}
+
+// -------------------------------------------------------------------------
+
+string FormulaOpenCLImageRD::AssembleKernelSourceFromFormula(const string& formula) const
+{
+    return this->AssembleKernelSourceWithOptions(formula, this->wrap, this->parameters, this->use_local_memory,
+        this->IsUsingGhostCells(), this->IsSkippingQuiescentTiles());
+}
+
+// -------------------------------------------------------------------------
+
+string FormulaOpenCLImageRD::AssembleKernelSourceWithOptions(const string& formula, bool wrap,
+    const vector<Parameter>& parameters, bool use_local_memory, bool use_ghost_cells, bool track_activity) const
+{
+    // along x a block is a vector type (e.g. float8), along y and z a work-item updates several blocks
+    auto is_supported_size = [](int n) { return n == 1 || n == 2 || n == 4 || n == 8 || n == 16; };
+    if (!is_supported_size(this->block_size[0]) || !is_supported_size(this->block_size[1]) || !is_supported_size(this->block_size[2]))
     {
         throw runtime_error("unsupported block size in AssembleKernelSourceFromFormula");
     }
+    if (use_local_memory && (this->block_size[1] > 1 || this->block_size[2] > 1))
+    {
+        throw runtime_error("block_size_y and block_size_z must be 1 when using local memory, in AssembleKernelSourceFromFormula");
+    }
+    if (this->IsUsingImageObjects())
+    {
+        // (each texel holds a block, in its R, RG or RGBA channels, and the sampler handles the edges)
+        if (use_local_memory || use_ghost_cells)
+        {
+            throw runtime_error("image objects cannot be combined with local memory or ghost cells, in AssembleKernelSourceFromFormula");
+        }
+        if (this->data_type != VTK_FLOAT)
+        {
+            throw runtime_error("image objects need the float data type, in AssembleKernelSourceFromFormula");
+        }
+        if (this->block_size[0] != 1 && this->block_size[0] != 2 && this->block_size[0] != 4)
+        {
+            throw runtime_error("block_size_x must be 1, 2 or 4 when using image objects, in AssembleKernelSourceFromFormula");
+        }
+    }
+    // leave the inner laplacians of the high-order stencils to the passes before, which fill the staged inputs
+    StencilStages stages{ formula, {}, {}, 0 };
+    if (this->IsStagingStencils())
+    {
+        if (use_ghost_cells || this->IsUsingImageObjects())
+        {
+            throw runtime_error("staged stencils cannot be combined with ghost cells or image objects, in AssembleKernelSourceFromFormula");
+        }
+        stages = PlanStencilStages(formula, this->GetNumberOfChemicals());
+    }
+    string full_data_type_string = this->data_type_string;
+    if (this->block_size[0] > 1)
+    {
+        full_data_type_string += to_string(this->block_size[0]);
+    }
 
-    const InputsNeeded inputs_needed = DetectInputsNeeded(formula, this->GetNumberOfChemicals(),
-        this->GetArenaDimensionality(), this->block_size, this->GetAccuracy());
+    const InputsNeeded inputs_needed = DetectInputsNeeded(stages.formula, this->GetNumberOfChemicals(),
+        this->GetArenaDimensionality(), this->block_size, this->GetAccuracy(), this->parameter_maps, stages.staged_inputs);
 
     const string indent = "    ";
-    const KernelOptions options(this->wrap, indent, this->data_type, full_data_type_string, this->data_type_suffix, this->block_size,
-        this->use_local_memory, this->local_work_size);
+    KernelOptions options(wrap, use_ghost_cells, indent, this->data_type, full_data_type_string, this->data_type_suffix, this->block_size,
+        use_local_memory, this->local_work_size);
+    options.storage = this->GetStorage();
+    options.write_constant_chemicals = !this->IsSharingConstantBuffers();
+    if (this->IsUsingImageObjects())
+    {
+        options.image_dimensionality = this->GetArenaDimensionality() == 3 ? 3 : 2;
+    }
+    if (track_activity)
+    {
+        int num_tiles[3], tile_size[3];
+        this->GetActivityTiles(num_tiles, tile_size);
+        ostringstream tile_index;
+        tile_index << num_tiles[0] << " * (" << num_tiles[1] << " * (index_z / " << tile_size[2]
+            << ") + index_y / " << tile_size[1]
+            << ") + index_x * " << this->block_size[0] << " / " << tile_size[0];
+        options.activity_tile_index = tile_index.str();
+        options.activity_threshold = this->activity_threshold;
+    }
 
-    string amended_formula = formula;
+    string amended_formula = stages.formula;
     if (this->data_type == VTK_DOUBLE)
     {
         // float4 doesn't auto-convert to double4 or double
@@ -610,13 +1190,518 @@ string FormulaOpenCLImageRD::AssembleKernelSourceFromFormula(const string& formu
         amended_formula = ReplaceAllSubstrings(amended_formula, "double", full_data_type_string);
     }
 
-    const string kernel_source = AssembleKernelSource(inputs_needed, this->parameters, amended_formula, options);
+    const string kernel_source = AssembleKernelSource(inputs_needed, parameters, amended_formula, options);
 
     return kernel_source;
 }
 
 // -------------------------------------------------------------------------
 
+const int ACTIVITY_TILE_SIZE = 16; // in cells, along each axis
+
+// updates the activity mask after each step: a tile stays active while it or a neighbor changed within QUIESCENT_STEPS steps
+const char* activity_kernel_source = "\n\
+kernel void update_tile_activity(global const int* tile_changed, global int* tile_changed_to_clear,\n\
+                                 global int* tile_quiet, global int* tile_active)\n\
+{\n\
+    const int NTX = get_global_size(0);\n\
+    const int NTY = get_global_size(1);\n\
+    const int NTZ = get_global_size(2);\n\
+    const int tx = get_global_id(0);\n\
+    const int ty = get_global_id(1);\n\
+    const int tz = get_global_id(2);\n\
+    int changed = 0;\n\
+    for (int dz = -1; dz <= 1; dz++)\n\
+        for (int dy = -1; dy <= 1; dy++)\n\
+            for (int dx = -1; dx <= 1; dx++)\n\
+            {\n\
+                const int nx = WRAP ? (tx + dx + NTX) % NTX : min(NTX - 1, max(0, tx + dx));\n\
+                const int ny = WRAP ? (ty + dy + NTY) % NTY : min(NTY - 1, max(0, ty + dy));\n\
+                const int nz = WRAP ? (tz + dz + NTZ) % NTZ : min(NTZ - 1, max(0, tz + dz));\n\
+                changed |= tile_changed[NTX * (NTY * nz + ny) + nx];\n\
+            }\n\
+    const int t = NTX * (NTY * tz + ty) + tx;\n\
+    const int quiet = changed ? 0 : min(tile_quiet[t] + 1, QUIESCENT_STEPS);\n\
+    tile_quiet[t] = quiet;\n\
+    tile_active[t] = quiet < QUIESCENT_STEPS;\n\
+    tile_changed_to_clear[t] = 0;\n\
+}\n";
+
+// -------------------------------------------------------------------------
+
+void FormulaOpenCLImageRD::GetActivityTiles(int num_tiles[3], int tile_size[3]) const
+{
+    const int dims[3] = { vtkMath::Round(this->GetX()), vtkMath::Round(this->GetY()), vtkMath::Round(this->GetZ()) };
+    for (int axis = 0; axis < 3; axis++)
+    {
+        tile_size[axis] = min(ACTIVITY_TILE_SIZE, dims[axis]);
+        num_tiles[axis] = (dims[axis] + tile_size[axis] - 1) / tile_size[axis];
+    }
+}
+
+// -------------------------------------------------------------------------
+
+void FormulaOpenCLImageRD::ReloadKernelIfNeeded()
+{
+    if (!this->need_reload_formula) return;
+
+    this->is_tuned = false; // (the kernel may have changed, so check the TuningCache again before stepping)
+
+    // each work-item updates a whole block, so the blocks must tile the image
+    const int dims[3] = { vtkMath::Round(this->GetX()), vtkMath::Round(this->GetY()), vtkMath::Round(this->GetZ()) };
+    for (int axis = 0; axis < 3; axis++)
+    {
+        if (dims[axis] % this->block_size[axis] != 0)
+        {
+            throw runtime_error("FormulaOpenCLImageRD::ReloadKernelIfNeeded : image dimensions must be a multiple of the block size");
+        }
+    }
+
+    OpenCLImageRD::ReloadKernelIfNeeded();
+
+    const InputsNeeded inputs_needed = DetectInputsNeeded(this->formula, this->GetNumberOfChemicals(),
+        this->GetArenaDimensionality(), this->block_size, this->GetAccuracy(), this->parameter_maps, {});
+
+    // the kernel doesn't write the chemicals that the formula never changes, so they only need one buffer
+    vector<bool> is_constant(this->GetNumberOfChemicals(), false);
+    if (this->IsSharingConstantBuffers())
+    {
+        for (int ic = 0; ic < this->GetNumberOfChemicals(); ic++)
+        {
+            is_constant[ic] = find(inputs_needed.chemicals_written.begin(), inputs_needed.chemicals_written.end(),
+                GetChemicalName(ic)) == inputs_needed.chemicals_written.end();
+        }
+    }
+    this->SetConstantChemicals(is_constant);
+
+    // pad the buffers by as much as the stencils reach beyond each edge
+    int ghost_cells[3] = { 0, 0, 0 };
+    if (this->IsUsingGhostCells())
+    {
+        ghost_cells[0] = inputs_needed.stencil_radii[0] * this->block_size[0]; // (the others are already in cells)
+        ghost_cells[1] = inputs_needed.stencil_radii[1];
+        ghost_cells[2] = inputs_needed.stencil_radii[2];
+    }
+    this->SetSteppedBufferLayout(ghost_cells, this->GetStorage());
+    this->SetReadingFromImageObjects(this->IsUsingImageObjects() ? this->block_size[0] : 0);
+
+    // make a kernel for each pass of the staged stencils, and a buffer for each of the staged inputs that they fill
+    this->ReleaseStages();
+    if (this->IsStagingStencils())
+    {
+        const StencilStages stages = PlanStencilStages(this->formula, this->GetNumberOfChemicals());
+        for (int pass = 1; pass <= stages.num_passes; pass++)
+        {
+            const string source = this->AssembleKernelSourceWithOptions(GetStageFormula(stages, pass), this->wrap,
+                this->parameters, this->use_local_memory, false, false);
+            this->stage_programs.push_back(this->CreateProgramFromSource(source));
+            cl_int ret;
+            this->stage_kernels.push_back(clCreateKernel(this->stage_programs.back(), this->kernel_function_name.c_str(), &ret));
+            throwOnError(ret, "FormulaOpenCLImageRD::ReloadKernelIfNeeded : kernel creation failed: ");
+        }
+        this->staged_buffers = stages.staged_buffers;
+        const size_t buffer_size = this->GetStoredValueSize() * dims[0] * dims[1] * dims[2];
+        for (size_t i = 0; i < this->staged_buffers.size(); i++)
+        {
+            cl_int ret;
+            this->staged_input_buffers.push_back(clCreateBuffer(this->context, CL_MEM_READ_WRITE, buffer_size, NULL, &ret));
+            throwOnError(ret, "FormulaOpenCLImageRD::ReloadKernelIfNeeded : buffer creation failed: ");
+        }
+    }
+
+    this->ReleaseActivityMask();
+    if (!this->IsSkippingQuiescentTiles()) return;
+
+    ostringstream source;
+    source << "#define WRAP " << (this->wrap ? 1 : 0) << "\n";
+    source << "#define QUIESCENT_STEPS " << this->quiescent_steps << "\n";
+    source << activity_kernel_source;
+    this->activity_program = this->CreateProgramFromSource(source.str());
+    cl_int ret;
+    this->activity_kernel = clCreateKernel(this->activity_program, "update_tile_activity", &ret);
+    throwOnError(ret, "FormulaOpenCLImageRD::ReloadKernelIfNeeded : kernel creation failed: ");
+
+    int num_tiles[3], tile_size[3];
+    this->GetActivityTiles(num_tiles, tile_size);
+    const size_t MEM_SIZE = sizeof(int) * num_tiles[0] * num_tiles[1] * num_tiles[2];
+    for (cl_mem* buffer : { &this->tile_active_buffer, &this->tile_quiet_buffer, &this->tile_changed_buffers[0], &this->tile_changed_buffers[1] })
+    {
+        *buffer = clCreateBuffer(this->context, CL_MEM_READ_WRITE, MEM_SIZE, NULL, &ret);
+        throwOnError(ret, "FormulaOpenCLImageRD::ReloadKernelIfNeeded : buffer creation failed: ");
+    }
+    this->ResetActivityMask();
+}
+
+// -------------------------------------------------------------------------
+
+void FormulaOpenCLImageRD::ResetActivityMask()
+{
+    int num_tiles[3], tile_size[3];
+    this->GetActivityTiles(num_tiles, tile_size);
+    const size_t n_tiles = num_tiles[0] * num_tiles[1] * num_tiles[2];
+    const vector<int> ones(n_tiles, 1), zeros(n_tiles, 0);
+    const pair<cl_mem, const int*> initial_values[4] = { { this->tile_active_buffer, ones.data() },
+        { this->tile_quiet_buffer, zeros.data() }, { this->tile_changed_buffers[0], zeros.data() },
+        { this->tile_changed_buffers[1], zeros.data() } };
+    for (const pair<cl_mem, const int*>& initial_value : initial_values)
+    {
+        cl_int ret = clEnqueueWriteBuffer(this->command_queue, initial_value.first, CL_TRUE, 0, sizeof(int) * n_tiles,
+            initial_value.second, 0, NULL, NULL);
+        throwOnError(ret, "FormulaOpenCLImageRD::ResetActivityMask : buffer writing failed: ");
+    }
+    this->iChangedBuffer = 0;
+}
+
+// -------------------------------------------------------------------------
+
+void FormulaOpenCLImageRD::ReleaseActivityMask()
+{
+    if (this->activity_kernel)
+        clReleaseKernel(this->activity_kernel);
+    if (this->activity_program)
+        clReleaseProgram(this->activity_program);
+    this->activity_kernel = NULL;
+    this->activity_program = NULL;
+    for (cl_mem* buffer : { &this->tile_active_buffer, &this->tile_quiet_buffer, &this->tile_changed_buffers[0], &this->tile_changed_buffers[1] })
+    {
+        if (*buffer)
+            clReleaseMemObject(*buffer);
+        *buffer = NULL;
+    }
+}
+
+// -------------------------------------------------------------------------
+
+void FormulaOpenCLImageRD::ReleaseStages()
+{
+    for (cl_kernel stage_kernel : this->stage_kernels)
+        clReleaseKernel(stage_kernel);
+    for (cl_program stage_program : this->stage_programs)
+        clReleaseProgram(stage_program);
+    for (cl_mem buffer : this->staged_input_buffers)
+        clReleaseMemObject(buffer);
+    this->stage_kernels.clear();
+    this->stage_programs.clear();
+    this->staged_input_buffers.clear();
+    this->staged_buffers.clear();
+}
+
+// -------------------------------------------------------------------------
+
+void FormulaOpenCLImageRD::RunStages()
+{
+    const int NC = this->GetNumberOfChemicals();
+    for (size_t iStage = 0; iStage < this->stage_kernels.size(); iStage++)
+    {
+        const int pass = static_cast<int>(iStage) + 1;
+        cl_kernel stage_kernel = this->stage_kernels[iStage];
+        for (int ic = 0; ic < NC; ic++)
+        {
+            // each pass reads what the pass before filled (the first reads the chemicals) and fills its own staged
+            // inputs, leaving the other chemicals alone, so those can be given their current buffer for both
+            cl_mem input = this->buffers[this->iCurrentBuffer][ic];
+            cl_mem output = input;
+            for (size_t i = 0; i < this->staged_buffers.size(); i++)
+            {
+                if (this->staged_buffers[i] == make_pair(pass - 1, ic))
+                    input = this->staged_input_buffers[i];
+                else if (this->staged_buffers[i] == make_pair(pass, ic))
+                    output = this->staged_input_buffers[i];
+            }
+            const cl_mem args[3] = { this->intergral_buffers[0][ic], input, output };
+            for (int io = 0; io < 3; io++)
+            {
+                cl_int ret = clSetKernelArg(stage_kernel, NC * io + ic, sizeof(cl_mem), &args[io]);
+                throwOnError(ret, "FormulaOpenCLImageRD::RunStages : clSetKernelArg failed: ");
+            }
+        }
+        cl_int ret = clEnqueueNDRangeKernel(this->command_queue, stage_kernel, 3, NULL, this->global_range,
+            this->GetLocalWorkSize(), 0, NULL, this->GetKernelTimingEvent());
+        throwOnError(ret, "FormulaOpenCLImageRD::RunStages : clEnqueueNDRangeKernel failed: ");
+    }
+}
+
+// -------------------------------------------------------------------------
+
+size_t FormulaOpenCLImageRD::GetBytesPerCellUpdate() const
+{
+    // each staged input is written by one pass and read by the next (or the main kernel), and the first pass also
+    // reads its chemicals
+    const size_t n_first_pass = count_if(this->staged_buffers.begin(), this->staged_buffers.end(),
+        [](const pair<int, int>& staged_buffer) { return staged_buffer.first == 1; });
+    return OpenCLImageRD::GetBytesPerCellUpdate()
+        + (2 * this->staged_buffers.size() + n_first_pass) * this->GetStoredValueSize();
+}
+
+// -------------------------------------------------------------------------
+
+void FormulaOpenCLImageRD::WriteToOpenCLBuffersIfNeeded()
+{
+    if (!this->need_write_to_opencl_buffers) return;
+
+    OpenCLImageRD::WriteToOpenCLBuffersIfNeeded();
+
+    // the image may have changed anywhere
+    if (this->activity_kernel)
+        this->ResetActivityMask();
+}
+
+// -------------------------------------------------------------------------
+
+void FormulaOpenCLImageRD::SetAutoTune(bool val)
+{
+    this->auto_tune = val;
+    this->is_tuned = false;
+    if (!val)
+    {
+        // keep the tuned block size and local memory setting, which the user can see, but not the work-group size
+        const size_t default_local_work_size[3] = { 0, 0, 0 };
+        this->SetLocalWorkSize(default_local_work_size);
+    }
+}
+
+// -------------------------------------------------------------------------
+
+void FormulaOpenCLImageRD::TuneKernelIfNeeded()
+{
+    if (!this->HasAutoTuneOption() || !this->auto_tune || this->is_tuned) return;
+
+    const string key = this->GetTuningKey();
+    KernelConfiguration config;
+    if (!TuningCache::Find(key, config))
+    {
+        config = this->FindFastestConfiguration();
+        TuningCache::Store(key, config);
+    }
+    this->ApplyConfiguration(config);
+    this->ReloadKernelIfNeeded();
+    this->WriteToOpenCLBuffersIfNeeded();
+    this->is_tuned = true;
+}
+
+// -------------------------------------------------------------------------
+
+string FormulaOpenCLImageRD::GetTuningKey() const
+{
+    // the parameter values are left out, since changing them doesn't change the speed
+    ostringstream description;
+    description << this->formula << "\n" << this->GetNumberOfChemicals() << " " << this->data_type_string << " "
+        << static_cast<int>(this->accuracy) << " " << this->wrap << " " << this->use_ghost_cells << " "
+        << this->quiescent_steps << " " << static_cast<int>(this->GetStorage()) << " " << this->IsUsingImageObjects() << " " << this->IsStagingStencils();
+    for (int iParam = 0; iParam < this->GetNumberOfParameters(); iParam++)
+        description << " " << this->GetParameterName(iParam);
+    for (const pair<const int, string>& parameter_map : this->parameter_maps)
+        description << " " << GetChemicalName(parameter_map.first) << "=" << parameter_map.second;
+    const int grid_size[3] = { vtkMath::Round(this->GetX()), vtkMath::Round(this->GetY()), vtkMath::Round(this->GetZ()) };
+    return TuningCache::MakeKey(OpenCL_utils::GetDeviceDescription(this->GetPlatform(), this->GetDevice()),
+        description.str(), grid_size);
+}
+
+// -------------------------------------------------------------------------
+
+KernelConfiguration FormulaOpenCLImageRD::FindFastestConfiguration()
+{
+    const int dims[3] = { vtkMath::Round(this->GetX()), vtkMath::Round(this->GetY()), vtkMath::Round(this->GetZ()) };
+    const int dimensionality = this->GetArenaDimensionality();
+
+    KernelConfiguration fastest = { { this->block_size[0], this->block_size[1], this->block_size[2] },
+        this->use_local_memory, { 0, 0, 0 } };
+    double fastest_time = numeric_limits<double>::infinity();
+    auto try_configuration = [&](const KernelConfiguration& config)
+    {
+        const double time_per_step = this->TimeConfiguration(config);
+        if (time_per_step < fastest_time)
+        {
+            fastest = config;
+            fastest_time = time_per_step;
+        }
+    };
+
+    // try each block shape that tiles the image, with and without local memory (which only supports blocking along x)
+    const int block_shapes_yz[4][2] = { { 1, 1 }, { 2, 1 }, { 4, 1 }, { 1, 2 } };
+    for (const int bx : { 1, 4, 8, 16 })
+    {
+        for (const int* shape_yz : block_shapes_yz)
+        {
+            const KernelConfiguration config = { { bx, shape_yz[0], shape_yz[1] }, false, { 0, 0, 0 } };
+            if (dims[0] % config.block_size[0] != 0 || dims[1] % config.block_size[1] != 0 || dims[2] % config.block_size[2] != 0)
+                continue;
+            if ((config.block_size[1] > 1 && dimensionality < 2) || (config.block_size[2] > 1 && dimensionality < 3))
+                continue;
+            if (this->IsUsingImageObjects() && bx > 4)
+                continue; // (a texel holds at most 4 values)
+            try_configuration(config);
+            if (config.block_size[1] == 1 && config.block_size[2] == 1 && !this->IsUsingImageObjects())
+                try_configuration({ { bx, 1, 1 }, true, { 0, 0, 0 } });
+        }
+    }
+
+    // then try some work-group shapes with the fastest, if it left them to the OpenCL implementation
+    if (!fastest.use_local_memory)
+    {
+        const KernelConfiguration fastest_block = fastest;
+        const size_t work_group_shapes[8][3] = { { 64, 1, 1 }, { 32, 2, 1 }, { 16, 4, 1 }, { 8, 8, 1 }, { 32, 8, 1 },
+            { 16, 16, 1 }, { 8, 8, 2 }, { 4, 4, 4 } };
+        for (const size_t* shape : work_group_shapes)
+        {
+            KernelConfiguration config = fastest_block;
+            bool fits = true;
+            for (int axis = 0; axis < 3; axis++)
+            {
+                // each work-group must be no bigger than the range, and (in OpenCL 1.x) divide it exactly
+                const size_t range = dims[axis] / config.block_size[axis];
+                fits = fits && shape[axis] <= range && range % shape[axis] == 0;
+                config.local_work_size[axis] = shape[axis];
+            }
+            if (fits)
+                try_configuration(config);
+        }
+    }
+
+    this->CollectKernelTime(); // (leave the timing runs out of the performance counters)
+    this->need_write_to_opencl_buffers = true; // (put back the values from before the timing runs)
+    return fastest;
+}
+
+// -------------------------------------------------------------------------
+
+double FormulaOpenCLImageRD::TimeConfiguration(const KernelConfiguration& config)
+{
+    // a few hundred steps, or a fraction of a second for large images, after a few to warm up
+    const int N_WARM_UP_STEPS = 10;
+    const int N_STEPS_PER_BATCH = 20;
+    const int MAX_STEPS = 300;
+    const double MIN_SECONDS = 0.2;
+    try
+    {
+        this->ApplyConfiguration(config);
+        this->ReloadKernelIfNeeded();
+        this->need_write_to_opencl_buffers = true; // (start each from the same values)
+        this->WriteToOpenCLBuffersIfNeeded();
+        this->RunKernels(N_WARM_UP_STEPS);
+        this->CollectKernelTime(); // (waits for them)
+        const double start = get_time_in_seconds();
+        int n_steps = 0;
+        double seconds = 0.0;
+        while (n_steps < MAX_STEPS && seconds < MIN_SECONDS)
+        {
+            this->RunKernels(N_STEPS_PER_BATCH);
+            this->CollectKernelTime();
+            n_steps += N_STEPS_PER_BATCH;
+            seconds = get_time_in_seconds() - start;
+        }
+        return seconds / n_steps;
+    }
+    catch (const exception&)
+    {
+        return numeric_limits<double>::infinity();
+    }
+}
+
+// -------------------------------------------------------------------------
+
+void FormulaOpenCLImageRD::ApplyConfiguration(const KernelConfiguration& config)
+{
+    copy(config.block_size, config.block_size + 3, this->block_size);
+    this->use_local_memory = config.use_local_memory;
+    this->SetLocalWorkSize(config.local_work_size);
+    this->need_reload_formula = true;
+}
+
+// -------------------------------------------------------------------------
+
+void FormulaOpenCLImageRD::RunKernels(int n_steps)
+{
+    if (!this->IsSkippingQuiescentTiles() && this->stage_kernels.empty())
+    {
+        OpenCLImageRD::RunKernels(n_steps);
+        return;
+    }
+
+    const int NC = this->GetNumberOfChemicals();
+    const bool tracking_activity = this->IsSkippingQuiescentTiles();
+    int num_tiles[3], tile_size[3];
+    this->GetActivityTiles(num_tiles, tile_size);
+    const size_t tiles_range[3] = { static_cast<size_t>(num_tiles[0]), static_cast<size_t>(num_tiles[1]), static_cast<size_t>(num_tiles[2]) };
+
+    // the kernel takes the activity mask after the chemicals, then the staged inputs
+    cl_int ret;
+    if (tracking_activity)
+    {
+        ret = clSetKernelArg(this->kernel, 3 * NC, sizeof(cl_mem), &this->tile_active_buffer);
+        throwOnError(ret, "FormulaOpenCLImageRD::RunKernels : clSetKernelArg failed: ");
+        ret = clSetKernelArg(this->activity_kernel, 2, sizeof(cl_mem), &this->tile_quiet_buffer);
+        throwOnError(ret, "FormulaOpenCLImageRD::RunKernels : clSetKernelArg failed: ");
+        ret = clSetKernelArg(this->activity_kernel, 3, sizeof(cl_mem), &this->tile_active_buffer);
+        throwOnError(ret, "FormulaOpenCLImageRD::RunKernels : clSetKernelArg failed: ");
+    }
+    const int iFirstStagedInput = 3 * NC + (tracking_activity ? 2 : 0);
+    for (size_t i = 0; i < this->staged_input_buffers.size(); i++)
+    {
+        ret = clSetKernelArg(this->kernel, iFirstStagedInput + static_cast<int>(i), sizeof(cl_mem), &this->staged_input_buffers[i]);
+        throwOnError(ret, "FormulaOpenCLImageRD::RunKernels : clSetKernelArg failed: ");
+    }
+
+    for (int it = 0; it < n_steps; it++)
+    {
+        this->RunStages();
+        if (!tracking_activity)
+        {
+            this->RunKernel();
+            continue;
+        }
+
+        ret = clSetKernelArg(this->kernel, 3 * NC + 1, sizeof(cl_mem), &this->tile_changed_buffers[this->iChangedBuffer]);
+        throwOnError(ret, "FormulaOpenCLImageRD::RunKernels : clSetKernelArg failed: ");
+        this->RunKernel();
+
+        // work out which tiles to run next step, from the ones that changed in this step
+        ret = clSetKernelArg(this->activity_kernel, 0, sizeof(cl_mem), &this->tile_changed_buffers[this->iChangedBuffer]);
+        throwOnError(ret, "FormulaOpenCLImageRD::RunKernels : clSetKernelArg failed: ");
+        ret = clSetKernelArg(this->activity_kernel, 1, sizeof(cl_mem), &this->tile_changed_buffers[1 - this->iChangedBuffer]);
+        throwOnError(ret, "FormulaOpenCLImageRD::RunKernels : clSetKernelArg failed: ");
+        ret = clEnqueueNDRangeKernel(this->command_queue, this->activity_kernel, 3, NULL, tiles_range, NULL, 0, NULL, NULL);
+        throwOnError(ret, "FormulaOpenCLImageRD::RunKernels : clEnqueueNDRangeKernel failed: ");
+        this->iChangedBuffer = 1 - this->iChangedBuffer;
+    }
+}
+
+// -------------------------------------------------------------------------
+
+bool FormulaOpenCLImageRD::IsUsingImageObjects() const
+{
+    // (OpenCL 1.1 can only write 3D images through an extension)
+    return this->use_image_objects && (this->GetArenaDimensionality() < 3 || this->HasDeviceExtension("cl_khr_3d_image_writes"));
+}
+
+// -------------------------------------------------------------------------
+
+OpenCLImageRD::Storage FormulaOpenCLImageRD::GetStorage() const
+{
+    // (storing doubles as floats is the only conversion that needs the double data type)
+    if (this->storage == Storage::Float && this->data_type != VTK_DOUBLE)
+        return Storage::Same;
+    return this->storage;
+}
+
+// -------------------------------------------------------------------------
+
+int FormulaOpenCLImageRD::GetStencilRadius(const string& formula) const
+{
+    const InputsNeeded inputs_needed = DetectInputsNeeded(formula, this->GetNumberOfChemicals(),
+        this->GetArenaDimensionality(), this->block_size, this->GetAccuracy(), this->parameter_maps, {});
+    int radius = 0;
+    for (const InputPoint& input_point : inputs_needed.cells_needed)
+    {
+        radius = max(radius, abs(input_point.point.x));
+        radius = max(radius, abs(input_point.point.y));
+        radius = max(radius, abs(input_point.point.z));
+    }
+    return radius;
+}
+
+// -------------------------------------------------------------------------
+
 void FormulaOpenCLImageRD::InitializeFromXML(vtkXMLDataElement *rd, bool &warn_to_update)
 {
     OpenCLImageRD::InitializeFromXML(rd,warn_to_update);
@@ -630,6 +1715,20 @@ void FormulaOpenCLImageRD::InitializeFromXML(vtkXMLDataElement *rd, bool &warn_t
     read_optional_attribute(xml_formula, "block_size_x", this->block_size[0]);
     read_optional_attribute(xml_formula, "block_size_y", this->block_size[1]);
     read_optional_attribute(xml_formula, "block_size_z", this->block_size[2]);
+    read_optional_attribute(xml_formula, "quiescent_steps", this->quiescent_steps);
+    read_optional_attribute(xml_formula, "activity_threshold", this->activity_threshold);
+    int ghost_cells = this->use_ghost_cells ? 1 : 0;
+    read_optional_attribute(xml_formula, "ghost_cells", ghost_cells);
+    this->use_ghost_cells = ghost_cells != 0;
+    int image_objects = this->use_image_objects ? 1 : 0;
+    read_optional_attribute(xml_formula, "image_objects", image_objects);
+    this->use_image_objects = image_objects != 0;
+    int staged_stencils = this->stage_stencils ? 1 : 0;
+    read_optional_attribute(xml_formula, "staged_stencils", staged_stencils);
+    this->stage_stencils = staged_stencils != 0;
+    int auto_tune = this->auto_tune ? 1 : 0;
+    read_optional_attribute(xml_formula, "auto_tune", auto_tune);
+    this->SetAutoTune(auto_tune != 0);
 
     // number_of_chemicals:
     read_required_attribute(xml_formula,"number_of_chemicals",this->n_chemicals);
@@ -648,6 +1747,21 @@ void FormulaOpenCLImageRD::InitializeFromXML(vtkXMLDataElement *rd, bool &warn_t
         this->SetAccuracy(static_cast<AbstractRD::Accuracy>(it - accuracy_labels));
     }
 
+    // storage
+    string storage_string;
+    read_optional_attribute(xml_formula, "storage", storage_string);
+    if (storage_string.size() > 0)
+    {
+        const char* storage_labels[3] = { "same", "half", "float" };
+        auto it = find(storage_labels, storage_labels + 3, storage_string);
+        if (it == storage_labels + 3)
+        {
+            throw std::runtime_error("unknown storage attribute: " + storage_string);
+        }
+        this->storage = static_cast<Storage>(it - storage_labels);
+        this->need_reload_formula = true;
+    }
+
     string formula = trim_multiline_string(xml_formula->GetCharacterData());
     //this->TestFormula(formula); // will throw on error
     this->SetFormula(formula); // (won't throw yet)
@@ -671,6 +1785,32 @@ vtkSmartPointer<vtkXMLDataElement> FormulaOpenCLImageRD::GetAsXML(bool generate_
     formula->SetIntAttribute("block_size_z", this->block_size[2]);
     const char* accuracy_labels[3] = { "low", "medium", "high" };
     formula->SetAttribute("accuracy", accuracy_labels[static_cast<int>(this->accuracy)]);
+    if (this->IsSkippingQuiescentTiles())
+    {
+        formula->SetIntAttribute("quiescent_steps", this->quiescent_steps);
+        formula->SetFloatAttribute("activity_threshold", this->activity_threshold);
+    }
+    if (this->use_ghost_cells)
+    {
+        formula->SetIntAttribute("ghost_cells", 1);
+    }
+    if (this->use_image_objects)
+    {
+        formula->SetIntAttribute("image_objects", 1);
+    }
+    if (this->stage_stencils)
+    {
+        formula->SetIntAttribute("staged_stencils", 1);
+    }
+    if (this->auto_tune)
+    {
+        formula->SetIntAttribute("auto_tune", 1);
+    }
+    if (this->storage != Storage::Same)
+    {
+        const char* storage_labels[3] = { "same", "half", "float" };
+        formula->SetAttribute("storage", storage_labels[static_cast<int>(this->storage)]);
+    }
     string f = this->GetFormula();
     f = ReplaceAllSubstrings(f, "\n", "\n        "); // indent the lines
     formula->SetCharacterData(f.c_str(), (int)f.length());
@@ -689,6 +1829,14 @@ void FormulaOpenCLImageRD::SetParameterValue(int iParam,float val)
 
 // -------------------------------------------------------------------------
 
+void FormulaOpenCLImageRD::SetParameterMapName(int iChemical,const string& name)
+{
+    AbstractRD::SetParameterMapName(iChemical,name);
+    this->need_reload_formula = true;
+}
+
+// -------------------------------------------------------------------------
+
 void FormulaOpenCLImageRD::SetParameterName(int iParam,const string& s)
 {
     AbstractRD::SetParameterName(iParam,s);
@@ -15,8 +15,16 @@
     You should have received a copy of the GNU General Public License
     along with Ready. If not, see <http://www.gnu.org/licenses/>.         */
 
+#ifndef __FORMULAOPENCLIMAGERD__
+#define __FORMULAOPENCLIMAGERD__
+
 // local:
 #include "OpenCLImageRD.hpp"
+#include "TuningCache.hpp"
+
+// STL:
+#include <utility>
+#include <vector>
 
 /// An RD system that uses an OpenCL formula snippet.
 /** An N-dimensional (1D,2D,3D) OpenCL RD implementations with n chemicals
@@ -28,6 +36,7 @@ class FormulaOpenCLImageRD : public OpenCLImageRD
     public:
 
         FormulaOpenCLImageRD(int opencl_platform,int opencl_device,int data_type);
+        ~FormulaOpenCLImageRD() override;
 
         void InitializeFromXML(vtkXMLDataElement* rd,bool& warn_to_update) override;
         vtkSmartPointer<vtkXMLDataElement> GetAsXML(bool generate_initial_pattern_when_loading) const override;
@@ -54,11 +63,112 @@ class FormulaOpenCLImageRD : public OpenCLImageRD
         void SetParameterName(int iParam,const std::string& s) override;
         void SetParameterValue(int iParam,float val) override;
 
+        /// The parameter maps are never written, so they share one buffer and aren't read back after each update.
+        bool HasParameterMapOption() const override { return true; }
+        void SetParameterMapName(int iChemical,const std::string& name) override;
+
         bool HasEditableWrapOption() const override { return true; }
         void SetWrap(bool w) override;
         bool HasEditableDataType() const override { return true; }
 
+        /// Tiles that haven't changed by more than activity_threshold for quiescent_steps steps are skipped until a neighbor changes.
+        bool IsSkippingQuiescentTiles() const { return this->quiescent_steps > 0; }
+
+        /// The buffers can be padded with ghost cells, so that the stencils read their neighbors without wrapping or clamping.
+        virtual bool IsUsingGhostCells() const { return this->use_ghost_cells; }
+        bool NeedsPowerOfTwoDimensions() const override { return !this->IsUsingGhostCells() && !this->IsUsingImageObjects(); }
+
+        /// The chemicals can be stepped in image objects instead of buffers, whose samplers cache the neighbors and
+        /// handle the edges in hardware. In 3D this needs cl_khr_3d_image_writes, without which we keep to the buffers.
+        virtual bool IsUsingImageObjects() const;
+
+        /// The high-order stencils (bilaplacian and trilaplacian) can be staged: passes before the main kernel apply the
+        /// laplacian to fill a buffer for each, which the main kernel then applies the last laplacian to, reading far
+        /// fewer cells. (The result differs slightly from the single stencil, and at the edges when not wrapping.)
+        virtual bool IsStagingStencils() const { return this->stage_stencils; }
+
+        /// The buffers can store the chemicals as a smaller type than they are computed in, to save memory and bandwidth.
+        virtual Storage GetStorage() const;
+
+        /// The chemicals that the formula never changes can use the same buffer for input and output, which the kernel
+        /// then only reads.
+        virtual bool IsSharingConstantBuffers() const { return true; }
+
+        /// If on, the block size, local memory and work-group size are the fastest found for this kernel, device and
+        /// grid size, remembered in the TuningCache so that each is only searched for once.
+        bool HasAutoTuneOption() const override { return true; }
+        bool GetAutoTune() const override { return this->auto_tune; }
+        void SetAutoTune(bool val) override;
+
+    protected:
+
+        void RunKernels(int n_steps) override;
+        void ReloadKernelIfNeeded() override;
+        void WriteToOpenCLBuffersIfNeeded() override;
+        void TuneKernelIfNeeded() override;
+        size_t GetBytesPerCellUpdate() const override;
+
+        /// As AssembleKernelSourceFromFormula but with the given wrap, parameters, local memory, ghost cells and activity
+        /// tracking settings.
+        std::string AssembleKernelSourceWithOptions(const std::string& formula, bool wrap,
+            const std::vector<Parameter>& parameters, bool use_local_memory, bool use_ghost_cells, bool track_activity) const;
+
+        /// Returns the furthest (in cells, along any axis) that the formula reads from the cell being updated.
+        int GetStencilRadius(const std::string& formula) const;
+
+    protected:
+
+        int quiescent_steps;        ///< if more than zero, skip tiles once they have been still for this many steps
+        float activity_threshold;   ///< a tile is still if no chemical changes by more than this in a step
+        bool use_ghost_cells;       ///< if true, pad the buffers by the stencil radius, refreshed before each step
+        bool use_image_objects;     ///< if true, the kernel steps the chemicals in images, if the device can write them
+        bool stage_stencils;        ///< if true, the inner laplacians of the high-order stencils are computed by earlier passes
+        Storage storage;            ///< as requested, which GetStorage() ignores if it is the same size as the data type
+
+    private:
+
+        /// Gets the number of tiles along each axis for the activity mask, and their size in cells.
+        void GetActivityTiles(int num_tiles[3], int tile_size[3]) const;
+
+        /// Marks every tile as active.
+        void ResetActivityMask();
+
+        void ReleaseActivityMask();
+
+        /// Runs the passes that fill the staged inputs of the main kernel from the current buffers.
+        void RunStages();
+
+        void ReleaseStages();
+
+        /// Returns the key for this kernel in the TuningCache, from everything that affects its speed apart from the
+        /// settings being tuned.
+        std::string GetTuningKey() const;
+
+        /// Times each candidate on the current values, which are restored afterwards, and returns the fastest.
+        KernelConfiguration FindFastestConfiguration();
+
+        /// Returns the time per step (in seconds) with config, or infinity if it fails to build or run.
+        double TimeConfiguration(const KernelConfiguration& config);
+
+        void ApplyConfiguration(const KernelConfiguration& config);
+
     private:
 
         int block_size[3];
+
+        bool auto_tune;
+        bool is_tuned;              ///< if true, the current settings came from the TuningCache
+
+        cl_program activity_program;
+        cl_kernel activity_kernel;
+        cl_mem tile_active_buffer, tile_quiet_buffer, tile_changed_buffers[2];
+        int iChangedBuffer;
+
+        // for IsStagingStencils():
+        std::vector<cl_program> stage_programs;
+        std::vector<cl_kernel> stage_kernels;               ///< one for each pass, in order
+        std::vector<std::pair<int, int>> staged_buffers;    ///< the pass (from 1) and the chemical of each staged input
+        std::vector<cl_mem> staged_input_buffers;           ///< filled by the passes, read by the main kernel
 };
+
+#endif
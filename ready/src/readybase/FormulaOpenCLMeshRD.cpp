@@ -71,25 +71,26 @@ std::string FormulaOpenCLMeshRD::AssembleKernelSourceFromFormula(const std::stri
         kernel_source << "global " << this->data_type_string << " *" << GetChemicalName(i) << "_in,";
     for(int i=0;i<NC;i++)
         kernel_source << "global " << this->data_type_string << " *" << GetChemicalName(i) << "_out,";
-    kernel_source << "global int* neighbor_indices,global float* neighbor_weights,const int max_neighbors)\n";
+    kernel_source << "global int* neighbor_indices,global float* neighbor_weights,const int max_neighbors,";
+    kernel_source << "global const int* L_offsets,global const int* L_rows,global const int* L_columns,global const float* L_values,const int L_stride,const int L_format)\n";
     // output the body
     kernel_source << "{\n";
-    kernel_source << indent << "const int index_x = get_global_id(0);\n";
+    kernel_source << SparseMatrix::GetOpenCLRowSetup(indent);
     for(int i=0;i<NC;i++)
         kernel_source << indent << this->data_type_string << " " << GetChemicalName(i) << " = " << GetChemicalName(i) << "_in[index_x];\n";
     kernel_source << "\n";
-    // compute the laplacians
+    // compute the laplacians, as one row of the sparse matrix-vector product for each chemical
+    const vector<string> formula_tokens = tokenize_for_keywords(f);
     kernel_source << indent << "// compute the Laplacians\n";
     for(int i=0;i<NC;i++)
-        kernel_source << indent << this->data_type_string << " laplacian_" << GetChemicalName(i) << " = -" << GetChemicalName(i) << ";\n";
-    kernel_source << indent << "int _offset = index_x * max_neighbors;\n";
-    kernel_source << indent << "for(int _i=0;_i<max_neighbors;_i++)\n" << indent << "{\n";
+        kernel_source << indent << this->data_type_string << " laplacian_" << GetChemicalName(i) << " = 0.0" << this->data_type_suffix << ";\n";
+    kernel_source << indent << "for(int _k=0,_j=_start;_k<_count;_k++,_j+=_step)\n" << indent << "{\n";
+    kernel_source << indent << indent << "const int _column = L_columns[_j];\n";
+    kernel_source << indent << indent << "const " << this->data_type_string << " _value = L_values[_j];\n";
     for(int i=0;i<NC;i++)
-        kernel_source << indent << indent << "laplacian_" << GetChemicalName(i) << " += " << GetChemicalName(i)
-                      << "_in[neighbor_indices[_offset+_i]] * neighbor_weights[_offset+_i];\n";
+        if(UsingKeyword(formula_tokens, "laplacian_" + GetChemicalName(i)))
+            kernel_source << indent << indent << "laplacian_" << GetChemicalName(i) << " += " << GetChemicalName(i) << "_in[_column] * _value;\n";
     kernel_source << indent << "}\n";
-    for(int i=0;i<NC;i++)
-        kernel_source << indent << "laplacian_" << GetChemicalName(i) << " *= 4.0" << this->data_type_suffix << ";\n"; // TODO: not sure about 3D meshes
     kernel_source << "\n";
     // the parameters (assume all float for now)
     kernel_source << indent << "// parameters:\n";
@@ -0,0 +1,241 @@
+/*  Copyright 2011-2024 The Ready Bunch
+
+    This file is part of Ready.
+
+    Ready is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ready is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ready. If not, see <http://www.gnu.org/licenses/>.         */
+
+// local:
+#include "FrameRecorder.hpp"
+#include "Properties.hpp"
+#include "scene_items.hpp"
+
+// VTK:
+#include <vtkCellDataToPointData.h>
+#include <vtkImageData.h>
+#include <vtkJPEGWriter.h>
+#include <vtkPLYWriter.h>
+#include <vtkPNGWriter.h>
+#include <vtkPolyData.h>
+#include <vtkPolyDataNormals.h>
+#include <vtkScalarsToColors.h>
+#include <vtkSmartPointer.h>
+#include <vtkXMLPolyDataWriter.h>
+
+// STL:
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <stdexcept>
+
+using namespace std;
+
+// ---------------------------------------------------------------------
+
+/// Returns the extension of the filename in lower case, without the dot.
+static string GetLowerCaseExtension(const string& filename)
+{
+    const size_t dot = filename.find_last_of('.');
+    if (dot == string::npos)
+        return string();
+    string ext = filename.substr(dot + 1);
+    transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return static_cast<char>(tolower(c)); });
+    return ext;
+}
+
+// ---------------------------------------------------------------------
+
+FrameRecorder::FrameRecorder(int n_threads, int max_queued)
+    : n_running(0)
+    , stopping(false)
+{
+    if (n_threads <= 0)
+    {
+        // leave one core for the simulation and the UI, and don't bother with more than 4 since writing the files will be the limit
+        const int n_hardware = static_cast<int>(thread::hardware_concurrency()); // (can return 0 if unknown)
+        n_threads = max(1, min(4, n_hardware - 1));
+    }
+    this->max_queued = static_cast<size_t>(max_queued > 0 ? max_queued : 2 * n_threads);
+    this->threads.reserve(n_threads);
+    for (int iThread = 0; iThread < n_threads; iThread++)
+        this->threads.emplace_back(&FrameRecorder::WorkerLoop, this);
+}
+
+// ---------------------------------------------------------------------
+
+FrameRecorder::~FrameRecorder()
+{
+    try { this->Finish(); }
+    catch (...) {} // nowhere to report it
+    {
+        lock_guard<mutex> lock(this->m);
+        this->stopping = true;
+    }
+    this->job_added.notify_all();
+    for (thread& t : this->threads)
+        t.join();
+}
+
+// ---------------------------------------------------------------------
+
+void FrameRecorder::Submit(function<void()> job)
+{
+    unique_lock<mutex> lock(this->m);
+    this->job_done.wait(lock, [&] { return this->queue.size() < this->max_queued || this->error; });
+    this->RethrowErrorIfAny(lock);
+    this->queue.push_back(move(job));
+    lock.unlock();
+    this->job_added.notify_one();
+}
+
+// ---------------------------------------------------------------------
+
+void FrameRecorder::SubmitImage(function<void(vtkImageData*)> make_image, const string& filename)
+{
+    // check the file type now, rather than finding out on a worker thread after a frame has been made
+    const string ext = GetLowerCaseExtension(filename);
+    if (ext != "png" && ext != "jpg" && ext != "jpeg")
+        throw runtime_error("FrameRecorder::SubmitImage : unsupported image file type: " + filename);
+
+    this->Submit([make_image, filename, ext]()
+    {
+        vtkSmartPointer<vtkImageData> image = vtkSmartPointer<vtkImageData>::New();
+        make_image(image);
+        vtkSmartPointer<vtkImageWriter> writer;
+        if (ext == "png")
+            writer = vtkSmartPointer<vtkPNGWriter>::New();
+        else
+            writer = vtkSmartPointer<vtkJPEGWriter>::New();
+        writer->SetInputData(image);
+        writer->SetFileName(filename.c_str());
+        writer->Write();
+    });
+}
+
+// ---------------------------------------------------------------------
+
+void FrameRecorder::SubmitMesh(function<void(vtkPolyData*)> make_mesh, const string& filename, const Properties& render_settings)
+{
+    const string ext = GetLowerCaseExtension(filename);
+    if (ext != "vtp" && ext != "ply")
+        throw runtime_error("FrameRecorder::SubmitMesh : unsupported mesh file type: " + filename);
+
+    this->Submit([make_mesh, filename, ext, render_settings]()
+    {
+        vtkSmartPointer<vtkPolyData> mesh = vtkSmartPointer<vtkPolyData>::New();
+        make_mesh(mesh);
+        vtkSmartPointer<vtkPolyDataNormals> normals = vtkSmartPointer<vtkPolyDataNormals>::New();
+        normals->SetInputData(mesh);
+        normals->SplittingOff();
+        if (ext == "vtp")
+        {
+            vtkSmartPointer<vtkXMLPolyDataWriter> writer = vtkSmartPointer<vtkXMLPolyDataWriter>::New();
+            writer->SetInputConnection(normals->GetOutputPort());
+            writer->SetFileName(filename.c_str());
+            writer->Write();
+        }
+        else
+        {
+            vtkSmartPointer<vtkCellDataToPointData> to_point_data = vtkSmartPointer<vtkCellDataToPointData>::New();
+            to_point_data->SetInputConnection(normals->GetOutputPort());
+            vtkSmartPointer<vtkPLYWriter> writer = vtkSmartPointer<vtkPLYWriter>::New();
+            writer->SetInputConnection(to_point_data->GetOutputPort());
+            writer->SetFileName(filename.c_str());
+            writer->SetLookupTable(GetColorMap(render_settings));
+            writer->SetArrayName(render_settings.GetProperty("active_chemical").GetChemical().c_str());
+            writer->Write();
+        }
+    });
+}
+
+// ---------------------------------------------------------------------
+
+void FrameRecorder::SubmitRawData(vector<vector<float>> chemicals, const string& filename)
+{
+    this->Submit([chemicals = move(chemicals), filename]()
+    {
+        ofstream out(filename, ios::binary);
+        for (const vector<float>& values : chemicals)
+            out.write(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(float));
+        if (!out)
+            throw runtime_error("FrameRecorder::SubmitRawData : failed to write " + filename);
+    });
+}
+
+// ---------------------------------------------------------------------
+
+void FrameRecorder::Finish()
+{
+    unique_lock<mutex> lock(this->m);
+    this->job_done.wait(lock, [&] { return (this->queue.empty() && this->n_running == 0) || this->error; });
+    if (this->error)
+    {
+        // wait for the jobs already running, so that the caller can rely on nothing happening after we return
+        this->job_done.wait(lock, [&] { return this->n_running == 0; });
+    }
+    this->RethrowErrorIfAny(lock);
+}
+
+// ---------------------------------------------------------------------
+
+size_t FrameRecorder::GetNumberOfPendingJobs() const
+{
+    lock_guard<mutex> lock(this->m);
+    return this->queue.size() + this->n_running;
+}
+
+// ---------------------------------------------------------------------
+
+void FrameRecorder::RethrowErrorIfAny(unique_lock<mutex>& lock)
+{
+    if (!this->error)
+        return;
+    exception_ptr e = this->error;
+    this->error = nullptr; // (so that the recorder can be used again once the caller has dealt with it)
+    lock.unlock();
+    rethrow_exception(e);
+}
+
+// ---------------------------------------------------------------------
+
+void FrameRecorder::WorkerLoop()
+{
+    unique_lock<mutex> lock(this->m);
+    while (true)
+    {
+        this->job_added.wait(lock, [&] { return !this->queue.empty() || this->stopping; });
+        if (this->queue.empty())
+            return; // stopping
+        function<void()> job = move(this->queue.front());
+        this->queue.pop_front();
+        this->n_running++;
+        lock.unlock();
+        this->job_done.notify_all(); // there is room in the queue now
+
+        exception_ptr job_error;
+        try { job(); }
+        catch (...) { job_error = current_exception(); }
+        job = nullptr; // release the snapshot before taking the lock
+
+        lock.lock();
+        this->n_running--;
+        if (job_error && !this->error)
+        {
+            this->error = job_error;
+            this->queue.clear(); // no point writing the rest of the frames
+        }
+        this->job_done.notify_all();
+    }
+}
+
+// ---------------------------------------------------------------------
@@ -0,0 +1,95 @@
+/*  Copyright 2011-2024 The Ready Bunch
+
+    This file is part of Ready.
+
+    Ready is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ready is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ready. If not, see <http://www.gnu.org/licenses/>.         */
+
+#ifndef __FRAMERECORDER__
+#define __FRAMERECORDER__
+
+// local:
+class Properties;
+
+// VTK:
+class vtkImageData;
+class vtkPolyData;
+
+// STL:
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/// Runs the slow part of recording frames (color mapping, meshing, encoding, writing) on worker threads.
+/** The caller takes a cheap snapshot of the system on its own thread (see AbstractRD::GetAs2DImageLater()) and submits a
+    job that turns the snapshot into a file. At most max_queued jobs can be waiting at once: Submit() blocks when the
+    queue is full, so a simulation that runs faster than the frames can be written slows down to match instead of
+    filling memory with snapshots. If a job throws, the first error is rethrown on the caller's thread by the next
+    call to Submit() or Finish(), and the jobs still waiting are dropped. */
+class FrameRecorder
+{
+    public:
+
+        /// n_threads of 0 means pick a number based on the hardware. max_queued of 0 means twice the number of threads.
+        explicit FrameRecorder(int n_threads = 0, int max_queued = 0);
+        /// Waits for the queued jobs to finish. Any error is discarded.
+        ~FrameRecorder();
+
+        FrameRecorder(const FrameRecorder&) = delete;
+        FrameRecorder& operator=(const FrameRecorder&) = delete;
+
+        /// Adds a job to the queue, first waiting for room if the queue is full.
+        void Submit(std::function<void()> job);
+
+        /// Submits a job that makes an image and writes it to a .png or .jpg file, depending on the filename's extension.
+        void SubmitImage(std::function<void(vtkImageData*)> make_image, const std::string& filename);
+
+        /// Submits a job that makes a mesh and writes it to a .vtp or .ply file, depending on the filename's extension.
+        /** The ply files are colored using the color map in render_settings. */
+        void SubmitMesh(std::function<void(vtkPolyData*)> make_mesh, const std::string& filename, const Properties& render_settings);
+
+        /// Submits a job that writes the values of each chemical in turn as 32-bit floats in native byte order.
+        void SubmitRawData(std::vector<std::vector<float>> chemicals, const std::string& filename);
+
+        /// Waits until every submitted job has finished. Rethrows the first error from any job.
+        void Finish();
+
+        int GetNumberOfThreads() const { return static_cast<int>(this->threads.size()); }
+        size_t GetNumberOfPendingJobs() const;
+
+    private:
+
+        void WorkerLoop();
+        void RethrowErrorIfAny(std::unique_lock<std::mutex>& lock);
+
+    private:
+
+        std::vector<std::thread> threads;
+        std::deque<std::function<void()>> queue;
+        size_t max_queued;
+        size_t n_running;       ///< number of jobs that have been taken off the queue but not yet finished
+        bool stopping;
+        std::exception_ptr error;
+
+        mutable std::mutex m;
+        std::condition_variable job_added;      ///< signalled when a job is queued, or when stopping
+        std::condition_variable job_done;       ///< signalled when a job is taken or finished, making room or progress
+};
+
+#endif
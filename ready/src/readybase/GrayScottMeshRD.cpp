@@ -17,6 +17,7 @@
 
 // local:
 #include "GrayScottMeshRD.hpp"
+#include "parallel.hpp"
 #include "utils.hpp"
 
 // VTK:
@@ -25,6 +26,12 @@
 #include <vtkCellData.h>
 #include <vtkMinimalStandardRandomSequence.h>
 
+// STL:
+#include <algorithm>
+#include <stdexcept>
+
+using namespace std;
+
 // ---------------------------------------------------------------------
 
 GrayScottMeshRD::GrayScottMeshRD()
@@ -37,91 +44,86 @@ GrayScottMeshRD::GrayScottMeshRD()
     this->AddParameter("D_b",0.041f);
     this->AddParameter("k",0.06f);
     this->AddParameter("F",0.035f);
-    this->buffer = vtkSmartPointer<vtkUnstructuredGrid>::New();
+    for(int iChem=0;iChem<2;iChem++)
+    {
+        this->buffer[iChem] = vtkSmartPointer<vtkFloatArray>::New();
+        this->buffer[iChem]->SetName(GetChemicalName(iChem).c_str());
+    }
 }
 
 // ---------------------------------------------------------------------
 
 void GrayScottMeshRD::InternalUpdate(int n_steps)
 {
-    float timestep = this->GetParameterValueByName("timestep");
-    float D_a = this->GetParameterValueByName("D_a");
-    float D_b = this->GetParameterValueByName("D_b");
-    float k = this->GetParameterValueByName("k");
-    float F = this->GetParameterValueByName("F");
-
-    vtkFloatArray *source_a,*source_b;
-    vtkFloatArray *target_a,*target_b;
-    float dda,ddb,aval,bval,da,db;
-    int neighbor_index;
-    float diffusion_coefficient;
-
-    for(int iStep=0;iStep<n_steps;iStep++)
+    const float timestep = this->GetParameterValueByName("timestep");
+    const float D_a = this->GetParameterValueByName("D_a");
+    const float D_b = this->GetParameterValueByName("D_b");
+    const float k = this->GetParameterValueByName("k");
+    const float F = this->GetParameterValueByName("F");
+
+    const vtkIdType n_cells = this->mesh->GetNumberOfCells();
+
+    // look up the raw storage once, rather than per step and per value
+    vtkFloatArray *mesh_arrays[2];
+    float *data[2][2]; // [buffer][chemical], where buffer 0 is the mesh
+    for(int iChem=0;iChem<2;iChem++)
     {
-        if(iStep%2)
-        {
-            source_a = vtkFloatArray::SafeDownCast( this->buffer->GetCellData()->GetArray(GetChemicalName(0).c_str()) );
-            source_b = vtkFloatArray::SafeDownCast( this->buffer->GetCellData()->GetArray(GetChemicalName(1).c_str()) );
-            target_a = vtkFloatArray::SafeDownCast( this->mesh->GetCellData()->GetArray(GetChemicalName(0).c_str()) );
-            target_b = vtkFloatArray::SafeDownCast( this->mesh->GetCellData()->GetArray(GetChemicalName(1).c_str()) );
-        }
-        else
-        {
-            source_a = vtkFloatArray::SafeDownCast( this->mesh->GetCellData()->GetArray(GetChemicalName(0).c_str()) );
-            source_b = vtkFloatArray::SafeDownCast( this->mesh->GetCellData()->GetArray(GetChemicalName(1).c_str()) );
-            target_a = vtkFloatArray::SafeDownCast( this->buffer->GetCellData()->GetArray(GetChemicalName(0).c_str()) );
-            target_b = vtkFloatArray::SafeDownCast( this->buffer->GetCellData()->GetArray(GetChemicalName(1).c_str()) );
-        }
-        for(vtkIdType iCell=0;iCell<this->mesh->GetNumberOfCells();iCell++)
+        mesh_arrays[iChem] = vtkFloatArray::SafeDownCast( this->mesh->GetCellData()->GetArray(GetChemicalName(iChem).c_str()) );
+        if(!mesh_arrays[iChem])
+            throw runtime_error("GrayScottMeshRD::InternalUpdate : failed to find float array for chemical "+GetChemicalName(iChem));
+        if(this->buffer[iChem]->GetNumberOfTuples() != n_cells)
+            this->buffer[iChem]->SetNumberOfTuples(n_cells);
+        this->laplacian[iChem].resize(n_cells);
+        data[0][iChem] = mesh_arrays[iChem]->GetPointer(0);
+        data[1][iChem] = this->buffer[iChem]->GetPointer(0);
+    }
+    float *laplacian_a = this->laplacian[0].data();
+    float *laplacian_b = this->laplacian[1].data();
+
+    // each thread works on whole blocks of rows of the Laplacian operator, so it can apply it to its own cells independently
+    const SparseMatrix& L = this->laplacian_operator;
+    const int block_size = L.GetRowBlockSize();
+    const int n_threads = GetNumberOfWorkerThreads(n_cells, MIN_CELLS_PER_THREAD);
+    ParallelForSteps(n_threads, L.GetNumberOfRowBlocks(), n_steps, [&](int, int iStep, size_t begin_block, size_t end_block)
+    {
+        const float *source_a = data[iStep%2][0];
+        const float *source_b = data[iStep%2][1];
+        float *target_a = data[(iStep+1)%2][0];
+        float *target_b = data[(iStep+1)%2][1];
+        const int begin = static_cast<int>(begin_block) * block_size;
+        const int end = min(static_cast<int>(n_cells), static_cast<int>(end_block) * block_size);
+        // diffusion:
+        L.Multiply(source_a, laplacian_a, begin, end);
+        L.Multiply(source_b, laplacian_b, begin, end);
+        // reaction, cell by cell:
+        for(int iCell=begin;iCell<end;iCell++)
         {
-            // compute the laplacian
-            aval = source_a->GetValue(iCell);
-            bval = source_b->GetValue(iCell);
-            dda = 0.0f;
-            ddb = 0.0f;
-            for(int iNeighbor=0;iNeighbor<this->max_neighbors;iNeighbor++)
-            {
-                int k = iCell*this->max_neighbors + iNeighbor;
-                neighbor_index = this->cell_neighbor_indices[k];
-                diffusion_coefficient = this->cell_neighbor_weights[k];
-                dda += source_a->GetValue(neighbor_index) * diffusion_coefficient;
-                ddb += source_b->GetValue(neighbor_index) * diffusion_coefficient;
-            }
-            dda -= aval;
-            ddb -= bval;
-            dda *= 4.0f; // scale the Laplacian to be more similar to the 2D square grid version, so the same parameters work
-            ddb *= 4.0f;
+            const float aval = source_a[iCell];
+            const float bval = source_b[iCell];
             // Gray-Scott update step:
-            da = D_a * dda - aval*bval*bval + F*(1-aval);
-            db = D_b * ddb + aval*bval*bval - (F+k)*bval;
+            float da = D_a * laplacian_a[iCell] - aval*bval*bval + F*(1-aval);
+            float db = D_b * laplacian_b[iCell] + aval*bval*bval - (F+k)*bval;
             #if !defined( USE_SSE )
                 // avoid denormals manually
                 da += 1e-10f;
                 db += 1e-10f;
             #endif
             // apply the step:
-            target_a->SetValue(iCell,aval + timestep*da );
-            target_b->SetValue(iCell,bval + timestep*db );
+            target_a[iCell] = aval + timestep*da;
+            target_b[iCell] = bval + timestep*db;
         }
-    }
-    if(n_steps%2)
-        this->mesh->DeepCopy(this->buffer);
-}
+    });
 
-// ---------------------------------------------------------------------
-
-void GrayScottMeshRD::SetNumberOfChemicals(int n, bool reallocate_storage)
-{
-    MeshRD::SetNumberOfChemicals(n, reallocate_storage);
-    this->buffer->DeepCopy(this->mesh);
-}
-
-// ---------------------------------------------------------------------
-
-void GrayScottMeshRD::CopyFromMesh(vtkUnstructuredGrid *mesh2)
-{
-    MeshRD::CopyFromMesh(mesh2);
-    this->buffer->DeepCopy(this->mesh);
+    if(n_steps%2)
+    {
+        // the latest values are in the buffer, so swap it into the mesh (AddArray replaces the array with the same name)
+        for(int iChem=0;iChem<2;iChem++)
+        {
+            vtkSmartPointer<vtkFloatArray> previous = mesh_arrays[iChem];
+            this->mesh->GetCellData()->AddArray(this->buffer[iChem]);
+            this->buffer[iChem] = previous;
+        }
+    }
 }
 
 // ---------------------------------------------------------------------
@@ -18,6 +18,9 @@
 // local:
 #include "MeshRD.hpp"
 
+// VTK:
+class vtkFloatArray;
+
 /// Base class for all the inbuilt mesh implementations.
 // TODO: put in its own file (when there is more than one derived class)
 class InbuiltMeshRD : public MeshRD
@@ -33,21 +36,19 @@ class InbuiltMeshRD : public MeshRD
         bool HasEditableDataType() const override { return false; }
 };
 
-/// A non-OpenCL mesh implementation, just as an example.
+/// A non-OpenCL mesh implementation, multithreaded for when OpenCL is not available.
 class GrayScottMeshRD : public InbuiltMeshRD
 {
     public:
 
         GrayScottMeshRD();
 
-        void SetNumberOfChemicals(int n, bool reallocate_storage = false) override;
-        void CopyFromMesh(vtkUnstructuredGrid *mesh2) override;
-
     protected:
 
         void InternalUpdate(int n_steps) override;
 
     protected:
 
-        vtkSmartPointer<vtkUnstructuredGrid> buffer;           ///< temporary storage used during computation
+        vtkSmartPointer<vtkFloatArray> buffer[2];   ///< temporary storage used during computation, swapped with the mesh arrays
+        std::vector<float> laplacian[2];            ///< the result of applying the Laplacian operator to each chemical
 };
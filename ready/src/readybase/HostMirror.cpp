@@ -0,0 +1,178 @@
+/*  Copyright 2011-2024 The Ready Bunch
+
+    This file is part of Ready.
+
+    Ready is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ready is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ready. If not, see <http://www.gnu.org/licenses/>.         */
+
+// local:
+#include "HostMirror.hpp"
+#include "OpenCL_utils.hpp"
+using namespace OpenCL_utils;
+
+// STL:
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+// VTK:
+#include <vtkDataArray.h>
+
+using namespace std;
+
+// ---------------------------------------------------------------------
+
+HostMirror::HostMirror()
+    : buffer(NULL)
+    , mapped(NULL)
+    , size(0)
+    , last_queue(NULL)
+{
+}
+
+// ---------------------------------------------------------------------
+
+HostMirror::~HostMirror()
+{
+    try
+    {
+        this->Detach();
+    }
+    catch(...) {}
+}
+
+// ---------------------------------------------------------------------
+
+void HostMirror::Attach(vtkDataArray* new_array, cl_context context, cl_command_queue queue)
+{
+    this->Detach();
+
+    this->array = new_array;
+    this->size = static_cast<size_t>(new_array->GetNumberOfValues()) * new_array->GetDataTypeSize();
+    if (this->size == 0)
+        return; // (OpenCL doesn't allow empty buffers)
+
+    cl_int ret;
+    this->buffer = clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, this->size, NULL, &ret);
+    throwOnError(ret, "HostMirror::Attach : buffer creation failed: ");
+    clRetainCommandQueue(queue);
+    this->last_queue = queue;
+
+    const void* values = new_array->GetVoidPointer(0);
+    void* p = clEnqueueMapBuffer(queue, this->buffer, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, this->size, 0, NULL, NULL, &ret);
+    throwOnError(ret, "HostMirror::Attach : clEnqueueMapBuffer failed: ");
+    memcpy(p, values, this->size);
+    new_array->SetVoidArray(p, new_array->GetNumberOfValues(), 1); // (1 = the array mustn't free it)
+    this->mapped = p;
+}
+
+// ---------------------------------------------------------------------
+
+void HostMirror::Detach()
+{
+    if (this->IsAttachedTo(this->array))
+        this->GiveArrayItsOwnMemory(this->mapped);
+    if (this->mapped)
+        clEnqueueUnmapMemObject(this->last_queue, this->buffer, this->mapped, 0, NULL, NULL);
+    if (this->last_queue)
+    {
+        clFinish(this->last_queue);
+        clReleaseCommandQueue(this->last_queue);
+    }
+    if (this->buffer)
+        clReleaseMemObject(this->buffer);
+    this->array = NULL;
+    this->buffer = NULL;
+    this->mapped = NULL;
+    this->size = 0;
+    this->last_queue = NULL;
+}
+
+// ---------------------------------------------------------------------
+
+bool HostMirror::IsAttachedTo(vtkDataArray* a) const
+{
+    return a && a == this->array && this->mapped && a->GetVoidPointer(0) == this->mapped
+        && static_cast<size_t>(a->GetNumberOfValues()) * a->GetDataTypeSize() == this->size;
+}
+
+// ---------------------------------------------------------------------
+
+void HostMirror::CopyFrom(cl_mem source, cl_command_queue queue, cl_bool blocking,
+                          cl_uint n_events_to_wait_for, const cl_event* events_to_wait_for, cl_event* done_event)
+{
+    this->Unmap(queue, n_events_to_wait_for, events_to_wait_for);
+    cl_int ret = clEnqueueCopyBuffer(queue, source, this->buffer, 0, 0, this->size, 0, NULL, NULL);
+    if (ret != CL_SUCCESS)
+    {
+        this->Map(queue, CL_TRUE, NULL); // (so that the array is usable)
+        throwOnError(ret, "HostMirror::CopyFrom : buffer copying failed: ");
+    }
+    this->Map(queue, blocking, done_event);
+}
+
+// ---------------------------------------------------------------------
+
+void HostMirror::CopyTo(cl_mem target, cl_command_queue queue)
+{
+    this->Unmap(queue, 0, NULL);
+    cl_int ret = clEnqueueCopyBuffer(queue, this->buffer, target, 0, 0, this->size, 0, NULL, NULL);
+    this->Map(queue, CL_TRUE, NULL);
+    throwOnError(ret, "HostMirror::CopyTo : buffer copying failed: ");
+}
+
+// ---------------------------------------------------------------------
+
+void HostMirror::Unmap(cl_command_queue queue, cl_uint n_events_to_wait_for, const cl_event* events_to_wait_for)
+{
+    if (!this->mapped)
+        throw runtime_error("HostMirror::Unmap : not attached");
+    cl_int ret = clEnqueueUnmapMemObject(queue, this->buffer, this->mapped, n_events_to_wait_for, events_to_wait_for, NULL);
+    throwOnError(ret, "HostMirror::Unmap : clEnqueueUnmapMemObject failed: ");
+    if (queue != this->last_queue)
+    {
+        clRetainCommandQueue(queue);
+        clReleaseCommandQueue(this->last_queue);
+        this->last_queue = queue;
+    }
+}
+
+// ---------------------------------------------------------------------
+
+void HostMirror::Map(cl_command_queue queue, cl_bool blocking, cl_event* done_event)
+{
+    cl_int ret;
+    void* p = clEnqueueMapBuffer(queue, this->buffer, blocking, CL_MAP_READ | CL_MAP_WRITE, 0, this->size, 0, NULL, done_event, &ret);
+    if (ret != CL_SUCCESS)
+    {
+        // the old mapping is gone, so the array needs some memory of its own
+        this->mapped = NULL;
+        this->GiveArrayItsOwnMemory(NULL);
+        throwOnError(ret, "HostMirror::Map : clEnqueueMapBuffer failed: ");
+    }
+    if (p != this->mapped)
+        this->array->SetVoidArray(p, this->array->GetNumberOfValues(), 1);
+    this->mapped = p; // (usually the same place each time, but OpenCL doesn't promise that)
+}
+
+// ---------------------------------------------------------------------
+
+void HostMirror::GiveArrayItsOwnMemory(const void* values)
+{
+    void* own = calloc(this->size, 1);
+    if (!own)
+        throw runtime_error("HostMirror::GiveArrayItsOwnMemory : out of memory");
+    if (values)
+        memcpy(own, values, this->size);
+    this->array->SetVoidArray(own, this->array->GetNumberOfValues(), 0); // (0 = the array frees it, with free())
+}
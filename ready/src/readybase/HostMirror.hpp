@@ -0,0 +1,83 @@
+/*  Copyright 2011-2024 The Ready Bunch
+
+    This file is part of Ready.
+
+    Ready is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ready is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ready. If not, see <http://www.gnu.org/licenses/>.         */
+
+#ifndef __HOSTMIRROR__
+#define __HOSTMIRROR__
+
+// OpenCL:
+#ifdef __APPLE__
+    // OpenCL is linked at start up time on Mac OS 10.6+
+    #include <OpenCL/opencl.h>
+#else
+    // OpenCL is loaded dynamically on Windows and Linux
+    #include "OpenCL_Dyn_Load.h"
+#endif
+
+// VTK:
+#include <vtkSmartPointer.h>
+class vtkDataArray;
+
+/// An OpenCL buffer in host memory, which a VTK array uses in place of its own memory.
+/** The buffer is made with CL_MEM_ALLOC_HOST_PTR, so on a GPU it is pinned memory that copies to and from the device
+    go straight into, with no staging copy by the driver, and on a CPU device it is ordinary memory that maps for free.
+    The buffer is kept mapped except while copying, so the array can be read and changed as usual in the meantime. */
+class HostMirror
+{
+    public:
+
+        HostMirror();
+        /// Gives the array back its own copy of the values.
+        ~HostMirror();
+
+        HostMirror(const HostMirror&) = delete;
+        HostMirror& operator=(const HostMirror&) = delete;
+
+        /// Makes the buffer and makes the array use it, keeping the values the array has.
+        void Attach(vtkDataArray* array, cl_context context, cl_command_queue queue);
+
+        /// Gives the array back its own copy of the values, and releases the buffer.
+        void Detach();
+
+        /// Returns whether the array is using our memory. (It stops if its memory is reallocated, e.g. by DeepCopy.)
+        bool IsAttachedTo(vtkDataArray* array) const;
+
+        /// Copies a device buffer of the same size into the mirror, after the given events.
+        /** If not blocking then the array must not be used until done_event is complete. */
+        void CopyFrom(cl_mem source, cl_command_queue queue, cl_bool blocking = CL_TRUE,
+                      cl_uint n_events_to_wait_for = 0, const cl_event* events_to_wait_for = NULL, cl_event* done_event = NULL);
+
+        /// Copies the mirror, with any changes made through the array, into a device buffer of the same size.
+        void CopyTo(cl_mem target, cl_command_queue queue);
+
+    private:
+
+        void Unmap(cl_command_queue queue, cl_uint n_events_to_wait_for, const cl_event* events_to_wait_for);
+        void Map(cl_command_queue queue, cl_bool blocking, cl_event* done_event);
+
+        /// Points the array at its own memory, holding these values (or zeros if NULL).
+        void GiveArrayItsOwnMemory(const void* values);
+
+    private:
+
+        vtkSmartPointer<vtkDataArray> array;
+        cl_mem buffer;
+        void* mapped;                   ///< where the buffer is mapped, or NULL while it isn't
+        size_t size;
+        cl_command_queue last_queue;    ///< (retained) for unmapping when we detach
+};
+
+#endif
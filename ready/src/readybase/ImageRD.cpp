@@ -18,6 +18,7 @@
 // local:
 #include "ImageRD.hpp"
 #include "IO_XML.hpp"
+#include "IsosurfaceExtractor.hpp"
 #include "overlays.hpp"
 #include "Properties.hpp"
 #include "scene_items.hpp"
@@ -55,6 +56,7 @@
 #include <vtkImageMapper.h>
 #include <vtkImageMirrorPad.h>
 #include <vtkImageReslice.h>
+#include <vtkImageShrink3D.h>
 #include <vtkImageStencil.h>
 #include <vtkImageThreshold.h>
 #include <vtkImageToStructuredPoints.h>
@@ -88,6 +90,7 @@
 #include <vtkThreshold.h>
 #include <vtkTransform.h>
 #include <vtkTransformFilter.h>
+#include <vtkTrivialProducer.h>
 #include <vtkTubeFilter.h>
 #include <vtkUnstructuredGrid.h>
 #include <vtkVertexGlyphFilter.h>
@@ -99,10 +102,23 @@ using namespace std;
 
 // -------------------------------------------------------------------
 
+/// Returns the number of axes along which the image has more than one cell.
+static int GetImageDimensionality(vtkImageData* image)
+{
+    int dimensionality=0;
+    for(int iDim=0;iDim<3;iDim++)
+        if(image->GetDimensions()[iDim]>1)
+            dimensionality++;
+    return dimensionality;
+}
+
+// -------------------------------------------------------------------
+
 ImageRD::ImageRD(int data_type)
     : AbstractRD(data_type)
     , image_top1D(2.0)
     , image_ratio1D(30.0)
+    , isosurface_extractor(make_shared<IsosurfaceExtractor>())
 {
     this->starting_pattern = vtkSmartPointer<vtkImageData>::New();
     this->assign_attribute_filter = NULL;
@@ -129,11 +145,7 @@ void ImageRD::DeallocateImages()
 int ImageRD::GetArenaDimensionality() const
 {
     assert(this->images.front());
-    int dimensionality=0;
-    for(int iDim=0;iDim<3;iDim++)
-        if(this->images.front()->GetDimensions()[iDim]>1)
-            dimensionality++;
-    return dimensionality;
+    return GetImageDimensionality(this->images.front());
 }
 
 // ---------------------------------------------------------------------
@@ -360,8 +372,14 @@ void ImageRD::BlankImage(float value)
 void ImageRD::Update(int n_steps)
 {
     this->undo_stack.clear();
-    this->InternalUpdate(n_steps);
+    this->TimedInternalUpdate(n_steps);
+    this->FinishUpdate(n_steps);
+}
+
+// ---------------------------------------------------------------------
 
+void ImageRD::FinishUpdate(int n_steps)
+{
     this->timesteps_taken += n_steps;
 
     for(int ic=0;ic<this->GetNumberOfChemicals();ic++)
@@ -398,6 +416,42 @@ void ImageRD::InitializeRenderPipeline(vtkRenderer* pRenderer,const Properties&
 
 // ---------------------------------------------------------------------
 
+vtkSmartPointer<vtkAlgorithm> ImageRD::GetDisplayImageSource(int iChemical,const Properties& render_settings) const
+{
+    const int preview_resolution = render_settings.GetProperty("preview_resolution").GetInt();
+    const string preview_pooling = render_settings.GetProperty("preview_pooling").GetPooling();
+
+    int shrink_factors[3] = { 1, 1, 1 };
+    if(preview_resolution > 0)
+    {
+        const int dimensions[3] = { this->GetX(), this->GetY(), this->GetZ() };
+        for(int i = 0; i < 3; i++)
+            shrink_factors[i] = max(1, (dimensions[i] + preview_resolution - 1) / preview_resolution);
+    }
+
+    if(shrink_factors[0] == 1 && shrink_factors[1] == 1 && shrink_factors[2] == 1)
+    {
+        vtkSmartPointer<vtkTrivialProducer> producer = vtkSmartPointer<vtkTrivialProducer>::New();
+        producer->SetOutput(this->GetImage(iChemical));
+        return producer;
+    }
+
+    // pool each block of cells down to a single cell, so that the size of what we color, upload and contour
+    // each render no longer grows with the size of the image
+    vtkSmartPointer<vtkImageShrink3D> shrink = vtkSmartPointer<vtkImageShrink3D>::New();
+    shrink->SetInputData(this->GetImage(iChemical));
+    shrink->SetShrinkFactors(shrink_factors[0], shrink_factors[1], shrink_factors[2]);
+    if(preview_pooling == "minimum")
+        shrink->MinimumOn();
+    else if(preview_pooling == "maximum")
+        shrink->MaximumOn();
+    else
+        shrink->MeanOn();
+    return shrink;
+}
+
+// ---------------------------------------------------------------------
+
 void ImageRD::InitializeVTKPipeline_1D(vtkRenderer* pRenderer,const Properties& render_settings)
 {
     float low = render_settings.GetProperty("low").GetFloat();
@@ -645,15 +699,20 @@ void ImageRD::InitializeVTKPipeline_2D(vtkRenderer* pRenderer,const Properties&
 
     for(int iChem = iFirstChem; iChem <= iLastChem; iChem++)
     {
+        // the image to show, pooled down to a preview if it is large
+        vtkSmartPointer<vtkAlgorithm> source = this->GetDisplayImageSource(iChem,render_settings);
+        source->Update();
+        int *display_dimensions = vtkImageData::SafeDownCast(source->GetOutputDataObject(0))->GetDimensions();
+
         // pass the image through the lookup table
         vtkSmartPointer<vtkImageMapToColors> image_mapper = vtkSmartPointer<vtkImageMapToColors>::New();
         image_mapper->SetLookupTable(lut);
-        image_mapper->SetInputData(this->GetImage(iChem));
+        image_mapper->SetInputConnection(source->GetOutputPort());
 
         // will convert the x*y 2D image to a x*y grid of quads
         vtkSmartPointer<vtkPlaneSource> plane = vtkSmartPointer<vtkPlaneSource>::New();
-        plane->SetXResolution(this->GetX());
-        plane->SetYResolution(this->GetY());
+        plane->SetXResolution(display_dimensions[0]);
+        plane->SetYResolution(display_dimensions[1]);
         plane->SetOrigin(0,0,0);
         plane->SetPoint1(this->GetX(),0,0);
         plane->SetPoint2(0,this->GetY(),0);
@@ -678,7 +737,7 @@ void ImageRD::InitializeVTKPipeline_2D(vtkRenderer* pRenderer,const Properties&
         if(show_displacement_mapped_surface)
         {
             vtkSmartPointer<vtkImageDataGeometryFilter> plane = vtkSmartPointer<vtkImageDataGeometryFilter>::New();
-            plane->SetInputData(this->GetImage(iChem));
+            plane->SetInputConnection(source->GetOutputPort());
             vtkSmartPointer<vtkWarpScalar> warp = vtkSmartPointer<vtkWarpScalar>::New();
             warp->SetInputConnection(plane->GetOutputPort());
             warp->SetScaleFactor(scaling);
@@ -851,15 +910,23 @@ void ImageRD::InitializeVTKPipeline_3D(vtkRenderer* pRenderer,const Properties&
         vtkImageData *image = this->GetImage(iChem);
         int *extent = image->GetExtent();
 
+        // the image to show, pooled down to a preview if it is large
+        vtkSmartPointer<vtkAlgorithm> source = this->GetDisplayImageSource(iChem,render_settings);
+        source->Update();
+        vtkImageData *display_image = vtkImageData::SafeDownCast(source->GetOutputDataObject(0));
+        int *display_extent = display_image->GetExtent();
+        double *display_spacing = display_image->GetSpacing();
+
         // we first convert the image from point data to cell data, to match the users expectations
 
         vtkSmartPointer<vtkImageWrapPad> pad = vtkSmartPointer<vtkImageWrapPad>::New();
-        pad->SetInputData(image);
-        pad->SetOutputWholeExtent(extent[0],extent[1]+1,extent[2],extent[3]+1,extent[4],extent[5]+1);
+        pad->SetInputConnection(source->GetOutputPort());
+        pad->SetOutputWholeExtent(display_extent[0],display_extent[1]+1,display_extent[2],display_extent[3]+1,
+                                  display_extent[4],display_extent[5]+1);
 
         // move the pixel values (stored in the point data) to cell data
         vtkSmartPointer<vtkRearrangeFields> prearrange_fields = vtkSmartPointer<vtkRearrangeFields>::New();
-        prearrange_fields->SetInputData(image);
+        prearrange_fields->SetInputConnection(source->GetOutputPort());
         prearrange_fields->AddOperation(vtkRearrangeFields::MOVE,vtkDataSetAttributes::SCALARS,
             vtkRearrangeFields::POINT_DATA,vtkRearrangeFields::CELL_DATA);
 
@@ -899,7 +966,8 @@ void ImageRD::InitializeVTKPipeline_3D(vtkRenderer* pRenderer,const Properties&
                 // pad outside the volume with zero so that the contour caps the ends instead of leaving holes
                 vtkSmartPointer<vtkImageConstantPad> cap_pad = vtkSmartPointer<vtkImageConstantPad>::New();
                 cap_pad->SetInputConnection(to_point_data->GetOutputPort());
-                cap_pad->SetOutputWholeExtent(extent[0] - 1, extent[1] + 2, extent[2] - 1, extent[3] + 2, extent[4] - 1, extent[5] + 2);
+                cap_pad->SetOutputWholeExtent(display_extent[0] - 1, display_extent[1] + 2, display_extent[2] - 1,
+                                              display_extent[3] + 2, display_extent[4] - 1, display_extent[5] + 2);
                 if (invert_contour_cap)
                 {
                     cap_pad->SetConstant(high + (high - low));
@@ -916,8 +984,9 @@ void ImageRD::InitializeVTKPipeline_3D(vtkRenderer* pRenderer,const Properties&
 
                 // clip away the internal parts of the volume, to leave only the caps
                 vtkSmartPointer<vtkBox> box = vtkSmartPointer<vtkBox>::New();
-                double* bounds = image->GetBounds();
-                box->SetBounds(bounds[0], bounds[1] + 1, bounds[2], bounds[3] + 1, bounds[4], bounds[5] + 1);
+                double* bounds = display_image->GetBounds();
+                box->SetBounds(bounds[0], bounds[1] + display_spacing[0], bounds[2], bounds[3] + display_spacing[1],
+                               bounds[4], bounds[5] + display_spacing[2]);
                 vtkSmartPointer<vtkExtractPolyDataGeometry> gf = vtkSmartPointer<vtkExtractPolyDataGeometry>::New();
                 gf->SetInputConnection(cap_surface->GetOutputPort());
                 gf->SetImplicitFunction(box);
@@ -1009,7 +1078,7 @@ void ImageRD::InitializeVTKPipeline_3D(vtkRenderer* pRenderer,const Properties&
         if(slice_3D)
         {
             vtkSmartPointer<vtkPlane> plane = vtkSmartPointer<vtkPlane>::New();
-            double *bounds = image->GetBounds();
+            double *bounds = display_image->GetBounds();
             plane->SetOrigin(slice_3D_position*(bounds[1]-bounds[0])+bounds[0],
                              slice_3D_position*(bounds[3]-bounds[2])+bounds[2],
                              slice_3D_position*(bounds[5]-bounds[4])+bounds[4]);
@@ -1317,8 +1386,15 @@ int ImageRD::GetNumberOfCells() const
 
 void ImageRD::GetAsMesh(vtkPolyData *out, const Properties &render_settings) const
 {
-    bool use_image_interpolation = render_settings.GetProperty("use_image_interpolation").GetBool();
     int iActiveChemical = IndexFromChemicalName(render_settings.GetProperty("active_chemical").GetChemical());
+    ImageRD::MakeMesh(this->GetImage(iActiveChemical), out, render_settings, this->isosurface_extractor.get());
+}
+
+// ---------------------------------------------------------------------
+
+void ImageRD::MakeMesh(vtkImageData *image, vtkPolyData *out, const Properties &render_settings, IsosurfaceExtractor *extractor)
+{
+    bool use_image_interpolation = render_settings.GetProperty("use_image_interpolation").GetBool();
     float contour_level = render_settings.GetProperty("contour_level").GetFloat();
 
     float low = render_settings.GetProperty("low").GetFloat();
@@ -1326,14 +1402,14 @@ void ImageRD::GetAsMesh(vtkPolyData *out, const Properties &render_settings) con
     float vertical_scale_1D = render_settings.GetProperty("vertical_scale_1D").GetFloat();
     float vertical_scale_2D = render_settings.GetProperty("vertical_scale_2D").GetFloat();
 
-    switch(this->GetArenaDimensionality())
+    switch(GetImageDimensionality(image))
     {
         case 1:
             {
                 float scaling = vertical_scale_1D / (high-low); // vertical_scale gives the height of the graph in worldspace units
 
                 vtkSmartPointer<vtkImageDataGeometryFilter> plane = vtkSmartPointer<vtkImageDataGeometryFilter>::New();
-                plane->SetInputData(this->GetImage(iActiveChemical));
+                plane->SetInputData(image);
                 vtkSmartPointer<vtkWarpScalar> warp = vtkSmartPointer<vtkWarpScalar>::New();
                 warp->SetInputConnection(plane->GetOutputPort());
                 warp->SetScaleFactor(-scaling);
@@ -1346,7 +1422,7 @@ void ImageRD::GetAsMesh(vtkPolyData *out, const Properties &render_settings) con
                 float scaling = vertical_scale_2D / (high-low); // vertical_scale gives the height of the graph in worldspace units
 
                 vtkSmartPointer<vtkImageDataGeometryFilter> plane = vtkSmartPointer<vtkImageDataGeometryFilter>::New();
-                plane->SetInputData(this->GetImage(iActiveChemical));
+                plane->SetInputData(image);
                 vtkSmartPointer<vtkWarpScalar> warp = vtkSmartPointer<vtkWarpScalar>::New();
                 warp->SetInputConnection(plane->GetOutputPort());
                 warp->SetScaleFactor(scaling);
@@ -1358,12 +1434,17 @@ void ImageRD::GetAsMesh(vtkPolyData *out, const Properties &render_settings) con
             }
             break;
         case 3:
-            if(use_image_interpolation)
+            if(use_image_interpolation && extractor)
+            {
+                // only the parts of the surface that may have changed since the last call are contoured again
+                extractor->Extract(image, contour_level, out);
+            }
+            else if(use_image_interpolation)
             {
                 // turns the 3d grid of sampled values into a polygon mesh for rendering,
                 // by making a surface that contours the volume at a specified level
                 vtkSmartPointer<vtkContourFilter> surface = vtkSmartPointer<vtkContourFilter>::New();
-                surface->SetInputData(this->GetImage(iActiveChemical));
+                surface->SetInputData(image);
                 surface->SetValue(0, contour_level);
                 surface->Update();
                 out->DeepCopy(surface->GetOutput());
@@ -1371,7 +1452,6 @@ void ImageRD::GetAsMesh(vtkPolyData *out, const Properties &render_settings) con
             else
             {
                 // render as cubes, Minecraft-style
-                vtkImageData *image = this->GetImage(iActiveChemical);
                 int *extent = image->GetExtent();
 
                 vtkSmartPointer<vtkImageWrapPad> pad = vtkSmartPointer<vtkImageWrapPad>::New();
@@ -1439,7 +1519,13 @@ void ImageRD::SaveFile(const char* filename,const Properties& render_settings,bo
 void ImageRD::GetAs2DImage(vtkImageData *out,const Properties& render_settings) const
 {
     int iActiveChemical = IndexFromChemicalName(render_settings.GetProperty("active_chemical").GetChemical());
+    ImageRD::Make2DImage(this->GetImage(iActiveChemical), out, render_settings);
+}
 
+// --------------------------------------------------------------------------------
+
+void ImageRD::Make2DImage(vtkImageData *image,vtkImageData *out,const Properties& render_settings)
+{
     // create a lookup table for mapping values to colors
     vtkSmartPointer<vtkScalarsToColors> lut = GetColorMap(render_settings);
 
@@ -1447,11 +1533,11 @@ void ImageRD::GetAs2DImage(vtkImageData *out,const Properties& render_settings)
     vtkSmartPointer<vtkImageMapToColors> image_mapper = vtkSmartPointer<vtkImageMapToColors>::New();
     image_mapper->SetLookupTable(lut);
     image_mapper->SetOutputFormatToRGB(); // without this, vtkJPEGWriter writes JPEGs that some software struggles with
-    switch(this->GetArenaDimensionality())
+    switch(GetImageDimensionality(image))
     {
         case 1:
         case 2:
-            image_mapper->SetInputData(this->GetImage(iActiveChemical));
+            image_mapper->SetInputData(image);
             break;
         case 3:
             {
@@ -1487,12 +1573,12 @@ void ImageRD::GetAs2DImage(vtkImageData *out,const Properties& render_settings)
                     resliceAxes->DeepCopy(coronalElements);
                 else if(slice_3D_axis=="z")
                     resliceAxes->DeepCopy(axialElements);
-                resliceAxes->SetElement(0, 3, slice_3D_position * this->GetX());
-                resliceAxes->SetElement(1, 3, slice_3D_position * this->GetY());
-                resliceAxes->SetElement(2, 3, slice_3D_position * this->GetZ());
+                resliceAxes->SetElement(0, 3, slice_3D_position * image->GetDimensions()[0]);
+                resliceAxes->SetElement(1, 3, slice_3D_position * image->GetDimensions()[1]);
+                resliceAxes->SetElement(2, 3, slice_3D_position * image->GetDimensions()[2]);
 
                 vtkSmartPointer<vtkImageReslice> voi = vtkSmartPointer<vtkImageReslice>::New();
-                voi->SetInputData(this->GetImage(iActiveChemical));
+                voi->SetInputData(image);
                 voi->SetOutputDimensionality(2);
                 voi->SetResliceAxes(resliceAxes);
                 image_mapper->SetInputConnection(voi->GetOutputPort());
@@ -1505,6 +1591,28 @@ void ImageRD::GetAs2DImage(vtkImageData *out,const Properties& render_settings)
 
 // --------------------------------------------------------------------------------
 
+function<void(vtkImageData*)> ImageRD::GetAs2DImageLater(const Properties& render_settings) const
+{
+    // only the active chemical and the settings are copied now, the color mapping and slicing happen when called
+    int iActiveChemical = IndexFromChemicalName(render_settings.GetProperty("active_chemical").GetChemical());
+    vtkSmartPointer<vtkImageData> image = vtkSmartPointer<vtkImageData>::New();
+    image->DeepCopy(this->GetImage(iActiveChemical));
+    return [image, render_settings](vtkImageData* out) { ImageRD::Make2DImage(image, out, render_settings); };
+}
+
+// --------------------------------------------------------------------------------
+
+function<void(vtkPolyData*)> ImageRD::GetAsMeshLater(const Properties& render_settings) const
+{
+    int iActiveChemical = IndexFromChemicalName(render_settings.GetProperty("active_chemical").GetChemical());
+    vtkSmartPointer<vtkImageData> image = vtkSmartPointer<vtkImageData>::New();
+    image->DeepCopy(this->GetImage(iActiveChemical));
+    shared_ptr<IsosurfaceExtractor> extractor = this->isosurface_extractor; // (shared, so the snapshots can reuse the surface from earlier frames)
+    return [image, render_settings, extractor](vtkPolyData* out) { ImageRD::MakeMesh(image, out, render_settings, extractor.get()); };
+}
+
+// --------------------------------------------------------------------------------
+
 void ImageRD::SetFrom2DImage(int iChemical, vtkImageData *im)
 {
     if (this->images.front()->GetDimensions()[0] != im->GetDimensions()[0] ||
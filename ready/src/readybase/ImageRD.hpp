@@ -20,13 +20,18 @@
 
 // local:
 #include "AbstractRD.hpp"
+class IsosurfaceExtractor;
 
 // VTK:
+class vtkAlgorithm;
 class vtkImageData;
 class vtkAssignAttribute;
 class vtkRearrangeFields;
 class vtkUnstructuredGrid;
 
+// STL:
+#include <memory>
+
 /// Base class for image-based systems.
 class ImageRD : public AbstractRD
 {
@@ -73,6 +78,8 @@ class ImageRD : public AbstractRD
 
         void GetAsMesh(vtkPolyData *out,const Properties& render_settings) const override;
         void GetAs2DImage(vtkImageData *out,const Properties& render_settings) const override;
+        std::function<void(vtkPolyData*)> GetAsMeshLater(const Properties& render_settings) const override;
+        std::function<void(vtkImageData*)> GetAs2DImageLater(const Properties& render_settings) const override;
         void SetFrom2DImage(int iChemical, vtkImageData *im) override;
         bool Is2DImageAvailable() const override { return true; }
 
@@ -98,6 +105,9 @@ class ImageRD : public AbstractRD
 
         vtkImageData* GetImage(int iChemical) const;
 
+        /// Does the bookkeeping that follows InternalUpdate(): counts the steps and marks the images as changed.
+        void FinishUpdate(int n_steps);
+
         void AddPhasePlot(vtkRenderer* pRenderer,float scaling,float low,float high,float posX,float posY,float posZ,
                             int iChemX,int iChemY,int iChemZ) override;
 
@@ -108,16 +118,30 @@ class ImageRD : public AbstractRD
 
         static vtkSmartPointer<vtkImageData> AllocateVTKImage(int x,int y,int z,int data_type);
 
+        /// Makes the 3D object for one chemical's image, as GetAsMesh() does. Touches no member data so is safe to call from any thread.
+        /** If an extractor is given then it is used for the 3D surface, so that only the changed parts are contoured. */
+        static void MakeMesh(vtkImageData *image,vtkPolyData *out,const Properties& render_settings,IsosurfaceExtractor *extractor = nullptr);
+        /// Makes the colored 2D plane for one chemical's image, as GetAs2DImage() does. Touches no member data so is safe to call from any thread.
+        static void Make2DImage(vtkImageData *image,vtkImageData *out,const Properties& render_settings);
+
         int GetArenaDimensionality() const override;
 
         void FlipPaintAction(PaintAction& cca) override;
 
+        /// keeps the 3D surface between calls to GetAsMesh(), to save contouring the parts that haven't changed
+        std::shared_ptr<IsosurfaceExtractor> isosurface_extractor;
+
         // some saved handles into the pipeline, for manual updates to workaround a named arrays problem
         vtkAssignAttribute *assign_attribute_filter;
         vtkRearrangeFields *rearrange_fields_filter;
 
     private:
 
+        /// Returns a pipeline source for the image of a chemical, as it should be rendered.
+        /** If the preview_resolution render setting asks for it then this is a downsampled copy of the image,
+         *  pooled by preview_pooling, with no more than preview_resolution cells along each axis. */
+        vtkSmartPointer<vtkAlgorithm> GetDisplayImageSource(int iChemical,const Properties& render_settings) const;
+
         void InitializeVTKPipeline_1D(vtkRenderer* pRenderer,const Properties& render_settings);
         void InitializeVTKPipeline_2D(vtkRenderer* pRenderer,const Properties& render_settings);
         void InitializeVTKPipeline_3D(vtkRenderer* pRenderer,const Properties& render_settings);
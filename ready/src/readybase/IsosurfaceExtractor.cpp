@@ -0,0 +1,369 @@
+/*  Copyright 2011-2024 The Ready Bunch
+
+    This file is part of Ready.
+
+    Ready is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ready is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ready. If not, see <http://www.gnu.org/licenses/>.         */
+
+// local:
+#include "IsosurfaceExtractor.hpp"
+#include "parallel.hpp"
+
+// VTK:
+#include <vtkCellArray.h>
+#include <vtkContourFilter.h>
+#include <vtkDataArray.h>
+#include <vtkIdList.h>
+#include <vtkImageData.h>
+#include <vtkPointData.h>
+#include <vtkPoints.h>
+#include <vtkPolyData.h>
+
+// STL:
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <map>
+#include <stdexcept>
+
+using namespace std;
+
+// ---------------------------------------------------------------------
+
+namespace
+{
+    /// Returns whether the block [lo,hi] (in point indices) needs contouring again, given the values now and at the last call.
+    /** If before is null then there was no last call, and the block only needs contouring if it contains the level. */
+    template <typename T>
+    bool BlockNeedsUpdate(const T* now, const T* before, const int dims[3], const int lo[3], const int hi[3], double level)
+    {
+        const size_t X = dims[0], XY = size_t(dims[0]) * dims[1];
+
+        if (before)
+        {
+            // the normals at the edge of the block use the values one cell outside it, so we look there for changes too
+            bool changed = false;
+            const int x0 = max(0, lo[0] - 1), x1 = min(dims[0] - 1, hi[0] + 1);
+            for (int z = max(0, lo[2] - 1); z <= min(dims[2] - 1, hi[2] + 1) && !changed; z++)
+                for (int y = max(0, lo[1] - 1); y <= min(dims[1] - 1, hi[1] + 1) && !changed; y++)
+                {
+                    const size_t row = z * XY + y * X;
+                    changed = memcmp(now + row + x0, before + row + x0, (x1 - x0 + 1) * sizeof(T)) != 0;
+                }
+            if (!changed)
+                return false;
+        }
+
+        // a block that is wholly above or below the level has no surface in it
+        auto contains_level = [&](const T* values)
+        {
+            bool any_below = false, any_above = false;
+            for (int z = lo[2]; z <= hi[2]; z++)
+                for (int y = lo[1]; y <= hi[1]; y++)
+                {
+                    const T* row = values + z * XY + y * X;
+                    for (int x = lo[0]; x <= hi[0]; x++)
+                    {
+                        any_below |= row[x] < level;
+                        any_above |= row[x] >= level;
+                    }
+                    if (any_below && any_above)
+                        return true;
+                }
+            return false;
+        };
+        return contains_level(now) || (before && contains_level(before));
+    }
+}
+
+// ---------------------------------------------------------------------
+
+IsosurfaceExtractor::IsosurfaceExtractor()
+    : data_type(0)
+    , level(0.0)
+    , n_blocks_updated(0)
+{
+    for (int i = 0; i < 3; i++)
+    {
+        this->dims[i] = 0;
+        this->extent_start[i] = 0;
+        this->origin[i] = 0.0;
+        this->spacing[i] = 1.0;
+        this->num_blocks[i] = 0;
+    }
+}
+
+// ---------------------------------------------------------------------
+
+void IsosurfaceExtractor::Reset()
+{
+    lock_guard<mutex> lock(this->m);
+    this->previous_values = nullptr;
+    this->blocks.clear();
+}
+
+// ---------------------------------------------------------------------
+
+void IsosurfaceExtractor::Extract(vtkImageData* image, double level, vtkPolyData* out)
+{
+    lock_guard<mutex> lock(this->m);
+
+    vtkDataArray* values = image->GetPointData()->GetScalars();
+    if (!values || values->GetNumberOfComponents() != 1)
+        throw runtime_error("IsosurfaceExtractor::Extract : expected an image with one scalar component");
+    const int data_type = values->GetDataType();
+    if (data_type != VTK_FLOAT && data_type != VTK_DOUBLE)
+        throw runtime_error("IsosurfaceExtractor::Extract : unsupported data type");
+
+    const int* image_dims = image->GetDimensions();
+    const double* image_origin = image->GetOrigin();
+    const double* image_spacing = image->GetSpacing();
+    bool same_layout = this->previous_values && level == this->level && data_type == this->data_type;
+    for (int i = 0; i < 3; i++)
+        same_layout = same_layout && image_dims[i] == this->dims[i] && image->GetExtent()[2 * i] == this->extent_start[i]
+                      && image_origin[i] == this->origin[i] && image_spacing[i] == this->spacing[i];
+    if (!same_layout)
+    {
+        // start again from nothing
+        this->level = level;
+        this->data_type = data_type;
+        for (int i = 0; i < 3; i++)
+        {
+            this->dims[i] = image_dims[i];
+            this->extent_start[i] = image->GetExtent()[2 * i];
+            this->origin[i] = image_origin[i];
+            this->spacing[i] = image_spacing[i];
+            this->num_blocks[i] = max(1, (this->dims[i] - 1 + BLOCK_SIZE - 1) / BLOCK_SIZE);
+        }
+        this->previous_values = nullptr;
+        this->blocks.assign(size_t(this->num_blocks[0]) * this->num_blocks[1] * this->num_blocks[2], vtkSmartPointer<vtkPolyData>());
+    }
+
+    // find the blocks that need contouring again
+    const size_t n_blocks = this->blocks.size();
+    vector<char> needs_update(n_blocks, 0);
+    ParallelFor(GetNumberOfWorkerThreads(n_blocks, 1), n_blocks, [&](int, size_t begin, size_t end)
+    {
+        for (size_t iBlock = begin; iBlock < end; iBlock++)
+        {
+            int lo[3], hi[3];
+            this->GetBlockRange(static_cast<int>(iBlock), lo, hi);
+            if (data_type == VTK_FLOAT)
+                needs_update[iBlock] = BlockNeedsUpdate(static_cast<const float*>(values->GetVoidPointer(0)),
+                    this->previous_values ? static_cast<const float*>(this->previous_values->GetVoidPointer(0)) : nullptr,
+                    this->dims, lo, hi, level);
+            else
+                needs_update[iBlock] = BlockNeedsUpdate(static_cast<const double*>(values->GetVoidPointer(0)),
+                    this->previous_values ? static_cast<const double*>(this->previous_values->GetVoidPointer(0)) : nullptr,
+                    this->dims, lo, hi, level);
+        }
+    });
+    vector<int> blocks_to_update;
+    for (size_t iBlock = 0; iBlock < n_blocks; iBlock++)
+        if (needs_update[iBlock])
+            blocks_to_update.push_back(static_cast<int>(iBlock));
+    this->n_blocks_updated = static_cast<int>(blocks_to_update.size());
+
+    // contour them
+    ParallelFor(GetNumberOfWorkerThreads(blocks_to_update.size(), 1), blocks_to_update.size(), [&](int, size_t begin, size_t end)
+    {
+        for (size_t i = begin; i < end; i++)
+        {
+            vtkSmartPointer<vtkPolyData> block = vtkSmartPointer<vtkPolyData>::New();
+            this->ExtractBlock(image, blocks_to_update[i], block);
+            if (block->GetNumberOfPoints() > 0)
+                this->blocks[blocks_to_update[i]] = block;
+            else
+                this->blocks[blocks_to_update[i]] = nullptr; // (the surface has left this block)
+        }
+    });
+
+    if (!this->previous_values)
+        this->previous_values.TakeReference(values->NewInstance());
+    this->previous_values->DeepCopy(values);
+
+    this->AppendBlocks(out);
+}
+
+// ---------------------------------------------------------------------
+
+void IsosurfaceExtractor::GetBlockRange(int iBlock, int lo[3], int hi[3]) const
+{
+    const int b[3] = { iBlock % this->num_blocks[0],
+                       (iBlock / this->num_blocks[0]) % this->num_blocks[1],
+                       iBlock / (this->num_blocks[0] * this->num_blocks[1]) };
+    for (int i = 0; i < 3; i++)
+    {
+        lo[i] = b[i] * BLOCK_SIZE;
+        hi[i] = min(lo[i] + BLOCK_SIZE, this->dims[i] - 1);
+    }
+}
+
+// ---------------------------------------------------------------------
+
+void IsosurfaceExtractor::ExtractBlock(vtkImageData* image, int iBlock, vtkPolyData* out) const
+{
+    int lo[3], hi[3], border_lo[3], border_hi[3];
+    this->GetBlockRange(iBlock, lo, hi);
+    for (int i = 0; i < 3; i++)
+    {
+        border_lo[i] = max(0, lo[i] - 1);
+        border_hi[i] = min(this->dims[i] - 1, hi[i] + 1);
+    }
+
+    // copy the block and its border into a small image of its own, at the same position in space
+    vtkSmartPointer<vtkImageData> sub_image = vtkSmartPointer<vtkImageData>::New();
+    sub_image->SetOrigin(this->origin[0], this->origin[1], this->origin[2]);
+    sub_image->SetSpacing(this->spacing[0], this->spacing[1], this->spacing[2]);
+    sub_image->SetExtent(this->extent_start[0] + border_lo[0], this->extent_start[0] + border_hi[0],
+                         this->extent_start[1] + border_lo[1], this->extent_start[1] + border_hi[1],
+                         this->extent_start[2] + border_lo[2], this->extent_start[2] + border_hi[2]);
+    sub_image->AllocateScalars(this->data_type, 1);
+    const size_t row_bytes = size_t(border_hi[0] - border_lo[0] + 1) * sub_image->GetScalarSize();
+    for (int z = border_lo[2]; z <= border_hi[2]; z++)
+        for (int y = border_lo[1]; y <= border_hi[1]; y++)
+        {
+            const int x0 = this->extent_start[0] + border_lo[0];
+            const int y0 = this->extent_start[1] + y, z0 = this->extent_start[2] + z;
+            memcpy(sub_image->GetScalarPointer(x0, y0, z0), image->GetScalarPointer(x0, y0, z0), row_bytes);
+        }
+
+    vtkSmartPointer<vtkContourFilter> surface = vtkSmartPointer<vtkContourFilter>::New();
+    surface->SetInputData(sub_image);
+    surface->SetValue(0, this->level);
+    surface->Update();
+    vtkPolyData* pd = surface->GetOutput();
+
+    // keep only the triangles in the cells of this block, the border is contoured by the neighboring blocks
+    vtkSmartPointer<vtkPoints> points = vtkSmartPointer<vtkPoints>::New();
+    points->SetDataType(pd->GetPoints() ? pd->GetPoints()->GetDataType() : VTK_FLOAT);
+    vtkSmartPointer<vtkCellArray> polys = vtkSmartPointer<vtkCellArray>::New();
+    out->GetPointData()->CopyAllocate(pd->GetPointData());
+    vector<vtkIdType> new_ids(pd->GetNumberOfPoints(), -1);
+    vtkSmartPointer<vtkIdList> ids = vtkSmartPointer<vtkIdList>::New();
+    vtkCellArray* pd_polys = pd->GetPolys();
+    pd_polys->InitTraversal();
+    while (pd_polys->GetNextCell(ids))
+    {
+        double centroid[3] = { 0.0, 0.0, 0.0 };
+        for (vtkIdType i = 0; i < ids->GetNumberOfIds(); i++)
+        {
+            const double* p = pd->GetPoint(ids->GetId(i));
+            for (int j = 0; j < 3; j++)
+                centroid[j] += p[j] / ids->GetNumberOfIds();
+        }
+        bool inside = true;
+        for (int j = 0; j < 3 && inside; j++)
+        {
+            const double c = (centroid[j] - this->origin[j]) / this->spacing[j] - this->extent_start[j];
+            inside = c >= lo[j] && (c < hi[j] || (hi[j] == this->dims[j] - 1 && c <= hi[j]));
+        }
+        if (!inside)
+            continue;
+        for (vtkIdType i = 0; i < ids->GetNumberOfIds(); i++)
+        {
+            const vtkIdType iPt = ids->GetId(i);
+            if (new_ids[iPt] < 0)
+            {
+                new_ids[iPt] = points->InsertNextPoint(pd->GetPoint(iPt));
+                out->GetPointData()->CopyData(pd->GetPointData(), iPt, new_ids[iPt]);
+            }
+            ids->SetId(i, new_ids[iPt]);
+        }
+        polys->InsertNextCell(ids);
+    }
+    out->SetPoints(points);
+    out->SetPolys(polys);
+}
+
+// ---------------------------------------------------------------------
+
+void IsosurfaceExtractor::AppendBlocks(vtkPolyData* out) const
+{
+    vtkIdType n_points = 0;
+    vtkPolyData* first = nullptr;
+    for (const vtkSmartPointer<vtkPolyData>& block : this->blocks)
+    {
+        if (!block)
+            continue;
+        if (!first)
+            first = block;
+        n_points += block->GetNumberOfPoints();
+    }
+
+    out->Initialize();
+    vtkSmartPointer<vtkPoints> points = vtkSmartPointer<vtkPoints>::New();
+    vtkSmartPointer<vtkCellArray> polys = vtkSmartPointer<vtkCellArray>::New();
+    out->SetPoints(points);
+    out->SetPolys(polys);
+    if (!first)
+        return;
+    points->SetDataType(first->GetPoints()->GetDataType());
+    points->Allocate(n_points);
+    out->GetPointData()->CopyAllocate(first->GetPointData(), n_points);
+
+    // The vertices on the faces between blocks are made by both blocks, from the same edge and the same values. We merge
+    // them so that the surface is connected, which matters for smoothing and decimation when saving.
+    auto is_on_seam = [&](const double* p)
+    {
+        for (int i = 0; i < 3; i++)
+        {
+            const double c = (p[i] - this->origin[i]) / this->spacing[i] - this->extent_start[i];
+            if (c > 0.0 && c < this->dims[i] - 1 && fmod(c, BLOCK_SIZE) == 0.0)
+                return true;
+        }
+        return false;
+    };
+    map<array<double, 3>, vtkIdType> seam_points;
+    vector<vtkIdType> new_ids;
+    vtkSmartPointer<vtkIdList> ids = vtkSmartPointer<vtkIdList>::New();
+    for (const vtkSmartPointer<vtkPolyData>& block : this->blocks)
+    {
+        if (!block)
+            continue;
+        new_ids.resize(block->GetNumberOfPoints());
+        for (vtkIdType iPt = 0; iPt < block->GetNumberOfPoints(); iPt++)
+        {
+            const double* p = block->GetPoint(iPt);
+            if (is_on_seam(p))
+            {
+                const array<double, 3> key = { p[0], p[1], p[2] };
+                const auto found = seam_points.find(key);
+                if (found != seam_points.end())
+                {
+                    new_ids[iPt] = found->second;
+                    continue;
+                }
+                new_ids[iPt] = points->InsertNextPoint(p);
+                seam_points[key] = new_ids[iPt];
+            }
+            else
+            {
+                new_ids[iPt] = points->InsertNextPoint(p);
+            }
+            out->GetPointData()->CopyData(block->GetPointData(), iPt, new_ids[iPt]);
+        }
+        vtkCellArray* block_polys = block->GetPolys();
+        block_polys->InitTraversal();
+        while (block_polys->GetNextCell(ids))
+        {
+            for (vtkIdType i = 0; i < ids->GetNumberOfIds(); i++)
+                ids->SetId(i, new_ids[ids->GetId(i)]);
+            polys->InsertNextCell(ids);
+        }
+    }
+    out->Squeeze();
+}
+
+// ---------------------------------------------------------------------
@@ -0,0 +1,80 @@
+/*  Copyright 2011-2024 The Ready Bunch
+
+    This file is part of Ready.
+
+    Ready is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ready is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ready. If not, see <http://www.gnu.org/licenses/>.         */
+
+#ifndef __ISOSURFACEEXTRACTOR__
+#define __ISOSURFACEEXTRACTOR__
+
+// VTK:
+#include <vtkSmartPointer.h>
+class vtkDataArray;
+class vtkImageData;
+class vtkPolyData;
+
+// STL:
+#include <mutex>
+#include <vector>
+
+/// Contours a 3D image at a given level, re-extracting only the parts of the surface that could have changed since the last call.
+/** The image is split into cubic blocks and the surface in each block is kept between calls. A block is contoured again only
+    if a value in it (or in the one-cell border that its normals depend on) has changed and the block contained the
+    contour level, before or after. The blocks are contoured in parallel and then stitched together, merging the
+    vertices on the shared faces, so the result matches contouring the whole image at once.
+
+    Calls from different threads are serialized, so one extractor can be shared by a system and its recorded snapshots. */
+class IsosurfaceExtractor
+{
+    public:
+
+        IsosurfaceExtractor();
+
+        /// Writes the surface where image has the value level into out. The image must have one scalar component.
+        void Extract(vtkImageData* image, double level, vtkPolyData* out);
+
+        /// Forgets the stored surface, so the next call to Extract() contours everything.
+        void Reset();
+
+        /// How many blocks were contoured by the last call to Extract().
+        int GetNumberOfBlocksUpdated() const { return this->n_blocks_updated; }
+
+    private:
+
+        /// Contours a single block, including a border of one cell for the normals, keeping only the triangles inside the block.
+        void ExtractBlock(vtkImageData* image, int iBlock, vtkPolyData* out) const;
+
+        /// Finds the range of points covered by a block, in index coordinates (not including the border).
+        void GetBlockRange(int iBlock, int lo[3], int hi[3]) const;
+
+        /// Joins the blocks into out, merging the vertices that lie on the faces between blocks.
+        void AppendBlocks(vtkPolyData* out) const;
+
+    private:
+
+        static const int BLOCK_SIZE = 32; ///< number of cells along each side of a block
+
+        std::mutex m;
+        int dims[3];
+        int extent_start[3];
+        double origin[3], spacing[3];
+        int num_blocks[3];
+        int data_type;
+        double level;
+        vtkSmartPointer<vtkDataArray> previous_values; ///< the image values at the last call
+        std::vector<vtkSmartPointer<vtkPolyData>> blocks;
+        int n_blocks_updated;
+};
+
+#endif
@@ -19,21 +19,23 @@
 
 // local:
 #include "MeshGenerators.hpp"
+#include "parallel.hpp"
 #include "utils.hpp"
 
 // VTK:
 #include <vtkAppendFilter.h>
+#include <vtkCallbackCommand.h>
 #include <vtkCellArray.h>
 #include <vtkCellData.h>
 #include <vtkCleanPolyData.h>
 #include <vtkDelaunay2D.h>
 #include <vtkDelaunay3D.h>
-#include <vtkGenericCell.h>
+#include <vtkIdTypeArray.h>
 #include <vtkLinearSubdivisionFilter.h>
 #include <vtkMath.h>
+#include <vtkMergePoints.h>
 #include <vtkPlatonicSolidSource.h>
 #include <vtkPointLocator.h>
-#include <vtkPointSource.h>
 #include <vtkSmartPointer.h>
 #include <vtkTransform.h>
 #include <vtkTransformPolyDataFilter.h>
@@ -41,7 +43,10 @@
 #include <vtkUnstructuredGrid.h>
 
 // STL:
+#include <algorithm>
 #include <cmath>
+#include <cstdint>
+#include <unordered_map>
 #include <vector>
 
 using namespace std;
@@ -324,10 +329,62 @@ void MeshGenerators::GetHexagonalMesh(int nx,int ny,vtkUnstructuredGrid* mesh,in
 
 // ---------------------------------------------------------------------
 
+/// Below this many items (triangles, points, cells) per thread it isn't worth starting more threads.
+const size_t MIN_ITEMS_PER_THREAD = 1000;
+
+// ---------------------------------------------------------------------
+
+/// Make a cell array from cells laid out as n,id1,..,idn,n,.. - much faster than inserting the cells one at a time.
+vtkSmartPointer<vtkCellArray> MakeCellArray(vtkIdType n_cells,const vector<vtkIdType>& connectivity)
+{
+    vtkSmartPointer<vtkIdTypeArray> ids = vtkSmartPointer<vtkIdTypeArray>::New();
+    ids->SetNumberOfValues(connectivity.size());
+    copy(connectivity.begin(),connectivity.end(),ids->GetPointer(0));
+    vtkSmartPointer<vtkCellArray> cells = vtkSmartPointer<vtkCellArray>::New();
+    cells->SetCells(n_cells,ids);
+    return cells;
+}
+
+// ---------------------------------------------------------------------
+
+/// The part of a generator's progress that a VTK filter is responsible for, used by UpdateWithProgress().
+struct ProgressRange {
+    const MeshGenerators::ProgressCallback* progress;
+    double from,to;
+};
+
+void OnFilterProgress(vtkObject*,unsigned long,void* client_data,void* call_data)
+{
+    const ProgressRange* range = static_cast<const ProgressRange*>(client_data);
+    const double fraction_done = *static_cast<const double*>(call_data);
+    (*range->progress)( range->from + fraction_done * ( range->to - range->from ) );
+}
+
+/// Run the filter, passing on its progress as going from 'from' to 'to'.
+void UpdateWithProgress(vtkAlgorithm* filter,const MeshGenerators::ProgressCallback& progress,double from,double to)
+{
+    if(!progress)
+    {
+        filter->Update();
+        return;
+    }
+    ProgressRange range = { &progress, from, to };
+    vtkSmartPointer<vtkCallbackCommand> observer = vtkSmartPointer<vtkCallbackCommand>::New();
+    observer->SetCallback(OnFilterProgress);
+    observer->SetClientData(&range);
+    const unsigned long tag = filter->AddObserver(vtkCommand::ProgressEvent,observer);
+    filter->Update();
+    filter->RemoveObserver(tag);
+    progress(to);
+}
+
+// ---------------------------------------------------------------------
+
 /// A two-dimensional triangle, used in MeshRD::GetPenroseTiling().
 struct Tri {
     double p[3][2];  /// Coordinates of corners A, B and C.
     int index[3];    /// Index of corners A, B and C in the points structure.
+    Tri() {}
     Tri(double ax,double ay,int iA,double bx,double by,int iB,double cx,double cy,int iC) {
         p[0][0] = ax; p[0][1] = ay; index[0] = iA;
         p[1][0] = bx; p[1][1] = by; index[1] = iB;
@@ -335,57 +392,88 @@ struct Tri {
     }
 };
 
-typedef map<pair<int,int>,int> TPairIndex; /// For accessing an int by an ordered pair of ints.
+/// A point to be inserted between two corners of a Tri, used in MeshRD::GetPenroseTiling().
+struct EdgeSplit {
+    int i1,i2;   /// Index of the two corners in the points structure.
+    double x,y;  /// Coordinates of the new point.
+    int iP;      /// Index of the new point in the points structure.
+};
+
+typedef unordered_map<uint64_t,int> TEdgeIndex; /// For accessing an int by an ordered pair of point indices.
+
+uint64_t GetEdgeKey(int i1,int i2)
+{
+    return ( static_cast<uint64_t>( static_cast<uint32_t>( i1 ) ) << 32 ) | static_cast<uint32_t>( i2 );
+}
 
-/// Insert a new point between the points, unless one already exists.
-int SplitEdge(const Tri &tri,int i1,int i2,double &x, double &y,TPairIndex &edge_splits,vtkPoints* pts)
+/// Find where the edge between corners i1 and i2 gets split. The point is given an index later, in GetPenroseTiling().
+void SplitEdge(const Tri &tri,int i1,int i2,EdgeSplit &split)
 {
     const double goldenRatio = (1.0 + sqrt(5.0)) / 2.0;
 
-    x = tri.p[i1][0] + (tri.p[i2][0] - tri.p[i1][0]) / goldenRatio;
-    y = tri.p[i1][1] + (tri.p[i2][1] - tri.p[i1][1]) / goldenRatio;
+    split.x = tri.p[i1][0] + (tri.p[i2][0] - tri.p[i1][0]) / goldenRatio;
+    split.y = tri.p[i1][1] + (tri.p[i2][1] - tri.p[i1][1]) / goldenRatio;
     // (x,y is closer to point 2 than point 1)
 
-    pair<int,int> edge(tri.index[i1],tri.index[i2]);
-    TPairIndex::const_iterator found = edge_splits.find(edge);
-    if(found!=edge_splits.end())
-    {
-        return found->second;
-    }
-    else
-    {
-        int iP = pts->InsertNextPoint(x,y,0);
-        edge_splits[edge] = iP;
-        return iP;
-    }
+    split.i1 = tri.index[i1];
+    split.i2 = tri.index[i2];
 }
 
 // workaround for LLVM/Clang issue: lld-link : error : undefined symbol: __powidf2
-void MeshGenerators::GetPenroseTiling(/*int*/double n_subdivisions,int type,vtkUnstructuredGrid* mesh,int n_chems,int data_type)
+void MeshGenerators::GetPenroseTiling(/*int*/double n_subdivisions,int type,vtkUnstructuredGrid* mesh,int n_chems,int data_type,
+                                      const ProgressCallback& progress)
 {
     // Many thanks to Jeff Preshing: http://preshing.com/20110831/penrose-tiling-explained
 
     const int RHOMBI = 0;
     const int DARTS_AND_KITES = 1;
+    if(type != DARTS_AND_KITES)
+        type = RHOMBI;
 
     // we keep a list of the 'red' and 'blue' Robinson triangles and use 'deflation' (decomposition)
     vector<Tri> red_tris[2],blue_tris[2]; // each list has two buffers
     int iCurrentBuffer = 0;
 
-    vtkSmartPointer<vtkPoints> pts = vtkSmartPointer<vtkPoints>::New();
+    vector<double> pts; // x,y of each point
 
-    TPairIndex edge_splits; // given a pair of point indices, what is the index of the point made by splitting that edge?
+    TEdgeIndex edge_splits; // given a pair of point indices, what is the index of the point made by splitting that edge?
+
+    // each triangle always splits into the same number of red and blue triangles, so we know in advance how many there will be
+    const int n_red_splits  = (type == RHOMBI) ? 1 : 2; // edges split in each red triangle
+    const int n_blue_splits = (type == RHOMBI) ? 2 : 1; // edges split in each blue triangle
+    const int red_from_red   = (type == RHOMBI) ? 1 : 2;
+    const int blue_from_red  = 1;
+    const int red_from_blue  = 1;
+    const int blue_from_blue = (type == RHOMBI) ? 2 : 1;
 
     // start with 10 red triangles in a wheel, to get a nice circular shape (with 5-fold rotational symmetry)
     // (any correctly-tiled starting pattern will work too)
     const int NT = 10;
+    {
+        size_t n_red = NT, n_blue = 0;
+        for(int i=0;i<n_subdivisions;i++)
+        {
+            const size_t n_new_red = n_red * red_from_red + n_blue * red_from_blue;
+            n_blue = n_red * blue_from_red + n_blue * blue_from_blue;
+            n_red = n_new_red;
+        }
+        for(int iBuffer=0;iBuffer<2;iBuffer++)
+        {
+            red_tris[iBuffer].reserve(n_red);
+            blue_tris[iBuffer].reserve(n_blue);
+        }
+        pts.reserve( 2 * ( n_red + n_blue + NT + 1 ) ); // (a planar triangulation has fewer points than triangles, plus the boundary)
+        edge_splits.reserve( n_red + n_blue );
+    }
     const double angle_step = 2.0 * 3.1415926535 / NT;
     const double goldenRatio = (1.0 + sqrt(5.0)) / 2.0;
     const double scale = pow( goldenRatio, n_subdivisions );
-    pts->InsertNextPoint(0,0,0);
+    pts.push_back(0);
+    pts.push_back(0);
     for(int i=0;i<NT;i++)
     {
-        pts->InsertNextPoint(scale*cos(angle_step*i),scale*sin(angle_step*i),0);
+        pts.push_back(scale*cos(angle_step*i));
+        pts.push_back(scale*sin(angle_step*i));
         int i1 = (i + i%2) % NT;
         int i2 = (i + 1 - i%2) % NT;
         double angle1 = angle_step * i1;
@@ -404,94 +492,177 @@ void MeshGenerators::GetPenroseTiling(/*int*/double n_subdivisions,int type,vtkU
     }
 
     // subdivide
-    double px,py,qx,qy,rx,ry;
+    vector<EdgeSplit> splits;
     for(int i=0;i<n_subdivisions;i++)
     {
-        int iTargetBuffer = 1-iCurrentBuffer;
-        red_tris[iTargetBuffer].clear();
-        blue_tris[iTargetBuffer].clear();
-        // subdivide the red triangles
-        for(vector<Tri>::const_iterator it = red_tris[iCurrentBuffer].begin();it!=red_tris[iCurrentBuffer].end();it++)
+        const int iTargetBuffer = 1-iCurrentBuffer;
+        const vector<Tri>& red_source = red_tris[iCurrentBuffer];
+        const vector<Tri>& blue_source = blue_tris[iCurrentBuffer];
+        vector<Tri>& red_target = red_tris[iTargetBuffer];
+        vector<Tri>& blue_target = blue_tris[iTargetBuffer];
+        const size_t n_red = red_source.size();
+        const size_t n_blue = blue_source.size();
+        const int n_threads = GetNumberOfWorkerThreads(n_red + n_blue, MIN_ITEMS_PER_THREAD);
+
+        // find where the edges of each triangle get split (independent, so done in parallel)
+        splits.resize(n_red * n_red_splits + n_blue * n_blue_splits);
+        EdgeSplit *red_splits = splits.data();
+        EdgeSplit *blue_splits = splits.data() + n_red * n_red_splits;
+        ParallelFor(n_threads, n_red + n_blue, [&](int, size_t begin, size_t end)
         {
-            switch(type)
+            for(size_t iTri=begin;iTri<end;iTri++)
             {
-                default:
-                case RHOMBI:
+                if(iTri < n_red)
                 {
-                    int iP = SplitEdge(*it,0,1,px,py,edge_splits,pts); // split A and B to get a new point P
-                    red_tris[iTargetBuffer].push_back(Tri(it->p[2][0],it->p[2][1],it->index[2],px,py,iP,it->p[1][0],it->p[1][1],it->index[1]));
-                    blue_tris[iTargetBuffer].push_back(Tri(px,py,iP,it->p[2][0],it->p[2][1],it->index[2],it->p[0][0],it->p[0][1],it->index[0]));
-                    break;
+                    const Tri& tri = red_source[iTri];
+                    EdgeSplit *s = red_splits + iTri * n_red_splits;
+                    switch(type)
+                    {
+                        default:
+                        case RHOMBI:
+                            SplitEdge(tri,0,1,s[0]); // split A and B to get a new point P
+                            break;
+                        case DARTS_AND_KITES:
+                            SplitEdge(tri,0,1,s[0]); // split A and B to get point Q
+                            SplitEdge(tri,1,2,s[1]); // split B and C to get point R
+                            break;
+                    }
                 }
-                case DARTS_AND_KITES:
+                else
                 {
-                    int iQ = SplitEdge(*it,0,1,qx,qy,edge_splits,pts); // split A and B to get point Q
-                    int iR = SplitEdge(*it,1,2,rx,ry,edge_splits,pts); // split B and C to get point R
-                    blue_tris[iTargetBuffer].push_back(Tri(rx,ry,iR,qx,qy,iQ,it->p[1][0],it->p[1][1],it->index[1]));
-                    red_tris[iTargetBuffer].push_back(Tri(qx,qy,iQ,it->p[0][0],it->p[0][1],it->index[0],rx,ry,iR));
-                    red_tris[iTargetBuffer].push_back(Tri(it->p[2][0],it->p[2][1],it->index[2],it->p[0][0],it->p[0][1],it->index[0],rx,ry,iR));
-                    break;
+                    const Tri& tri = blue_source[iTri - n_red];
+                    EdgeSplit *s = blue_splits + (iTri - n_red) * n_blue_splits;
+                    switch(type)
+                    {
+                        default:
+                        case RHOMBI:
+                            SplitEdge(tri,1,0,s[0]); // split B and A to get point Q
+                            SplitEdge(tri,1,2,s[1]); // split B and C to get point R
+                            break;
+                        case DARTS_AND_KITES:
+                            SplitEdge(tri,2,0,s[0]); // split C and A to get point P
+                            break;
+                    }
                 }
             }
+        });
+
+        // insert the new points, unless one already exists (in order, so the points are numbered the same on every run)
+        for(EdgeSplit& split : splits)
+        {
+            pair<TEdgeIndex::iterator,bool> inserted = edge_splits.emplace( GetEdgeKey(split.i1,split.i2), static_cast<int>(pts.size()/2) );
+            if(inserted.second)
+            {
+                pts.push_back(split.x);
+                pts.push_back(split.y);
+            }
+            split.iP = inserted.first->second;
         }
-        // subdivide the blue triangles
-        for(vector<Tri>::const_iterator it = blue_tris[iCurrentBuffer].begin();it!=blue_tris[iCurrentBuffer].end();it++)
+
+        // make the new triangles, each source triangle writing to its own place in the target lists
+        red_target.resize(n_red * red_from_red + n_blue * red_from_blue);
+        blue_target.resize(n_red * blue_from_red + n_blue * blue_from_blue);
+        ParallelFor(n_threads, n_red + n_blue, [&](int, size_t begin, size_t end)
         {
-            switch(type)
+            for(size_t iTri=begin;iTri<end;iTri++)
             {
-                default:
-                case RHOMBI:
+                if(iTri < n_red)
                 {
-                    int iQ = SplitEdge(*it,1,0,qx,qy,edge_splits,pts); // split B and A to get point Q
-                    int iR = SplitEdge(*it,1,2,rx,ry,edge_splits,pts); // split B and C to get point R
-                    red_tris[iTargetBuffer].push_back(Tri(rx,ry,iR,qx,qy,iQ,it->p[0][0],it->p[0][1],it->index[0]));
-                    blue_tris[iTargetBuffer].push_back(Tri(rx,ry,iR,it->p[2][0],it->p[2][1],it->index[2],it->p[0][0],it->p[0][1],it->index[0]));
-                    blue_tris[iTargetBuffer].push_back(Tri(qx,qy,iQ,rx,ry,iR,it->p[1][0],it->p[1][1],it->index[1]));
-                    break;
+                    const Tri& tri = red_source[iTri];
+                    const EdgeSplit *s = red_splits + iTri * n_red_splits;
+                    Tri *new_red = &red_target[iTri * red_from_red];
+                    Tri *new_blue = &blue_target[iTri * blue_from_red];
+                    switch(type)
+                    {
+                        default:
+                        case RHOMBI:
+                        {
+                            const EdgeSplit& P = s[0];
+                            new_red[0] = Tri(tri.p[2][0],tri.p[2][1],tri.index[2],P.x,P.y,P.iP,tri.p[1][0],tri.p[1][1],tri.index[1]);
+                            new_blue[0] = Tri(P.x,P.y,P.iP,tri.p[2][0],tri.p[2][1],tri.index[2],tri.p[0][0],tri.p[0][1],tri.index[0]);
+                            break;
+                        }
+                        case DARTS_AND_KITES:
+                        {
+                            const EdgeSplit& Q = s[0];
+                            const EdgeSplit& R = s[1];
+                            new_blue[0] = Tri(R.x,R.y,R.iP,Q.x,Q.y,Q.iP,tri.p[1][0],tri.p[1][1],tri.index[1]);
+                            new_red[0] = Tri(Q.x,Q.y,Q.iP,tri.p[0][0],tri.p[0][1],tri.index[0],R.x,R.y,R.iP);
+                            new_red[1] = Tri(tri.p[2][0],tri.p[2][1],tri.index[2],tri.p[0][0],tri.p[0][1],tri.index[0],R.x,R.y,R.iP);
+                            break;
+                        }
+                    }
                 }
-                case DARTS_AND_KITES:
+                else
                 {
-                    int iP = SplitEdge(*it,2,0,px,py,edge_splits,pts); // split C and A to get point P
-                    blue_tris[iTargetBuffer].push_back(Tri(it->p[1][0],it->p[1][1],it->index[1],px,py,iP,it->p[0][0],it->p[0][1],it->index[0]));
-                    red_tris[iTargetBuffer].push_back(Tri(px,py,iP,it->p[2][0],it->p[2][1],it->index[2],it->p[1][0],it->p[1][1],it->index[1]));
-                    break;
+                    const size_t iBlue = iTri - n_red;
+                    const Tri& tri = blue_source[iBlue];
+                    const EdgeSplit *s = blue_splits + iBlue * n_blue_splits;
+                    Tri *new_red = &red_target[n_red * red_from_red + iBlue * red_from_blue];
+                    Tri *new_blue = &blue_target[n_red * blue_from_red + iBlue * blue_from_blue];
+                    switch(type)
+                    {
+                        default:
+                        case RHOMBI:
+                        {
+                            const EdgeSplit& Q = s[0];
+                            const EdgeSplit& R = s[1];
+                            new_red[0] = Tri(R.x,R.y,R.iP,Q.x,Q.y,Q.iP,tri.p[0][0],tri.p[0][1],tri.index[0]);
+                            new_blue[0] = Tri(R.x,R.y,R.iP,tri.p[2][0],tri.p[2][1],tri.index[2],tri.p[0][0],tri.p[0][1],tri.index[0]);
+                            new_blue[1] = Tri(Q.x,Q.y,Q.iP,R.x,R.y,R.iP,tri.p[1][0],tri.p[1][1],tri.index[1]);
+                            break;
+                        }
+                        case DARTS_AND_KITES:
+                        {
+                            const EdgeSplit& P = s[0];
+                            new_blue[0] = Tri(tri.p[1][0],tri.p[1][1],tri.index[1],P.x,P.y,P.iP,tri.p[0][0],tri.p[0][1],tri.index[0]);
+                            new_red[0] = Tri(P.x,P.y,P.iP,tri.p[2][0],tri.p[2][1],tri.index[2],tri.p[1][0],tri.p[1][1],tri.index[1]);
+                            break;
+                        }
+                    }
                 }
             }
-        }
+        });
         iCurrentBuffer = iTargetBuffer;
+        if(progress)
+            progress( 0.9 * (i+1) / n_subdivisions );
     }
 
     // merge triangles that have abutting open edges into quads
-    vtkSmartPointer<vtkCellArray> cells = vtkSmartPointer<vtkCellArray>::New();
+    vector<vtkIdType> quads; // (in the legacy cell array layout: 4,a,b,c,d,4,...)
     {
-        vector<Tri> all_tris(red_tris[iCurrentBuffer]);
-        all_tris.insert(all_tris.end(),blue_tris[iCurrentBuffer].begin(),blue_tris[iCurrentBuffer].end());
-        TPairIndex half_quads; // for each open edge, what is the index of its triangle?
-        TPairIndex::const_iterator found;
-        for(int iTri = 0; iTri<(int)all_tris.size(); iTri++)
+        const vector<Tri>& red = red_tris[iCurrentBuffer];
+        const vector<Tri>& blue = blue_tris[iCurrentBuffer];
+        const size_t n_tris = red.size() + blue.size();
+        quads.reserve( 5 * ( n_tris / 2 ) );
+        unordered_map<uint64_t,size_t> half_quads; // for each open edge, what is the index of its triangle?
+        half_quads.reserve( n_tris );
+        for(size_t iTri = 0; iTri<n_tris; iTri++)
         {
-            // is this the other half of a triangle we've seen previously?
-            pair<int,int> edge(all_tris[iTri].index[1],all_tris[iTri].index[2]);
-            found = half_quads.find(edge);
-            if(found!=half_quads.end())
+            const Tri& tri = (iTri < red.size()) ? red[iTri] : blue[iTri - red.size()];
+            // is this the other half of a triangle we've seen previously? if not then store it for later
+            pair<unordered_map<uint64_t,size_t>::iterator,bool> inserted = half_quads.emplace( GetEdgeKey(tri.index[1],tri.index[2]), iTri );
+            if(!inserted.second)
             {
                 // output a quad (no need to store the triangle)
-                cells->InsertNextCell(4);
-                cells->InsertCellPoint(all_tris[iTri].index[0]);
-                cells->InsertCellPoint(all_tris[iTri].index[1]);
-                cells->InsertCellPoint(all_tris[found->second].index[0]);
-                cells->InsertCellPoint(all_tris[iTri].index[2]);
-            }
-            else
-            {
-                // this triangle has not yet found its other half so store it for later
-                half_quads[edge] = iTri;
+                const size_t iOther = inserted.first->second;
+                const Tri& other = (iOther < red.size()) ? red[iOther] : blue[iOther - red.size()];
+                quads.push_back(4);
+                quads.push_back(tri.index[0]);
+                quads.push_back(tri.index[1]);
+                quads.push_back(other.index[0]);
+                quads.push_back(tri.index[2]);
             }
         }
     }
 
-    mesh->SetPoints(pts);
-    mesh->SetCells(VTK_POLYGON,cells);
+    const vtkIdType n_points = static_cast<vtkIdType>(pts.size() / 2);
+    vtkSmartPointer<vtkPoints> points = vtkSmartPointer<vtkPoints>::New();
+    points->SetNumberOfPoints(n_points);
+    for(vtkIdType i=0;i<n_points;i++)
+        points->SetPoint(i,pts[2*i],pts[2*i+1],0);
+    mesh->SetPoints(points);
+    mesh->SetCells(VTK_POLYGON,MakeCellArray(static_cast<vtkIdType>(quads.size() / 5),quads));
 
     // allocate the chemicals arrays
     for(int iChem=0;iChem<n_chems;iChem++)
@@ -503,6 +674,9 @@ void MeshGenerators::GetPenroseTiling(/*int*/double n_subdivisions,int type,vtkU
         scalars->FillComponent(0,0.0f);
         mesh->GetCellData()->AddArray(scalars);
     }
+
+    if(progress)
+        progress(1.0);
 }
 
 // ---------------------------------------------------------------------
@@ -543,112 +717,153 @@ void MeshGenerators::GetRandomDelaunay2D(int n_points,vtkUnstructuredGrid *mesh,
 
 // ---------------------------------------------------------------------
 
-void MeshGenerators::GetRandomVoronoi2D(int n_points,vtkUnstructuredGrid *mesh,int n_chems,int data_type)
+void MeshGenerators::GetRandomVoronoi2D(int n_points,vtkUnstructuredGrid *mesh,int n_chems,int data_type,const ProgressCallback& progress)
 {
     // make a 2D mesh of voronoi cells from a point cloud
 
-    vtkSmartPointer<vtkPolyData> old_poly = vtkSmartPointer<vtkPolyData>::New();
+    vtkSmartPointer<vtkPolyData> old_poly;
     double side = sqrt((double)n_points); // spread enough for <pixel> access
     // first make a delaunay triangular mesh
     {
         vtkSmartPointer<vtkPoints> pts = vtkSmartPointer<vtkPoints>::New();
         pts->SetNumberOfPoints(n_points);
-        vtkSmartPointer<vtkCellArray> cells = vtkSmartPointer<vtkCellArray>::New();
         for(vtkIdType i=0;i<(vtkIdType)n_points;i++)
-        {
             pts->SetPoint(i,vtkMath::Random()*side,vtkMath::Random()*side,0);
-            cells->InsertNextCell(1);
-            cells->InsertCellPoint(i);
-        }
-        old_poly->SetPoints(pts);
-        old_poly->SetPolys(cells);
+        vtkSmartPointer<vtkPolyData> cloud = vtkSmartPointer<vtkPolyData>::New();
+        cloud->SetPoints(pts);
         vtkSmartPointer<vtkDelaunay2D> del = vtkSmartPointer<vtkDelaunay2D>::New();
-        del->SetInputData(old_poly);
-        del->Update();
-        old_poly->DeepCopy(del->GetOutput());
-        old_poly->BuildLinks();
+        del->SetInputData(cloud);
+        UpdateWithProgress(del,progress,0.0,0.5);
+        old_poly = del->GetOutput();
+    }
+
+    // copy the triangles into plain arrays, so the rest can be done in parallel without going through VTK
+    const vtkIdType n_tris = old_poly->GetNumberOfCells();
+    const vtkIdType n_old_points = old_poly->GetNumberOfPoints();
+    vector<vtkIdType> tri_points(3*n_tris);
+    {
+        vtkSmartPointer<vtkIdList> ids = vtkSmartPointer<vtkIdList>::New();
+        for(vtkIdType i=0;i<n_tris;i++)
+        {
+            old_poly->GetCellPoints(i,ids);
+            for(int j=0;j<3;j++)
+                tri_points[3*i+j] = ids->GetId(j); // (input mesh is only triangles)
+        }
+    }
+    vector<double> old_coords(3*n_old_points);
+    for(vtkIdType i=0;i<n_old_points;i++)
+        old_poly->GetPoint(i,&old_coords[3*i]);
+    // for each point, the triangles that use it, in order (a compressed row layout: point i's are at [tri_offsets[i],tri_offsets[i+1]))
+    vector<vtkIdType> tri_offsets(n_old_points+1,0);
+    for(vtkIdType iPt : tri_points)
+        tri_offsets[iPt+1]++;
+    for(vtkIdType i=0;i<n_old_points;i++)
+        tri_offsets[i+1] += tri_offsets[i];
+    vector<vtkIdType> point_tris(tri_points.size());
+    {
+        vector<vtkIdType> next(tri_offsets.begin(),tri_offsets.end()-1);
+        for(vtkIdType iTri=0;iTri<n_tris;iTri++)
+            for(int j=0;j<3;j++)
+                point_tris[next[tri_points[3*iTri+j]]++] = iTri;
     }
 
     // then make polygons from the circumcenters of the neighboring triangles of each vertex
 
     // points: the circumcenter of each tri
-    vtkSmartPointer<vtkPoints> pts = vtkSmartPointer<vtkPoints>::New();
-    pts->SetNumberOfPoints(old_poly->GetNumberOfCells());
-    double center[3]={0,0,0},p1[3],p2[3],p3[3];
-    vtkSmartPointer<vtkGenericCell> cell = vtkSmartPointer<vtkGenericCell>::New();
-    for(vtkIdType i=0;i<old_poly->GetNumberOfCells();i++)
+    vector<double> centers(3*n_tris,0.0);
+    ParallelFor(GetNumberOfWorkerThreads(n_tris,MIN_ITEMS_PER_THREAD), n_tris, [&](int, size_t begin, size_t end)
     {
-        old_poly->GetCell(i,cell);
-        vtkIdType pt1 = cell->GetPointId(0);
-        vtkIdType pt2 = cell->GetPointId(1);
-        vtkIdType pt3 = cell->GetPointId(2);
-        old_poly->GetPoint(pt1,p1);
-        old_poly->GetPoint(pt2,p2);
-        old_poly->GetPoint(pt3,p3);
-        vtkTriangle::Circumcircle(p1,p2,p3,center);
-        pts->SetPoint(i,center);
-    }
+        for(size_t i=begin;i<end;i++)
+            vtkTriangle::Circumcircle(&old_coords[3*tri_points[3*i]],&old_coords[3*tri_points[3*i+1]],&old_coords[3*tri_points[3*i+2]],&centers[3*i]);
+    });
+    if(progress)
+        progress(0.6);
+
     // polys: join the circumcenters of each neighboring tri of each point (if >2)
-    vtkSmartPointer<vtkCellArray> new_cells = vtkSmartPointer<vtkCellArray>::New();
-    vtkSmartPointer<vtkIdList> cell_ids = vtkSmartPointer<vtkIdList>::New();
-    for(vtkIdType i=0;i<old_poly->GetNumberOfPoints();i++)
+    vector<vector<vtkIdType> > polygons(n_old_points);
+    ParallelFor(GetNumberOfWorkerThreads(n_old_points,MIN_ITEMS_PER_THREAD), n_old_points, [&](int, size_t begin, size_t end)
     {
-        old_poly->GetPointCells(i,cell_ids);
-        if(cell_ids->GetNumberOfIds()<=2) continue;
-        // collect the points
-        vector<vtkIdType> pt_ids;
+        for(size_t i=begin;i<end;i++)
         {
-            const int N_POINTS = cell_ids->GetNumberOfIds();
-            int iCurrentCell = 0;
-            vector<bool> seen(N_POINTS,false);
-            pt_ids.push_back(cell_ids->GetId(iCurrentCell));
-            seen[0]=true;
-            vtkSmartPointer<vtkIdList> cell_pts = vtkSmartPointer<vtkIdList>::New();
-            vtkSmartPointer<vtkIdList> cell_pts2 = vtkSmartPointer<vtkIdList>::New();
-            for(vtkIdType j=1;j<N_POINTS;j++)
+            const vtkIdType *cell_ids = &point_tris[tri_offsets[i]];
+            const int N_POINTS = static_cast<int>(tri_offsets[i+1] - tri_offsets[i]);
+            if(N_POINTS<=2) continue;
+            // collect the points
+            vector<vtkIdType>& pt_ids = polygons[i];
+            pt_ids.reserve(N_POINTS);
             {
-                // find a cell in the list that is a neighbor of iCurrentCell and not yet seen
-                for(vtkIdType k=0;k<N_POINTS;k++)
+                int iCurrentCell = 0;
+                vector<bool> seen(N_POINTS,false);
+                pt_ids.push_back(cell_ids[iCurrentCell]);
+                seen[0]=true;
+                for(int j=1;j<N_POINTS;j++)
                 {
-                    if(seen[k]) continue;
-                    old_poly->GetCellPoints(cell_ids->GetId(iCurrentCell),cell_pts);
-                    old_poly->GetCellPoints(cell_ids->GetId(k),cell_pts2);
-                    cell_pts->IntersectWith(cell_pts2);
-                    if(cell_pts->GetNumberOfIds()==2) // (input mesh is only triangles)
+                    // find a cell in the list that is a neighbor of iCurrentCell and not yet seen
+                    const vtkIdType *current_pts = &tri_points[3*cell_ids[iCurrentCell]];
+                    for(int k=0;k<N_POINTS;k++)
                     {
-                        pt_ids.push_back(cell_ids->GetId(k));
-                        seen[k] = true;
-                        iCurrentCell = k;
-                        break;
+                        if(seen[k]) continue;
+                        const vtkIdType *other_pts = &tri_points[3*cell_ids[k]];
+                        int n_shared = 0;
+                        for(int a=0;a<3;a++)
+                            for(int b=0;b<3;b++)
+                                if(current_pts[a]==other_pts[b])
+                                    n_shared++;
+                        if(n_shared==2)
+                        {
+                            pt_ids.push_back(cell_ids[k]);
+                            seen[k] = true;
+                            iCurrentCell = k;
+                            break;
+                        }
                     }
                 }
             }
-        }
-        // check if all the points are within the original area (don't want the external stretched ones)
-        bool is_ok = true;
-        for(vector<vtkIdType>::const_iterator it=pt_ids.begin();it!=pt_ids.end();it++)
-        {
-            double p[3];
-            pts->GetPoint(*it,p);
-            if(p[0]<0 || p[0]>side || p[1]<0 || p[1]>side)
+            // check if all the points are within the original area (don't want the external stretched ones)
+            for(vtkIdType iPt : pt_ids)
             {
-                is_ok = false;
-                break;
+                const double *p = &centers[3*iPt];
+                if(p[0]<0 || p[0]>side || p[1]<0 || p[1]>side)
+                {
+                    pt_ids.clear();
+                    break;
+                }
             }
         }
-        if(!is_ok) continue;
-        // add the cell to the mesh
-        new_cells->InsertNextCell((vtkIdType)pt_ids.size(),&pt_ids[0]);
+    });
+    if(progress)
+        progress(0.8);
+
+    // add the cells to the mesh
+    vtkIdType n_polygons = 0;
+    size_t connectivity_size = 0;
+    for(const vector<vtkIdType>& pt_ids : polygons)
+    {
+        if(pt_ids.empty()) continue;
+        n_polygons++;
+        connectivity_size += 1 + pt_ids.size();
+    }
+    vector<vtkIdType> connectivity;
+    connectivity.reserve(connectivity_size);
+    for(const vector<vtkIdType>& pt_ids : polygons)
+    {
+        if(pt_ids.empty()) continue;
+        connectivity.push_back(static_cast<vtkIdType>(pt_ids.size()));
+        connectivity.insert(connectivity.end(),pt_ids.begin(),pt_ids.end());
     }
+    vtkSmartPointer<vtkPoints> pts = vtkSmartPointer<vtkPoints>::New();
+    pts->SetNumberOfPoints(n_tris);
+    for(vtkIdType i=0;i<n_tris;i++)
+        pts->SetPoint(i,&centers[3*i]);
 
     // remove unused points (they affect the bounding box)
     vtkSmartPointer<vtkPolyData> poly = vtkSmartPointer<vtkPolyData>::New();
     poly->SetPoints(pts);
-    poly->SetPolys(new_cells);
+    poly->SetPolys(MakeCellArray(n_polygons,connectivity));
     vtkSmartPointer<vtkCleanPolyData> clean = vtkSmartPointer<vtkCleanPolyData>::New();
     clean->SetInputData(poly);
     clean->PointMergingOff();
-    clean->Update();
+    UpdateWithProgress(clean,progress,0.8,1.0);
     mesh->SetPoints(clean->GetOutput()->GetPoints());
     mesh->SetCells(VTK_POLYGON,clean->GetOutput()->GetPolys());
 
@@ -666,23 +881,32 @@ void MeshGenerators::GetRandomVoronoi2D(int n_points,vtkUnstructuredGrid *mesh,i
 
 // ---------------------------------------------------------------------
 
-void MeshGenerators::GetRandomDelaunay3D(int n_points,vtkUnstructuredGrid *mesh,int n_chems,int data_type)
+void MeshGenerators::GetRandomDelaunay3D(int n_points,vtkUnstructuredGrid *mesh,int n_chems,int data_type,const ProgressCallback& progress)
 {
     // TODO: we could make any number of shapes here but we need a more general mechanism,
     // e.g. input a closed surface, scatter points inside, tetrahedralize
 
-    // make a tetrahedral mesh by delaunay tetrahedralization on a point cloud
-    vtkSmartPointer<vtkPointSource> pts = vtkSmartPointer<vtkPointSource>::New();
+    // scatter points uniformly inside an ellipsoid, the same way as vtkPointSource does for a sphere
+    // (but writing them straight into the points array, without going through a transform filter)
+    const double radii[3] = { 100, 50, 50 }; // just to make it a bit more interesting we stretch the points in one direction
+    vtkSmartPointer<vtkPoints> pts = vtkSmartPointer<vtkPoints>::New();
     pts->SetNumberOfPoints(n_points);
-    vtkSmartPointer<vtkTransform> transform = vtkSmartPointer<vtkTransform>::New();
-    transform->Scale(200,100,100); // just to make it a bit more interesting we stretch the points in one direction
-    vtkSmartPointer<vtkTransformPolyDataFilter> trans = vtkSmartPointer<vtkTransformPolyDataFilter>::New();
-    trans->SetTransform(transform);
-    trans->SetInputConnection(pts->GetOutputPort());
+    for(vtkIdType i=0;i<(vtkIdType)n_points;i++)
+    {
+        const double cosphi = 1.0 - 2.0 * vtkMath::Random();
+        const double sinphi = sqrt( 1.0 - cosphi * cosphi );
+        const double rho = pow( vtkMath::Random(), 1.0 / 3.0 );
+        const double theta = 2.0 * M_PI * vtkMath::Random();
+        pts->SetPoint(i, radii[0] * rho * sinphi * cos(theta), radii[1] * rho * sinphi * sin(theta), radii[2] * rho * cosphi);
+    }
+    vtkSmartPointer<vtkPolyData> cloud = vtkSmartPointer<vtkPolyData>::New();
+    cloud->SetPoints(pts);
+
+    // make a tetrahedral mesh by delaunay tetrahedralization on the point cloud
     vtkSmartPointer<vtkDelaunay3D> del = vtkSmartPointer<vtkDelaunay3D>::New();
-    del->SetInputConnection(trans->GetOutputPort());
-    del->Update();
-    mesh->DeepCopy(del->GetOutput());
+    del->SetInputData(cloud);
+    UpdateWithProgress(del,progress,0.0,1.0);
+    mesh->ShallowCopy(del->GetOutput()); // (the filter goes away after this so there's no need to copy the data)
 
     // allocate the chemicals arrays
     for(int iChem=0;iChem<n_chems;iChem++)
@@ -936,13 +1160,114 @@ void GetInversionCircleForPlaneTiling( double edge_length, int schlafli1, int sc
 
 // ---------------------------------------------------------------------
 
-void MeshGenerators::GetHyperbolicPlaneTiling(int schlafli1,int schlafli2,int num_levels,vtkUnstructuredGrid *mesh,int n_chems,int data_type)
+/// Make the cells of a hyperbolic tiling by repeatedly inverting the central cell in the mirror spheres.
+/** Returns the vertex coordinates of each cell: num_vertices*3 values per cell. Each level reflects the cells that
+    were new in the previous level in every sphere (in parallel), then keeps the reflections whose centroid we haven't
+    seen before, in order. Cells that turn out to be duplicates are not reflected further, since their reflections are
+    duplicates too - this keeps the work proportional to the number of cells instead of growing exponentially with
+    the number of levels. */
+vector<double> GetCellsByInversion(const vector<vector<double> >& vertex_coords,const vector<vector<double> >& sphere_centers,
+                                   double R,int num_levels,const MeshGenerators::ProgressCallback& progress)
+{
+    const int num_vertices = static_cast<int>(vertex_coords.size());
+    const size_t num_spheres = sphere_centers.size();
+    const size_t cell_size = 3 * num_vertices;
+
+    vtkSmartPointer<vtkPointLocator> point_locator = vtkSmartPointer<vtkPointLocator>::New();
+    vtkSmartPointer<vtkPoints> locator_points = vtkSmartPointer<vtkPoints>::New();
+    double bounds[6] = {-10,10,-10,10,-10,10};
+    point_locator->InitPointInsertion(locator_points,bounds);
+
+    // start with the central cell
+    vector<double> cells;
+    double centroid[3] = {0,0,0};
+    for(int iV = 0; iV < num_vertices; ++iV ) {
+        cells.insert( cells.end(), vertex_coords[iV].begin(), vertex_coords[iV].end() );
+        for( int xyz = 0; xyz < 3; ++xyz )
+            centroid[xyz] += vertex_coords[iV][xyz];
+    }
+    for( int xyz = 0; xyz < 3; ++xyz )
+        centroid[xyz] /= num_vertices;
+    point_locator->InsertNextPoint( centroid );
+
+    size_t iFirstNewCell = 0;
+    size_t num_new_cells = 1;
+    vector<double> candidates, candidate_centroids;
+    for( int iLevel = 0; iLevel < num_levels; ++iLevel )
+    {
+        // reflect each new cell in each sphere
+        const size_t num_candidates = num_new_cells * num_spheres;
+        candidates.resize( num_candidates * cell_size );
+        candidate_centroids.resize( num_candidates * 3 );
+        ParallelFor(GetNumberOfWorkerThreads(num_candidates,MIN_ITEMS_PER_THREAD), num_candidates, [&](int, size_t begin, size_t end)
+        {
+            for( size_t iCandidate = begin; iCandidate < end; ++iCandidate )
+            {
+                const double *parent = &cells[ ( iFirstNewCell + iCandidate / num_spheres ) * cell_size ];
+                const vector<double>& sphere_center = sphere_centers[ iCandidate % num_spheres ];
+                double *child = &candidates[ iCandidate * cell_size ];
+                double *c = &candidate_centroids[ iCandidate * 3 ];
+                c[0] = c[1] = c[2] = 0.0;
+                for(int iV = 0; iV < num_vertices; ++iV ) {
+                    sphereInversion( parent + 3*iV, sphere_center, R, child + 3*iV );
+                    c[0] += child[3*iV+0];
+                    c[1] += child[3*iV+1];
+                    c[2] += child[3*iV+2];
+                }
+                c[0] /= num_vertices;
+                c[1] /= num_vertices;
+                c[2] /= num_vertices;
+            }
+        });
+        // only add each cell if we haven't seen its centroid before
+        iFirstNewCell = cells.size() / cell_size;
+        for( size_t iCandidate = 0; iCandidate < num_candidates; ++iCandidate )
+        {
+            double *c = &candidate_centroids[ iCandidate * 3 ];
+            if( point_locator->IsInsertedPoint( c ) < 0 )
+            {
+                point_locator->InsertNextPoint( c );
+                cells.insert( cells.end(), candidates.begin() + iCandidate * cell_size, candidates.begin() + ( iCandidate + 1 ) * cell_size );
+            }
+        }
+        num_new_cells = cells.size() / cell_size - iFirstNewCell;
+        if( progress )
+            progress( 0.8 * ( iLevel + 1 ) / num_levels );
+    }
+    return cells;
+}
+
+// ---------------------------------------------------------------------
+
+/// Merge the vertices that are at exactly the same place (as vtkAppendFilter would), returning the point id of each vertex.
+vtkSmartPointer<vtkPoints> MergeVertices(const vector<double>& coords,vector<vtkIdType>& point_ids)
+{
+    const size_t num_vertices = coords.size() / 3;
+    double bounds[6] = { VTK_DOUBLE_MAX, -VTK_DOUBLE_MAX, VTK_DOUBLE_MAX, -VTK_DOUBLE_MAX, VTK_DOUBLE_MAX, -VTK_DOUBLE_MAX };
+    for( size_t i = 0; i < num_vertices; ++i ) {
+        for( int xyz = 0; xyz < 3; ++xyz ) {
+            bounds[ 2*xyz ] = min( bounds[ 2*xyz ], coords[ 3*i + xyz ] );
+            bounds[ 2*xyz + 1 ] = max( bounds[ 2*xyz + 1 ], coords[ 3*i + xyz ] );
+        }
+    }
+    vtkSmartPointer<vtkPoints> points = vtkSmartPointer<vtkPoints>::New();
+    vtkSmartPointer<vtkMergePoints> merger = vtkSmartPointer<vtkMergePoints>::New();
+    merger->InitPointInsertion( points, bounds, static_cast<vtkIdType>( num_vertices ) );
+    point_ids.resize( num_vertices );
+    for( size_t i = 0; i < num_vertices; ++i )
+        merger->InsertUniquePoint( &coords[ 3*i ], point_ids[i] );
+    return points;
+}
+
+// ---------------------------------------------------------------------
+
+void MeshGenerators::GetHyperbolicPlaneTiling(int schlafli1,int schlafli2,int num_levels,vtkUnstructuredGrid *mesh,int n_chems,int data_type,
+                                              const ProgressCallback& progress)
 {
     // define the central cell
     const double edge_length = 1.0;
     const int num_vertices = schlafli1;
     vector<vector<double> > vertex_coords(num_vertices,vector<double>(3));
-    vector<int> faces(num_vertices);
     double r1 = GetPolygonRadius( edge_length, schlafli1 );
     for( int i = 0; i < num_vertices; ++i )
     {
@@ -950,7 +1275,6 @@ void MeshGenerators::GetHyperbolicPlaneTiling(int schlafli1,int schlafli2,int nu
         vertex_coords[i][0] = r1 * cos( angle );
         vertex_coords[i][1] = r1 * sin( angle );
         vertex_coords[i][2] = 0.0;
-        faces[i] = i;
     }
 
     // define the mirror spheres
@@ -969,68 +1293,25 @@ void MeshGenerators::GetHyperbolicPlaneTiling(int schlafli1,int schlafli2,int nu
         sphere_centers[i][2] = n[2] * d / nl;
     }
 
-    // make a list of lists of sphere ids to use
-    vector< vector< int > > sphere_lists;
-    sphere_lists.push_back( vector<int>() );
-    size_t iList = 0;
-    for( int iLevel = 0; iLevel < num_levels; ++iLevel ) {
-        const size_t num_lists = sphere_lists.size();
-        for( ; iList < num_lists; ++iList ) {
-            for( int iExtraSphere = 0; iExtraSphere < num_spheres; ++iExtraSphere ) {
-                vector<int> extended_list( sphere_lists[iList] );
-                extended_list.push_back( iExtraSphere );
-                sphere_lists.push_back( extended_list );
-            }
-        }
-    }
-
-    vtkSmartPointer<vtkAppendFilter> append = vtkSmartPointer<vtkAppendFilter>::New();
-    append->MergePointsOn();
-
-    vtkSmartPointer<vtkPointLocator> point_locator = vtkSmartPointer<vtkPointLocator>::New();
-    vtkSmartPointer<vtkPoints> locator_points = vtkSmartPointer<vtkPoints>::New();
-    double bounds[6] = {-10,10,-10,10,-10,10};
-    point_locator->InitPointInsertion(locator_points,bounds);
-
-    for( size_t iSphereList = 0; iSphereList < sphere_lists.size(); ++iSphereList )
+    // make the cells by reflecting the starting cell
+    const vector<double> cell_coords = GetCellsByInversion( vertex_coords, sphere_centers, R, num_levels, progress );
+    const vtkIdType num_cells = static_cast<vtkIdType>( cell_coords.size() / ( 3 * num_vertices ) );
+
+    // join the cells together where they share vertices
+    vector<vtkIdType> point_ids;
+    vtkSmartPointer<vtkPoints> points = MergeVertices( cell_coords, point_ids );
+    if( progress )
+        progress( 0.9 );
+    vector<vtkIdType> connectivity( num_cells * ( num_vertices + 1 ) );
+    for( vtkIdType iCell = 0; iCell < num_cells; ++iCell )
     {
-        vector<int>& sphere_list = sphere_lists[iSphereList];
-        // make a cell by reflecting the starting cell in the order listed
-        vtkSmartPointer<vtkUnstructuredGrid> ug = vtkSmartPointer<vtkUnstructuredGrid>::New();
-        vector<vtkIdType> pointIds;
-        vtkSmartPointer<vtkPoints> points = vtkSmartPointer<vtkPoints>::New();
-        double centroid[3] = {0,0,0};
-        for(int iV = 0; iV < num_vertices; ++iV ) {
-            double p[3] = { vertex_coords[iV][0], vertex_coords[iV][1], vertex_coords[iV][2] };
-            for( size_t iSphereEntry = 0; iSphereEntry < sphere_list.size(); ++iSphereEntry )
-            {
-                int iSphere = sphere_list[iSphereEntry];
-                sphereInversion( p, sphere_centers[iSphere], R, p );
-            }
-            pointIds.push_back( points->InsertNextPoint( p ) );
-            centroid[0]+=p[0];
-            centroid[1]+=p[1];
-            centroid[2]+=p[2];
-        }
-        // only add this cell if we haven't seen this centroid before
-        centroid[0] /= num_vertices;
-        centroid[1] /= num_vertices;
-        centroid[2] /= num_vertices;
-        if( point_locator->IsInsertedPoint( centroid ) < 0 )
-        {
-            vector<vtkIdType> faceStream;
-            faceStream.push_back( num_vertices );
-            for( int j = 0; j < num_vertices; ++j )
-                faceStream.push_back( faces[j] );
-            ug->InsertNextCell(VTK_POLYGON,num_vertices,&pointIds.front(),1,&faceStream.front());
-            ug->SetPoints(points);
-            append->AddInputData(ug);
-            point_locator->InsertNextPoint( centroid );
-        }
+        vtkIdType *cell = &connectivity[ iCell * ( num_vertices + 1 ) ];
+        cell[0] = num_vertices;
+        for( int iV = 0; iV < num_vertices; ++iV )
+            cell[ 1 + iV ] = point_ids[ iCell * num_vertices + iV ];
     }
-
-    append->Update();
-    mesh->DeepCopy(append->GetOutput());
+    mesh->SetPoints( points );
+    mesh->SetCells( VTK_POLYGON, MakeCellArray( num_cells, connectivity ) );
 
     // allocate the chemicals arrays
     for(int iChem=0;iChem<n_chems;iChem++)
@@ -1043,6 +1324,8 @@ void MeshGenerators::GetHyperbolicPlaneTiling(int schlafli1,int schlafli2,int nu
         mesh->GetCellData()->AddArray(scalars);
     }
 
+    if( progress )
+        progress( 1.0 );
 }
 
 // ---------------------------------------------------------------------
@@ -1075,7 +1358,8 @@ void GetInversionSphereForSpaceTessellation( double edge_length, int schlafli1,
     d = h + sqrt( R*R - r1*r1 );
 }
 
-void MeshGenerators::GetHyperbolicSpaceTessellation(int schlafli1,int schlafli2,int schlafli3,int num_levels,vtkUnstructuredGrid *mesh,int n_chems,int data_type)
+void MeshGenerators::GetHyperbolicSpaceTessellation(int schlafli1,int schlafli2,int schlafli3,int num_levels,vtkUnstructuredGrid *mesh,int n_chems,int data_type,
+                                                    const ProgressCallback& progress)
 {
     // implemented with help from Adam P. Goucher - many thanks!
 
@@ -1141,72 +1425,32 @@ void MeshGenerators::GetHyperbolicSpaceTessellation(int schlafli1,int schlafli2,
         sphere_centers.push_back( vector<double>( n, n+3 ) );
     }
 
-    // make a list of lists of sphere ids to use
-    vector< vector< int > > sphere_lists;
-    sphere_lists.push_back( vector<int>() );
-    size_t iList = 0;
-    for( int iLevel = 0; iLevel < num_levels; ++iLevel ) {
-        const size_t num_lists = sphere_lists.size();
-        for( ; iList < num_lists; ++iList ) {
-            for( int iExtraSphere = 0; iExtraSphere < num_faces; ++iExtraSphere ) {
-                vector<int> extended_list( sphere_lists[iList] );
-                extended_list.push_back( iExtraSphere );
-                sphere_lists.push_back( extended_list );
-            }
-        }
-    }
-
-    vtkSmartPointer<vtkAppendFilter> append = vtkSmartPointer<vtkAppendFilter>::New();
-    append->MergePointsOn();
-
-    vtkSmartPointer<vtkPointLocator> point_locator = vtkSmartPointer<vtkPointLocator>::New();
-    vtkSmartPointer<vtkPoints> locator_points = vtkSmartPointer<vtkPoints>::New();
-    double bounds[6] = {-10,10,-10,10,-10,10};
-    point_locator->InitPointInsertion(locator_points,bounds);
-
-    for( size_t iSphereList = 0; iSphereList < sphere_lists.size(); ++iSphereList )
+    // make the cells by reflecting the starting cell
+    const vector<double> cell_coords = GetCellsByInversion( vertex_coords, sphere_centers, R, num_levels, progress );
+    const vtkIdType num_cells = static_cast<vtkIdType>( cell_coords.size() / ( 3 * num_vertices ) );
+
+    // join the cells together where they share vertices
+    vector<vtkIdType> point_ids;
+    vtkSmartPointer<vtkPoints> points = MergeVertices( cell_coords, point_ids );
+    if( progress )
+        progress( 0.9 );
+    mesh->SetPoints( points );
+    mesh->Allocate( num_cells );
+    vector<vtkIdType> faceStream;
+    faceStream.reserve( num_faces * ( num_vertices_per_face + 1 ) );
+    for( vtkIdType iCell = 0; iCell < num_cells; ++iCell )
     {
-        vector<int>& sphere_list = sphere_lists[iSphereList];
-        // make a cell by reflecting the starting cell in the order listed
-        vtkSmartPointer<vtkUnstructuredGrid> ug = vtkSmartPointer<vtkUnstructuredGrid>::New();
-        vector<vtkIdType> pointIds;
-        vtkSmartPointer<vtkPoints> points = vtkSmartPointer<vtkPoints>::New();
-        double centroid[3] = {0,0,0};
-        for(int iV = 0; iV < num_vertices; ++iV ) {
-            double p[3] = { vertex_coords[iV][0], vertex_coords[iV][1], vertex_coords[iV][2] };
-            for( size_t iSphereEntry = 0; iSphereEntry < sphere_list.size(); ++iSphereEntry )
-            {
-                int iSphere = sphere_list[iSphereEntry];
-                sphereInversion( p, sphere_centers[iSphere], R, p );
-            }
-            pointIds.push_back( points->InsertNextPoint( p ) );
-            centroid[0]+=p[0];
-            centroid[1]+=p[1];
-            centroid[2]+=p[2];
-        }
-        // only add this cell if we haven't seen this centroid before
-        centroid[0] /= num_vertices;
-        centroid[1] /= num_vertices;
-        centroid[2] /= num_vertices;
-        if( point_locator->IsInsertedPoint( centroid ) < 0 )
+        vtkIdType *cell_point_ids = &point_ids[ iCell * num_vertices ];
+        faceStream.clear();
+        for(int iF = 0; iF < num_faces; ++iF )
         {
-            vector<vtkIdType> faceStream;
-            for(int iF = 0; iF < num_faces; ++iF )
-            {
-                faceStream.push_back( num_vertices_per_face );
-                for(int j = 0; j < num_vertices_per_face; ++j )
-                    faceStream.push_back( faces[iF][j] );
-            }
-            ug->InsertNextCell(VTK_POLYHEDRON,num_vertices,&pointIds.front(),num_faces,&faceStream.front());
-            ug->SetPoints(points);
-            append->AddInputData(ug);
-            point_locator->InsertNextPoint( centroid );
+            faceStream.push_back( num_vertices_per_face );
+            for(int j = 0; j < num_vertices_per_face; ++j )
+                faceStream.push_back( cell_point_ids[ faces[iF][j] ] );
         }
+        mesh->InsertNextCell(VTK_POLYHEDRON,num_vertices,cell_point_ids,num_faces,&faceStream.front());
     }
 
-    append->Update();
-    mesh->DeepCopy(append->GetOutput());
-
     // allocate the chemicals arrays
     for(int iChem=0;iChem<n_chems;iChem++)
     {
@@ -1217,6 +1461,9 @@ void MeshGenerators::GetHyperbolicSpaceTessellation(int schlafli1,int schlafli2,
         scalars->FillComponent(0,0.0f);
         mesh->GetCellData()->AddArray(scalars);
     }
+
+    if( progress )
+        progress( 1.0 );
 }
 
 // ---------------------------------------------------------------------
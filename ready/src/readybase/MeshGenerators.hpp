@@ -18,9 +18,15 @@
 // VTK:
 class vtkUnstructuredGrid;
 
+// STL:
+#include <functional>
+
 /// Methods for generating meshes from scratch.
 namespace MeshGenerators 
 {
+    /// Receives the fraction of the work done so far (0 to 1). Always called on the thread that called the generator.
+    typedef std::function<void(double fraction_done)> ProgressCallback;
+
     /// Subdivides an icosahedron to get a sphere evenly covered with triangles.
     void GetGeodesicSphere(int n_subdivisions,vtkUnstructuredGrid* mesh,int n_chems,int data_type);
 
@@ -37,17 +43,18 @@ namespace MeshGenerators
     void GetRhombilleTiling(int nx,int ny,vtkUnstructuredGrid* mesh,int n_chems,int data_type);
 
     /// Make a planar Penrose tiling, using either rhombi (type=0) or darts and kites (type=1).
-    void GetPenroseTiling(/*int*/double n_subdivisions,int type,vtkUnstructuredGrid* mesh,int n_chems,int data_type);
+    void GetPenroseTiling(/*int*/double n_subdivisions,int type,vtkUnstructuredGrid* mesh,int n_chems,int data_type,
+                          const ProgressCallback& progress = nullptr);
     // (workaround for LLVM/Clang issue: lld-link : error : undefined symbol: __powidf2)
 
     /// Make a 2D Delaunay triangulation from a random set of points
     void GetRandomDelaunay2D(int n_points,vtkUnstructuredGrid *mesh,int n_chems,int data_type);
 
     /// Make a 2D Voronoi mesh from a random set of points
-    void GetRandomVoronoi2D(int n_points,vtkUnstructuredGrid *mesh,int n_chems,int data_type);
+    void GetRandomVoronoi2D(int n_points,vtkUnstructuredGrid *mesh,int n_chems,int data_type,const ProgressCallback& progress = nullptr);
 
     /// Applies the Delaunay algorithm to scattered points to get a mesh of tetrahedra.
-    void GetRandomDelaunay3D(int n_points,vtkUnstructuredGrid* mesh,int n_chems,int data_type);
+    void GetRandomDelaunay3D(int n_points,vtkUnstructuredGrid* mesh,int n_chems,int data_type,const ProgressCallback& progress = nullptr);
 
     /// Make a honeycomb from truncated octahedra.
     void GetBodyCentredCubicHoneycomb(int side,vtkUnstructuredGrid* mesh,int n_chems,int data_type);
@@ -59,8 +66,10 @@ namespace MeshGenerators
     void GetDiamondCells(int side,vtkUnstructuredGrid *mesh,int n_chems,int data_type);
 
     // Make a hyperbolic plane tiling such as {3,7} or {4,5} at the specified recursion level
-    void GetHyperbolicPlaneTiling(int schlafli1,int schlafli2,int num_levels,vtkUnstructuredGrid *mesh,int n_chems,int data_type);
+    void GetHyperbolicPlaneTiling(int schlafli1,int schlafli2,int num_levels,vtkUnstructuredGrid *mesh,int n_chems,int data_type,
+                                  const ProgressCallback& progress = nullptr);
 
     // Make a hyperbolic space tessellation such as {4,3,5} at the specified recursion level
-    void GetHyperbolicSpaceTessellation(int schlafli1,int schlafli2,int schlafli3,int num_levels,vtkUnstructuredGrid *mesh,int n_chems,int data_type);
+    void GetHyperbolicSpaceTessellation(int schlafli1,int schlafli2,int schlafli3,int num_levels,vtkUnstructuredGrid *mesh,int n_chems,int data_type,
+                                        const ProgressCallback& progress = nullptr);
 }
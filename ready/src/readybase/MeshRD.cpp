@@ -84,7 +84,7 @@ MeshRD::MeshRD(int data_type)
 void MeshRD::Update(int n_steps)
 {
     this->undo_stack.clear();
-    this->InternalUpdate(n_steps);
+    this->TimedInternalUpdate(n_steps);
 
     this->timesteps_taken += n_steps;
 
@@ -799,6 +799,37 @@ void MeshRD::ComputeCellNeighbors(TNeighborhood neighborhood_type)
             this->cell_neighbor_weights[k] = 0.0f;
         }
     }
+
+    this->BuildLaplacianOperator(cell_neighbors);
+}
+
+// ---------------------------------------------------------------------
+
+void MeshRD::BuildLaplacianOperator(const vector<vector<TNeighbor> >& cell_neighbors)
+{
+    // laplacian_x = 4 * ( sum_n( w_n * x_n ) - x ), as one row of the matrix per cell
+    // (scaled by 4 to be more similar to the 2D square grid version, so the same parameters work)
+    const int n_cells = static_cast<int>(cell_neighbors.size());
+    const int row_width = this->max_neighbors + 1;
+    vector<int> columns(size_t(n_cells) * row_width);
+    vector<float> values(size_t(n_cells) * row_width, 0.0f);
+    vector<int> row_lengths(n_cells);
+    for(int i=0;i<n_cells;i++)
+    {
+        int* row_columns = &columns[size_t(i) * row_width];
+        float* row_values = &values[size_t(i) * row_width];
+        row_columns[0] = i;
+        row_values[0] = -4.0f;
+        for(int j=0;j<row_width-1;j++)
+        {
+            const bool is_neighbor = j < (int)cell_neighbors[i].size();
+            row_columns[j+1] = is_neighbor ? (int)cell_neighbors[i][j].iNeighbor : i;
+            row_values[j+1] = is_neighbor ? 4.0f * cell_neighbors[i][j].weight : 0.0f;
+        }
+        row_lengths[i] = 1 + (int)cell_neighbors[i].size();
+    }
+    const SparseMatrix::Format format = SparseMatrix::ChooseFormat(row_lengths);
+    this->laplacian_operator.SetFromPaddedRows(n_cells, row_width, columns.data(), values.data(), format);
 }
 
 // ---------------------------------------------------------------------
@@ -1058,7 +1089,7 @@ size_t MeshRD::GetMemorySize() const
     const size_t DATA_SIZE = this->n_chemicals * this->data_type_size * this->mesh->GetNumberOfCells();
     const size_t NBORS_INDICES_SIZE = sizeof(int) * this->mesh->GetNumberOfCells() * this->max_neighbors;
     const size_t NBORS_WEIGHTS_SIZE = sizeof(float) * this->mesh->GetNumberOfCells() * this->max_neighbors;
-    return DATA_SIZE + NBORS_INDICES_SIZE + NBORS_WEIGHTS_SIZE;
+    return DATA_SIZE + NBORS_INDICES_SIZE + NBORS_WEIGHTS_SIZE + this->laplacian_operator.GetMemorySize();
 }
 
 // --------------------------------------------------------------------------------
@@ -20,12 +20,15 @@
 
 // local:
 #include "AbstractRD.hpp"
+#include "SparseMatrix.hpp"
 
 // VTK:
 #include <vtkType.h>
 class vtkUnstructuredGrid;
 class vtkCellLocator;
 
+struct TNeighbor;
+
 /// Base class for mesh-based systems.
 class MeshRD : public AbstractRD
 {
@@ -85,10 +88,17 @@ class MeshRD : public AbstractRD
         /// work out which cells are neighbors of each other
         void ComputeCellNeighbors(TNeighborhood neighborhood_type);
 
+        /// build laplacian_operator from the neighbors, choosing the storage format that suits the mesh
+        void BuildLaplacianOperator(const std::vector<std::vector<TNeighbor> >& cell_neighbors);
+
         void CreateCellLocatorIfNeeded();
 
         void FlipPaintAction(PaintAction& cca) override;
 
+    protected: // constants for the CPU implementations
+
+        static const size_t MIN_CELLS_PER_THREAD = 4096;    ///< smaller meshes aren't worth the cost of starting threads
+
     protected: // variables
 
         vtkSmartPointer<vtkUnstructuredGrid> mesh;             ///< the cell data contains a named array for each chemical ('a', 'b', etc.)
@@ -98,6 +108,8 @@ class MeshRD : public AbstractRD
         std::vector<int> cell_neighbor_indices;   ///< index of each neighbor of a cell
         std::vector<float> cell_neighbor_weights; ///< diffusion coefficient between each cell and a neighbor
 
+        SparseMatrix laplacian_operator;          ///< the same diffusion as a sparse matrix, for the CPU and formula implementations
+
         vtkSmartPointer<vtkCellLocator> cell_locator; ///< Returns a cell ID when given a 3D location
 
     private: // deliberately not implemented, to prevent use
@@ -19,12 +19,15 @@
 
 // local:
 #include "OpenCL_utils.hpp"
+#include "Properties.hpp"
+#include "scene_items.hpp"
 #include "utils.hpp"
 using namespace OpenCL_utils;
 
 // STL:
 #include <algorithm>
 #include <cassert>
+#include <cmath>
 #include <stdexcept>
 #include <sstream>
 #include <utility>
@@ -40,17 +43,301 @@ using namespace OpenCL_utils;
 
 
 // VTK:
+#include <vtkDataArray.h>
 #include <vtkImageData.h>
 #include <vtkMath.h>
+#include <vtkPointData.h>
+#include <vtkScalarsToColors.h>
 
 using namespace std;
 
 // ----------------------------------------------------------------------------------------------------------------
 
+namespace
+{
+    /// Colors one pixel of a 2D slice through the values by looking it up in a table, as vtkImageMapToColors does.
+    const char* color_map_kernel_source = "\n\
+kernel void map_to_colors(global const real* values, global const uchar4* table, global uchar* rgb,\n\
+                          const real low, const real scale, const int n_colors, const int nx,\n\
+                          const long origin, const long step_x, const long step_y)\n\
+{\n\
+    const int i = get_global_id(0);\n\
+    const int j = get_global_id(1);\n\
+    const real v = values[origin + i * step_x + j * step_y];\n\
+    const int k = isnan(v) ? n_colors : clamp(convert_int_rte((v - low) * scale), 0, n_colors - 1); // (NaN is last)\n\
+    const size_t o = 3 * ((size_t)j * nx + i);\n\
+    rgb[o] = table[k].x;\n\
+    rgb[o + 1] = table[k].y;\n\
+    rgb[o + 2] = table[k].z;\n\
+}\n";
+
+    /// Fills the ghost cells along one axis, for each cell across the other axes. The axes before this one are done
+    /// first, and their ghost cells are included, so that the edges and corners are filled too.
+    const char* ghost_cells_kernel_source = "\n\
+kernel void refresh_ghost_cells(global stored_bits* values, const int axis)\n\
+{\n\
+    const int n[3] = { NX, NY, NZ };\n\
+    const int g[3] = { GX, GY, GZ };\n\
+    int q[3] = { get_global_id(0), get_global_id(1), get_global_id(2) };\n\
+    for (int a = axis + 1; a < 3; a++)\n\
+        q[a] += g[a];\n\
+    // along the axis there is a work item for each ghost cell: those on the low side, then those on the high side\n\
+    const int i = q[axis] < g[axis] ? q[axis] - g[axis] : n[axis] + q[axis] - g[axis];\n\
+    // (the ghost cells can reach further than the size of the axis, e.g. a trilaplacian across 2 cells)\n\
+    const int source = WRAP ? ((i % n[axis]) + n[axis]) % n[axis] : clamp(i, 0, n[axis] - 1);\n\
+    const int PX = NX + 2 * GX;\n\
+    const int PY = NY + 2 * GY;\n\
+    q[axis] = g[axis] + i;\n\
+    const int target_index = PX * (PY * q[2] + q[1]) + q[0];\n\
+    q[axis] = g[axis] + source;\n\
+    values[target_index] = values[PX * (PY * q[2] + q[1]) + q[0]];\n\
+}\n";
+
+    /// Copy one value between the plain layout of the images and the buffers that the kernels step, converting it
+    /// to or from the type they store.
+    const char* convert_values_kernel_source = "\n\
+kernel void load_values(global const stored* stepped, global real* plain)\n\
+{\n\
+    const int x = get_global_id(0);\n\
+    const int y = get_global_id(1);\n\
+    const int z = get_global_id(2);\n\
+    const int PX = NX + 2 * GX;\n\
+    const int PY = NY + 2 * GY;\n\
+    plain[NX * (NY * z + y) + x] = LOAD(PX * (PY * (z + GZ) + y + GY) + x + GX, stepped);\n\
+}\n\
+\n\
+kernel void store_values(global const real* plain, global stored* stepped)\n\
+{\n\
+    const int x = get_global_id(0);\n\
+    const int y = get_global_id(1);\n\
+    const int z = get_global_id(2);\n\
+    const int PX = NX + 2 * GX;\n\
+    const int PY = NY + 2 * GY;\n\
+    STORE(plain[NX * (NY * z + y) + x], PX * (PY * (z + GZ) + y + GY) + x + GX, stepped);\n\
+}\n";
+
+    /// The number of samples we take of the color map. Enough that the steps between them don't show in 8-bit colors.
+    const int N_TABLE_COLORS = 1024;
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
 OpenCLImageRD::OpenCLImageRD(int opencl_platform,int opencl_device,int data_type)
     : ImageRD(data_type)
-    , OpenCL_MixIn(opencl_platform,opencl_device)
+    , OpenCL_MixIn(opencl_platform,opencl_device,this->performance_counters)
+    , read_back_done(NULL)
+    , n_steps_being_read_back(0)
+    , n_chemicals_being_read_back(0)
+    , time_read_back_started(0.0)
+    , is_snapshot_current(false)
+    , is_stepping_in_background(false)
+    , chosen_local_work_size{ 0, 0, 0 }
+    , values_per_texel(0)
+    , are_image_objects_current(false)
+    , ghost_cells{ 0, 0, 0 }
+    , buffer_storage(Storage::Same)
+    , layout_program(NULL)
+    , ghost_cells_kernel(NULL)
+    , load_values_kernel(NULL)
+    , store_values_kernel(NULL)
+    , color_map_program(NULL)
+    , color_map_kernel(NULL)
+    , color_table_buffer(NULL)
+    , color_output_buffer(NULL)
+    , color_output_size(0)
+    , color_map_data_type(0)
+{
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+OpenCLImageRD::~OpenCLImageRD()
+{
+    if (this->read_back_done)
+    {
+        clWaitForEvents(1, &this->read_back_done); // (it is writing into our images)
+        clReleaseEvent(this->read_back_done);
+    }
+    for (cl_mem buffer : this->snapshot_buffers)
+        clReleaseMemObject(buffer);
+    this->ReleaseImageObjects();
+    this->ReleaseLayoutKernels();
+    this->ReleaseColorMapObjects();
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void OpenCLImageRD::ReleaseColorMapObjects() const
+{
+    if (this->color_map_kernel)
+        clReleaseKernel(this->color_map_kernel);
+    if (this->color_map_program)
+        clReleaseProgram(this->color_map_program);
+    for (cl_mem buffer : { this->color_table_buffer, this->color_output_buffer })
+        if (buffer)
+            clReleaseMemObject(buffer);
+    this->color_map_kernel = NULL;
+    this->color_map_program = NULL;
+    this->color_table_buffer = this->color_output_buffer = NULL;
+    this->color_output_size = 0;
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+bool OpenCLImageRD::AreOpenCLBuffersCurrent() const
+{
+    // after an edit on the host the images are newer, until the next update writes them to the device, and while
+    // stepping in the background the kernels are changing the buffers
+    // (the color map kernel doesn't know about ghost cells or the storage type, but then the read back goes through
+    // the snapshot anyway)
+    return this->context && !this->need_reload_context && !this->need_write_to_opencl_buffers
+        && !this->is_stepping_in_background && this->AreSteppedBuffersPlain()
+        && this->buffers[this->iCurrentBuffer].size() == static_cast<size_t>(this->GetNumberOfChemicals());
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+bool OpenCLImageRD::IsSnapshotCurrent() const
+{
+    return this->is_snapshot_current && this->context && !this->need_reload_context && !this->need_write_to_opencl_buffers
+        && this->snapshot_buffers.size() == static_cast<size_t>(this->GetNumberOfChemicals());
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void OpenCLImageRD::GetAs2DImage(vtkImageData *out,const Properties& render_settings) const
+{
+    if (this->IsSnapshotCurrent() || this->AreOpenCLBuffersCurrent())
+        this->MapToColorsOnDevice(out, render_settings);
+    else
+        ImageRD::GetAs2DImage(out, render_settings);
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+function<void(vtkImageData*)> OpenCLImageRD::GetAs2DImageLater(const Properties& render_settings) const
 {
+    // on the device it is quicker to make the image now than to copy the values for later
+    if (this->IsSnapshotCurrent() || this->AreOpenCLBuffersCurrent())
+        return AbstractRD::GetAs2DImageLater(render_settings);
+    return ImageRD::GetAs2DImageLater(render_settings);
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void OpenCLImageRD::MapToColorsOnDevice(vtkImageData *out,const Properties& render_settings) const
+{
+    cl_int ret;
+
+    // the snapshot is only written by FinishBackgroundSteps(), so we can color it on the transfer queue without
+    // waiting for (or getting in the way of) any steps that are running
+    const bool from_snapshot = this->IsSnapshotCurrent();
+    cl_command_queue queue = from_snapshot ? this->transfer_queue : this->command_queue;
+
+    if (!this->color_map_kernel || this->color_map_data_type != this->data_type)
+    {
+        this->ReleaseColorMapObjects();
+        ostringstream source;
+        if (this->data_type == VTK_DOUBLE)
+            source << "#pragma OPENCL EXTENSION cl_khr_fp64 : enable\n";
+        source << "typedef " << this->data_type_string << " real;\n" << color_map_kernel_source;
+        this->color_map_program = this->CreateProgramFromSource(source.str());
+        this->color_map_kernel = clCreateKernel(this->color_map_program, "map_to_colors", &ret);
+        throwOnError(ret, "OpenCLImageRD::MapToColorsOnDevice : kernel creation failed: ");
+        this->color_table_buffer = clCreateBuffer(this->context, CL_MEM_READ_ONLY, 4 * (N_TABLE_COLORS + 1), NULL, &ret);
+        throwOnError(ret, "OpenCLImageRD::MapToColorsOnDevice : buffer creation failed: ");
+        this->color_map_data_type = this->data_type;
+    }
+
+    // sample the color map into a table of RGBA values, with the color for NaN at the end
+    const double low = render_settings.GetProperty("low").GetFloat();
+    const double high = render_settings.GetProperty("high").GetFloat();
+    vtkSmartPointer<vtkScalarsToColors> lut = GetColorMap(render_settings);
+    vector<unsigned char> table(4 * (N_TABLE_COLORS + 1));
+    for (int k = 0; k <= N_TABLE_COLORS; k++)
+    {
+        const double v = k < N_TABLE_COLORS ? low + (high - low) * k / (N_TABLE_COLORS - 1) : vtkMath::Nan();
+        const unsigned char* rgba = lut->MapValue(v);
+        copy(rgba, rgba + 4, table.begin() + 4 * k);
+    }
+    ret = clEnqueueWriteBuffer(queue, this->color_table_buffer, CL_FALSE, 0, table.size(), table.data(), 0, NULL, NULL);
+    throwOnError(ret, "OpenCLImageRD::MapToColorsOnDevice : buffer writing failed: ");
+
+    // work out which cells to take, as offsets into the buffer
+    const cl_long X = this->images.front()->GetDimensions()[0];
+    const cl_long Y = this->images.front()->GetDimensions()[1];
+    const cl_long Z = this->images.front()->GetDimensions()[2];
+    cl_int nx = static_cast<cl_int>(X), ny = static_cast<cl_int>(Y);
+    cl_long origin = 0, step_x = 1, step_y = X;
+    if (this->GetArenaDimensionality() == 3)
+    {
+        // match the orientations that ImageRD::GetAs2DImage() gets from vtkImageReslice, with nearest-neighbor sampling
+        const string slice_3D_axis = render_settings.GetProperty("slice_3D_axis").GetAxis();
+        const float slice_3D_position = render_settings.GetProperty("slice_3D_position").GetFloat();
+        auto slice_index = [&](cl_long n) { return min<cl_long>(n - 1, max<cl_long>(0, static_cast<cl_long>(floor(slice_3D_position * n + 0.5)))); };
+        if (slice_3D_axis == "x")
+        {
+            nx = static_cast<cl_int>(Y);
+            ny = static_cast<cl_int>(Z);
+            origin = slice_index(X) + X * Y * (Z - 1);
+            step_x = X;
+            step_y = -X * Y;
+        }
+        else if (slice_3D_axis == "y")
+        {
+            nx = static_cast<cl_int>(X);
+            ny = static_cast<cl_int>(Z);
+            origin = X * slice_index(Y) + X * Y * (Z - 1);
+            step_x = 1;
+            step_y = -X * Y;
+        }
+        else
+        {
+            origin = X * Y * slice_index(Z);
+        }
+    }
+
+    const size_t output_size = 3 * static_cast<size_t>(nx) * ny;
+    if (output_size > this->color_output_size)
+    {
+        if (this->color_output_buffer)
+            clReleaseMemObject(this->color_output_buffer);
+        this->color_output_buffer = clCreateBuffer(this->context, CL_MEM_WRITE_ONLY, output_size, NULL, &ret);
+        throwOnError(ret, "OpenCLImageRD::MapToColorsOnDevice : buffer creation failed: ");
+        this->color_output_size = output_size;
+    }
+
+    const int iActiveChemical = IndexFromChemicalName(render_settings.GetProperty("active_chemical").GetChemical());
+    const double scale = high > low ? (N_TABLE_COLORS - 1) / (high - low) : 0.0;
+    const float low_f = static_cast<float>(low), scale_f = static_cast<float>(scale);
+    const bool is_double = this->data_type == VTK_DOUBLE;
+    const cl_int n_colors = N_TABLE_COLORS;
+    const pair<size_t, const void*> args[] = {
+        { sizeof(cl_mem), from_snapshot ? &this->snapshot_buffers[iActiveChemical] : &this->buffers[this->iCurrentBuffer][iActiveChemical] },
+        { sizeof(cl_mem), &this->color_table_buffer },
+        { sizeof(cl_mem), &this->color_output_buffer },
+        { this->data_type_size, is_double ? static_cast<const void*>(&low) : &low_f },
+        { this->data_type_size, is_double ? static_cast<const void*>(&scale) : &scale_f },
+        { sizeof(cl_int), &n_colors },
+        { sizeof(cl_int), &nx },
+        { sizeof(cl_long), &origin },
+        { sizeof(cl_long), &step_x },
+        { sizeof(cl_long), &step_y } };
+    for (cl_uint i = 0; i < sizeof(args) / sizeof(args[0]); i++)
+    {
+        ret = clSetKernelArg(this->color_map_kernel, i, args[i].first, args[i].second);
+        throwOnError(ret, "OpenCLImageRD::MapToColorsOnDevice : clSetKernelArg failed: ");
+    }
+    const size_t range[2] = { static_cast<size_t>(nx), static_cast<size_t>(ny) };
+    ret = clEnqueueNDRangeKernel(queue, this->color_map_kernel, 2, NULL, range, NULL, 0, NULL, NULL);
+    throwOnError(ret, "OpenCLImageRD::MapToColorsOnDevice : clEnqueueNDRangeKernel failed: ");
+
+    // read the colors straight into the output image
+    out->Initialize();
+    out->SetDimensions(nx, ny, 1);
+    out->AllocateScalars(VTK_UNSIGNED_CHAR, 3);
+    ret = clEnqueueReadBuffer(queue, this->color_output_buffer, CL_TRUE, 0, output_size, out->GetScalarPointer(), 0, NULL, NULL);
+    throwOnError(ret, "OpenCLImageRD::MapToColorsOnDevice : buffer reading failed: ");
 }
 
 // ----------------------------------------------------------------------------------------------------------------
@@ -67,7 +354,9 @@ void OpenCLImageRD::BuildProgram()
     throwOnError(ret, "OpenCLImageRD::ReloadKernelIfNeeded : Failed to create program with source: ");
 
     // build the program
+    const double start = get_time_in_seconds();
     ret = clBuildProgram(this->program, 1, &this->device_id, "-cl-denorms-are-zero", NULL, NULL);
+    this->performance_counters.AddBuild(get_time_in_seconds() - start);
     if (ret != CL_SUCCESS)
     {
         size_t build_log_length = 0;
@@ -93,7 +382,11 @@ void OpenCLImageRD::ReloadKernelIfNeeded()
     this->global_range[1] = max(1, vtkMath::Round(this->GetY()) / this->GetBlockSizeY());
     this->global_range[2] = max(1, vtkMath::Round(this->GetZ()) / this->GetBlockSizeZ());
 
-    if (this->use_local_memory)
+    if (this->chosen_local_work_size[0] > 0)
+    {
+        copy(this->chosen_local_work_size, this->chosen_local_work_size + 3, this->local_work_size);
+    }
+    else if (this->use_local_memory)
     {
         cl_ulong local_memory_size;
         clGetDeviceInfo(this->device_id, CL_DEVICE_LOCAL_MEM_SIZE, sizeof(local_memory_size), &local_memory_size, NULL);
@@ -103,9 +396,9 @@ void OpenCLImageRD::ReloadKernelIfNeeded()
         int n = 1;
         while (n <= 1024)
         {
-            this->local_work_size[0] = min(this->global_range[0], (size_t)4 * n / this->GetBlockSizeX());
-            this->local_work_size[1] = min(this->global_range[1], (size_t)4 * n / this->GetBlockSizeY());
-            this->local_work_size[2] = min(this->global_range[2], (size_t)4 * n / this->GetBlockSizeZ());
+            this->local_work_size[0] = min(this->global_range[0], max((size_t)1, (size_t)4 * n / this->GetBlockSizeX()));
+            this->local_work_size[1] = min(this->global_range[1], max((size_t)1, (size_t)4 * n / this->GetBlockSizeY()));
+            this->local_work_size[2] = min(this->global_range[2], max((size_t)1, (size_t)4 * n / this->GetBlockSizeZ()));
             try
             {
                 // ensure that we don't hit CL_DEVICE_MAX_WORK_GROUP_SIZE
@@ -114,10 +407,9 @@ void OpenCLImageRD::ReloadKernelIfNeeded()
                 {
                     break;
                 }
-                // ensure that we don't hit CL_DEVICE_LOCAL_MEM_SIZE
+                // ensure that we don't hit CL_DEVICE_LOCAL_MEM_SIZE, with a tile (and its halo) for each chemical
                 int extra = 2;
-                size_t expected_mem = 4 * sizeof(float) * (this->local_work_size[0] + extra) * (this->local_work_size[1] + extra) * (this->local_work_size[2] + extra);
-                // TODO: allow for number of chemicals etc, as we allocate in the kernel
+                size_t expected_mem = this->GetNumberOfChemicals() * this->GetBlockSizeX() * this->data_type_size * (this->local_work_size[0] + extra) * (this->local_work_size[1] + extra) * (this->local_work_size[2] + extra);
                 if (expected_mem > local_memory_size)
                 {
                     break;
@@ -131,9 +423,9 @@ void OpenCLImageRD::ReloadKernelIfNeeded()
             n *= 2;
         }
         n /= 2; // return to last known good
-        this->local_work_size[0] = min(this->global_range[0], (size_t)4 * n / this->GetBlockSizeX());
-        this->local_work_size[1] = min(this->global_range[1], (size_t)4 * n / this->GetBlockSizeY());
-        this->local_work_size[2] = min(this->global_range[2], (size_t)4 * n / this->GetBlockSizeZ());
+        this->local_work_size[0] = min(this->global_range[0], max((size_t)1, (size_t)4 * n / this->GetBlockSizeX()));
+        this->local_work_size[1] = min(this->global_range[1], max((size_t)1, (size_t)4 * n / this->GetBlockSizeY()));
+        this->local_work_size[2] = min(this->global_range[2], max((size_t)1, (size_t)4 * n / this->GetBlockSizeZ()));
     }
 
     BuildProgram();
@@ -165,7 +457,14 @@ void OpenCLImageRD::CreateOpenCLBuffers()
         this->buffers[io].resize(NC);
         for(int ic=0;ic<NC;ic++)
         {
-            this->buffers[io][ic] = clCreateBuffer(this->context, CL_MEM_READ_WRITE, MEM_SIZE, NULL, &ret);
+            if (io == 1 && ic < static_cast<int>(this->is_chemical_constant.size()) && this->is_chemical_constant[ic])
+            {
+                // the kernel doesn't change this chemical, so it can read and "write" the same buffer
+                this->buffers[1][ic] = this->buffers[0][ic];
+                clRetainMemObject(this->buffers[1][ic]); // (both entries get released)
+                continue;
+            }
+            this->buffers[io][ic] = clCreateBuffer(this->context, CL_MEM_READ_WRITE, this->GetBufferSize(), NULL, &ret);
             throwOnError(ret,"OpenCLImageRD::CreateOpenCLBuffers : buffer creation failed: ");
         }
     }
@@ -177,11 +476,369 @@ void OpenCLImageRD::CreateOpenCLBuffers()
         throwOnError(ret,"OpenCLImageRD::CreateOpenCLBuffers : buffer creation failed: ");
     }
 
+    this->snapshot_buffers.resize(NC);
+    for(int ic=0;ic<NC;ic++)
+    {
+        this->snapshot_buffers[ic] = clCreateBuffer(this->context, CL_MEM_READ_WRITE, MEM_SIZE, NULL, &ret);
+        throwOnError(ret,"OpenCLImageRD::CreateOpenCLBuffers : buffer creation failed: ");
+    }
+    this->is_snapshot_current = false;
+
+    if (this->IsReadingFromImageObjects())
+        this->CreateImageObjects();
+
     this->need_write_to_opencl_buffers = true;
 }
 
 // ----------------------------------------------------------------------------------------------------------------
 
+void OpenCLImageRD::SetConstantChemicals(const vector<bool>& is_constant)
+{
+    if (is_constant == this->is_chemical_constant)
+        return;
+    this->is_chemical_constant = is_constant;
+    if (!this->buffers[0].empty())
+        this->CreateOpenCLBuffers(); // (the images are read back after every update, so they are current)
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void OpenCLImageRD::SetReadingFromImageObjects(int values_per_texel)
+{
+    if (values_per_texel == this->values_per_texel)
+        return;
+    if (values_per_texel != 0 && values_per_texel != 1 && values_per_texel != 2 && values_per_texel != 4)
+        throw runtime_error("OpenCLImageRD::SetReadingFromImageObjects : texels hold 1, 2 or 4 values");
+    this->values_per_texel = values_per_texel;
+    this->ReleaseImageObjects();
+    if (this->IsReadingFromImageObjects() && !this->buffers[0].empty())
+        this->CreateImageObjects();
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void OpenCLImageRD::CreateImageObjects()
+{
+    this->ReleaseImageObjects();
+
+    const int *dims = this->images.front()->GetDimensions();
+    cl_bool image_support = CL_FALSE;
+    clGetDeviceInfo(this->device_id, CL_DEVICE_IMAGE_SUPPORT, sizeof(image_support), &image_support, NULL);
+    if (!image_support)
+        throw runtime_error("OpenCLImageRD::CreateImageObjects : this OpenCL device doesn't support images");
+    if (dims[2] > 1 && !this->HasDeviceExtension("cl_khr_3d_image_writes"))
+        throw runtime_error("OpenCLImageRD::CreateImageObjects : this OpenCL device can't write 3D images");
+    if (this->HasGhostCells() || (this->data_type == VTK_DOUBLE && this->buffer_storage == Storage::Same))
+        throw runtime_error("OpenCLImageRD::CreateImageObjects : image objects need float or half values without ghost cells");
+    if (dims[0] % this->values_per_texel != 0)
+        throw runtime_error("OpenCLImageRD::CreateImageObjects : the image width must be a multiple of the texel size");
+
+    const cl_channel_order orders[5] = { 0, CL_R, CL_RG, 0, CL_RGBA };
+    cl_image_format format;
+    format.image_channel_order = orders[this->values_per_texel];
+    format.image_channel_data_type = this->buffer_storage == Storage::Half ? CL_HALF_FLOAT : CL_FLOAT;
+
+    cl_int ret;
+    const int NC = this->GetNumberOfChemicals();
+    for (int io = 0; io < 2; io++) // (as for the buffers)
+    {
+        this->image_objects[io].resize(NC);
+        for (int ic = 0; ic < NC; ic++)
+        {
+            if (io == 1 && this->IsChemicalConstant(ic))
+            {
+                // the kernel only reads this chemical, so it only needs one image
+                this->image_objects[1][ic] = this->image_objects[0][ic];
+                clRetainMemObject(this->image_objects[1][ic]); // (both entries get released)
+                continue;
+            }
+            if (dims[2] > 1)
+                this->image_objects[io][ic] = clCreateImage3D(this->context, CL_MEM_READ_WRITE, &format,
+                    dims[0] / this->values_per_texel, dims[1], dims[2], 0, 0, NULL, &ret);
+            else
+                this->image_objects[io][ic] = clCreateImage2D(this->context, CL_MEM_READ_WRITE, &format,
+                    dims[0] / this->values_per_texel, dims[1], 0, NULL, &ret);
+            throwOnError(ret, "OpenCLImageRD::CreateImageObjects : image creation failed: ");
+        }
+    }
+    this->are_image_objects_current = false;
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void OpenCLImageRD::ReleaseImageObjects()
+{
+    for (int io = 0; io < 2; io++)
+    {
+        for (cl_mem image : this->image_objects[io])
+            if (image)
+                clReleaseMemObject(image);
+        this->image_objects[io].clear();
+    }
+    this->are_image_objects_current = false;
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void OpenCLImageRD::CopyBuffersToImageObjects()
+{
+    const int *dims = this->images.front()->GetDimensions();
+    const size_t origin[3] = { 0, 0, 0 };
+    const size_t region[3] = { static_cast<size_t>(dims[0] / this->values_per_texel), static_cast<size_t>(dims[1]),
+        static_cast<size_t>(dims[2]) };
+    for (int ic = 0; ic < this->GetNumberOfChemicals(); ic++)
+    {
+        cl_int ret = clEnqueueCopyBufferToImage(this->command_queue, this->buffers[this->iCurrentBuffer][ic],
+            this->image_objects[this->iCurrentBuffer][ic], 0, origin, region, 0, NULL, NULL);
+        throwOnError(ret, "OpenCLImageRD::CopyBuffersToImageObjects : clEnqueueCopyBufferToImage failed: ");
+    }
+    this->are_image_objects_current = true;
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void OpenCLImageRD::CopyImageObjectsToBuffers()
+{
+    const int *dims = this->images.front()->GetDimensions();
+    const size_t origin[3] = { 0, 0, 0 };
+    const size_t region[3] = { static_cast<size_t>(dims[0] / this->values_per_texel), static_cast<size_t>(dims[1]),
+        static_cast<size_t>(dims[2]) };
+    for (int ic = 0; ic < this->GetNumberOfChemicals(); ic++)
+    {
+        if (this->IsChemicalConstant(ic))
+            continue; // (the kernel doesn't change it, so its buffer is still current)
+        cl_int ret = clEnqueueCopyImageToBuffer(this->command_queue, this->image_objects[this->iCurrentBuffer][ic],
+            this->buffers[this->iCurrentBuffer][ic], origin, region, 0, 0, NULL, NULL);
+        throwOnError(ret, "OpenCLImageRD::CopyImageObjectsToBuffers : clEnqueueCopyImageToBuffer failed: ");
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void OpenCLImageRD::SetSteppedBufferLayout(const int n[3], Storage storage)
+{
+    if (!equal(n, n + 3, this->ghost_cells) || storage != this->buffer_storage)
+    {
+        copy(n, n + 3, this->ghost_cells);
+        this->buffer_storage = storage;
+        if (!this->buffers[0].empty())
+            this->CreateOpenCLBuffers(); // (the images are read back after every update, so they are current)
+    }
+
+    // the kernels depend on the size, wrap and data type, all of which need a reload of the formula, which calls us
+    this->ReleaseLayoutKernels();
+    if (this->AreSteppedBuffersPlain())
+        return;
+    const int *dims = this->images.front()->GetDimensions();
+    ostringstream source;
+    if (this->data_type == VTK_DOUBLE)
+        source << "#pragma OPENCL EXTENSION cl_khr_fp64 : enable\n";
+    source << "typedef " << this->data_type_string << " real;\n";
+    switch (storage)
+    {
+        case Storage::Half:
+            // (half can only be read and written through vload_half and vstore_half, so the ghost cells copy the bits)
+            source << "typedef half stored;\ntypedef ushort stored_bits;\n";
+            source << "#define LOAD(i, p) vload_half(i, p)\n#define STORE(v, i, p) vstore_half(v, i, p)\n";
+            break;
+        case Storage::Float:
+        case Storage::Same:
+            source << "typedef " << (storage == Storage::Float ? "float" : this->data_type_string) << " stored;\n";
+            source << "typedef stored stored_bits;\n";
+            source << "#define LOAD(i, p) (p)[i]\n#define STORE(v, i, p) (p)[i] = (stored)(v)\n";
+            break;
+    }
+    source << "#define NX " << dims[0] << "\n#define NY " << dims[1] << "\n#define NZ " << dims[2] << "\n";
+    source << "#define GX " << n[0] << "\n#define GY " << n[1] << "\n#define GZ " << n[2] << "\n";
+    source << "#define WRAP " << (this->wrap ? 1 : 0) << "\n" << ghost_cells_kernel_source << convert_values_kernel_source;
+    this->layout_program = this->CreateProgramFromSource(source.str());
+    const pair<cl_kernel*, const char*> kernels[3] = { { &this->ghost_cells_kernel, "refresh_ghost_cells" },
+        { &this->load_values_kernel, "load_values" }, { &this->store_values_kernel, "store_values" } };
+    for (const pair<cl_kernel*, const char*>& kernel : kernels)
+    {
+        cl_int ret;
+        *kernel.first = clCreateKernel(this->layout_program, kernel.second, &ret);
+        throwOnError(ret, "OpenCLImageRD::SetSteppedBufferLayout : kernel creation failed: ");
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void OpenCLImageRD::SetLocalWorkSize(const size_t n[3])
+{
+    if (!equal(n, n + 3, this->chosen_local_work_size))
+    {
+        copy(n, n + 3, this->chosen_local_work_size);
+        this->need_reload_formula = true;
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+const size_t* OpenCLImageRD::GetLocalWorkSize() const
+{
+    return this->use_local_memory || this->chosen_local_work_size[0] > 0 ? this->local_work_size : NULL;
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+bool OpenCLImageRD::HasGhostCells() const
+{
+    return this->ghost_cells[0] > 0 || this->ghost_cells[1] > 0 || this->ghost_cells[2] > 0;
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void OpenCLImageRD::ReleaseLayoutKernels()
+{
+    for (cl_kernel* kernel : { &this->ghost_cells_kernel, &this->load_values_kernel, &this->store_values_kernel })
+    {
+        if (*kernel)
+            clReleaseKernel(*kernel);
+        *kernel = NULL;
+    }
+    if (this->layout_program)
+        clReleaseProgram(this->layout_program);
+    this->layout_program = NULL;
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+size_t OpenCLImageRD::GetStoredValueSize() const
+{
+    switch (this->buffer_storage)
+    {
+        case Storage::Half: return 2;
+        case Storage::Float: return sizeof(float);
+        default:
+        case Storage::Same: return this->data_type_size;
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+size_t OpenCLImageRD::GetBytesPerCellUpdate() const
+{
+    // each chemical is read and written, apart from the constant ones, which are only read
+    const size_t n_constant = count(this->is_chemical_constant.begin(), this->is_chemical_constant.end(), true);
+    return (2 * this->GetNumberOfChemicals() - n_constant) * this->GetStoredValueSize();
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+size_t OpenCLImageRD::GetBufferSize() const
+{
+    const int *dims = this->images.front()->GetDimensions();
+    size_t size = this->GetStoredValueSize();
+    for (int axis = 0; axis < 3; axis++)
+        size *= dims[axis] + 2 * this->ghost_cells[axis];
+    return size;
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void OpenCLImageRD::CopyValues(cl_mem source, cl_mem target, bool into_stepped_buffer, cl_command_queue queue,
+                               cl_event* done_event)
+{
+    cl_int ret;
+    const int *dims = this->images.front()->GetDimensions();
+    if (this->AreSteppedBuffersPlain())
+    {
+        const size_t MEM_SIZE = this->data_type_size * dims[0] * dims[1] * dims[2];
+        ret = clEnqueueCopyBuffer(queue, source, target, 0, 0, MEM_SIZE, 0, NULL, done_event);
+        throwOnError(ret, "OpenCLImageRD::CopyValues : buffer copying failed: ");
+        return;
+    }
+    if (this->IsStorageConverted())
+    {
+        // convert each value with a kernel, which also steps over the ghost cells
+        cl_kernel kernel = into_stepped_buffer ? this->store_values_kernel : this->load_values_kernel;
+        ret = clSetKernelArg(kernel, 0, sizeof(cl_mem), &source);
+        throwOnError(ret, "OpenCLImageRD::CopyValues : clSetKernelArg failed: ");
+        ret = clSetKernelArg(kernel, 1, sizeof(cl_mem), &target);
+        throwOnError(ret, "OpenCLImageRD::CopyValues : clSetKernelArg failed: ");
+        const size_t range[3] = { static_cast<size_t>(dims[0]), static_cast<size_t>(dims[1]), static_cast<size_t>(dims[2]) };
+        ret = clEnqueueNDRangeKernel(queue, kernel, 3, NULL, range, NULL, 0, NULL, done_event);
+        throwOnError(ret, "OpenCLImageRD::CopyValues : clEnqueueNDRangeKernel failed: ");
+        return;
+    }
+
+    // copy the rows of the image, stepping over the ghost cells on the padded side
+    const size_t padded_origin[3] = { this->ghost_cells[0] * this->data_type_size,
+                                      static_cast<size_t>(this->ghost_cells[1]), static_cast<size_t>(this->ghost_cells[2]) };
+    const size_t plain_origin[3] = { 0, 0, 0 };
+    const size_t region[3] = { dims[0] * this->data_type_size, static_cast<size_t>(dims[1]), static_cast<size_t>(dims[2]) };
+    const size_t padded_row_pitch = (dims[0] + 2 * this->ghost_cells[0]) * this->data_type_size;
+    const size_t padded_slice_pitch = padded_row_pitch * (dims[1] + 2 * this->ghost_cells[1]);
+    const size_t plain_row_pitch = dims[0] * this->data_type_size;
+    const size_t plain_slice_pitch = plain_row_pitch * dims[1];
+    if (into_stepped_buffer)
+        ret = clEnqueueCopyBufferRect(queue, source, target, plain_origin, padded_origin, region,
+            plain_row_pitch, plain_slice_pitch, padded_row_pitch, padded_slice_pitch, 0, NULL, done_event);
+    else
+        ret = clEnqueueCopyBufferRect(queue, source, target, padded_origin, plain_origin, region,
+            padded_row_pitch, padded_slice_pitch, plain_row_pitch, plain_slice_pitch, 0, NULL, done_event);
+    throwOnError(ret, "OpenCLImageRD::CopyValues : buffer copying failed: ");
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void OpenCLImageRD::RefreshGhostCells(int iBuffer)
+{
+    const int *dims = this->images.front()->GetDimensions();
+    for (int ic = 0; ic < this->GetNumberOfChemicals(); ic++)
+    {
+        cl_int ret = clSetKernelArg(this->ghost_cells_kernel, 0, sizeof(cl_mem), &this->buffers[iBuffer][ic]);
+        throwOnError(ret, "OpenCLImageRD::RefreshGhostCells : clSetKernelArg failed: ");
+        // one axis at a time, each spanning the ghost cells of the axes before it
+        for (cl_int axis = 0; axis < 3; axis++)
+        {
+            if (this->ghost_cells[axis] == 0)
+                continue;
+            size_t range[3];
+            for (int a = 0; a < 3; a++)
+                range[a] = a < axis ? dims[a] + 2 * this->ghost_cells[a] : a == axis ? 2 * this->ghost_cells[a] : dims[a];
+            ret = clSetKernelArg(this->ghost_cells_kernel, 1, sizeof(cl_int), &axis);
+            throwOnError(ret, "OpenCLImageRD::RefreshGhostCells : clSetKernelArg failed: ");
+            ret = clEnqueueNDRangeKernel(this->command_queue, this->ghost_cells_kernel, 3, NULL, range, NULL, 0, NULL, NULL);
+            throwOnError(ret, "OpenCLImageRD::RefreshGhostCells : clEnqueueNDRangeKernel failed: ");
+        }
+    }
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+vector<vtkDataArray*> OpenCLImageRD::GetChemicalArrays() const
+{
+    vector<vtkDataArray*> arrays;
+    for (const vtkSmartPointer<vtkImageData>& image : this->images)
+        arrays.push_back(image->GetPointData()->GetScalars());
+    return arrays;
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void OpenCLImageRD::ReleaseOpenCLBuffers()
+{
+    this->CompleteBackgroundSteps(); // (the read back might be using the snapshot)
+    OpenCL_MixIn::ReleaseOpenCLBuffers();
+    this->ReleaseImageObjects();
+    for (cl_mem buffer : this->snapshot_buffers)
+        clReleaseMemObject(buffer);
+    this->snapshot_buffers.clear();
+    this->is_snapshot_current = false;
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void OpenCLImageRD::ReleaseContextObjects()
+{
+    // (they are kept from one frame to the next, so would otherwise outlive the context, e.g. after TestKernel())
+    this->ReleaseColorMapObjects();
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
 // void OpenCLImageRD::GetIntegrals()
 // {
 //     const int NC = this->GetNumberOfChemicals();
@@ -301,18 +958,28 @@ void OpenCLImageRD::WriteToOpenCLBuffersIfNeeded()
 
     std::vector<vtkSmartPointer<vtkImageData>> data_integrals = this->SumImageScalars(this->images);
 
+    const double start = get_time_in_seconds();
     this->iCurrentBuffer = 0;
+    this->is_snapshot_current = false;
+    this->are_image_objects_current = false;
+    this->AttachHostMirrors(this->GetChemicalArrays());
     for(int ic=0;ic<this->GetNumberOfChemicals();ic++)
     {
-        void* data = this->images[ic]->GetScalarPointer();
-        cl_int ret = clEnqueueWriteBuffer(this->command_queue,this->buffers[this->iCurrentBuffer][ic], CL_TRUE, 0, MEM_SIZE, data, 0, NULL, NULL);
-        throwOnError(ret,"OpenCLImageRD::WriteToOpenCLBuffers : buffer writing failed: ");
+        if (!this->AreSteppedBuffersPlain())
+        {
+            // (the ghost cells are filled before the first step)
+            this->host_mirrors[ic]->CopyTo(this->snapshot_buffers[ic], this->command_queue);
+            this->CopyValues(this->snapshot_buffers[ic], this->buffers[this->iCurrentBuffer][ic], true, this->command_queue);
+        }
+        else
+            this->host_mirrors[ic]->CopyTo(this->buffers[this->iCurrentBuffer][ic], this->command_queue);
 
         void * temp = data_integrals[ic]->GetScalarPointer();
         cl_int ret1 = clEnqueueWriteBuffer(this->command_queue,this->intergral_buffers[0][ic], CL_TRUE, 0, MEM_SIZE, temp, 0, NULL, NULL);
         throwOnError(ret1,"OpenCLImageRD::WriteToOpenCLBuffers : buffer writing failed: ");
 
     }
+    this->performance_counters.AddTransferToDevice(2 * this->GetNumberOfChemicals() * MEM_SIZE, get_time_in_seconds() - start);
 
     this->need_write_to_opencl_buffers = false;
 }
@@ -384,92 +1051,236 @@ void OpenCLImageRD::InternalUpdate(int n_steps)
     this->ReloadContextIfNeeded();
     this->ReloadKernelIfNeeded();
     this->WriteToOpenCLBuffersIfNeeded();
+    this->TuneKernelIfNeeded();
 
+    this->RunKernels(n_steps);
+    if (this->IsReadingFromImageObjects())
+        this->CopyImageObjectsToBuffers(); // (the read back and the rest of the engine work on the buffers)
+    // (this waits for the kernels, so that the read back is timed on its own)
+    this->performance_counters.AddKernelTime(n_steps, this->GetNumberOfCells(), this->GetBytesPerCellUpdate(),
+        this->CollectKernelTime());
 
-    cl_int ret;
-    int iBuffer;
+    this->ReadFromOpenCLBuffers();
+    this->is_snapshot_current = !this->AreSteppedBuffersPlain(); // (else the read back doesn't go through the snapshot)
+}
 
-    const int NC = this->GetNumberOfChemicals();
-    
+// ----------------------------------------------------------------------------------------------------------------
+
+void OpenCLImageRD::RunKernels(int n_steps)
+{
     for(int it=0;it<n_steps;it++)
-    {
-        string temp_buffer_values = "";
-        for(int ic=0;ic<NC;ic++){
-            // temp_buffer_values += std::to_string(*reinterpret_cast<uint64_t*>(intergral_buffers[0][ic])) + " ";
+        this->RunKernel();
+}
 
-            ret = clSetKernelArg(this->kernel, ic, sizeof(cl_mem), (void *)&this->intergral_buffers[0][ic]);
-            throwOnError(ret,"OpenCLImageRD::InternalUpdate : clSetKernelArg failed: ");
-        }
-        // throwOnError(1,temp_buffer_values.c_str());
+// ----------------------------------------------------------------------------------------------------------------
+
+void OpenCLImageRD::PrepareForBackgroundSteps()
+{
+    this->ReloadContextIfNeeded();
+    this->ReloadKernelIfNeeded();
+    this->WriteToOpenCLBuffersIfNeeded();
+    this->TuneKernelIfNeeded();
+    this->is_stepping_in_background = true;
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void OpenCLImageRD::StepInBackground(int n_steps)
+{
+    const double start = get_time_in_seconds();
+    this->RunKernels(n_steps);
+    if (this->IsReadingFromImageObjects())
+        this->CopyImageObjectsToBuffers(); // (FinishBackgroundSteps() copies from the buffers)
+
+    // wait here rather than in the read back, so that the caller's timing is of the steps alone
+    cl_int ret = clFinish(this->command_queue);
+    throwOnError(ret,"OpenCLImageRD::StepInBackground : clFinish failed: ");
+
+    // (the main thread may be reading performance_counters, so we keep our own until the steps are finished)
+    this->background_counters.AddSteps(n_steps, this->GetNumberOfCells(), get_time_in_seconds() - start);
+    this->background_counters.AddKernelTime(n_steps, this->GetNumberOfCells(), this->GetBytesPerCellUpdate(),
+        this->CollectKernelTime());
+}
+
+// ----------------------------------------------------------------------------------------------------------------
 
+void OpenCLImageRD::FinishBackgroundSteps(int n_steps_taken)
+{
+    this->CompleteBackgroundSteps(); // (in case the last read back hasn't been waited for)
+    this->is_stepping_in_background = false;
+    this->performance_counters.Add(this->background_counters);
+    this->background_counters.Reset();
+    if (n_steps_taken == 0)
+        return;
+    this->undo_stack.clear();
 
-        for(int io=0;io<2;io++) // first input buffers (io=0) then output buffers (io=1)
+    const size_t MEM_SIZE = this->data_type_size * this->GetX() * this->GetY() * this->GetZ();
+    const int NC = this->GetNumberOfChemicals();
+    cl_int ret;
+
+    // the copies go in the kernels' queue, so that they come after the steps so far and before any that follow
+    vector<cl_event> copied(NC);
+    for(int ic=0;ic<NC;ic++)
+    {
+        this->CopyValues(this->buffers[this->iCurrentBuffer][ic], this->snapshot_buffers[ic], false, this->command_queue,
+            &copied[ic]);
+    }
+    clFlush(this->command_queue);
+    this->time_read_back_started = get_time_in_seconds();
+
+    // the reads go in the transfer queue, so that they overlap any steps that follow
+    // (the images of the constant chemicals are already current, but we read at least one, to know when we are done)
+    int iLastRead = NC-1;
+    while (iLastRead > 0 && this->IsChemicalConstant(iLastRead))
+        iLastRead--;
+    this->n_chemicals_being_read_back = 0;
+    this->AttachHostMirrors(this->GetChemicalArrays());
+    for(int ic=0;ic<NC;ic++)
+    {
+        try
         {
-            iBuffer = (this->iCurrentBuffer+io)%2;
-            for(int ic=0;ic<NC;ic++)
+            // (the queue is in order, so the last read is the last to finish)
+            if (ic == iLastRead || !this->IsChemicalConstant(ic))
             {
-                // a_in, b_in, ... a_out, b_out ...
-                ret = clSetKernelArg(this->kernel, NC*( io + 1 ) + ic, sizeof(cl_mem), (void *)&this->buffers[iBuffer][ic]);
-                throwOnError(ret,"OpenCLImageRD::InternalUpdate : clSetKernelArg failed: ");
+                this->host_mirrors[ic]->CopyFrom(this->snapshot_buffers[ic], this->transfer_queue, CL_FALSE,
+                    1, &copied[ic], ic == iLastRead ? &this->read_back_done : NULL);
+                this->n_chemicals_being_read_back++;
             }
         }
-        cl_uint num_args;
-        clGetKernelInfo(kernel, CL_KERNEL_NUM_ARGS, sizeof(num_args), &num_args, NULL);
-        
-        
-        ret = clEnqueueNDRangeKernel(this->command_queue, this->kernel, 3, // dimensions
-            NULL, this->global_range, this->use_local_memory ? this->local_work_size : NULL,
-            0, NULL, NULL);
-        if (ret != CL_SUCCESS)
+        catch(...)
         {
-            ostringstream oss;
-            oss << "OpenCLImageRD::InternalUpdate : clEnqueueNDRangeKernel failed.\n";
-            oss << "Local work size: " << this->local_work_size[0] << " x " << this->local_work_size[1] << " x " << this->local_work_size[2] << "\n";
+            for(; ic<NC; ic++)
+                clReleaseEvent(copied[ic]);
+            throw;
+        }
+        clReleaseEvent(copied[ic]);
+    }
+    clFlush(this->transfer_queue);
+
+    this->n_steps_being_read_back = n_steps_taken;
+    this->is_snapshot_current = true;
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void OpenCLImageRD::CompleteBackgroundSteps()
+{
+    if (!this->read_back_done)
+        return;
+
+    cl_int ret = clWaitForEvents(1, &this->read_back_done);
+    clReleaseEvent(this->read_back_done);
+    this->read_back_done = NULL;
+    throwOnError(ret,"OpenCLImageRD::CompleteBackgroundSteps : buffer reading failed: ");
+    // (this includes the copy into the snapshot, so it slightly underestimates the speed of the transfer)
+    const size_t MEM_SIZE = this->data_type_size * this->GetX() * this->GetY() * this->GetZ();
+    this->performance_counters.AddTransferFromDevice(this->n_chemicals_being_read_back * MEM_SIZE,
+        get_time_in_seconds() - this->time_read_back_started);
+
+    this->FinishUpdate(this->n_steps_being_read_back);
+    this->n_steps_being_read_back = 0;
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+void OpenCLImageRD::RunKernel()
+{
+    cl_int ret;
+    int iBuffer;
+
+    const int NC = this->GetNumberOfChemicals();
+
+    string temp_buffer_values = "";
+    for(int ic=0;ic<NC;ic++){
+        // temp_buffer_values += std::to_string(*reinterpret_cast<uint64_t*>(intergral_buffers[0][ic])) + " ";
+
+        ret = clSetKernelArg(this->kernel, ic, sizeof(cl_mem), (void *)&this->intergral_buffers[0][ic]);
+        throwOnError(ret,"OpenCLImageRD::RunKernel : clSetKernelArg failed: ");
+    }
+    // throwOnError(1,temp_buffer_values.c_str());
+
+
+    for(int io=0;io<2;io++) // first input buffers (io=0) then output buffers (io=1)
+    {
+        iBuffer = (this->iCurrentBuffer+io)%2;
+        for(int ic=0;ic<NC;ic++)
+        {
+            // a_in, b_in, ... a_out, b_out ...
+            // (with image objects the constant chemicals are still given their buffer as their output, which the
+            // kernel declares but doesn't touch, since their input and output image would be the same)
+            const bool is_image = this->IsReadingFromImageObjects() && (io == 0 || !this->IsChemicalConstant(ic));
+            const cl_mem* arg = is_image ? &this->image_objects[iBuffer][ic] : &this->buffers[iBuffer][ic];
+            ret = clSetKernelArg(this->kernel, NC*( io + 1 ) + ic, sizeof(cl_mem), (void *)arg);
+            throwOnError(ret,"OpenCLImageRD::RunKernel : clSetKernelArg failed: ");
+        }
+    }
+    cl_uint num_args;
+    clGetKernelInfo(kernel, CL_KERNEL_NUM_ARGS, sizeof(num_args), &num_args, NULL);
+
+    if (this->HasGhostCells())
+        this->RefreshGhostCells(this->iCurrentBuffer);
+    if (this->IsReadingFromImageObjects() && !this->are_image_objects_current)
+        this->CopyBuffersToImageObjects(); // (only before the first step, after which the kernel writes the images)
+
+    ret = clEnqueueNDRangeKernel(this->command_queue, this->kernel, 3, // dimensions
+        NULL, this->global_range, this->GetLocalWorkSize(), 0, NULL, this->GetKernelTimingEvent());
+    if (ret != CL_SUCCESS)
+    {
+        ostringstream oss;
+        oss << "OpenCLImageRD::RunKernel : clEnqueueNDRangeKernel failed.\n";
+        oss << "Local work size: " << this->local_work_size[0] << " x " << this->local_work_size[1] << " x " << this->local_work_size[2] << "\n";
 //--------
-            oss<<"Global range: ["<< global_range[0]<<" "<< global_range[1]<<" "<< global_range[2]<<"]\n";
-            oss<<"Local work size: ["<< local_work_size[0]<<" "<< local_work_size[1]<<" "<< local_work_size[2]<<"]\n";
+        oss<<"Global range: ["<< global_range[0]<<" "<< global_range[1]<<" "<< global_range[2]<<"]\n";
+        oss<<"Local work size: ["<< local_work_size[0]<<" "<< local_work_size[1]<<" "<< local_work_size[2]<<"]\n";
 //--------
-            oss <<"Kernel expects arguments" << num_args<<" "<<NC<<"\n";
-            //-------------------------------------------
-            for (cl_uint i = 0; i < num_args; i++) {
-                size_t size;
-                char* value;
-
-                // Тип аргумента
-                clGetKernelArgInfo(kernel, i, CL_KERNEL_ARG_TYPE_NAME, 0, NULL, &size);
-                value = (char*)malloc(size);
-                clGetKernelArgInfo(kernel, i, CL_KERNEL_ARG_TYPE_NAME, size, value, NULL);
-                oss<< "Arg:" << i <<" type: "<< value<<"\n";
-                free(value);
-
-                // Имя аргумента
-                clGetKernelArgInfo(kernel, i, CL_KERNEL_ARG_NAME, 0, NULL, &size);
-                value = (char*)malloc(size);
-                clGetKernelArgInfo(kernel, i, CL_KERNEL_ARG_NAME, size, value, NULL);
-                oss<< "Arg:" << i <<" type: "<< value<<"\n";
-                free(value);
-            }
-            //-------------------------------------------
-            throwOnError(ret, oss.str().c_str());
+        oss <<"Kernel expects arguments" << num_args<<" "<<NC<<"\n";
+        //-------------------------------------------
+        for (cl_uint i = 0; i < num_args; i++) {
+            size_t size;
+            char* value;
+
+            // Тип аргумента
+            clGetKernelArgInfo(kernel, i, CL_KERNEL_ARG_TYPE_NAME, 0, NULL, &size);
+            value = (char*)malloc(size);
+            clGetKernelArgInfo(kernel, i, CL_KERNEL_ARG_TYPE_NAME, size, value, NULL);
+            oss<< "Arg:" << i <<" type: "<< value<<"\n";
+            free(value);
+
+            // Имя аргумента
+            clGetKernelArgInfo(kernel, i, CL_KERNEL_ARG_NAME, 0, NULL, &size);
+            value = (char*)malloc(size);
+            clGetKernelArgInfo(kernel, i, CL_KERNEL_ARG_NAME, size, value, NULL);
+            oss<< "Arg:" << i <<" type: "<< value<<"\n";
+            free(value);
         }
-        this->iCurrentBuffer = 1 - this->iCurrentBuffer;
+        //-------------------------------------------
+        throwOnError(ret, oss.str().c_str());
     }
-
-    this->ReadFromOpenCLBuffers();
+    this->iCurrentBuffer = 1 - this->iCurrentBuffer;
 }
 
 // ----------------------------------------------------------------------------------------------------------------
 
 void OpenCLImageRD::ReadFromOpenCLBuffers()
 {
-    // read from opencl buffers into our image
-    const size_t MEM_SIZE = this->data_type_size * this->GetX() * this->GetY() * this->GetZ();
+    // read from opencl buffers into our image, through the memory it shares with its host mirror
+    const double start = get_time_in_seconds();
+    this->AttachHostMirrors(this->GetChemicalArrays());
+    int n_read = 0;
     for(int ic=0;ic<this->GetNumberOfChemicals();ic++)
     {
-        void* data = this->images[ic]->GetScalarPointer();
-        cl_int ret = clEnqueueReadBuffer(this->command_queue,this->buffers[this->iCurrentBuffer][ic], CL_TRUE, 0, MEM_SIZE, data, 0, NULL, NULL);
-        throwOnError(ret,"OpenCLImageRD::ReadFromOpenCLBuffers : buffer reading failed: ");
+        // (the snapshot is used to make the images on the device, so it needs every chemical)
+        if (!this->AreSteppedBuffersPlain())
+            this->CopyValues(this->buffers[this->iCurrentBuffer][ic], this->snapshot_buffers[ic], false, this->command_queue);
+        if (this->IsChemicalConstant(ic))
+            continue; // (the kernel doesn't change it, so its image is still current)
+        this->host_mirrors[ic]->CopyFrom(this->AreSteppedBuffersPlain() ? this->buffers[this->iCurrentBuffer][ic]
+            : this->snapshot_buffers[ic], this->command_queue);
+        n_read++;
     }
+    clFinish(this->command_queue); // (the reads block, but the last copy into the snapshot may come after them)
+    const size_t MEM_SIZE = this->data_type_size * this->GetX() * this->GetY() * this->GetZ();
+    this->performance_counters.AddTransferFromDevice(n_read * MEM_SIZE, get_time_in_seconds() - start);
 }
 
 // ----------------------------------------------------------------------------------------------------------------
@@ -28,6 +28,11 @@ class OpenCLImageRD : public ImageRD, public OpenCL_MixIn
     public:
 
         OpenCLImageRD(int opencl_platform,int opencl_device,int data_type);
+        ~OpenCLImageRD() override;
+
+        /// How the buffers that the kernels step hold each value: in the data type, as 16-bit half floats or (for the
+        /// double data type) as floats. The kernels still compute in the data type.
+        enum class Storage { Same, Half, Float };
 
         bool HasEditableFormula() const override { return true; }
 
@@ -38,6 +43,9 @@ class OpenCLImageRD : public ImageRD, public OpenCL_MixIn
 
         std::string GetKernel() const override { return this->AssembleKernelSourceFromFormula(this->formula); }
 
+        /// When the OpenCL buffers are up to date, the color mapping and slicing are done on the device and only the colors are read back.
+        void GetAs2DImage(vtkImageData *out,const Properties& render_settings) const override;
+        std::function<void(vtkImageData*)> GetAs2DImageLater(const Properties& render_settings) const override;
         void SetFrom2DImage(int iChemical, vtkImageData *im) override;
 
         void SetValue(float x,float y,float z,float val,const Properties& render_settings) override;
@@ -46,6 +54,14 @@ class OpenCLImageRD : public ImageRD, public OpenCL_MixIn
         void Undo() override;
         void Redo() override;
 
+        /// The steps only touch the OpenCL buffers, so they can run on another thread while the images are rendered.
+        bool CanStepInBackground() const override { return true; }
+        void PrepareForBackgroundSteps() override;
+        void StepInBackground(int n_steps) override;
+        /// Copies the buffers to a snapshot, which is read back on the transfer queue while the next steps run.
+        void FinishBackgroundSteps(int n_steps_taken) override;
+        void CompleteBackgroundSteps() override;
+
     protected:
 
         void CopyFromImage(vtkImageData* im) override;
@@ -57,17 +73,144 @@ class OpenCLImageRD : public ImageRD, public OpenCL_MixIn
 
         void InternalUpdate(int n_steps) override;
 
+        /// Advances the buffers on the device by n_steps, without reading them back.
+        virtual void RunKernels(int n_steps);
+
+        /// Runs the kernel once over the whole image, from the current buffers into the others, then swaps them.
+        void RunKernel();
+
         void ReloadKernelIfNeeded() override;
 
         void CreateOpenCLBuffers() override;
         void WriteToOpenCLBuffersIfNeeded() override;
         void ReadFromOpenCLBuffers() override;
+        void ReleaseOpenCLBuffers() override;
+        void ReleaseContextObjects() override;
 
         std::vector<vtkSmartPointer<vtkImageData>> SumImageScalars(const std::vector<vtkSmartPointer<vtkImageData>>& images);
 
+        /// Pads the buffers that the kernels step with n[axis] ghost cells on each side, and stores their values as
+        /// storage, both of which the kernel must expect.
+        /** Before each step the ghost cells are filled from the far side of the image (with wrap-around) or from the
+            nearest edge cell, so the kernel can read every neighbor at a fixed offset, for any size of image. Other
+            buffers (and the images) keep the plain layout and the data type, and the values are converted on the
+            device as they are copied between them. Recreates the buffers if the padding or storage changes. */
+        void SetSteppedBufferLayout(const int n[3], Storage storage);
+        bool HasGhostCells() const;
+        bool IsStorageConverted() const { return this->buffer_storage != Storage::Same; }
+
+        /// Makes the input and output buffers that the kernels step the same buffer for each chemical that is_constant,
+        /// so the kernel must only read those. Saves the memory and the copying, and those chemicals aren't read back
+        /// after each update. Recreates the buffers if this changes.
+        void SetConstantChemicals(const std::vector<bool>& is_constant);
+
+        /// If values_per_texel is 1, 2 or 4, steps the chemicals in image objects instead of buffers, each texel
+        /// holding that many neighboring values along x (so the kernel must expect this).
+        /** Like the buffers there are two images for each chemical that the kernel changes, and it reads one (through
+            a sampler that caches the neighbors and handles the edges) and writes the other. The constant chemicals
+            have a single image, and their output argument is still their buffer, which the kernel mustn't touch. The
+            buffers are copied into the images before the first step and back after each update, for the rest of the
+            engine. The buffers must be plain and hold floats (or halfs), and the device must support images, and
+            cl_khr_3d_image_writes for 3D. Zero steps the buffers again. */
+        void SetReadingFromImageObjects(int values_per_texel);
+        bool IsReadingFromImageObjects() const { return this->values_per_texel > 0; }
+
+        size_t GetBytesPerCellUpdate() const override;
+
+        /// Launches the kernel with work-groups of n[0] x n[1] x n[2] work-items, or (if all zero) the default size.
+        void SetLocalWorkSize(const size_t n[3]);
+        /// Returns the work-group size to launch the kernels with, or NULL to leave it to the OpenCL implementation.
+        const size_t* GetLocalWorkSize() const;
+
+        /// Returns the size in bytes of each value in the buffers that the kernels step.
+        size_t GetStoredValueSize() const;
+
+        /// Called before stepping, once the kernel is built and the buffers are written, for implementations that time
+        /// their kernel with different settings to find the fastest. The images hold the current values.
+        virtual void TuneKernelIfNeeded() {}
+
     private:
 
         void BuildProgram();
+
+        /// Returns the scalars of each image, for AttachHostMirrors().
+        std::vector<vtkDataArray*> GetChemicalArrays() const;
+
+        /// Returns whether the current buffers on the device hold the latest values, so we can make images from them.
+        bool AreOpenCLBuffersCurrent() const;
+
+        /// Returns whether the snapshot buffers hold the latest values, so we can make images from them instead.
+        bool IsSnapshotCurrent() const;
+
+        /// Returns whether SetConstantChemicals() was told that the kernel doesn't change chemical ic, so its image is
+        /// always current and needn't be read back.
+        bool IsChemicalConstant(int ic) const
+        {
+            return ic < static_cast<int>(this->is_chemical_constant.size()) && this->is_chemical_constant[ic];
+        }
+
+        /// Returns whether the buffers that the kernels step have the same layout and type as the images.
+        bool AreSteppedBuffersPlain() const { return !this->HasGhostCells() && !this->IsStorageConverted(); }
+
+        /// Returns the size of each of the buffers that the kernels step, including any ghost cells.
+        size_t GetBufferSize() const;
+
+        /// Copies one chemical from a plain buffer into one that the kernels step (or the other way), skipping the
+        /// ghost cells and converting to or from the storage type. Otherwise this is a plain copy.
+        void CopyValues(cl_mem source, cl_mem target, bool into_stepped_buffer, cl_command_queue queue,
+                        cl_event* done_event = NULL);
+
+        /// Fills the ghost cells of each chemical's buffer from the values in it.
+        void RefreshGhostCells(int iBuffer);
+
+        void ReleaseLayoutKernels();
+
+        /// Makes the pairs of image objects for SetReadingFromImageObjects().
+        void CreateImageObjects();
+        void ReleaseImageObjects();
+
+        /// Copies the current buffers into the current image objects, before the first step from them.
+        void CopyBuffersToImageObjects();
+        /// Copies the current image objects of the chemicals that change into the current buffers.
+        void CopyImageObjectsToBuffers();
+
+        /// Makes the 2D image with a kernel on the device, reading back only the RGB values.
+        void MapToColorsOnDevice(vtkImageData *out,const Properties& render_settings) const;
+
+        void ReleaseColorMapObjects() const;
+
+    private:
+
+        // for FinishBackgroundSteps():
+        std::vector<cl_mem> snapshot_buffers; ///< a copy of the current buffers, which the kernels don't touch
+        cl_event read_back_done;            ///< set while the snapshot is being read into the images
+        int n_steps_being_read_back;
+        int n_chemicals_being_read_back;    ///< (the constant chemicals aren't)
+        double time_read_back_started;
+        bool is_snapshot_current, is_stepping_in_background;
+        PerformanceCounters background_counters; ///< kept by StepInBackground(), added in by FinishBackgroundSteps()
+
+        size_t chosen_local_work_size[3];   ///< for SetLocalWorkSize()
+
+        std::vector<bool> is_chemical_constant; ///< for SetConstantChemicals()
+
+        // for SetReadingFromImageObjects():
+        int values_per_texel;               ///< or zero if the kernel steps the buffers
+        std::vector<cl_mem> image_objects[2]; ///< switched between like the buffers, with iCurrentBuffer
+        bool are_image_objects_current;     ///< false until the buffers are copied in, after they are written
+
+        // for SetSteppedBufferLayout():
+        int ghost_cells[3];                 ///< on each side, in cells
+        Storage buffer_storage;
+        cl_program layout_program;
+        cl_kernel ghost_cells_kernel, load_values_kernel, store_values_kernel;
+
+        // for MapToColorsOnDevice(), made when first needed:
+        mutable cl_program color_map_program;
+        mutable cl_kernel color_map_kernel;
+        mutable cl_mem color_table_buffer, color_output_buffer;
+        mutable size_t color_output_size;
+        mutable int color_map_data_type;
 };
 
 #endif
\ No newline at end of file
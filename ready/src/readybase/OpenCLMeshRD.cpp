@@ -36,10 +36,14 @@ using namespace std;
 
 OpenCLMeshRD::OpenCLMeshRD(int opencl_platform,int opencl_device,int data_type)
     : MeshRD(data_type)
-    , OpenCL_MixIn(opencl_platform,opencl_device)
+    , OpenCL_MixIn(opencl_platform,opencl_device,this->performance_counters)
 {
     this->clBuffer_cell_neighbor_indices = NULL;
     this->clBuffer_cell_neighbor_weights = NULL;
+    this->clBuffer_laplacian_offsets = NULL;
+    this->clBuffer_laplacian_rows = NULL;
+    this->clBuffer_laplacian_columns = NULL;
+    this->clBuffer_laplacian_values = NULL;
 }
 
 // -------------------------------------------------------------------------
@@ -48,6 +52,10 @@ OpenCLMeshRD::~OpenCLMeshRD()
 {
     clReleaseMemObject(this->clBuffer_cell_neighbor_indices);
     clReleaseMemObject(this->clBuffer_cell_neighbor_weights);
+    clReleaseMemObject(this->clBuffer_laplacian_offsets);
+    clReleaseMemObject(this->clBuffer_laplacian_rows);
+    clReleaseMemObject(this->clBuffer_laplacian_columns);
+    clReleaseMemObject(this->clBuffer_laplacian_values);
 }
 
 // -------------------------------------------------------------------------
@@ -121,6 +129,26 @@ void OpenCLMeshRD::InternalUpdate(int n_steps)
     ret = clSetKernelArg(this->kernel, 2*NC + 2, sizeof(int), &this->max_neighbors);
     throwOnError(ret,"OpenCLMeshRD::InternalUpdate : clSetKernelArg failed on max_neighbors parameter: ");
 
+    this->global_range[0] = this->mesh->GetNumberOfCells();
+    if(this->KernelUsesLaplacianOperator())
+    {
+        // pass the Laplacian operator, in whichever format suits this mesh
+        const cl_mem laplacian_buffers[4] = { this->clBuffer_laplacian_offsets, this->clBuffer_laplacian_rows,
+                                              this->clBuffer_laplacian_columns, this->clBuffer_laplacian_values };
+        for(int i=0;i<4;i++)
+        {
+            ret = clSetKernelArg(this->kernel, 2*NC + 3 + i, sizeof(cl_mem), &laplacian_buffers[i]);
+            throwOnError(ret,"OpenCLMeshRD::InternalUpdate : clSetKernelArg failed on Laplacian operator array: ");
+        }
+        const int stride = this->laplacian_operator.GetStride();
+        ret = clSetKernelArg(this->kernel, 2*NC + 7, sizeof(int), &stride);
+        throwOnError(ret,"OpenCLMeshRD::InternalUpdate : clSetKernelArg failed on L_stride parameter: ");
+        const int format = static_cast<int>(this->laplacian_operator.GetFormat());
+        ret = clSetKernelArg(this->kernel, 2*NC + 8, sizeof(int), &format);
+        throwOnError(ret,"OpenCLMeshRD::InternalUpdate : clSetKernelArg failed on L_format parameter: ");
+        this->global_range[0] = this->laplacian_operator.GetNumberOfWorkItems();
+    }
+
     for(int it=0;it<n_steps;it++)
     {
         for(int io=0;io<2;io++) // first input buffers (io=0) then output buffers (io=1)
@@ -133,10 +161,13 @@ void OpenCLMeshRD::InternalUpdate(int n_steps)
                 throwOnError(ret,"OpenCLMeshRD::InternalUpdate : clSetKernelArg failed on buffer: ");
             }
         }
-        ret = clEnqueueNDRangeKernel(this->command_queue,this->kernel, 3, NULL, this->global_range, NULL, 0, NULL, NULL);
+        ret = clEnqueueNDRangeKernel(this->command_queue,this->kernel, 3, NULL, this->global_range, NULL, 0, NULL, this->GetKernelTimingEvent());
         throwOnError(ret,"OpenCLMeshRD::InternalUpdate : clEnqueueNDRangeKernel failed: ");
         this->iCurrentBuffer = 1 - this->iCurrentBuffer;
     }
+    // (this waits for the kernels, so that the read back is timed on its own)
+    this->performance_counters.AddKernelTime(n_steps, this->GetNumberOfCells(), this->GetBytesPerCellUpdate(),
+        this->CollectKernelTime());
 
     this->ReadFromOpenCLBuffers();
 }
@@ -161,7 +192,9 @@ void OpenCLMeshRD::ReloadKernelIfNeeded()
     throwOnError(ret,"OpenCLMeshRD::ReloadKernelIfNeeded : Failed to create program with source: ");
 
     // build the program
+    const double start = get_time_in_seconds();
     ret = clBuildProgram(this->program,1,&this->device_id,"-cl-denorms-are-zero",NULL,NULL);
+    this->performance_counters.AddBuild(get_time_in_seconds() - start);
     if(ret != CL_SUCCESS)
     {
         size_t build_log_length = 0;
@@ -223,11 +256,36 @@ void OpenCLMeshRD::CreateOpenCLBuffers()
     this->clBuffer_cell_neighbor_weights = clCreateBuffer(this->context, CL_MEM_READ_ONLY, NBORS_WEIGHTS_SIZE, NULL, &ret);
     throwOnError(ret,"OpenCLMeshRD::CreateOpenCLBuffers : neighbor_weights buffer creation failed: ");
 
+    // create buffers for the Laplacian operator
+    const SparseMatrix& L = this->laplacian_operator;
+    this->clBuffer_laplacian_offsets = clCreateBuffer(this->context, CL_MEM_READ_ONLY, sizeof(int) * L.GetOffsets().size(), NULL, &ret);
+    throwOnError(ret,"OpenCLMeshRD::CreateOpenCLBuffers : Laplacian offsets buffer creation failed: ");
+    this->clBuffer_laplacian_rows = clCreateBuffer(this->context, CL_MEM_READ_ONLY, sizeof(int) * L.GetRows().size(), NULL, &ret);
+    throwOnError(ret,"OpenCLMeshRD::CreateOpenCLBuffers : Laplacian rows buffer creation failed: ");
+    this->clBuffer_laplacian_columns = clCreateBuffer(this->context, CL_MEM_READ_ONLY, sizeof(int) * L.GetColumns().size(), NULL, &ret);
+    throwOnError(ret,"OpenCLMeshRD::CreateOpenCLBuffers : Laplacian columns buffer creation failed: ");
+    this->clBuffer_laplacian_values = clCreateBuffer(this->context, CL_MEM_READ_ONLY, sizeof(float) * L.GetValues().size(), NULL, &ret);
+    throwOnError(ret,"OpenCLMeshRD::CreateOpenCLBuffers : Laplacian values buffer creation failed: ");
+
     this->need_write_to_opencl_buffers = true;
 }
 
 // ----------------------------------------------------------------------------------------------------------------
 
+vector<vtkDataArray*> OpenCLMeshRD::GetChemicalArrays() const
+{
+    vector<vtkDataArray*> arrays;
+    for(int ic=0;ic<this->GetNumberOfChemicals();ic++)
+    {
+        vtkDataArray *array = this->mesh->GetCellData()->GetArray(GetChemicalName(ic).c_str());
+        if( !array ) throw runtime_error( "OpenCLMeshRD::GetChemicalArrays : named array not found" );
+        arrays.push_back(array);
+    }
+    return arrays;
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
 void OpenCLMeshRD::WriteToOpenCLBuffersIfNeeded()
 {
     if(!this->need_write_to_opencl_buffers) return;
@@ -236,14 +294,13 @@ void OpenCLMeshRD::WriteToOpenCLBuffersIfNeeded()
         this->CreateOpenCLBuffers();
 
     cl_int ret;
-    const size_t MEM_SIZE = this->data_type_size * this->mesh->GetNumberOfCells();
+    const double start = get_time_in_seconds();
     this->iCurrentBuffer = 0;
+    this->AttachHostMirrors(this->GetChemicalArrays());
     for(int ic=0;ic<this->GetNumberOfChemicals();ic++)
-    {
-        const void* data = this->mesh->GetCellData()->GetArray(GetChemicalName(ic).c_str())->WriteVoidPointer(0,0);
-        ret = clEnqueueWriteBuffer(this->command_queue,this->buffers[this->iCurrentBuffer][ic], CL_TRUE, 0, MEM_SIZE, data, 0, NULL, NULL);
-        throwOnError(ret,"OpenCLMeshRD::WriteToOpenCLBuffers : data buffer writing failed: ");
-    }
+        this->host_mirrors[ic]->CopyTo(this->buffers[this->iCurrentBuffer][ic], this->command_queue);
+    const size_t MEM_SIZE = this->data_type_size * this->mesh->GetNumberOfCells();
+    this->performance_counters.AddTransferToDevice(this->GetNumberOfChemicals() * MEM_SIZE, get_time_in_seconds() - start);
 
     // fill indices buffer
     const size_t NBORS_INDICES_SIZE = sizeof(int) * this->mesh->GetNumberOfCells() * this->max_neighbors;
@@ -271,6 +328,21 @@ void OpenCLMeshRD::WriteToOpenCLBuffersIfNeeded()
         NULL);
     throwOnError(ret,"OpenCLMeshRD::WriteToOpenCLBuffers : weights buffer writing failed: ");
 
+    // fill the Laplacian operator buffers
+    const SparseMatrix& L = this->laplacian_operator;
+    ret = clEnqueueWriteBuffer(this->command_queue, this->clBuffer_laplacian_offsets, CL_TRUE, 0,
+        sizeof(int) * L.GetOffsets().size(), L.GetOffsets().data(), 0, NULL, NULL);
+    throwOnError(ret,"OpenCLMeshRD::WriteToOpenCLBuffers : Laplacian offsets buffer writing failed: ");
+    ret = clEnqueueWriteBuffer(this->command_queue, this->clBuffer_laplacian_rows, CL_TRUE, 0,
+        sizeof(int) * L.GetRows().size(), L.GetRows().data(), 0, NULL, NULL);
+    throwOnError(ret,"OpenCLMeshRD::WriteToOpenCLBuffers : Laplacian rows buffer writing failed: ");
+    ret = clEnqueueWriteBuffer(this->command_queue, this->clBuffer_laplacian_columns, CL_TRUE, 0,
+        sizeof(int) * L.GetColumns().size(), L.GetColumns().data(), 0, NULL, NULL);
+    throwOnError(ret,"OpenCLMeshRD::WriteToOpenCLBuffers : Laplacian columns buffer writing failed: ");
+    ret = clEnqueueWriteBuffer(this->command_queue, this->clBuffer_laplacian_values, CL_TRUE, 0,
+        sizeof(float) * L.GetValues().size(), L.GetValues().data(), 0, NULL, NULL);
+    throwOnError(ret,"OpenCLMeshRD::WriteToOpenCLBuffers : Laplacian values buffer writing failed: ");
+
     this->need_write_to_opencl_buffers = false;
 }
 
@@ -278,16 +350,13 @@ void OpenCLMeshRD::WriteToOpenCLBuffersIfNeeded()
 
 void OpenCLMeshRD::ReadFromOpenCLBuffers()
 {
-    // read from opencl buffers into our mesh data
-    const size_t MEM_SIZE = this->data_type_size * this->mesh->GetNumberOfCells();
+    // read from opencl buffers into our mesh data, through the memory it shares with its host mirror
+    const double start = get_time_in_seconds();
+    this->AttachHostMirrors(this->GetChemicalArrays());
     for(int ic=0;ic<this->GetNumberOfChemicals();ic++)
-    {
-        vtkDataArray *array = this->mesh->GetCellData()->GetArray(GetChemicalName(ic).c_str());
-        if( !array ) throw runtime_error( "OpenCLMeshRD::ReadFromOpenCLBuffers : named array not found" );
-        void* data = array->WriteVoidPointer(0,0);
-        cl_int ret = clEnqueueReadBuffer(this->command_queue,this->buffers[this->iCurrentBuffer][ic], CL_TRUE, 0, MEM_SIZE, data, 0, NULL, NULL);
-        throwOnError(ret,"OpenCLMeshRD::ReadFromOpenCLBuffers : data buffer reading failed: ");
-    }
+        this->host_mirrors[ic]->CopyFrom(this->buffers[this->iCurrentBuffer][ic], this->command_queue);
+    const size_t MEM_SIZE = this->data_type_size * this->mesh->GetNumberOfCells();
+    this->performance_counters.AddTransferFromDevice(this->GetNumberOfChemicals() * MEM_SIZE, get_time_in_seconds() - start);
 }
 
 // ----------------------------------------------------------------------------------------------------------------
@@ -328,6 +397,21 @@ void OpenCLMeshRD::ReleaseOpenCLBuffers()
     OpenCL_MixIn::ReleaseOpenCLBuffers();
     clReleaseMemObject(this->clBuffer_cell_neighbor_indices);
     clReleaseMemObject(this->clBuffer_cell_neighbor_weights);
+    clReleaseMemObject(this->clBuffer_laplacian_offsets);
+    clReleaseMemObject(this->clBuffer_laplacian_rows);
+    clReleaseMemObject(this->clBuffer_laplacian_columns);
+    clReleaseMemObject(this->clBuffer_laplacian_values);
+}
+
+// ----------------------------------------------------------------------------------------------------------------
+
+bool OpenCLMeshRD::KernelUsesLaplacianOperator() const
+{
+    // older kernels (and hand-written ones) stop at max_neighbors
+    cl_uint n_args = 0;
+    cl_int ret = clGetKernelInfo(this->kernel, CL_KERNEL_NUM_ARGS, sizeof(cl_uint), &n_args, NULL);
+    throwOnError(ret,"OpenCLMeshRD::KernelUsesLaplacianOperator : clGetKernelInfo failed: ");
+    return n_args >= static_cast<cl_uint>(2*this->GetNumberOfChemicals() + 9);
 }
 
 // ----------------------------------------------------------------------------------------------------------------
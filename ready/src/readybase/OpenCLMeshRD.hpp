@@ -66,10 +66,22 @@ class OpenCLMeshRD : public MeshRD, public OpenCL_MixIn
         void ReadFromOpenCLBuffers() override;
         void ReleaseOpenCLBuffers() override;
 
+        /// Kernels that declare the L_* arguments after max_neighbors are given the Laplacian operator (see SparseMatrix).
+        bool KernelUsesLaplacianOperator() const;
+
+    private:
+
+        /// Returns the cell data array for each chemical, for AttachHostMirrors().
+        std::vector<vtkDataArray*> GetChemicalArrays() const;
+
     private:
 
         cl_mem clBuffer_cell_neighbor_indices;
         cl_mem clBuffer_cell_neighbor_weights;
+        cl_mem clBuffer_laplacian_offsets;
+        cl_mem clBuffer_laplacian_rows;
+        cl_mem clBuffer_laplacian_columns;
+        cl_mem clBuffer_laplacian_values;
 };
 
 #endif
@@ -19,6 +19,7 @@
 #include "OpenCL_MixIn.hpp"
 #include "OpenCL_utils.hpp"
 using namespace OpenCL_utils;
+#include "utils.hpp"
 
 // STL:
 #include <stdexcept>
@@ -29,7 +30,7 @@ using namespace std;
 
 // ---------------------------------------------------------------------------
 
-OpenCL_MixIn::OpenCL_MixIn(int opencl_platform, int opencl_device)
+OpenCL_MixIn::OpenCL_MixIn(int opencl_platform, int opencl_device, PerformanceCounters& counters)
     : context(NULL)
     , device_id(NULL)
     , program(NULL)
@@ -38,11 +39,15 @@ OpenCL_MixIn::OpenCL_MixIn(int opencl_platform, int opencl_device)
     , global_range{ 1, 1, 1 }
     , local_work_size{ 1, 1, 1 }
     , command_queue(NULL)
+    , transfer_queue(NULL)
     , need_reload_context(true)
     , need_write_to_opencl_buffers(true)
     , iCurrentBuffer(0)
+    , counters(counters)
     , iPlatform(opencl_platform)
     , iDevice(opencl_device)
+    , kernel_ticks(0)
+    , is_kernel_timing_failed(false)
 {
     if(LinkOpenCL()!= CL_SUCCESS)
         throw runtime_error("Failed to load dynamic library for OpenCL");
@@ -52,8 +57,11 @@ OpenCL_MixIn::OpenCL_MixIn(int opencl_platform, int opencl_device)
 
 OpenCL_MixIn::~OpenCL_MixIn()
 {
+    this->host_mirrors.clear(); // (the arrays get their own memory back)
     clFlush(this->command_queue);
     clFinish(this->command_queue);
+    clFinish(this->transfer_queue);
+    this->ReleaseKernelTimingEvents();
     clReleaseKernel(this->kernel);
     clReleaseProgram(this->program);
     
@@ -66,6 +74,7 @@ OpenCL_MixIn::~OpenCL_MixIn()
             clReleaseMemObject(*it);
     
     clReleaseCommandQueue(this->command_queue);
+    clReleaseCommandQueue(this->transfer_queue);
     clReleaseContext(this->context);
 }
 
@@ -146,14 +155,19 @@ void OpenCL_MixIn::ReloadContextIfNeeded()
     }
 
     // create the context
+    this->ReleaseKernelTimingEvents();
+    this->ReleaseContextObjects();
     clReleaseContext(this->context);
     this->context = clCreateContext(NULL,1,&this->device_id,NULL,NULL,&ret);
     throwOnError(ret,"OpenCL_MixIn::ReloadContextIfNeeded : Failed to create context: ");
 
-    // create the command queue
+    // create the command queues, with profiling for the performance counters
     clReleaseCommandQueue(this->command_queue);
-    this->command_queue = clCreateCommandQueue(this->context,this->device_id,0,&ret);
+    this->command_queue = clCreateCommandQueue(this->context,this->device_id,CL_QUEUE_PROFILING_ENABLE,&ret);
     throwOnError(ret,"OpenCL_MixIn::ReloadContextIfNeeded : Failed to create command queue: ");
+    clReleaseCommandQueue(this->transfer_queue);
+    this->transfer_queue = clCreateCommandQueue(this->context,this->device_id,CL_QUEUE_PROFILING_ENABLE,&ret);
+    throwOnError(ret,"OpenCL_MixIn::ReloadContextIfNeeded : Failed to create transfer queue: ");
 
     this->need_reload_context = false;
 }
@@ -193,8 +207,139 @@ void OpenCL_MixIn::TestKernel(std::string kernel_source)
 
 // -----------------------------------------------------------------------
 
+cl_program OpenCL_MixIn::CreateProgramFromSource(const std::string& source_string) const
+{
+    cl_int ret;
+
+    // create the program
+    const char *source = source_string.c_str();
+    size_t source_size = source_string.length();
+    cl_program new_program = clCreateProgramWithSource(this->context,1,&source,&source_size,&ret);
+    throwOnError(ret,"OpenCL_MixIn::CreateProgramFromSource : Failed to create program with source: ");
+
+    // build the program
+    const double start = get_time_in_seconds();
+    ret = clBuildProgram(new_program,1,&this->device_id,"-cl-denorms-are-zero",NULL,NULL);
+    this->counters.AddBuild(get_time_in_seconds() - start);
+    if(ret != CL_SUCCESS)
+    {
+        size_t build_log_length = 0;
+        cl_int ret2 = clGetProgramBuildInfo(new_program,this->device_id,CL_PROGRAM_BUILD_LOG,0,0,&build_log_length);
+        throwOnError(ret2,"OpenCL_MixIn::CreateProgramFromSource : retrieving length of program build log failed: ");
+        vector<char> build_log(build_log_length);
+        cl_int ret3 = clGetProgramBuildInfo(new_program,this->device_id,CL_PROGRAM_BUILD_LOG,build_log_length,build_log.data(),0);
+        throwOnError(ret3,"OpenCL_MixIn::CreateProgramFromSource : retrieving program build log failed: ");
+        clReleaseProgram(new_program);
+        { ofstream out("kernel.txt"); out << source_string; }
+        ostringstream oss;
+        oss << "OpenCL_MixIn::CreateProgramFromSource : build failed (kernel saved as kernel.txt):\n\n" << string( build_log.begin(), build_log.end() );
+        throwOnError(ret,oss.str().c_str());
+    }
+    return new_program;
+}
+
+// -----------------------------------------------------------------------
+
+void OpenCL_MixIn::AttachHostMirrors(const vector<vtkDataArray*>& chemical_arrays)
+{
+    // (an array stops using its mirror if its memory is reallocated, e.g. by DeepCopy, so we check every time)
+    while (this->host_mirrors.size() < chemical_arrays.size())
+        this->host_mirrors.push_back(make_unique<HostMirror>());
+    for(size_t ic=0;ic<chemical_arrays.size();ic++)
+        if (!this->host_mirrors[ic]->IsAttachedTo(chemical_arrays[ic]))
+            this->host_mirrors[ic]->Attach(chemical_arrays[ic], this->context, this->command_queue);
+}
+
+// -----------------------------------------------------------------------
+
+bool OpenCL_MixIn::HasDeviceExtension(const string& extension) const
+{
+    if(!this->device_id)
+        return false;
+    size_t size = 0;
+    if(clGetDeviceInfo(this->device_id,CL_DEVICE_EXTENSIONS,0,NULL,&size) != CL_SUCCESS)
+        return false;
+    vector<char> extensions(size + 1, '\0');
+    if(clGetDeviceInfo(this->device_id,CL_DEVICE_EXTENSIONS,size,extensions.data(),NULL) != CL_SUCCESS)
+        return false;
+    // (the names are separated by spaces)
+    istringstream iss(extensions.data());
+    string name;
+    while(iss >> name)
+        if(name == extension)
+            return true;
+    return false;
+}
+
+// -----------------------------------------------------------------------
+
+cl_event* OpenCL_MixIn::GetKernelTimingEvent()
+{
+    // a long run (e.g. rdy -n 1000000) is a single update, so we can't keep every event until the end: drivers run out
+    const size_t MAX_KERNEL_EVENTS = 256;
+    if(this->kernel_events.size() >= MAX_KERNEL_EVENTS)
+        this->AccumulateKernelTimes();
+    // (the pointer is only valid until the next call, which is fine since it is filled in by the launch straight away)
+    this->kernel_events.push_back(NULL);
+    return &this->kernel_events.back();
+}
+
+// -----------------------------------------------------------------------
+
+double OpenCL_MixIn::CollectKernelTime()
+{
+    this->AccumulateKernelTimes();
+    // (profiling is only for reporting, so if the device can't do it we report nothing rather than fail)
+    const double seconds = this->is_kernel_timing_failed ? 0.0 : this->kernel_ticks * 1e-9;
+    this->kernel_ticks = 0;
+    this->is_kernel_timing_failed = false;
+    return seconds;
+}
+
+// -----------------------------------------------------------------------
+
+void OpenCL_MixIn::AccumulateKernelTimes()
+{
+    if(this->kernel_events.empty())
+        return;
+    // (the queue is in order, so once the last has finished they all have)
+    cl_int ret = clWaitForEvents(1,&this->kernel_events.back());
+    for(size_t i=0;i<this->kernel_events.size() && ret == CL_SUCCESS;i++)
+    {
+        // we add up the time each kernel ran for, rather than taking the span from the first to the last, since
+        // that would include the other commands in between (e.g. refreshing the ghost cells) and any idle time
+        cl_ulong start = 0, end = 0;
+        ret = clGetEventProfilingInfo(this->kernel_events[i],CL_PROFILING_COMMAND_START,sizeof(start),&start,NULL);
+        if(ret == CL_SUCCESS)
+            ret = clGetEventProfilingInfo(this->kernel_events[i],CL_PROFILING_COMMAND_END,sizeof(end),&end,NULL);
+        if(end > start)
+            this->kernel_ticks += end - start;
+    }
+    if(ret != CL_SUCCESS)
+        this->is_kernel_timing_failed = true;
+    for(cl_event event : this->kernel_events)
+        if(event)
+            clReleaseEvent(event);
+    this->kernel_events.clear();
+}
+
+// -----------------------------------------------------------------------
+
+void OpenCL_MixIn::ReleaseKernelTimingEvents()
+{
+    for(cl_event event : this->kernel_events)
+        if(event)
+            clReleaseEvent(event);
+    this->kernel_events.clear();
+    this->kernel_ticks = 0;
+    this->is_kernel_timing_failed = false;
+}
+
+// -----------------------------------------------------------------------
+
 void OpenCL_MixIn::ReleaseOpenCLBuffers()
 {
+    this->host_mirrors.clear();
     for(int i=0;i<2;i++)
         for(vector<cl_mem>::const_iterator it = this->buffers[i].begin();it!=this->buffers[i].end();it++)
             clReleaseMemObject(*it);
@@ -27,7 +27,12 @@
     #include "OpenCL_Dyn_Load.h"
 #endif
 
+// local:
+#include "HostMirror.hpp"
+#include "PerformanceCounters.hpp"
+
 // STL:
+#include <memory>
 #include <vector>
 #include <string>
 
@@ -36,7 +41,8 @@ class OpenCL_MixIn
 {
     public:
 
-        OpenCL_MixIn(int opencl_platform,int opencl_device);
+        /// The build times are added to counters, which should be those of the system.
+        OpenCL_MixIn(int opencl_platform,int opencl_device,PerformanceCounters& counters);
         virtual ~OpenCL_MixIn();
     
         void SetPlatform(int i);
@@ -55,10 +61,29 @@ class OpenCL_MixIn
         virtual void WriteToOpenCLBuffersIfNeeded() =0;
         virtual void ReadFromOpenCLBuffers() =0;
         virtual void ReleaseOpenCLBuffers();
+        /// Called by ReloadContextIfNeeded() before it releases the context, to release anything else made in it.
+        virtual void ReleaseContextObjects() {}
 
         /// Test a kernel string for errors on the current device.
         void TestKernel(std::string s);
 
+        /// Builds a program for the current device, throwing std::runtime_error with the build log on failure.
+        cl_program CreateProgramFromSource(const std::string& source) const;
+
+        /// Returns whether the current device supports the named extension, e.g. "cl_khr_fp64". False if there is no device yet.
+        bool HasDeviceExtension(const std::string& extension) const;
+
+        /// Makes each chemical's array use the memory of its host mirror, which the transfers to and from the device go
+        /// through. Arrays already using theirs are left alone, so this is cheap to call before every transfer.
+        void AttachHostMirrors(const std::vector<vtkDataArray*>& chemical_arrays);
+
+        /// Returns where the next kernel launch should put its event, so that CollectKernelTime() can time the kernels.
+        cl_event* GetKernelTimingEvent();
+        /// Waits for the kernels launched since the last call, then returns the total time that they ran for, in
+        /// seconds, as measured by the device. Other commands in the queue, and any gaps between them, aren't counted.
+        /// Returns zero if there were none to time.
+        double CollectKernelTime();
+
     protected:
 
         cl_context context;
@@ -70,6 +95,7 @@ class OpenCL_MixIn
         size_t local_work_size[3];
 
         cl_command_queue command_queue;
+        cl_command_queue transfer_queue; ///< for reading back while the kernels run, ordered against command_queue with events
 
         bool need_reload_context,need_write_to_opencl_buffers;
 
@@ -77,11 +103,26 @@ class OpenCL_MixIn
         std::vector<cl_mem> intergral_buffers[1]; // this step was create when we started to use integrals
         int iCurrentBuffer;
 
+        std::vector<std::unique_ptr<HostMirror>> host_mirrors; ///< one for each chemical
+
         std::string kernel_source;
 
+        PerformanceCounters& counters;
+
+    private:
+
+        /// Waits for the kernels in kernel_events, adds their times to kernel_ticks, then releases them.
+        void AccumulateKernelTimes();
+        void ReleaseKernelTimingEvents();
+
     private:
 
         int iPlatform,iDevice;
+
+        // for CollectKernelTime():
+        std::vector<cl_event> kernel_events; ///< those not yet added in (at most 256, see GetKernelTimingEvent())
+        cl_ulong kernel_ticks;               ///< the total of those already added in, in nanoseconds
+        bool is_kernel_timing_failed;        ///< set if the device couldn't give us the times
 };
 
 #endif
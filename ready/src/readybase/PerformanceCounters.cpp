@@ -0,0 +1,199 @@
+/*  Copyright 2011-2024 The Ready Bunch
+
+    This file is part of Ready.
+
+    Ready is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ready is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ready. If not, see <http://www.gnu.org/licenses/>.         */
+
+// local:
+#include "PerformanceCounters.hpp"
+
+// STL:
+#include <iomanip>
+#include <sstream>
+using namespace std;
+
+namespace
+{
+    double PerSecond(double amount, double seconds)
+    {
+        return seconds > 0.0 ? amount / seconds : 0.0;
+    }
+
+    string Format(double value, int precision, const string& units)
+    {
+        ostringstream oss;
+        oss << fixed << setprecision(precision) << value << units;
+        return oss.str();
+    }
+
+    string FormatTransfer(double bytes, double seconds)
+    {
+        return Format(bytes / 1e6, 1, " MB in ") + Format(seconds * 1e3, 1, " ms (")
+            + Format(PerSecond(bytes, seconds) / 1e9, 2, " GB/s)");
+    }
+}
+
+// ---------------------------------------------------------------------
+
+PerformanceCounters::PerformanceCounters()
+{
+    this->Reset();
+}
+
+// ---------------------------------------------------------------------
+
+void PerformanceCounters::Reset()
+{
+    this->n_steps = 0;
+    this->cell_updates = this->step_seconds = 0.0;
+    this->kernel_cell_updates = this->kernel_bytes = this->kernel_seconds = 0.0;
+    this->bytes_to_device = this->seconds_to_device = 0.0;
+    this->bytes_from_device = this->seconds_from_device = 0.0;
+    this->n_builds = 0;
+    this->build_seconds = 0.0;
+}
+
+// ---------------------------------------------------------------------
+
+void PerformanceCounters::AddSteps(int n_steps, int n_cells, double seconds)
+{
+    if (n_steps <= 0) return; // (e.g. Update(0) to write to the device)
+    this->n_steps += n_steps;
+    this->cell_updates += static_cast<double>(n_steps) * n_cells;
+    this->step_seconds += seconds;
+}
+
+// ---------------------------------------------------------------------
+
+void PerformanceCounters::AddKernelTime(int n_steps, int n_cells, size_t bytes_per_cell_update, double seconds)
+{
+    if (seconds <= 0.0) return; // (not profiled)
+    const double n_cell_updates = static_cast<double>(n_steps) * n_cells;
+    this->kernel_cell_updates += n_cell_updates;
+    this->kernel_bytes += n_cell_updates * bytes_per_cell_update;
+    this->kernel_seconds += seconds;
+}
+
+// ---------------------------------------------------------------------
+
+void PerformanceCounters::AddTransferToDevice(size_t bytes, double seconds)
+{
+    this->bytes_to_device += bytes;
+    this->seconds_to_device += seconds;
+}
+
+// ---------------------------------------------------------------------
+
+void PerformanceCounters::AddTransferFromDevice(size_t bytes, double seconds)
+{
+    this->bytes_from_device += bytes;
+    this->seconds_from_device += seconds;
+}
+
+// ---------------------------------------------------------------------
+
+void PerformanceCounters::AddBuild(double seconds)
+{
+    this->n_builds++;
+    this->build_seconds += seconds;
+}
+
+// ---------------------------------------------------------------------
+
+void PerformanceCounters::Add(const PerformanceCounters& other)
+{
+    this->n_steps += other.n_steps;
+    this->cell_updates += other.cell_updates;
+    this->step_seconds += other.step_seconds;
+    this->kernel_cell_updates += other.kernel_cell_updates;
+    this->kernel_bytes += other.kernel_bytes;
+    this->kernel_seconds += other.kernel_seconds;
+    this->bytes_to_device += other.bytes_to_device;
+    this->seconds_to_device += other.seconds_to_device;
+    this->bytes_from_device += other.bytes_from_device;
+    this->seconds_from_device += other.seconds_from_device;
+    this->n_builds += other.n_builds;
+    this->build_seconds += other.build_seconds;
+}
+
+// ---------------------------------------------------------------------
+
+double PerformanceCounters::GetMcellsPerSecond() const
+{
+    return PerSecond(this->cell_updates, this->step_seconds) / 1e6;
+}
+
+// ---------------------------------------------------------------------
+
+double PerformanceCounters::GetKernelMcellsPerSecond() const
+{
+    return PerSecond(this->kernel_cell_updates, this->kernel_seconds) / 1e6;
+}
+
+// ---------------------------------------------------------------------
+
+double PerformanceCounters::GetEffectiveGBPerSecond() const
+{
+    return PerSecond(this->kernel_bytes, this->kernel_seconds) / 1e9;
+}
+
+// ---------------------------------------------------------------------
+
+double PerformanceCounters::GetGBPerSecondToDevice() const
+{
+    return PerSecond(this->bytes_to_device, this->seconds_to_device) / 1e9;
+}
+
+// ---------------------------------------------------------------------
+
+double PerformanceCounters::GetGBPerSecondFromDevice() const
+{
+    return PerSecond(this->bytes_from_device, this->seconds_from_device) / 1e9;
+}
+
+// ---------------------------------------------------------------------
+
+vector<pair<string,string>> PerformanceCounters::GetReport() const
+{
+    vector<pair<string,string>> report;
+    if (this->n_steps > 0)
+    {
+        report.emplace_back("Timesteps timed", to_string(this->n_steps) + " in " + Format(this->step_seconds, 3, " s"));
+        report.emplace_back("Cell updates per second", Format(this->GetMcellsPerSecond(), 1, " M"));
+    }
+    if (this->kernel_seconds > 0.0)
+    {
+        report.emplace_back("Kernel cell updates per second", Format(this->GetKernelMcellsPerSecond(), 1, " M"));
+        report.emplace_back("Kernel memory bandwidth", Format(this->GetEffectiveGBPerSecond(), 2, " GB/s (estimated)"));
+    }
+    if (this->bytes_to_device > 0.0)
+        report.emplace_back("Host to device", FormatTransfer(this->bytes_to_device, this->seconds_to_device));
+    if (this->bytes_from_device > 0.0)
+        report.emplace_back("Device to host", FormatTransfer(this->bytes_from_device, this->seconds_from_device));
+    if (this->n_builds > 0)
+        report.emplace_back("Kernel builds", to_string(this->n_builds) + " in " + Format(this->build_seconds * 1e3, 0, " ms"));
+    return report;
+}
+
+// ---------------------------------------------------------------------
+
+string PerformanceCounters::GetSummary() const
+{
+    ostringstream oss;
+    for (const pair<string,string>& item : this->GetReport())
+        oss << item.first << ": " << item.second << "\n";
+    return oss.str();
+}
+
+// ---------------------------------------------------------------------
@@ -0,0 +1,86 @@
+/*  Copyright 2011-2024 The Ready Bunch
+
+    This file is part of Ready.
+
+    Ready is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ready is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ready. If not, see <http://www.gnu.org/licenses/>.         */
+
+#ifndef __PERFORMANCECOUNTERS__
+#define __PERFORMANCECOUNTERS__
+
+// STL:
+#include <cstddef>
+#include <string>
+#include <utility>
+#include <vector>
+
+/// Counts the work that a system has done and the time it took, for reporting its speed.
+/** Timesteps are timed on the host, by the wall clock, and (for OpenCL implementations) on the device, from profiling
+    events on the kernels. Memory bandwidth is estimated from the cells updated, assuming that each cell update reads
+    and writes every chemical once, which is what a stencil with perfect caching would do. The counts accumulate until
+    Reset(), e.g. over the whole of a run of rdy. */
+class PerformanceCounters
+{
+    public:
+
+        PerformanceCounters();
+
+        void Reset();
+
+        /// Call after taking n_steps timesteps of n_cells cells, with the wall-clock time they took.
+        void AddSteps(int n_steps, int n_cells, double seconds);
+        /// Call with the time that the device spent running the kernels for n_steps timesteps of n_cells cells.
+        void AddKernelTime(int n_steps, int n_cells, size_t bytes_per_cell_update, double seconds);
+        void AddTransferToDevice(size_t bytes, double seconds);
+        void AddTransferFromDevice(size_t bytes, double seconds);
+        /// Call after building an OpenCL program, with the time it took.
+        void AddBuild(double seconds);
+        /// Adds in the counts of another, e.g. one kept on a worker thread.
+        void Add(const PerformanceCounters& other);
+
+        long long GetTimestepsTaken() const { return this->n_steps; }
+        double GetSteppingTime() const { return this->step_seconds; }
+        double GetKernelTime() const { return this->kernel_seconds; }
+        double GetBuildTime() const { return this->build_seconds; }
+        int GetNumberOfBuilds() const { return this->n_builds; }
+        double GetBytesToDevice() const { return this->bytes_to_device; }
+        double GetBytesFromDevice() const { return this->bytes_from_device; }
+        double GetTransferToDeviceTime() const { return this->seconds_to_device; }
+        double GetTransferFromDeviceTime() const { return this->seconds_from_device; }
+
+        /// Returns millions of cell updates per second of wall-clock time, or zero if nothing has been timed.
+        double GetMcellsPerSecond() const;
+        /// Returns millions of cell updates per second of kernel time, or zero if the kernels were not profiled.
+        double GetKernelMcellsPerSecond() const;
+        /// Returns the memory bandwidth that the kernels achieved, in GB/s, or zero if the kernels were not profiled.
+        double GetEffectiveGBPerSecond() const;
+        double GetGBPerSecondToDevice() const;
+        double GetGBPerSecondFromDevice() const;
+
+        /// Returns a name and a formatted value for each of the counts that has something to report.
+        std::vector<std::pair<std::string,std::string>> GetReport() const;
+        /// Returns the report as lines of "name: value", as printed by rdy --stats.
+        std::string GetSummary() const;
+
+    private:
+
+        long long n_steps;
+        double cell_updates, step_seconds;
+        double kernel_cell_updates, kernel_bytes, kernel_seconds;
+        double bytes_to_device, seconds_to_device;
+        double bytes_from_device, seconds_from_device;
+        int n_builds;
+        double build_seconds;
+};
+
+#endif
@@ -63,6 +63,12 @@ void Property::ReadFromXML(vtkXMLDataElement* node)
         if(find(begin(SupportedColorMaps), end(SupportedColorMaps), this->s) == end(SupportedColorMaps))
             throw runtime_error("Property::ReadFromXML : unrecognised colormap: "+this->s);
     }
+    else if(this->type=="pooling")
+    {
+        read_required_attribute(node,"value",this->s);
+        if(find(begin(SupportedPoolingModes), end(SupportedPoolingModes), this->s) == end(SupportedPoolingModes))
+            throw runtime_error("Property::ReadFromXML : unrecognised pooling: "+this->s);
+    }
     else throw runtime_error("Property::ReadFromXML : unrecognised type: "+this->type);
 }
 
@@ -88,6 +94,8 @@ vtkSmartPointer<vtkXMLDataElement> Property::GetAsXML() const
         node->SetAttribute("value",this->s.c_str());
     else if(this->type=="colormap")
         node->SetAttribute("value",this->s.c_str());
+    else if(this->type=="pooling")
+        node->SetAttribute("value",this->s.c_str());
     else throw runtime_error("Property::GetAsXML : unrecognised type: "+this->type);
     return node;
 }
@@ -61,6 +61,7 @@ class Property : public XML_Object
         const std::string& GetChemical() const { assert(type=="chemical"); return this->s; }
         const std::string& GetAxis() const { assert(type=="axis"); return this->s; }
         const std::string& GetColorMap() const { assert(type=="colormap"); return this->s; }
+        const std::string& GetPooling() const { assert(type=="pooling"); return this->s; }
 
         void SetFloat(float f) { assert(type=="float"); this->f1=f; }
         void SetInt(int i) { assert(type=="int"); this->i = i; }
@@ -69,6 +70,7 @@ class Property : public XML_Object
         void SetChemical(const std::string& s) { assert(type=="chemical"); this->s = s; }
         void SetAxis(const std::string& s) { assert(type=="axis"); this->s = s; }
         void SetColorMap(const std::string& s) { assert(type=="colormap"); this->s = s; }
+        void SetPooling(const std::string& s) { assert(type=="pooling"); this->s = s; }
 
     protected:
 
@@ -0,0 +1,224 @@
+/*  Copyright 2011-2024 The Ready Bunch
+
+    This file is part of Ready.
+
+    Ready is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ready is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ready. If not, see <http://www.gnu.org/licenses/>.         */
+
+// local:
+#include "SimulationThread.hpp"
+#include "AbstractRD.hpp"
+#include "utils.hpp"
+
+// STL:
+#include <algorithm>
+#include <stdexcept>
+using namespace std;
+
+// ---------------------------------------------------------------------
+
+SimulationThread::SimulationThread(AbstractRD& system, function<void()> on_steps_done)
+    : system(system)
+    , on_steps_done(std::move(on_steps_done))
+    , is_paused(true)
+    , is_stepping(false)
+    , should_quit(false)
+    , steps_wanted(0)
+    , steps_taken(0)
+    , stepping_time(0.0)
+    , stepping_time_at_pause(0.0)
+    , chunk_scheduler(1.0 / 30.0, 0.2, 0.02)
+{
+    if (!system.CanStepInBackground())
+        throw runtime_error("SimulationThread::SimulationThread : this system cannot step in the background");
+    this->worker = thread(&SimulationThread::WorkerLoop, this);
+}
+
+// ---------------------------------------------------------------------
+
+SimulationThread::~SimulationThread()
+{
+    try
+    {
+        this->Pause();
+    }
+    catch (...) {}
+    {
+        lock_guard<mutex> lock(this->m);
+        this->should_quit = true;
+    }
+    this->state_changed.notify_all();
+    this->worker.join();
+}
+
+// ---------------------------------------------------------------------
+
+void SimulationThread::Resume(int n_steps)
+{
+    {
+        lock_guard<mutex> lock(this->m);
+        if (!this->is_paused)
+            throw runtime_error("SimulationThread::Resume : already running");
+    }
+    // the worker is waiting, so this is the moment to push any changes to the device
+    this->system.PrepareForBackgroundSteps();
+    {
+        lock_guard<mutex> lock(this->m);
+        this->steps_wanted = max(0, n_steps);
+        this->steps_taken = 0;
+        this->stepping_time = 0.0;
+        this->is_paused = false;
+    }
+    this->state_changed.notify_all();
+}
+
+// ---------------------------------------------------------------------
+
+int SimulationThread::StopWorker(exception_ptr& worker_error, deque<function<void(AbstractRD&)>>& posted_changes)
+{
+    unique_lock<mutex> lock(this->m);
+    this->is_paused = true;
+    this->state_changed.wait(lock, [this] { return !this->is_stepping; });
+    const int n_steps = this->steps_taken;
+    this->steps_taken = 0;
+    this->steps_wanted = 0;
+    this->stepping_time_at_pause = this->stepping_time;
+    worker_error = this->error;
+    this->error = nullptr;
+    posted_changes.swap(this->changes);
+    return n_steps;
+}
+
+// ---------------------------------------------------------------------
+
+int SimulationThread::Pause()
+{
+    if (this->IsPaused())
+        return 0;
+    exception_ptr worker_error;
+    deque<function<void(AbstractRD&)>> posted_changes;
+    const int n_steps = this->StopWorker(worker_error, posted_changes);
+
+    // the worker is now waiting, so we can change the system
+    this->system.FinishBackgroundSteps(n_steps);
+    this->system.CompleteBackgroundSteps();
+    for (const function<void(AbstractRD&)>& change : posted_changes)
+        change(this->system);
+    if (worker_error)
+        rethrow_exception(worker_error);
+    return n_steps;
+}
+
+// ---------------------------------------------------------------------
+
+int SimulationThread::StartNextFrame(int n_steps)
+{
+    if (this->IsPaused())
+        throw runtime_error("SimulationThread::StartNextFrame : not running");
+    exception_ptr worker_error;
+    deque<function<void(AbstractRD&)>> posted_changes;
+    const int n_steps_taken = this->StopWorker(worker_error, posted_changes);
+
+    this->system.FinishBackgroundSteps(n_steps_taken);
+    if (worker_error || !posted_changes.empty())
+    {
+        // the changes need the read back to have finished, so there's no overlap this time
+        this->system.CompleteBackgroundSteps();
+        for (const function<void(AbstractRD&)>& change : posted_changes)
+            change(this->system);
+        if (worker_error)
+            rethrow_exception(worker_error);
+    }
+    this->Resume(n_steps);
+    this->system.CompleteBackgroundSteps();
+    return n_steps_taken;
+}
+
+// ---------------------------------------------------------------------
+
+void SimulationThread::Post(function<void(AbstractRD&)> change)
+{
+    {
+        lock_guard<mutex> lock(this->m);
+        if (!this->is_paused)
+        {
+            this->changes.push_back(std::move(change));
+            return;
+        }
+    }
+    change(this->system);
+}
+
+// ---------------------------------------------------------------------
+
+bool SimulationThread::IsPaused() const
+{
+    lock_guard<mutex> lock(this->m);
+    return this->is_paused;
+}
+
+// ---------------------------------------------------------------------
+
+bool SimulationThread::AreStepsDone() const
+{
+    lock_guard<mutex> lock(this->m);
+    return !this->is_paused && (this->steps_taken >= this->steps_wanted || this->error);
+}
+
+// ---------------------------------------------------------------------
+
+void SimulationThread::WorkerLoop()
+{
+    unique_lock<mutex> lock(this->m);
+    for (;;)
+    {
+        this->state_changed.wait(lock, [this] {
+            return this->should_quit || (!this->is_paused && !this->error && this->steps_taken < this->steps_wanted);
+        });
+        if (this->should_quit)
+            return;
+
+        const int n_steps = this->chunk_scheduler.GetStepsForNextUpdate(this->steps_wanted - this->steps_taken);
+        this->is_stepping = true;
+        lock.unlock();
+
+        const double time_before = get_time_in_seconds();
+        exception_ptr step_error;
+        try
+        {
+            this->system.StepInBackground(n_steps);
+        }
+        catch (...)
+        {
+            step_error = current_exception();
+        }
+        const double seconds = get_time_in_seconds() - time_before;
+
+        lock.lock();
+        this->is_stepping = false;
+        if (step_error)
+            this->error = step_error; // (the steps may have been partly taken, but we count them anyway)
+        this->steps_taken += n_steps;
+        this->stepping_time += seconds;
+        this->chunk_scheduler.AddUpdateTiming(n_steps, seconds);
+        const bool is_done = this->steps_taken >= this->steps_wanted || this->error;
+        this->state_changed.notify_all();
+
+        if (is_done && this->on_steps_done)
+        {
+            lock.unlock();
+            this->on_steps_done();
+            lock.lock();
+        }
+    }
+}
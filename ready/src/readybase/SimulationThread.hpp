@@ -0,0 +1,105 @@
+/*  Copyright 2011-2024 The Ready Bunch
+
+    This file is part of Ready.
+
+    Ready is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ready is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ready. If not, see <http://www.gnu.org/licenses/>.         */
+
+#ifndef __SIMULATIONTHREAD__
+#define __SIMULATIONTHREAD__
+
+// local:
+#include "StepScheduler.hpp"
+class AbstractRD;
+
+// STL:
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+/// Takes the timesteps of a system on a worker thread, so that the main thread never waits for them.
+/** Only for systems where AbstractRD::CanStepInBackground() is true. The worker calls StepInBackground() in short
+    chunks until the number of steps asked for by Resume() have been taken, then calls on_steps_done (on the worker
+    thread) and waits. Meanwhile the main thread can read the system, e.g. to render it, but must not change it.
+
+    Changes to the system go through Post(): while the worker is stepping they are queued, and they are made by the
+    next call to Pause(), after the steps so far have been made visible. Pause() waits for the chunk in flight (at most
+    a few tens of milliseconds), so the main thread can also call it before making a change that can't wait. */
+class SimulationThread
+{
+    public:
+
+        /// Starts the worker thread, paused.
+        SimulationThread(AbstractRD& system, std::function<void()> on_steps_done);
+        /// Pauses and stops the worker thread. Any error is discarded.
+        ~SimulationThread();
+
+        SimulationThread(const SimulationThread&) = delete;
+        SimulationThread& operator=(const SimulationThread&) = delete;
+
+        /// Makes any changes to the system take effect, then sets the worker taking n_steps timesteps.
+        void Resume(int n_steps);
+
+        /// Waits for the worker to finish its chunk, makes the steps taken since the last pause visible in the system,
+        /// then makes the changes that were posted. Returns the number of steps that were taken.
+        /** If the worker failed then the error is rethrown here, after the steps it did take have been made visible. */
+        int Pause();
+
+        /// Like Pause() then Resume(n_steps), except that the worker starts on the next steps while the ones taken so
+        /// far are read back, for systems where FinishBackgroundSteps() leaves the read back running.
+        /** Returns the number of steps that were taken, once they are visible in the system. */
+        int StartNextFrame(int n_steps);
+
+        /// Changes the system now if the worker is paused, otherwise at the next call to Pause().
+        void Post(std::function<void(AbstractRD&)> change);
+
+        bool IsPaused() const;
+        /// Returns true if all the steps asked for by Resume() have been taken.
+        bool AreStepsDone() const;
+
+        /// Returns the time that the worker spent stepping, in seconds, up to the last call to Pause().
+        double GetSteppingTime() const { return this->stepping_time_at_pause; }
+
+    private:
+
+        void WorkerLoop();
+
+        /// Pauses the worker, then returns the steps it took and hands over the error and changes that it had.
+        int StopWorker(std::exception_ptr& worker_error, std::deque<std::function<void(AbstractRD&)>>& posted_changes);
+
+    private:
+
+        AbstractRD& system;
+        std::function<void()> on_steps_done;
+
+        mutable std::mutex m;
+        std::condition_variable state_changed;
+
+        bool is_paused;                 ///< set and cleared by the main thread
+        bool is_stepping;               ///< true while the worker is in StepInBackground()
+        bool should_quit;
+        int steps_wanted;               ///< the number of steps asked for by the last Resume()
+        int steps_taken;                ///< the number of steps taken since the last Pause()
+        double stepping_time;           ///< the time spent stepping since the last Pause()
+        double stepping_time_at_pause;
+        std::exception_ptr error;
+        std::deque<std::function<void(AbstractRD&)>> changes; ///< posted while the worker was stepping
+        StepScheduler chunk_scheduler;  ///< keeps each chunk short, so that Pause() doesn't wait long
+
+        std::thread worker;
+};
+
+#endif
@@ -0,0 +1,339 @@
+/*  Copyright 2011-2024 The Ready Bunch
+
+    This file is part of Ready.
+
+    Ready is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ready is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ready. If not, see <http://www.gnu.org/licenses/>.         */
+
+// local:
+#include "SparseMatrix.hpp"
+#include "parallel.hpp"
+
+// STL:
+#include <algorithm>
+#include <numeric>
+#include <sstream>
+#include <stdexcept>
+
+using namespace std;
+
+// ---------------------------------------------------------------------
+
+namespace
+{
+    const int PREFETCH_DISTANCE = 16; // entries ahead
+}
+
+// ---------------------------------------------------------------------
+
+SparseMatrix::SparseMatrix()
+    : format(Format::CSR)
+    , n_rows(0)
+    , n_nonzeros(0)
+    , ellpack_width(0)
+    , offsets(1, 0)
+{
+}
+
+// ---------------------------------------------------------------------
+
+SparseMatrix::Format SparseMatrix::ChooseFormat(const vector<int>& row_lengths)
+{
+    if (row_lengths.empty())
+        return Format::CSR;
+    const size_t n_nonzeros = accumulate(row_lengths.begin(), row_lengths.end(), size_t(0));
+    const size_t max_length = *max_element(row_lengths.begin(), row_lengths.end());
+    const double ellpack_padding = n_nonzeros ? double(max_length * row_lengths.size()) / n_nonzeros : 1.0;
+    if (ellpack_padding < 1.2)
+        return Format::ELLPACK; // e.g. all the cells have the same number of neighbors
+    if (row_lengths.size() >= static_cast<size_t>(SELL_SORTING_WINDOW))
+        return Format::SELL_C_SIGMA;
+    return Format::CSR; // too small to be worth sorting
+}
+
+// ---------------------------------------------------------------------
+
+string SparseMatrix::GetFormatName(Format format)
+{
+    switch (format)
+    {
+        case Format::CSR: return "CSR";
+        case Format::ELLPACK: return "ELLPACK";
+        case Format::SELL_C_SIGMA: return "SELL-" + to_string(SELL_CHUNK_SIZE) + "-" + to_string(SELL_SORTING_WINDOW);
+    }
+    return "unknown";
+}
+
+// ---------------------------------------------------------------------
+
+void SparseMatrix::SetFromPaddedRows(int n, int row_width, const int* in_columns, const float* in_values, Format fmt)
+{
+    this->format = fmt;
+    this->n_rows = n;
+    this->offsets.clear();
+    this->rows.clear();
+    this->columns.clear();
+    this->values.clear();
+
+    // collect the non-zero entries of each row
+    vector<int> row_lengths(n, 0);
+    for (int iRow = 0; iRow < n; iRow++)
+        for (int k = 0; k < row_width; k++)
+            if (in_values[iRow * row_width + k] != 0.0f)
+                row_lengths[iRow]++;
+    this->n_nonzeros = accumulate(row_lengths.begin(), row_lengths.end(), size_t(0));
+    auto entries_of_row = [&](int iRow, vector<pair<int, float>>& entries)
+    {
+        entries.clear();
+        for (int k = 0; k < row_width; k++)
+            if (in_values[iRow * row_width + k] != 0.0f)
+                entries.emplace_back(in_columns[iRow * row_width + k], in_values[iRow * row_width + k]);
+    };
+    vector<pair<int, float>> entries;
+
+    switch (this->format)
+    {
+        case Format::CSR:
+        {
+            this->offsets.resize(n + 1);
+            this->offsets[0] = 0;
+            for (int iRow = 0; iRow < n; iRow++)
+            {
+                entries_of_row(iRow, entries);
+                for (const auto& e : entries)
+                {
+                    this->columns.push_back(e.first);
+                    this->values.push_back(e.second);
+                }
+                this->offsets[iRow + 1] = static_cast<int>(this->columns.size());
+            }
+            break;
+        }
+        case Format::ELLPACK:
+        {
+            this->ellpack_width = n ? *max_element(row_lengths.begin(), row_lengths.end()) : 0;
+            this->offsets.assign(1, this->ellpack_width);
+            // padding points at the row itself with zero weight, so it reads valid memory
+            this->columns.resize(size_t(n) * this->ellpack_width);
+            this->values.assign(size_t(n) * this->ellpack_width, 0.0f);
+            for (int iRow = 0; iRow < n; iRow++)
+            {
+                entries_of_row(iRow, entries);
+                for (int k = 0; k < this->ellpack_width; k++)
+                {
+                    const size_t j = size_t(k) * n + iRow;
+                    this->columns[j] = k < (int)entries.size() ? entries[k].first : iRow;
+                    if (k < (int)entries.size())
+                        this->values[j] = entries[k].second;
+                }
+            }
+            break;
+        }
+        case Format::SELL_C_SIGMA:
+        {
+            const int C = SELL_CHUNK_SIZE;
+            const int n_chunks = (n + C - 1) / C;
+            // sort the rows by decreasing length within each window, so that rows in a chunk have similar lengths
+            this->rows.assign(size_t(n_chunks) * C, -1);
+            iota(this->rows.begin(), this->rows.begin() + n, 0);
+            for (int window_start = 0; window_start < n; window_start += SELL_SORTING_WINDOW)
+            {
+                const int window_end = min(n, window_start + SELL_SORTING_WINDOW);
+                stable_sort(this->rows.begin() + window_start, this->rows.begin() + window_end,
+                    [&](int r1, int r2) { return row_lengths[r1] > row_lengths[r2]; });
+            }
+            this->offsets.resize(n_chunks + 1);
+            this->offsets[0] = 0;
+            for (int iChunk = 0; iChunk < n_chunks; iChunk++)
+            {
+                int width = 0;
+                for (int lane = 0; lane < C; lane++)
+                {
+                    const int iRow = this->rows[iChunk * C + lane];
+                    if (iRow >= 0)
+                        width = max(width, row_lengths[iRow]);
+                }
+                const size_t chunk_start = this->columns.size();
+                this->columns.resize(chunk_start + size_t(width) * C);
+                this->values.resize(chunk_start + size_t(width) * C, 0.0f);
+                for (int lane = 0; lane < C; lane++)
+                {
+                    const int iRow = this->rows[iChunk * C + lane];
+                    if (iRow >= 0)
+                        entries_of_row(iRow, entries);
+                    else
+                        entries.clear();
+                    for (int k = 0; k < width; k++)
+                    {
+                        const size_t j = chunk_start + size_t(k) * C + lane;
+                        this->columns[j] = k < (int)entries.size() ? entries[k].first : max(iRow, 0);
+                        if (k < (int)entries.size())
+                            this->values[j] = entries[k].second;
+                    }
+                }
+                this->offsets[iChunk + 1] = static_cast<int>(this->columns.size());
+            }
+            break;
+        }
+    }
+    // (OpenCL doesn't allow zero-sized buffers)
+    if (this->rows.empty()) this->rows.push_back(-1);
+    if (this->columns.empty()) { this->columns.push_back(0); this->values.push_back(0.0f); }
+}
+
+// ---------------------------------------------------------------------
+
+size_t SparseMatrix::GetMemorySize() const
+{
+    return sizeof(int) * (this->offsets.size() + this->rows.size() + this->columns.size()) + sizeof(float) * this->values.size();
+}
+
+// ---------------------------------------------------------------------
+
+int SparseMatrix::GetRowBlockSize() const
+{
+    return this->format == Format::SELL_C_SIGMA ? SELL_SORTING_WINDOW : 1;
+}
+
+// ---------------------------------------------------------------------
+
+int SparseMatrix::GetNumberOfRowBlocks() const
+{
+    const int block_size = this->GetRowBlockSize();
+    return (this->n_rows + block_size - 1) / block_size;
+}
+
+// ---------------------------------------------------------------------
+
+size_t SparseMatrix::GetNumberOfWorkItems() const
+{
+    if (this->format == Format::SELL_C_SIGMA)
+        return this->rows.size(); // one per chunk slot, including the padding
+    return this->n_rows;
+}
+
+// ---------------------------------------------------------------------
+
+int SparseMatrix::GetStride() const
+{
+    switch (this->format)
+    {
+        case Format::ELLPACK: return this->n_rows;
+        case Format::SELL_C_SIGMA: return SELL_CHUNK_SIZE;
+        default: return 1;
+    }
+}
+
+// ---------------------------------------------------------------------
+
+template <typename T>
+void SparseMatrix::Multiply(const T* x, T* y, int row_begin, int row_end) const
+{
+    switch (this->format)
+    {
+        case Format::CSR:
+        {
+            const int* col = this->columns.data();
+            const float* val = this->values.data();
+            const int n_entries = this->offsets[this->n_rows];
+            for (int iRow = row_begin; iRow < row_end; iRow++)
+            {
+                T sum = 0;
+                for (int j = this->offsets[iRow]; j < this->offsets[iRow + 1]; j++)
+                {
+                    if (j + PREFETCH_DISTANCE < n_entries)
+                        READY_PREFETCH(x + col[j + PREFETCH_DISTANCE]);
+                    sum += val[j] * x[col[j]];
+                }
+                y[iRow] = sum;
+            }
+            break;
+        }
+        case Format::ELLPACK:
+        {
+            // column-major: sweep each column of the band, which streams through memory
+            fill(y + row_begin, y + row_end, T(0));
+            for (int k = 0; k < this->ellpack_width; k++)
+            {
+                const int* col = this->columns.data() + size_t(k) * this->n_rows;
+                const float* val = this->values.data() + size_t(k) * this->n_rows;
+                for (int iRow = row_begin; iRow < row_end; iRow++)
+                {
+                    if (iRow + PREFETCH_DISTANCE < row_end)
+                        READY_PREFETCH(x + col[iRow + PREFETCH_DISTANCE]);
+                    y[iRow] += val[iRow] * x[col[iRow]];
+                }
+            }
+            break;
+        }
+        case Format::SELL_C_SIGMA:
+        {
+            const int C = SELL_CHUNK_SIZE;
+            const int chunk_end = (row_end + C - 1) / C;
+            for (int iChunk = row_begin / C; iChunk < chunk_end; iChunk++)
+            {
+                T sum[C] = {};
+                const int width = (this->offsets[iChunk + 1] - this->offsets[iChunk]) / C;
+                const int* col = this->columns.data() + this->offsets[iChunk];
+                const float* val = this->values.data() + this->offsets[iChunk];
+                for (int k = 0; k < width; k++)
+                    for (int lane = 0; lane < C; lane++) // (the compiler can vectorize this)
+                        sum[lane] += val[k * C + lane] * x[col[k * C + lane]];
+                for (int lane = 0; lane < C; lane++)
+                {
+                    const int iRow = this->rows[iChunk * C + lane];
+                    if (iRow >= 0)
+                        y[iRow] = sum[lane];
+                }
+            }
+            break;
+        }
+    }
+}
+
+template void SparseMatrix::Multiply<float>(const float* x, float* y, int row_begin, int row_end) const;
+template void SparseMatrix::Multiply<double>(const double* x, double* y, int row_begin, int row_end) const;
+
+// ---------------------------------------------------------------------
+
+string SparseMatrix::GetOpenCLRowSetup(const string& indent)
+{
+    ostringstream oss;
+    oss << indent << "// find our cell, and where the entries of its row of the Laplacian operator are\n";
+    oss << indent << "int index_x = get_global_id(0);\n";
+    oss << indent << "int _start, _step, _count;\n";
+    oss << indent << "if(L_format == " << static_cast<int>(Format::SELL_C_SIGMA) << ") // SELL-C-sigma: one work item per slot of each chunk of L_stride rows\n";
+    oss << indent << "{\n";
+    oss << indent << indent << "const int _chunk = index_x / L_stride;\n";
+    oss << indent << indent << "_start = L_offsets[_chunk] + index_x % L_stride;\n";
+    oss << indent << indent << "_step = L_stride;\n";
+    oss << indent << indent << "_count = (L_offsets[_chunk+1] - L_offsets[_chunk]) / L_stride;\n";
+    oss << indent << indent << "index_x = L_rows[index_x];\n";
+    oss << indent << indent << "if(index_x < 0) return; // (padding)\n";
+    oss << indent << "}\n";
+    oss << indent << "else if(L_format == " << static_cast<int>(Format::ELLPACK) << ") // ELLPACK, column-major\n";
+    oss << indent << "{\n";
+    oss << indent << indent << "_start = index_x;\n";
+    oss << indent << indent << "_step = L_stride;\n";
+    oss << indent << indent << "_count = L_offsets[0];\n";
+    oss << indent << "}\n";
+    oss << indent << "else // CSR\n";
+    oss << indent << "{\n";
+    oss << indent << indent << "_start = L_offsets[index_x];\n";
+    oss << indent << indent << "_step = 1;\n";
+    oss << indent << indent << "_count = L_offsets[index_x+1] - _start;\n";
+    oss << indent << "}\n";
+    return oss.str();
+}
+
+// ---------------------------------------------------------------------
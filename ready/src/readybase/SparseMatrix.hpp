@@ -0,0 +1,88 @@
+/*  Copyright 2011-2024 The Ready Bunch
+
+    This file is part of Ready.
+
+    Ready is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ready is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ready. If not, see <http://www.gnu.org/licenses/>.         */
+
+#ifndef __SPARSEMATRIX__
+#define __SPARSEMATRIX__
+
+// STL:
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/// A square sparse matrix, e.g. the Laplacian operator of a mesh, stored in one of several formats.
+/** Every format is laid out so that the entries of a row are found at start, start+step, ... (count of them),
+    which lets a single OpenCL kernel handle all of them (see GetOpenCLRowSetup()). The CPU has a tuned loop for each.
+    - CSR: rows stored one after the other. Best when the rows have very different lengths.
+    - ELLPACK: every row padded to the same width, stored column-major (step = number of rows). Best for regular meshes.
+    - SELL-C-sigma: rows sorted by length within windows of sigma rows, then grouped into chunks of C rows that are each
+      stored like a small ELLPACK matrix. Keeps the padding low for irregular meshes while staying SIMD/GPU friendly. */
+class SparseMatrix
+{
+    public:
+
+        /// (the values are passed to the OpenCL kernels as L_format)
+        enum class Format { CSR = 0, ELLPACK = 1, SELL_C_SIGMA = 2 };
+
+        static const int SELL_CHUNK_SIZE = 8;       ///< C: rows per chunk (the SIMD width we aim for)
+        static const int SELL_SORTING_WINDOW = 256; ///< sigma: rows are only reordered within windows this big
+
+        SparseMatrix();
+
+        /// Builds the matrix from padded rows: row i has row_width entries at i*row_width in columns and values. Zero values are skipped.
+        void SetFromPaddedRows(int n_rows, int row_width, const int* columns, const float* values, Format format);
+
+        /// Picks the format that suits the distribution of row lengths.
+        static Format ChooseFormat(const std::vector<int>& row_lengths);
+        static std::string GetFormatName(Format format);
+
+        Format GetFormat() const { return this->format; }
+        int GetNumberOfRows() const { return this->n_rows; }
+        size_t GetNumberOfNonZeros() const { return this->n_nonzeros; }
+        size_t GetMemorySize() const;
+
+        /// Rows are never reordered across blocks of this many rows, so Multiply() can work on whole blocks independently.
+        int GetRowBlockSize() const;
+        int GetNumberOfRowBlocks() const;
+
+        /// Computes y[i] = sum_j A[i][j]*x[j] for rows in [row_begin,row_end). Both must be at a multiple of GetRowBlockSize() (or n_rows).
+        template <typename T>
+        void Multiply(const T* x, T* y, int row_begin, int row_end) const;
+
+        // for the OpenCL kernels (arguments L_offsets, L_rows, L_columns, L_values, L_stride, L_format):
+        size_t GetNumberOfWorkItems() const;
+        const std::vector<int>& GetOffsets() const { return this->offsets; }
+        const std::vector<int>& GetRows() const { return this->rows; }
+        const std::vector<int>& GetColumns() const { return this->columns; }
+        const std::vector<float>& GetValues() const { return this->values; }
+        int GetStride() const;
+
+        /// Returns the kernel code that finds index_x and the _start, _step and _count of the entries in its row.
+        static std::string GetOpenCLRowSetup(const std::string& indent);
+
+    private:
+
+        Format format;
+        int n_rows;
+        size_t n_nonzeros;
+        int ellpack_width;
+        std::vector<int> offsets;   ///< CSR: start of each row (n_rows+1). SELL: start of each chunk (n_chunks+1). ELLPACK: {width}.
+        std::vector<int> rows;      ///< SELL: the row in each chunk slot, -1 for padding. Otherwise unused.
+        std::vector<int> columns;
+        std::vector<float> values;
+};
+
+#endif
@@ -0,0 +1,153 @@
+/*  Copyright 2011-2024 The Ready Bunch
+
+    This file is part of Ready.
+
+    Ready is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ready is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ready. If not, see <http://www.gnu.org/licenses/>.         */
+
+// local:
+#include "StepScheduler.hpp"
+
+// STL:
+#include <algorithm>
+#include <climits>
+#include <stdexcept>
+using namespace std;
+
+namespace
+{
+    /// Updates with a duration shorter than this are too dominated by timer resolution and call overheads to use.
+    const double min_timeable_seconds = 0.002;
+
+    /// The weight given to each new measurement. Higher settles faster but is noisier.
+    const double smoothing = 0.25;
+
+    double Smooth(double average, double sample, bool first)
+    {
+        return first ? sample : average + smoothing * (sample - average);
+    }
+
+    int ClampSteps(double steps, int max_steps)
+    {
+        if(!(steps < max_steps)) return max_steps; // (also catches infinity and NaN)
+        return max(1, static_cast<int>(steps));
+    }
+}
+
+// ---------------------------------------------------------------------
+
+StepScheduler::StepScheduler(double target_frame_time, double max_render_fraction, double max_update_time)
+    : max_render_fraction(max_render_fraction)
+    , max_update_time(max_update_time)
+{
+    if(max_render_fraction <= 0.0 || max_render_fraction >= 1.0)
+        throw runtime_error("StepScheduler::StepScheduler : max_render_fraction must be between 0 and 1");
+    if(max_update_time <= 0.0)
+        throw runtime_error("StepScheduler::StepScheduler : max_update_time must be positive");
+    this->SetTargetFrameTime(target_frame_time);
+    this->Reset();
+}
+
+// ---------------------------------------------------------------------
+
+void StepScheduler::Reset()
+{
+    this->have_step_estimate = false;
+    this->bootstrap_steps = 1;
+    this->seconds_per_step = 0.0;
+    this->n_frames_timed = 0;
+    this->frame_seconds = 0.0;
+    this->update_seconds_per_frame = 0.0;
+    this->timesteps_per_second = 0.0;
+}
+
+// ---------------------------------------------------------------------
+
+void StepScheduler::SetTargetFrameTime(double seconds)
+{
+    if(seconds <= 0.0)
+        throw runtime_error("StepScheduler::SetTargetFrameTime : target frame time must be positive");
+    this->target_frame_time = seconds;
+}
+
+// ---------------------------------------------------------------------
+
+int StepScheduler::GetStepsPerRender(int max_steps_per_render) const
+{
+    max_steps_per_render = max(1, max_steps_per_render);
+    if(!this->have_step_estimate)
+        return min(this->bootstrap_steps, max_steps_per_render);
+
+    // stretch the frame if rendering would otherwise take more than its share of the time
+    const double render_seconds = this->GetSecondsPerRender();
+    const double frame_seconds = max(this->target_frame_time, render_seconds / this->max_render_fraction);
+    const double stepping_seconds = frame_seconds - render_seconds;
+    return ClampSteps(stepping_seconds / this->seconds_per_step, max_steps_per_render);
+}
+
+// ---------------------------------------------------------------------
+
+int StepScheduler::GetStepsForNextUpdate(int steps_until_render) const
+{
+    steps_until_render = max(1, steps_until_render);
+    if(!this->have_step_estimate)
+        return min(this->bootstrap_steps, steps_until_render);
+    return ClampSteps(this->max_update_time / this->seconds_per_step, steps_until_render);
+}
+
+// ---------------------------------------------------------------------
+
+void StepScheduler::AddUpdateTiming(int n_steps, double seconds)
+{
+    if(n_steps < 1)
+        return;
+    if(seconds < min_timeable_seconds)
+    {
+        // too quick to time reliably, so try more steps next time (until we have an estimate)
+        if(!this->have_step_estimate)
+            this->bootstrap_steps = (this->bootstrap_steps < INT_MAX / 2) ? this->bootstrap_steps * 2 : INT_MAX;
+        return;
+    }
+    this->seconds_per_step = Smooth(this->seconds_per_step, seconds / n_steps, !this->have_step_estimate);
+    this->have_step_estimate = true;
+}
+
+// ---------------------------------------------------------------------
+
+void StepScheduler::AddFrameTiming(int n_steps, double frame_seconds, double update_seconds)
+{
+    if(frame_seconds <= 0.0)
+        return;
+    update_seconds = min(max(0.0, update_seconds), frame_seconds);
+    const bool first = this->n_frames_timed == 0;
+    this->frame_seconds = Smooth(this->frame_seconds, frame_seconds, first);
+    this->update_seconds_per_frame = Smooth(this->update_seconds_per_frame, update_seconds, first);
+    this->timesteps_per_second = Smooth(this->timesteps_per_second, n_steps / frame_seconds, first);
+    this->n_frames_timed++;
+}
+
+// ---------------------------------------------------------------------
+
+double StepScheduler::GetSecondsPerRender() const
+{
+    return max(0.0, this->frame_seconds - this->update_seconds_per_frame);
+}
+
+// ---------------------------------------------------------------------
+
+double StepScheduler::GetPercentageSpentRendering() const
+{
+    if(this->frame_seconds <= 0.0)
+        return 0.0;
+    return 100.0 * this->GetSecondsPerRender() / this->frame_seconds;
+}
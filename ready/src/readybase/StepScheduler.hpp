@@ -0,0 +1,76 @@
+/*  Copyright 2011-2024 The Ready Bunch
+
+    This file is part of Ready.
+
+    Ready is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ready is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ready. If not, see <http://www.gnu.org/licenses/>.         */
+
+#ifndef __STEPSCHEDULER__
+#define __STEPSCHEDULER__
+
+/// Decides how many timesteps to take in each call to Update() and between renders, from the measured cost of each.
+/** The cost of a timestep and the cost of rendering a frame (everything between two renders that isn't stepping) are
+    tracked separately, as exponential moving averages, so the estimates settle within a few frames of a change (a new
+    pattern, a bigger window) while smoothing out the jitter of single measurements.
+
+    Each frame is given target_frame_time seconds, and the time left after rendering is spent stepping. Rendering is
+    never allowed to take more than max_render_fraction of the time: a slow renderer lengthens the frames instead of
+    starving the simulation. Each call to Update() is kept under max_update_time so that the GUI stays responsive. */
+class StepScheduler
+{
+    public:
+
+        explicit StepScheduler(double target_frame_time = 1.0 / 30.0, double max_render_fraction = 0.2,
+                               double max_update_time = 0.05);
+
+        /// Forgets all the measurements, e.g. when a different system is loaded.
+        void Reset();
+
+        double GetTargetFrameTime() const { return this->target_frame_time; }
+        void SetTargetFrameTime(double seconds);
+
+        /// Returns how many timesteps to take before the next render, never more than max_steps_per_render.
+        int GetStepsPerRender(int max_steps_per_render) const;
+
+        /// Returns how many timesteps to pass to the next call to Update(), given how many are left before the next render.
+        int GetStepsForNextUpdate(int steps_until_render) const;
+
+        /// Call after each Update() with the number of timesteps it took and how long it took.
+        void AddUpdateTiming(int n_steps, double seconds);
+
+        /// Call after each render with the number of timesteps since the previous render, the time since the previous
+        /// render and how much of that time was spent in Update().
+        void AddFrameTiming(int n_steps, double frame_seconds, double update_seconds);
+
+        /// Returns true once enough frames have been timed for the speed estimates below to be meaningful.
+        bool HasSpeedEstimates() const { return this->n_frames_timed >= 3; }
+
+        double GetSecondsPerStep() const { return this->seconds_per_step; }
+        double GetSecondsPerRender() const;
+        double GetTimestepsPerSecond() const { return this->timesteps_per_second; }
+        double GetPercentageSpentRendering() const;
+
+    private:
+
+        double target_frame_time;       ///< the time we aim to spend on each frame, in seconds
+        double max_render_fraction;     ///< the largest fraction of the time that rendering may take
+        double max_update_time;         ///< the longest that a single call to Update() should take, in seconds
+
+        bool have_step_estimate;
+        int bootstrap_steps;            ///< steps per Update() until one takes long enough to time reliably
+        double seconds_per_step;
+        int n_frames_timed;
+        double frame_seconds, update_seconds_per_frame, timesteps_per_second;
+};
+
+#endif
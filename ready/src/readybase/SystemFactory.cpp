@@ -21,11 +21,14 @@
 #include <IO_XML.hpp>
 #include <GrayScottImageRD.hpp>
 #include <FormulaOpenCLImageRD.hpp>
+#include <AMROpenCLImageRD.hpp>
 #include <FullKernelOpenCLImageRD.hpp>
 #include <GrayScottMeshRD.hpp>
 #include <FormulaOpenCLMeshRD.hpp>
+#include <FormulaCPUMeshRD.hpp>
 #include <FullKernelOpenCLMeshRD.hpp>
 #include <Properties.hpp>
+#include <utils.hpp>
 #include <OpenCL_utils.hpp>
 
 // VTK:
@@ -135,7 +138,16 @@ unique_ptr<AbstractRD> CreateFromImageDataFile(
     {
         if(!is_opencl_available)
             throw runtime_error(OpenCL_utils::GetOpenCLInstallationHints());
-        image_system = make_unique<FormulaOpenCLImageRD>(opencl_platform,opencl_device,data_type);
+        // patterns that ask for refinement get the adaptive version
+        int refinement_ratio = 1;
+        vtkSmartPointer<vtkXMLDataElement> rule = reader->GetRDElement()->FindNestedElementWithName("rule");
+        vtkSmartPointer<vtkXMLDataElement> formula = rule ? rule->FindNestedElementWithName("formula") : nullptr;
+        if(formula)
+            read_optional_attribute(formula,"refinement_ratio",refinement_ratio);
+        if(refinement_ratio > 1)
+            image_system = make_unique<AMROpenCLImageRD>(opencl_platform,opencl_device,data_type);
+        else
+            image_system = make_unique<FormulaOpenCLImageRD>(opencl_platform,opencl_device,data_type);
     }
     else if(type=="kernel")
     {
@@ -202,9 +214,10 @@ unique_ptr<AbstractRD> CreateFromUnstructuredGridFile(
     }
     else if(type=="formula")
     {
-        if(!is_opencl_available)
-            throw runtime_error(OpenCL_utils::GetOpenCLInstallationHints());
-        mesh_system = make_unique<FormulaOpenCLMeshRD>(opencl_platform,opencl_device,data_type);
+        if(is_opencl_available)
+            mesh_system = make_unique<FormulaOpenCLMeshRD>(opencl_platform,opencl_device,data_type);
+        else
+            mesh_system = make_unique<FormulaCPUMeshRD>(data_type); // slower, but lets mesh patterns run without OpenCL
     }
     else if(type=="kernel")
     {
@@ -0,0 +1,132 @@
+/*  Copyright 2011-2024 The Ready Bunch
+
+    This file is part of Ready.
+
+    Ready is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ready is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ready. If not, see <http://www.gnu.org/licenses/>.         */
+
+// local:
+#include "TuningCache.hpp"
+
+// STL:
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include <sstream>
+using namespace std;
+
+namespace
+{
+    mutex m;
+    string cache_filename;
+    map<string, KernelConfiguration> results;
+
+    /// Returns the 64-bit FNV-1a hash of s, which (unlike std::hash) is the same on every platform and every run.
+    uint64_t HashString(const string& s)
+    {
+        uint64_t hash = 14695981039346656037ULL;
+        for (const unsigned char c : s)
+        {
+            hash ^= c;
+            hash *= 1099511628211ULL;
+        }
+        return hash;
+    }
+
+    // each line is the key, a tab, then: block_size_x y z use_local_memory local_work_size_x y z
+    void Load()
+    {
+        ifstream in(cache_filename);
+        string line;
+        while (getline(in, line))
+        {
+            const size_t tab = line.find('\t');
+            if (line.empty() || line[0] == '#' || tab == string::npos)
+                continue;
+            KernelConfiguration config;
+            int use_local_memory;
+            istringstream iss(line.substr(tab + 1));
+            iss >> config.block_size[0] >> config.block_size[1] >> config.block_size[2] >> use_local_memory
+                >> config.local_work_size[0] >> config.local_work_size[1] >> config.local_work_size[2];
+            if (!iss)
+                continue; // (skip lines we don't understand, e.g. from a later version)
+            config.use_local_memory = use_local_memory != 0;
+            results[line.substr(0, tab)] = config;
+        }
+    }
+
+    void Save()
+    {
+        ofstream out(cache_filename);
+        if (!out)
+            return; // (the results are still kept for this run)
+        out << "# Fastest kernel configurations found by Ready's auto-tuner. Delete this file to search again.\n";
+        for (const pair<const string, KernelConfiguration>& result : results)
+        {
+            const KernelConfiguration& config = result.second;
+            out << result.first << "\t" << config.block_size[0] << " " << config.block_size[1] << " "
+                << config.block_size[2] << " " << (config.use_local_memory ? 1 : 0) << " "
+                << config.local_work_size[0] << " " << config.local_work_size[1] << " " << config.local_work_size[2]
+                << "\n";
+        }
+    }
+}
+
+// ---------------------------------------------------------------------
+
+void TuningCache::SetFilename(const string& filename)
+{
+    lock_guard<mutex> lock(m);
+    cache_filename = filename;
+    Load();
+}
+
+// ---------------------------------------------------------------------
+
+string TuningCache::MakeKey(const string& device_name, const string& kernel_description, const int grid_size[3])
+{
+    ostringstream oss;
+    oss << device_name << "|" << hex << setw(16) << setfill('0') << HashString(kernel_description) << dec << "|"
+        << grid_size[0] << "x" << grid_size[1] << "x" << grid_size[2];
+    // the file has one result per line, with a tab after the key, so drop any tabs, line breaks or nulls
+    string key = oss.str();
+    key.erase(remove_if(key.begin(), key.end(), [](unsigned char c) { return c < ' '; }), key.end());
+    return key;
+}
+
+// ---------------------------------------------------------------------
+
+bool TuningCache::Find(const string& key, KernelConfiguration& config)
+{
+    lock_guard<mutex> lock(m);
+    const auto it = results.find(key);
+    if (it == results.end())
+        return false;
+    config = it->second;
+    return true;
+}
+
+// ---------------------------------------------------------------------
+
+void TuningCache::Store(const string& key, const KernelConfiguration& config)
+{
+    lock_guard<mutex> lock(m);
+    results[key] = config;
+    if (!cache_filename.empty())
+        Save();
+}
+
+// ---------------------------------------------------------------------
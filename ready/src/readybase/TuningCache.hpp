@@ -0,0 +1,53 @@
+/*  Copyright 2011-2024 The Ready Bunch
+
+    This file is part of Ready.
+
+    Ready is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ready is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ready. If not, see <http://www.gnu.org/licenses/>.         */
+
+#ifndef __TUNINGCACHE__
+#define __TUNINGCACHE__
+
+// STL:
+#include <cstddef>
+#include <string>
+
+/// How a kernel is launched: the cells each work-item updates and the work-items in each work-group.
+struct KernelConfiguration
+{
+    int block_size[3];
+    bool use_local_memory;
+    size_t local_work_size[3]; ///< all zero to let the OpenCL implementation choose
+};
+
+/// The fastest kernel configurations found so far, kept in a text file so that each is only searched for once.
+/** The results are shared by all the systems, so the file is set once at startup. Without a file they are only kept
+    until the program exits. Safe to use from the simulation threads. */
+class TuningCache
+{
+    public:
+
+        /// Loads the results from the file (if it exists), and saves each new result to it.
+        static void SetFilename(const std::string& filename);
+
+        /// Returns a key for a kernel, from a description of everything that affects its speed apart from the grid size.
+        static std::string MakeKey(const std::string& device_name, const std::string& kernel_description,
+                                   const int grid_size[3]);
+
+        /// Returns true and sets config if there is a result for key.
+        static bool Find(const std::string& key, KernelConfiguration& config);
+
+        static void Store(const std::string& key, const KernelConfiguration& config);
+};
+
+#endif
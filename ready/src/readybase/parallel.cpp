@@ -0,0 +1,127 @@
+/*  Copyright 2011-2024 The Ready Bunch
+
+    This file is part of Ready.
+
+    Ready is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ready is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ready. If not, see <http://www.gnu.org/licenses/>.         */
+
+// local:
+#include "parallel.hpp"
+
+// STL:
+#include <algorithm>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// ---------------------------------------------------------------------
+
+namespace
+{
+    /// Blocks each thread that calls Wait() until all n_threads have called it, then releases them together. Reusable.
+    class StepBarrier
+    {
+        public:
+
+            explicit StepBarrier(int n_threads) : n_threads(n_threads), n_waiting(0), generation(0) {}
+
+            void Wait()
+            {
+                unique_lock<mutex> lock(this->m);
+                const unsigned int my_generation = this->generation;
+                if (++this->n_waiting == this->n_threads)
+                {
+                    this->n_waiting = 0;
+                    this->generation++;
+                    this->cv.notify_all();
+                }
+                else
+                {
+                    this->cv.wait(lock, [&] { return this->generation != my_generation; });
+                }
+            }
+
+        private:
+
+            mutex m;
+            condition_variable cv;
+            const int n_threads;
+            int n_waiting;
+            unsigned int generation;
+    };
+}
+
+// ---------------------------------------------------------------------
+
+int GetNumberOfWorkerThreads(size_t n_items, size_t min_items_per_thread)
+{
+    const size_t n_hardware = max(1u, thread::hardware_concurrency()); // (can return 0 if unknown)
+    const size_t n_useful = max<size_t>(1, n_items / max<size_t>(1, min_items_per_thread));
+    return static_cast<int>(min(n_hardware, n_useful));
+}
+
+// ---------------------------------------------------------------------
+
+void ParallelFor(int n_threads, size_t n_items, const function<void(int, size_t, size_t)>& work)
+{
+    ParallelForSteps(n_threads, n_items, 1, [&](int iThread, int, size_t begin, size_t end) { work(iThread, begin, end); });
+}
+
+// ---------------------------------------------------------------------
+
+void ParallelForSteps(int n_threads, size_t n_items, int n_steps, const function<void(int, int, size_t, size_t)>& work)
+{
+    n_threads = max(1, min<int>(n_threads, static_cast<int>(max<size_t>(1, n_items))));
+    if (n_threads == 1)
+    {
+        for (int iStep = 0; iStep < n_steps; iStep++)
+            work(0, iStep, 0, n_items);
+        return;
+    }
+
+    StepBarrier barrier(n_threads);
+    vector<exception_ptr> errors(n_threads);
+    auto run_chunk = [&](int iThread)
+    {
+        const size_t begin = n_items * iThread / n_threads;
+        const size_t end = n_items * (iThread + 1) / n_threads;
+        for (int iStep = 0; iStep < n_steps; iStep++)
+        {
+            // after an error we keep arriving at the barrier, else the other threads would wait forever
+            if (!errors[iThread])
+            {
+                try { work(iThread, iStep, begin, end); }
+                catch (...) { errors[iThread] = current_exception(); }
+            }
+            barrier.Wait();
+        }
+    };
+
+    vector<thread> threads;
+    threads.reserve(n_threads - 1);
+    for (int iThread = 1; iThread < n_threads; iThread++)
+        threads.emplace_back(run_chunk, iThread);
+    run_chunk(0);
+    for (thread& t : threads)
+        t.join();
+
+    for (const exception_ptr& e : errors)
+        if (e)
+            rethrow_exception(e);
+}
+
+// ---------------------------------------------------------------------
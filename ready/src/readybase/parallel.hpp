@@ -0,0 +1,52 @@
+/*  Copyright 2011-2024 The Ready Bunch
+
+    This file is part of Ready.
+
+    Ready is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Ready is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with Ready. If not, see <http://www.gnu.org/licenses/>.         */
+
+#ifndef __PARALLEL__
+#define __PARALLEL__
+
+// STL:
+#include <cstddef>
+#include <functional>
+
+// Hint to the CPU that we will soon read from addr. Used to hide the latency of the indirect
+// loads in the sparse matrix loops.
+#if defined(__GNUC__) || defined(__clang__)
+    #define READY_PREFETCH(addr) __builtin_prefetch(addr)
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+    #include <xmmintrin.h>
+    #define READY_PREFETCH(addr) _mm_prefetch(reinterpret_cast<const char*>(addr), _MM_HINT_T0)
+#else
+    #define READY_PREFETCH(addr) ((void)(addr))
+#endif
+
+/// Returns how many threads are worth using for n_items, given that each thread should have at least min_items_per_thread.
+/** Always returns at least 1, and never more than the number of hardware threads. */
+int GetNumberOfWorkerThreads(size_t n_items, size_t min_items_per_thread);
+
+/// Splits [0,n_items) into n_threads contiguous chunks and calls work(iThread,begin,end) for each, in parallel.
+/** Blocks until all the chunks are done. The calling thread processes the first chunk. If any call throws, the
+    first exception is rethrown here once all the threads have finished. */
+void ParallelFor(int n_threads, size_t n_items,
+                 const std::function<void(int iThread, size_t begin, size_t end)>& work);
+
+/// As ParallelFor but makes n_steps passes over the same chunks, waiting for every thread to finish each pass before starting the next.
+/** The threads are only created once, so this is much cheaper than calling ParallelFor() n_steps times. Each pass sees the
+    complete output of the previous one, which is what ping-pong buffered RD updates need. */
+void ParallelForSteps(int n_threads, size_t n_items, int n_steps,
+                      const std::function<void(int iThread, int iStep, size_t begin, size_t end)>& work);
+
+#endif
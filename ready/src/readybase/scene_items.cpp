@@ -178,6 +178,8 @@ void SetDefaultRenderSettings(Properties& render_settings)
     render_settings.AddProperty(Property("show_displacement_mapped_surface", true));
     render_settings.AddProperty(Property("color_displacement_mapped_surface", false));
     render_settings.AddProperty(Property("use_image_interpolation", true));
+    render_settings.AddProperty(Property("preview_resolution", 0)); // 0 = show every cell
+    render_settings.AddProperty(Property("preview_pooling", "pooling", "mean"));
     render_settings.AddProperty(Property("timesteps_per_render", 100));
     render_settings.AddProperty(Property("show_phase_plot", false));
     render_settings.AddProperty(Property("phase_plot_x_axis", "chemical", "a"));
@@ -207,6 +209,10 @@ bool RenderSettingAppliesToDimensionality(const string& render_setting, int dime
     applies["slice_3D_position"].insert(3);
     applies["show_displacement_mapped_surface"].insert(2);
     applies["color_displacement_mapped_surface"].insert(2);
+    applies["preview_resolution"].insert(2);
+    applies["preview_resolution"].insert(3);
+    applies["preview_pooling"].insert(2);
+    applies["preview_pooling"].insert(3);
     applies["plot_ab_orthogonally"].insert(1);
     if (applies.count(render_setting))
     {
@@ -223,5 +229,7 @@ bool RenderSettingDoesntApplyToMesh(const string& render_setting)
     doesnt_apply.insert("show_displacement_mapped_surface");
     doesnt_apply.insert("color_displacement_mapped_surface");
     doesnt_apply.insert("plot_ab_orthogonally");
+    doesnt_apply.insert("preview_resolution");
+    doesnt_apply.insert("preview_pooling");
     return doesnt_apply.count(render_setting);
 }
@@ -38,3 +38,5 @@ bool RenderSettingDoesntApplyToMesh(const std::string& render_setting);
 static const std::string SupportedColorMaps[] = {
     "HSV blend", "spectral", "spectral reversed", "inferno", "inferno reversed", "terrain", "terrain reversed",
     "orange-purple", "purple-orange", "brown-teal", "teal-brown" };
+
+static const std::string SupportedPoolingModes[] = { "mean", "minimum", "maximum" };
@@ -18,8 +18,10 @@
 #include "stencils.hpp"
 
 // Stdlib:
+#include <algorithm>
 #include <array>
 #include <cmath>
+#include <cstdlib>
 #include <exception>
 #include <map>
 #include <sstream>
@@ -74,52 +76,56 @@ string InputPoint::GetName() const
 
 // ---------------------------------------------------------------------
 
-pair<InputPoint, InputPoint> InputPoint::GetAlignedBlocks_Block411() const
+pair<InputPoint, InputPoint> InputPoint::GetAlignedBlocks(int n) const
 {
-    if (point.x % 4 == 0)
+    if (point.x % n == 0)
     {
         throw runtime_error("internal error: already block-aligned in GetAlignedBlocks");
     }
-    // return the two block-aligned float4's we'll need to assemble this non-block-aligned float4
+    // return the two block-aligned vectors we'll need to assemble this non-block-aligned vector
     InputPoint block_left{ point, chem };
     InputPoint block_right{ point, chem };
     if (point.x >= 0)
     {
-        block_left.point.x -= point.x % 4;
-        block_right.point.x += 4 - (point.x % 4);
+        block_left.point.x -= point.x % n;
+        block_right.point.x += n - (point.x % n);
     }
     else
     {
-        block_left.point.x -= 4 + (point.x % 4);
-        block_right.point.x -= point.x % 4;
+        block_left.point.x -= n + (point.x % n);
+        block_right.point.x -= point.x % n;
     }
     return make_pair(block_left, block_right);
 }
 
 // ---------------------------------------------------------------------
 
-string InputPoint::GetSwizzled_Block411() const
+string InputPoint::GetSwizzled(int n) const
 {
-    // assemble a non-block-aligned float4 for the requested point
-    const pair<InputPoint, InputPoint> blocks = GetAlignedBlocks_Block411();
+    // assemble a non-block-aligned vector for the requested point, from the end of the left block and the start of the right
+    const pair<InputPoint, InputPoint> blocks = GetAlignedBlocks(n);
     const InputPoint& block_left = blocks.first;
     const InputPoint& block_right = blocks.second;
+    const int offset = (point.x % n + n) % n;
     ostringstream oss;
-    switch (point.x % 4)
-    {
-    case 1:
-    case -3:
-        oss << block_left.GetName() << ".yzw, " << block_right.GetName() << ".x";
-        break;
-    case 2:
-    case -2:
-        oss << block_left.GetName() << ".zw, " << block_right.GetName() << ".xy";
-        break;
-    case 3:
-    case -1:
-        oss << block_left.GetName() << ".w, " << block_right.GetName() << ".xyz";
-        break;
-    }
+    auto write_components = [&oss, n](const string& name, int first, int last) {
+        // e.g. for the cell to the east: "a.yzw, a_e4.x" for float4, or "a.s12345678, a.s9abc, a.sdef, a_e16.s0" for
+        // float16, since swizzles must give vectors of a valid size
+        const string names = n == 4 ? "xyzw" : "0123456789abcdef";
+        const int valid_sizes[] = { 16, 8, 4, 3, 2, 1 };
+        while (first < last)
+        {
+            const int size = *find_if(begin(valid_sizes), end(valid_sizes), [&](int size) { return size <= last - first; });
+            if (oss.tellp() > 0)
+            {
+                oss << ", ";
+            }
+            oss << name << (n == 4 ? "." : ".s") << names.substr(first, size);
+            first += size;
+        }
+    };
+    write_components(block_left.GetName(), offset, n);
+    write_components(block_right.GetName(), 0, offset);
     return oss.str();
 }
 
@@ -188,27 +194,86 @@ string GetCoordString(int val, const string& coord, const string& coord_capital,
 
 // ---------------------------------------------------------------------
 
-string InputPoint::GetDirectAccessCode(bool wrap, const int block_size[3], bool use_local_memory) const
+string GetPaddedIndexString(int x, int y, int z)
 {
-    if (block_size[0] == 4 && point.x % 4 != 0)
+    // offset from index_cell, e.g. "index_cell - PX * PY + 1"
+    ostringstream oss;
+    oss << "index_cell";
+    const int offsets[3] = { z, y, x };
+    const string strides[3] = { "PX * PY", "PX", "" };
+    for (int i = 0; i < 3; i++)
     {
-        throw runtime_error("internal error in GetDirectAccessCode: point.x not divisible by 4");
+        if (offsets[i] == 0)
+        {
+            continue;
+        }
+        oss << (offsets[i] > 0 ? " + " : " - ");
+        if (strides[i].empty())
+        {
+            oss << abs(offsets[i]);
+        }
+        else
+        {
+            if (abs(offsets[i]) != 1)
+            {
+                oss << abs(offsets[i]) << " * ";
+            }
+            oss << strides[i];
+        }
+    }
+    return oss.str();
+}
+
+// -------------------------------------------------------------------------
+
+string GetPaddedIndexString(const string& x, const string& y, const string& z)
+{
+    // x, y, z are unpadded coordinates, e.g. "index_x - XR + 1 * LX", which can reach into the ghost cells
+    ostringstream oss;
+    oss << "PX * (PY * (" << z << " + ZR) + " << y << " + YR) + " << x << " + XR";
+    return oss.str();
+}
+
+// ---------------------------------------------------------------------
+
+string InputPoint::GetDirectAccessCode(bool wrap, bool use_ghost_cells, const int block_size[3], bool use_local_memory) const
+{
+    return GetName() + " = " + GetAccessCode(wrap, use_ghost_cells, block_size, use_local_memory);
+}
+
+// ---------------------------------------------------------------------
+
+string InputPoint::GetAccessCode(bool wrap, bool use_ghost_cells, const int block_size[3], bool use_local_memory) const
+{
+    if (point.x % block_size[0] != 0)
+    {
+        throw runtime_error("internal error in GetAccessCode: point.x not divisible by the block size");
     }
     ostringstream oss;
-    oss << GetName() << " = ";
     if (use_local_memory)
     {
-        oss << "local_" << chem << "[lz" << showpos << point.z / block_size[2]
-                                << "][ly" << showpos << point.y / block_size[1]
+        oss << "local_" << chem << "[lz" << showpos << point.z
+                                << "][ly" << showpos << point.y
                                 << "][lx" << showpos << point.x / block_size[0] << "]";
     }
     else
     {
-        oss << chem << "_in[" << GetIndexString(point.x / block_size[0], point.y / block_size[1], point.z / block_size[2], wrap) << "]";
+        oss << chem << "_in[" << GetIndexCode(wrap, use_ghost_cells, block_size) << "]";
     }
     return oss.str();
 }
 
+// ---------------------------------------------------------------------
+
+string InputPoint::GetIndexCode(bool wrap, bool use_ghost_cells, const int block_size[3]) const
+{
+    if (use_ghost_cells)
+    {
+        return GetPaddedIndexString(point.x / block_size[0], point.y, point.z);
+    }
+    return GetIndexString(point.x / block_size[0], point.y, point.z, wrap);
+}
+
 // -------------------------------------------------------------------------
 
 string Stencil::GetDivisorCode() const
@@ -248,7 +313,26 @@ set<InputPoint> AppliedStencil::GetInputPoints() const
 
 // ---------------------------------------------------------------------
 
-string AppliedStencil::GetCode() const
+string SharedSum::GetCode() const
+{
+    ostringstream oss;
+    oss << name << " = ";
+    bool is_first_point = true;
+    for (const Point& point : points)
+    {
+        if (!is_first_point)
+        {
+            oss << " + ";
+        }
+        is_first_point = false;
+        oss << InputPoint{ point, chem }.GetName();
+    }
+    return oss.str();
+}
+
+// ---------------------------------------------------------------------
+
+string AppliedStencil::GetCode(const vector<SharedSum>& shared_sums) const
 {
     ostringstream oss;
     oss << GetName() << " = ";
@@ -275,22 +359,43 @@ string AppliedStencil::GetCode() const
         if (weight != 1)
         {
             oss << weight << " * ";
-            if (points.size() > 1)
+        }
+        // use the shared sums that cover some of the points (largest first, they are sorted that way), then the rest
+        set<Point> remaining(points.begin(), points.end());
+        vector<string> terms;
+        for (const SharedSum& shared_sum : shared_sums)
+        {
+            if (shared_sum.chem == chem && includes(remaining.begin(), remaining.end(), shared_sum.points.begin(), shared_sum.points.end()))
             {
-                oss << "(";
+                terms.push_back(shared_sum.name);
+                for (const Point& point : shared_sum.points)
+                {
+                    remaining.erase(point);
+                }
             }
         }
-        bool is_first_point = true;
         for (const Point& point : points)
         {
-            if (!is_first_point)
+            if (remaining.find(point) != remaining.end())
+            {
+                terms.push_back(InputPoint{ point, chem }.GetName());
+            }
+        }
+        if (weight != 1 && terms.size() > 1)
+        {
+            oss << "(";
+        }
+        bool is_first_term = true;
+        for (const string& term : terms)
+        {
+            if (!is_first_term)
             {
                 oss << " + ";
             }
-            is_first_point = false;
-            oss << InputPoint{ point, chem }.GetName();
+            is_first_term = false;
+            oss << term;
         }
-        if (weight != 1 && points.size() > 1)
+        if (weight != 1 && terms.size() > 1)
         {
             oss << ")";
         }
@@ -501,8 +606,15 @@ Stencil GetLaplacianStencil(int dimensionality, const AbstractRD::Accuracy& accu
                 return StencilFrom2DArray<5,5>("laplacian", RotationallySymmetric5x5(0, -2, -1, 16, 52, -252), 60, 2, 0, 1); // 21-point stencil
         }
     case 3:
-        // Patra, M. & Karttunen, M. (2006) "Stencils with isotropic discretization error for differential operators" Numerical Methods for Partial Differential Equations, 22.
-        return StencilFrom3DArray<3,3,3>("laplacian", RotationallySymmetric3x3x3(1, 3, 14, -128), 30, 2, 0, 1, 2); // 27-point stencil
+        switch (accuracy)
+        {
+            case AbstractRD::Accuracy::Low:
+                return StencilFrom3DArray<3,3,3>("laplacian", RotationallySymmetric3x3x3(0, 0, 1, -6), 1, 2, 0, 1, 2); // 7-point stencil, anisotropic
+            case AbstractRD::Accuracy::Medium:
+            case AbstractRD::Accuracy::High:
+                // Patra, M. & Karttunen, M. (2006) "Stencils with isotropic discretization error for differential operators" Numerical Methods for Partial Differential Equations, 22.
+                return StencilFrom3DArray<3,3,3>("laplacian", RotationallySymmetric3x3x3(1, 3, 14, -128), 30, 2, 0, 1, 2); // 27-point stencil
+        }
     default:
         throw runtime_error("Internal error: unsupported dimensionality in GetLaplacianStencil");
     }
@@ -641,3 +753,42 @@ vector<Stencil> GetKnownStencils(int dimensionality, const AbstractRD::Accuracy&
 }
 
 // ---------------------------------------------------------------------
+
+vector<SharedSum> FindSharedSums(const vector<AppliedStencil>& applied_stencils)
+{
+    // count the stencils that each group of equally-weighted points appears in
+    map<pair<string, set<Point>>, int> group_counts;
+    for (const AppliedStencil& applied_stencil : applied_stencils)
+    {
+        map<int, set<Point>> weights;
+        for (const StencilPoint& stencil_point : applied_stencil.stencil.points)
+        {
+            weights[stencil_point.weight].insert(stencil_point.point);
+        }
+        for (const auto& weight_list : weights)
+        {
+            if (weight_list.second.size() > 1)
+            {
+                group_counts[{ applied_stencil.chem, weight_list.second }]++;
+            }
+        }
+    }
+    // the groups that appear more than once are worth computing separately, largest first so they get used first
+    vector<SharedSum> shared_sums;
+    for (const auto& group_count : group_counts)
+    {
+        if (group_count.second > 1)
+        {
+            shared_sums.push_back({ "", group_count.first.first, group_count.first.second });
+        }
+    }
+    stable_sort(shared_sums.begin(), shared_sums.end(), [](const SharedSum& a, const SharedSum& b) { return a.points.size() > b.points.size(); });
+    map<string, int> n_sums_per_chem;
+    for (SharedSum& shared_sum : shared_sums)
+    {
+        shared_sum.name = "sum_" + shared_sum.chem + "_" + to_string(n_sums_per_chem[shared_sum.chem]++);
+    }
+    return shared_sums;
+}
+
+// ---------------------------------------------------------------------
@@ -72,9 +72,12 @@ struct InputPoint
     std::string chem;
 
     std::string GetName() const;
-    std::string GetDirectAccessCode(bool wrap, const int block_size[3], bool use_local_memory) const;
-    std::string GetSwizzled_Block411() const;
-    std::pair<InputPoint, InputPoint> GetAlignedBlocks_Block411() const;
+    std::string GetDirectAccessCode(bool wrap, bool use_ghost_cells, const int block_size[3], bool use_local_memory) const;
+    std::string GetAccessCode(bool wrap, bool use_ghost_cells, const int block_size[3], bool use_local_memory) const; // without the name
+    std::string GetIndexCode(bool wrap, bool use_ghost_cells, const int block_size[3]) const; // into the chemical's buffer
+    // for blocks of n cells along x (float4, float8, etc.), with point.x not a multiple of n
+    std::string GetSwizzled(int n) const;
+    std::pair<InputPoint, InputPoint> GetAlignedBlocks(int n) const;
 
     friend bool operator<(const InputPoint& a, const InputPoint& b)
     {
@@ -86,22 +89,39 @@ struct InputPoint
 
 // ---------------------------------------------------------------------
 
+// a sum over some neighbors of a chemical that several stencils share, computed once
+struct SharedSum
+{
+    std::string name; // e.g. "sum_a_0"
+    std::string chem;
+    std::set<Point> points;
+
+    std::string GetCode() const;
+};
+
+// ---------------------------------------------------------------------
+
 struct AppliedStencil
 {
     Stencil stencil;
     std::string chem; // e.g. "a"
 
     std::string GetName() const { return stencil.label + "_" + chem; }
-    std::string GetCode() const;
+    std::string GetCode(const std::vector<SharedSum>& shared_sums = {}) const;
     std::set<InputPoint> GetInputPoints() const;
 };
 
 // ---------------------------------------------------------------------
 
 std::vector<Stencil> GetKnownStencils(int dimensionality, const AbstractRD::Accuracy& accuracy);
+// finds the groups of equally-weighted neighbors that appear in more than one of the stencils
+std::vector<SharedSum> FindSharedSums(const std::vector<AppliedStencil>& applied_stencils);
 std::string GetIndexString(int x, int y, int z, bool wrap);
 std::string GetIndexString(const std::string& x, const std::string& y, const std::string& z, bool wrap);
 std::string GetCoordString(int val, const std::string& coord, const std::string& coord_capital, bool wrap);
 std::string GetCoordString(const std::string& val, const std::string& coord_capital, bool wrap);
+// with ghost cells the buffers are PX x PY x PZ, padded by XR, YR and ZR on each side, so the neighbors are at fixed offsets
+std::string GetPaddedIndexString(int x, int y, int z);
+std::string GetPaddedIndexString(const std::string& x, const std::string& y, const std::string& z);
 
 // ---------------------------------------------------------------------
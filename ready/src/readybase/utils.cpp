@@ -23,6 +23,7 @@
 
 // STL:
 #include <algorithm>
+#include <cctype>
 #include <limits>
 #include <random>
 #include <vector>
@@ -208,4 +209,125 @@ bool UsingKeyword(const vector<string>& formula_tokens, const string& keyword)
     // TODO: parse properly: ignore comments, not in string, etc.
 }
 
+// ---------------------------------------------------------------------------------------------------------
+
+string RemoveComments(const string& code)
+{
+    string result;
+    result.reserve(code.size());
+    char quote = 0; // the quote character, while inside a string or character literal
+    for (size_t i = 0; i < code.size(); i++)
+    {
+        const char c = code[i];
+        if (quote)
+        {
+            result += c;
+            if (c == '\\' && i + 1 < code.size())
+                result += code[++i];
+            else if (c == quote)
+                quote = 0;
+        }
+        else if (c == '"' || c == '\'')
+        {
+            quote = c;
+            result += c;
+        }
+        else if (code.compare(i, 2, "//") == 0)
+        {
+            i = code.find('\n', i);
+            result += ' ';
+            if (i == string::npos)
+                break;
+            result += '\n';
+        }
+        else if (code.compare(i, 2, "/*") == 0)
+        {
+            i = code.find("*/", i + 2);
+            result += ' ';
+            if (i == string::npos)
+                break;
+            i++;
+        }
+        else
+        {
+            result += c;
+        }
+    }
+    return result;
+}
+
+// ---------------------------------------------------------------------------------------------------------
+
+bool AssigningToKeyword(const string& formula_with_comments, const string& keyword)
+{
+    const string formula = RemoveComments(formula_with_comments);
+    const auto is_word_char = [](char c) { return isalnum(static_cast<unsigned char>(c)) || c == '_'; };
+    const char* whitespace = " \t\r\n";
+    for (size_t pos = formula.find(keyword); pos != string::npos; pos = formula.find(keyword, pos + 1))
+    {
+        size_t end = pos + keyword.size();
+        if ((pos > 0 && is_word_char(formula[pos - 1])) || (end < formula.size() && is_word_char(formula[end])))
+        {
+            continue; // (whole words only)
+        }
+        // ++a or --a
+        const size_t before = formula.find_last_not_of(whitespace, pos == 0 ? string::npos : pos - 1);
+        if (before != string::npos && before > 0 && (formula.compare(before - 1, 2, "++") == 0 || formula.compare(before - 1, 2, "--") == 0))
+        {
+            return true;
+        }
+        // skip any components, e.g. a.x or a.s01
+        end = formula.find_first_not_of(whitespace, end);
+        while (end != string::npos && formula[end] == '.')
+        {
+            end = formula.find_first_not_of(whitespace, end + 1);
+            while (end < formula.size() && is_word_char(formula[end]))
+            {
+                end++;
+            }
+            end = formula.find_first_not_of(whitespace, end);
+        }
+        if (end == string::npos)
+        {
+            continue;
+        }
+        // a = ..., a += ..., a <<= ..., a++, etc. but not a == ..., a <= ..., a >= ... or a != ...
+        const string op = formula.substr(end, 3);
+        if (op.compare(0, 2, "++") == 0 || op.compare(0, 2, "--") == 0 || op == "<<=" || op == ">>=")
+        {
+            return true;
+        }
+        if (op[0] == '=' && op.compare(0, 2, "==") != 0)
+        {
+            return true;
+        }
+        if (op.size() > 1 && op[1] == '=' && string("+-*/%&|^").find(op[0]) != string::npos)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// ---------------------------------------------------------------------------------------------------------
+
+string ReplaceKeyword(const string& formula, const string& keyword, const string& replace)
+{
+    const auto is_word_char = [](char c) { return isalnum(static_cast<unsigned char>(c)) || c == '_'; };
+    string result = formula;
+    size_t pos = result.find(keyword);
+    while (pos != string::npos)
+    {
+        const size_t end = pos + keyword.size();
+        if ((pos > 0 && is_word_char(result[pos - 1])) || (end < result.size() && is_word_char(result[end])))
+        {
+            pos = result.find(keyword, pos + 1); // (whole words only)
+            continue;
+        }
+        result.replace(pos, keyword.size(), replace);
+        pos = result.find(keyword, pos + replace.size());
+    }
+    return result;
+}
+
 // -------------------------------------------------------------------------
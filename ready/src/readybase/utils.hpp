@@ -96,6 +96,13 @@ class XML_Object
 std::string ReplaceAllSubstrings(std::string subject, const std::string& search, const std::string& replace);
 std::vector<std::string> tokenize_for_keywords(const std::string& formula);
 bool UsingKeyword(const std::vector<std::string>& formula_tokens, const std::string& keyword);
+/// Returns the code with each // or /* */ comment replaced by a space. (Comment markers inside quotes are kept.)
+std::string RemoveComments(const std::string& code);
+/// Returns true if the formula might change the variable called keyword: by assigning to it (or to some of its
+/// components), or with ++ or --. Comments are ignored.
+bool AssigningToKeyword(const std::string& formula, const std::string& keyword);
+/// Returns the formula with each whole-word use of keyword replaced.
+std::string ReplaceKeyword(const std::string& formula, const std::string& keyword, const std::string& replace);
 
 class ThrowOnErrorObserver : public vtkCommand
 {